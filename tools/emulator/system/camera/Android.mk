@@ -29,14 +29,10 @@ LOCAL_SHARED_LIBRARIES:= \
 # JPEG conversion libraries and includes.
 LOCAL_SHARED_LIBRARIES += \
 	libjpeg \
-	libskia \
-	libandroid_runtime \
 	libcamera_metadata
 
 LOCAL_C_INCLUDES += external/jpeg \
-	external/skia/include/core/ \
 	frameworks/native/include/media/hardware \
-	frameworks/base/core/jni/android/graphics \
 	$(LOCAL_PATH)/../../opengl/system/OpenglSystemCommon \
 	$(call include-path-for, camera)
 
@@ -46,22 +42,39 @@ LOCAL_SRC_FILES := \
     EmulatedBaseCamera.cpp \
     EmulatedCamera.cpp \
 	EmulatedCameraDevice.cpp \
+	FramePacer.cpp \
+	StageTracer.cpp \
 	EmulatedQemuCamera.cpp \
 	EmulatedQemuCameraDevice.cpp \
 	EmulatedFakeCamera.cpp \
 	EmulatedFakeCameraDevice.cpp \
 	Converters.cpp \
+	ConvertersSSE2.cpp \
+	WorkerPool.cpp \
+	ImageScaler.cpp \
 	PreviewWindow.cpp \
+	GrallocMappingCache.cpp \
+	GrallocBufferPool.cpp \
 	CallbackNotifier.cpp \
+	CallbackBufferPool.cpp \
 	QemuClient.cpp \
-	JpegCompressor.cpp \
+	JpegEncoder.cpp \
     EmulatedCamera2.cpp \
 	EmulatedFakeCamera2.cpp \
+	MetadataTagCache.cpp \
 	EmulatedQemuCamera2.cpp \
 	fake-pipeline2/Scene.cpp \
 	fake-pipeline2/Sensor.cpp \
-	fake-pipeline2/JpegCompressor.cpp
+	fake-pipeline2/JpegCompressor.cpp \
+	fake-pipeline2/AuxBufferPool.cpp
 
+# NEON row converters are selected at runtime, so build them with NEON enabled
+# regardless of TARGET_ARCH_VARIANT.
+ifeq ($(TARGET_ARCH),arm)
+LOCAL_SRC_FILES += ConvertersNEON.cpp.neon
+else
+LOCAL_SRC_FILES += ConvertersNEON.cpp
+endif
 
 ifeq ($(TARGET_PRODUCT),vbox_x86)
 LOCAL_MODULE := camera.vbox_x86
@@ -70,3 +83,5 @@ LOCAL_MODULE := camera.goldfish
 endif
 
 include $(BUILD_SHARED_LIBRARY)
+
+include $(call all-makefiles-under,$(LOCAL_PATH))
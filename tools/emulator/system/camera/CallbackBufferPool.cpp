@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Contains implementation of a class CallbackBufferPool that recycles camera
+ * memory used to deliver frames via data callbacks.
+ */
+
+#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera_CallbackBufferPool"
+#include <cutils/log.h>
+#include "CallbackBufferPool.h"
+
+namespace android {
+
+CallbackBufferPool::CallbackBufferPool()
+    : mObjectLock(),
+      mGetMemoryCB(NULL),
+      mMemory(NULL),
+      mBufferSize(0),
+      mBufferNum(0),
+      mBusyMask(0),
+      mNextBuffer(0)
+{
+}
+
+CallbackBufferPool::~CallbackBufferPool()
+{
+    freeBuffers();
+}
+
+/****************************************************************************
+ * Public API
+ ***************************************************************************/
+
+status_t CallbackBufferPool::configure(camera_request_memory get_memory,
+                                       size_t buffer_size,
+                                       int buffer_num)
+{
+    Mutex::Autolock locker(&mObjectLock);
+
+    if (mMemory != NULL && mGetMemoryCB == get_memory &&
+        mBufferSize == buffer_size && mBufferNum == buffer_num) {
+        return NO_ERROR;
+    }
+
+    ALOGV("%s: %d buffers of %d bytes", __FUNCTION__, buffer_num, buffer_size);
+
+    if (get_memory == NULL || buffer_size == 0 ||
+        buffer_num <= 0 || buffer_num > mMaxBuffers) {
+        ALOGE("%s: Invalid pool configuration %p, %d buffers of %d bytes",
+             __FUNCTION__, get_memory, buffer_num, buffer_size);
+        return EINVAL;
+    }
+
+    if (mMemory != NULL) {
+        mMemory->release(mMemory);
+        mMemory = NULL;
+    }
+    mMemory = get_memory(-1, buffer_size, buffer_num, NULL);
+    if (mMemory == NULL || mMemory->data == NULL) {
+        ALOGE("%s: Unable to allocate %d buffers of %d bytes",
+             __FUNCTION__, buffer_num, buffer_size);
+        if (mMemory != NULL) {
+            mMemory->release(mMemory);
+            mMemory = NULL;
+        }
+        return ENOMEM;
+    }
+
+    mGetMemoryCB = get_memory;
+    mBufferSize = buffer_size;
+    mBufferNum = buffer_num;
+    mBusyMask = 0;
+    mNextBuffer = 0;
+    return NO_ERROR;
+}
+
+void CallbackBufferPool::freeBuffers()
+{
+    Mutex::Autolock locker(&mObjectLock);
+
+    if (mMemory != NULL) {
+        ALOGW_IF(mBusyMask != 0, "%s: Buffers %08x are still in use",
+                __FUNCTION__, mBusyMask);
+        mMemory->release(mMemory);
+        mMemory = NULL;
+    }
+    mGetMemoryCB = NULL;
+    mBufferSize = 0;
+    mBufferNum = 0;
+    mBusyMask = 0;
+    mNextBuffer = 0;
+}
+
+int CallbackBufferPool::acquireBuffer()
+{
+    Mutex::Autolock locker(&mObjectLock);
+
+    for (int n = 0; n < mBufferNum; n++) {
+        const int index = (mNextBuffer + n) % mBufferNum;
+        if ((mBusyMask & (1 << index)) == 0) {
+            mBusyMask |= 1 << index;
+            mNextBuffer = (index + 1) % mBufferNum;
+            return index;
+        }
+    }
+    return -1;
+}
+
+void CallbackBufferPool::releaseBuffer(int index)
+{
+    Mutex::Autolock locker(&mObjectLock);
+
+    if (index >= 0 && index < mBufferNum) {
+        mBusyMask &= ~(1 << index);
+    }
+}
+
+bool CallbackBufferPool::releaseBuffer(const void* data)
+{
+    Mutex::Autolock locker(&mObjectLock);
+
+    if (mMemory == NULL || data == NULL) {
+        return false;
+    }
+    const uint8_t* start = reinterpret_cast<const uint8_t*>(mMemory->data);
+    const uint8_t* ptr = reinterpret_cast<const uint8_t*>(data);
+    if (ptr < start || ptr >= start + mBufferSize * mBufferNum) {
+        return false;
+    }
+    mBusyMask &= ~(1 << ((ptr - start) / mBufferSize));
+    return true;
+}
+
+int CallbackBufferPool::getBusyCount()
+{
+    Mutex::Autolock locker(&mObjectLock);
+
+    int count = 0;
+    for (uint32_t mask = mBusyMask; mask != 0; mask &= mask - 1) {
+        count++;
+    }
+    return count;
+}
+
+}; /* namespace android */
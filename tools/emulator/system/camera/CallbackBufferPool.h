@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HW_EMULATOR_CAMERA_CALLBACK_BUFFER_POOL_H
+#define HW_EMULATOR_CAMERA_CALLBACK_BUFFER_POOL_H
+
+/*
+ * Contains declaration of a class CallbackBufferPool that recycles camera
+ * memory used to deliver frames via data callbacks.
+ */
+
+#include <hardware/camera.h>
+#include <utils/threads.h>
+
+namespace android {
+
+/* Recycles camera memory used to deliver frames via data callbacks.
+ *
+ * All buffers of the pool live in a single camera_memory_t, obtained with one
+ * call to the framework's camera_request_memory callback, and are passed to
+ * data callbacks by index. So, memory is requested once per configuration,
+ * rather than once per frame.
+ *
+ * Buffers are handed out in round-robin order. A buffer must only be given
+ * back once the framework has no references to it anymore, e.g. when it
+ * returns a video frame: the framework may hold on to the memory delivered with
+ * a data callback past the callback.
+ */
+class CallbackBufferPool {
+public:
+    /* Constructs CallbackBufferPool instance. */
+    CallbackBufferPool();
+
+    /* Destructs CallbackBufferPool instance. */
+    ~CallbackBufferPool();
+
+    /****************************************************************************
+     * Public API
+     ***************************************************************************/
+
+public:
+    /* Makes sure the pool has buffers of the given size.
+     * If the pool is already configured with the same parameters, this method
+     * does nothing. Otherwise current buffers are released, and new ones are
+     * requested from the framework.
+     * Param:
+     *  get_memory - Framework's callback that allocates camera memory.
+     *  buffer_size - Byte size of a buffer.
+     *  buffer_num - Number of buffers in the pool. Must not exceed
+     *      mMaxBuffers.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status.
+     */
+    status_t configure(camera_request_memory get_memory,
+                       size_t buffer_size,
+                       int buffer_num);
+
+    /* Releases all buffers of the pool.
+     * Note that buffers that are still in use by the framework remain valid
+     * until the framework drops its references to them.
+     */
+    void freeBuffers();
+
+    /* Takes a free buffer from the pool.
+     * Return:
+     *  Index of the buffer, or -1 if all buffers are in use.
+     */
+    int acquireBuffer();
+
+    /* Gives a buffer back to the pool.
+     * Param:
+     *  index - Index of the buffer, returned from acquireBuffer.
+     */
+    void releaseBuffer(int index);
+
+    /* Gives a buffer back to the pool.
+     * Param:
+     *  data - Address of the buffer data, as it was delivered to the framework.
+     * Return:
+     *  true if the buffer belongs to the pool, or false if it doesn't (e.g. it
+     *  belongs to a configuration that has been replaced).
+     */
+    bool releaseBuffer(const void* data);
+
+    /* Gets camera memory that contains the pool buffers. */
+    inline camera_memory_t* getMemory() const {
+        return mMemory;
+    }
+
+    /* Gets address of the buffer data. */
+    inline void* getBufferData(int index) const {
+        return reinterpret_cast<uint8_t*>(mMemory->data) + index * mBufferSize;
+    }
+
+    /* Gets number of buffers that are currently in use. */
+    int getBusyCount();
+
+    /****************************************************************************
+     * Data members
+     ***************************************************************************/
+
+public:
+    /* Maximum number of buffers in the pool. */
+    static const int        mMaxBuffers = 32;
+
+private:
+    /* Protects the pool, since buffers are given back on the framework's
+     * threads. */
+    Mutex                   mObjectLock;
+
+    /* Callback used to allocate mMemory. */
+    camera_request_memory   mGetMemoryCB;
+
+    /* Memory containing all pool buffers. */
+    camera_memory_t*        mMemory;
+
+    /* Byte size of a buffer. */
+    size_t                  mBufferSize;
+
+    /* Number of buffers in the pool. */
+    int                     mBufferNum;
+
+    /* Bit mask of buffers that are in use. */
+    uint32_t                mBusyMask;
+
+    /* Index of the buffer where the search for a free buffer starts. */
+    int                     mNextBuffer;
+};
+
+}; /* namespace android */
+
+#endif  /* HW_EMULATOR_CAMERA_CALLBACK_BUFFER_POOL_H */
@@ -25,7 +25,6 @@
 #include <MetadataBufferType.h>
 #include "EmulatedCameraDevice.h"
 #include "CallbackNotifier.h"
-#include "JpegCompressor.h"
 
 namespace android {
 
@@ -90,17 +89,22 @@ CallbackNotifier::CallbackNotifier()
       mDataCBTimestamp(NULL),
       mGetMemoryCB(NULL),
       mCBOpaque(NULL),
-      mLastFrameTimestamp(0),
+      mNextFrameTimestamp(0),
       mFrameRefreshFreq(0),
       mMessageEnabler(0),
       mJpegQuality(90),
       mVideoRecEnabled(false),
-      mTakingPicture(false)
+      mStoreMetaData(false),
+      mVideoMetaData(false),
+      mTakingPicture(false),
+      mVideoDelivering(false),
+      mVideoFreePending(false)
 {
 }
 
 CallbackNotifier::~CallbackNotifier()
 {
+    stopJpegThread();
 }
 
 /****************************************************************************
@@ -152,7 +156,8 @@ status_t CallbackNotifier::enableVideoRecording(int fps)
 
     Mutex::Autolock locker(&mObjectLock);
     mVideoRecEnabled = true;
-    mLastFrameTimestamp = 0;
+    mVideoMetaData = mStoreMetaData;
+    mNextFrameTimestamp = 0;
     mFrameRefreshFreq = 1000000000LL / fps;
 
     return NO_ERROR;
@@ -164,22 +169,36 @@ void CallbackNotifier::disableVideoRecording()
 
     Mutex::Autolock locker(&mObjectLock);
     mVideoRecEnabled = false;
-    mLastFrameTimestamp = 0;
+    mNextFrameTimestamp = 0;
     mFrameRefreshFreq = 0;
+    /* Frames the framework still holds remain valid: they keep references to
+     * the camera memory. Gralloc buffers don't, so in the metadata mode they
+     * are freed when the framework releases the last frame. */
+    if (!mVideoMetaData || mVideoBuffers.getBusyCount() == 0) {
+        freeVideoBuffers();
+    }
 }
 
 void CallbackNotifier::releaseRecordingFrame(const void* opaque)
 {
-    /* We don't really have anything to release here, since we report video
-     * frames by copying them directly to the camera memory. */
+    /* Return the buffer to the pool. Frames delivered before the pool has been
+     * reconfigured don't belong to it anymore, and are simply dropped. */
+    mVideoBuffers.releaseBuffer(opaque);
+
+    Mutex::Autolock locker(&mObjectLock);
+    if (!mVideoRecEnabled && mVideoGrallocBuffers.isConfigured() &&
+        mVideoBuffers.getBusyCount() == 0) {
+        freeVideoBuffers();
+    }
 }
 
 status_t CallbackNotifier::storeMetaDataInBuffers(bool enable)
 {
-    /* Return INVALID_OPERATION means HAL does not support metadata. So HAL will
-     * return actual frame data with CAMERA_MSG_VIDEO_FRRAME. Return
-     * INVALID_OPERATION to mean metadata is not supported. */
-    return INVALID_OPERATION;
+    ALOGV("%s: %s", __FUNCTION__, enable ? "true" : "false");
+
+    Mutex::Autolock locker(&mObjectLock);
+    mStoreMetaData = enable;
+    return NO_ERROR;
 }
 
 /****************************************************************************
@@ -188,6 +207,9 @@ status_t CallbackNotifier::storeMetaDataInBuffers(bool enable)
 
 void CallbackNotifier::cleanupCBNotifier()
 {
+    /* Pictures must not be delivered once callbacks are reset. */
+    stopJpegThread();
+
     Mutex::Autolock locker(&mObjectLock);
     mMessageEnabler = 0;
     mNotifyCB = NULL;
@@ -195,35 +217,42 @@ void CallbackNotifier::cleanupCBNotifier()
     mDataCBTimestamp = NULL;
     mGetMemoryCB = NULL;
     mCBOpaque = NULL;
-    mLastFrameTimestamp = 0;
+    mNextFrameTimestamp = 0;
     mFrameRefreshFreq = 0;
     mJpegQuality = 90;
     mVideoRecEnabled = false;
+    mStoreMetaData = false;
+    mVideoMetaData = false;
     mTakingPicture = false;
+    freeVideoBuffers();
 }
 
 void CallbackNotifier::onNextFrameAvailable(const void* frame,
                                             nsecs_t timestamp,
                                             EmulatedCameraDevice* camera_dev)
 {
+    const size_t frame_size = camera_dev->getFrameBufferSize();
+    const nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    bool delivered = false;
+
     if (isMessageEnabled(CAMERA_MSG_VIDEO_FRAME) && isVideoRecordingEnabled() &&
             isNewVideoFrameTime(timestamp)) {
-        camera_memory_t* cam_buff =
-            mGetMemoryCB(-1, camera_dev->getFrameBufferSize(), 1, NULL);
-        if (NULL != cam_buff && NULL != cam_buff->data) {
-            memcpy(cam_buff->data, frame, camera_dev->getFrameBufferSize());
-            mDataCBTimestamp(timestamp, CAMERA_MSG_VIDEO_FRAME,
-                               cam_buff, 0, mCBOpaque);
+        if (mVideoMetaData) {
+            deliverVideoMetadata(timestamp, camera_dev);
         } else {
-            ALOGE("%s: Memory failure in CAMERA_MSG_VIDEO_FRAME", __FUNCTION__);
+            deliverVideoFrame(frame, timestamp, camera_dev);
         }
+        delivered = true;
     }
 
     if (isMessageEnabled(CAMERA_MSG_PREVIEW_FRAME)) {
-        camera_memory_t* cam_buff =
-            mGetMemoryCB(-1, camera_dev->getFrameBufferSize(), 1, NULL);
+        delivered = true;
+        /* Each frame gets its own memory: the framework may keep references
+         * to it past the callback, and there is no telling when it drops them,
+         * so the memory can't be reused. */
+        camera_memory_t* cam_buff = mGetMemoryCB(-1, frame_size, 1, NULL);
         if (NULL != cam_buff && NULL != cam_buff->data) {
-            memcpy(cam_buff->data, frame, camera_dev->getFrameBufferSize());
+            memcpy(cam_buff->data, frame, frame_size);
             mDataCB(CAMERA_MSG_PREVIEW_FRAME, cam_buff, 0, NULL, mCBOpaque);
             cam_buff->release(cam_buff);
         } else {
@@ -231,6 +260,11 @@ void CallbackNotifier::onNextFrameAvailable(const void* frame,
         }
     }
 
+    if (delivered) {
+        camera_dev->getStageTracer().record(StageTracer::STAGE_CALLBACKS, start,
+                                            systemTime(SYSTEM_TIME_MONOTONIC));
+    }
+
     if (mTakingPicture) {
         /* This happens just once. */
         mTakingPicture = false;
@@ -246,25 +280,25 @@ void CallbackNotifier::onNextFrameAvailable(const void* frame,
             mNotifyCB(CAMERA_MSG_RAW_IMAGE_NOTIFY, 0, 0, mCBOpaque);
         }
         if (isMessageEnabled(CAMERA_MSG_COMPRESSED_IMAGE)) {
-            /* Compress the frame to JPEG. Note that when taking pictures, we
+            /* Compress the frame to JPEG on the compressor thread, so the
+             * camera device can go on. Note that when taking pictures, we
              * have requested camera device to provide us with NV21 frames. */
-            NV21JpegCompressor compressor;
-            status_t res =
-                compressor.compressRawImage(frame, camera_dev->getFrameWidth(),
-                                            camera_dev->getFrameHeight(),
-                                            mJpegQuality);
-            if (res == NO_ERROR) {
-                camera_memory_t* jpeg_buff =
-                    mGetMemoryCB(-1, compressor.getCompressedSize(), 1, NULL);
-                if (NULL != jpeg_buff && NULL != jpeg_buff->data) {
-                    compressor.getCompressedImage(jpeg_buff->data);
-                    mDataCB(CAMERA_MSG_COMPRESSED_IMAGE, jpeg_buff, 0, NULL, mCBOpaque);
-                    jpeg_buff->release(jpeg_buff);
-                } else {
-                    ALOGE("%s: Memory failure in CAMERA_MSG_VIDEO_FRAME", __FUNCTION__);
+            if (mJpegThread == NULL) {
+                mJpegThread = new JpegThread(this);
+                const status_t res = mJpegThread->run("Camera_JpegThread");
+                if (res != NO_ERROR) {
+                    ALOGE("%s: Unable to start JPEG thread: %d", __FUNCTION__, res);
+                    mJpegThread.clear();
                 }
-            } else {
-                ALOGE("%s: Compression failure in CAMERA_MSG_VIDEO_FRAME", __FUNCTION__);
+            }
+            if (mJpegThread == NULL ||
+                mJpegThread->queuePicture(frame, camera_dev->getFrameWidth(),
+                                          camera_dev->getFrameHeight(),
+                                          mJpegQuality,
+                                          &camera_dev->getStageTracer()) !=
+                    NO_ERROR) {
+                ALOGE("%s: Memory failure in CAMERA_MSG_COMPRESSED_IMAGE",
+                     __FUNCTION__);
             }
         }
     }
@@ -281,14 +315,292 @@ void CallbackNotifier::onCameraDeviceError(int err)
  * Private API
  ***************************************************************************/
 
+void CallbackNotifier::deliverVideoFrame(const void* frame,
+                                         nsecs_t timestamp,
+                                         EmulatedCameraDevice* camera_dev)
+{
+    const size_t frame_size = camera_dev->getFrameBufferSize();
+    camera_data_timestamp_callback data_cb;
+    camera_memory_t* memory;
+    void* opaque;
+    int index;
+
+    {
+        /* Callbacks are called without holding the lock. */
+        Mutex::Autolock locker(&mObjectLock);
+        if (!mVideoRecEnabled) {
+            return;
+        }
+
+        if (mVideoBuffers.configure(mGetMemoryCB, frame_size,
+                                    mVideoBufferNum) != NO_ERROR) {
+            ALOGE("%s: Memory failure in CAMERA_MSG_VIDEO_FRAME", __FUNCTION__);
+            return;
+        }
+        index = mVideoBuffers.acquireBuffer();
+        if (index < 0) {
+            ALOGW("%s: All video buffers are in use. Frame is dropped.",
+                 __FUNCTION__);
+            return;
+        }
+        memcpy(mVideoBuffers.getBufferData(index), frame, frame_size);
+
+        data_cb = mDataCBTimestamp;
+        memory = mVideoBuffers.getMemory();
+        opaque = mCBOpaque;
+        mVideoDelivering = true;
+    }
+
+    data_cb(timestamp, CAMERA_MSG_VIDEO_FRAME, memory, index, opaque);
+    endVideoDelivery();
+}
+
+void CallbackNotifier::deliverVideoMetadata(nsecs_t timestamp,
+                                            EmulatedCameraDevice* camera_dev)
+{
+    const int width = camera_dev->getFrameWidth();
+    const int height = camera_dev->getFrameHeight();
+    camera_data_timestamp_callback data_cb;
+    camera_memory_t* memory;
+    void* opaque;
+    int index;
+
+    {
+        /* Callbacks are called without holding the lock. */
+        Mutex::Autolock locker(&mObjectLock);
+        if (!mVideoRecEnabled) {
+            return;
+        }
+
+        /* Encoders read video buffers through the mapper, in the semi-planar
+         * format. */
+        if (mVideoBuffers.configure(mGetMemoryCB, mVideoMetadataSize,
+                                    mVideoBufferNum) != NO_ERROR ||
+            mVideoGrallocBuffers.configure(width, height,
+                                           HAL_PIXEL_FORMAT_YCrCb_420_SP,
+                                           GRALLOC_USAGE_SW_WRITE_OFTEN |
+                                           GRALLOC_USAGE_HW_VIDEO_ENCODER,
+                                           mVideoBufferNum) != NO_ERROR) {
+            ALOGE("%s: Memory failure in CAMERA_MSG_VIDEO_FRAME", __FUNCTION__);
+            return;
+        }
+        index = mVideoBuffers.acquireBuffer();
+        if (index < 0) {
+            ALOGW("%s: All video buffers are in use. Frame is dropped.",
+                 __FUNCTION__);
+            return;
+        }
+
+        /* Copy the frame to the gralloc buffer of the same index. */
+        buffer_handle_t* buffer = mVideoGrallocBuffers.getHandle(index);
+        void* img = NULL;
+        status_t res = mVideoMappings.lock(buffer, GRALLOC_USAGE_SW_WRITE_OFTEN,
+                                           width, height, &img);
+        if (res == NO_ERROR) {
+            res = camera_dev->getCurrentPreviewFrame(
+                    img, HAL_PIXEL_FORMAT_YCrCb_420_SP,
+                    mVideoGrallocBuffers.getStride());
+            mVideoMappings.unlock(buffer);
+        }
+        if (res != NO_ERROR) {
+            ALOGE("%s: Unable to copy video frame: %d", __FUNCTION__, res);
+            mVideoBuffers.releaseBuffer(index);
+            return;
+        }
+
+        /* The metadata is the buffer type, followed by the buffer handle. */
+        uint8_t* metadata =
+            reinterpret_cast<uint8_t*>(mVideoBuffers.getBufferData(index));
+        const uint32_t type = kMetadataBufferTypeGrallocSource;
+        memcpy(metadata, &type, sizeof(type));
+        memcpy(metadata + sizeof(type), buffer, sizeof(buffer_handle_t));
+
+        data_cb = mDataCBTimestamp;
+        memory = mVideoBuffers.getMemory();
+        opaque = mCBOpaque;
+        mVideoDelivering = true;
+    }
+
+    data_cb(timestamp, CAMERA_MSG_VIDEO_FRAME, memory, index, opaque);
+    endVideoDelivery();
+}
+
+void CallbackNotifier::endVideoDelivery()
+{
+    Mutex::Autolock locker(&mObjectLock);
+    mVideoDelivering = false;
+    if (mVideoFreePending) {
+        mVideoFreePending = false;
+        /* Recording may have been enabled again meanwhile. */
+        if (!mVideoRecEnabled) {
+            freeVideoBuffers();
+        }
+    }
+}
+
+void CallbackNotifier::freeVideoBuffers()
+{
+    /* The memory passed to a running callback must stay valid until it
+     * returns. */
+    if (mVideoDelivering) {
+        mVideoFreePending = true;
+        return;
+    }
+    mVideoBuffers.freeBuffers();
+    mVideoGrallocBuffers.freeBuffers();
+    mVideoMappings.reset();
+}
+
 bool CallbackNotifier::isNewVideoFrameTime(nsecs_t timestamp)
 {
     Mutex::Autolock locker(&mObjectLock);
-    if ((timestamp - mLastFrameTimestamp) >= mFrameRefreshFreq) {
-        mLastFrameTimestamp = timestamp;
-        return true;
+    /* Video frames are due on a grid one period apart, so frames delivered a
+     * little early, or late don't shift the grid, and the video frame rate
+     * doesn't drift below the requested one. Frames within half a period of
+     * the due time are taken. */
+    if (mNextFrameTimestamp == 0) {
+        mNextFrameTimestamp = timestamp;
+    }
+    if (timestamp < mNextFrameTimestamp - mFrameRefreshFreq / 2) {
+        return false;
+    }
+    mNextFrameTimestamp += mFrameRefreshFreq;
+    if (timestamp >= mNextFrameTimestamp) {
+        /* Fell behind by a period, or more: start over from this frame. */
+        mNextFrameTimestamp = timestamp + mFrameRefreshFreq;
+    }
+    return true;
+}
+
+void CallbackNotifier::onPictureCompressed(const uint8_t* jpeg, size_t size)
+{
+    /* Callbacks are called without holding the lock. */
+    camera_data_callback data_cb;
+    camera_request_memory get_memory;
+    void* opaque;
+    {
+        Mutex::Autolock locker(&mObjectLock);
+        if (!isMessageEnabled(CAMERA_MSG_COMPRESSED_IMAGE)) {
+            return;
+        }
+        data_cb = mDataCB;
+        get_memory = mGetMemoryCB;
+        opaque = mCBOpaque;
+    }
+    if (data_cb == NULL || get_memory == NULL) {
+        return;
+    }
+
+    camera_memory_t* jpeg_buff = get_memory(-1, size, 1, NULL);
+    if (NULL != jpeg_buff && NULL != jpeg_buff->data) {
+        memcpy(jpeg_buff->data, jpeg, size);
+        data_cb(CAMERA_MSG_COMPRESSED_IMAGE, jpeg_buff, 0, NULL, opaque);
+        jpeg_buff->release(jpeg_buff);
+    } else {
+        ALOGE("%s: Memory failure in CAMERA_MSG_COMPRESSED_IMAGE", __FUNCTION__);
+        if (jpeg_buff != NULL) {
+            jpeg_buff->release(jpeg_buff);
+        }
+    }
+}
+
+void CallbackNotifier::stopJpegThread()
+{
+    if (mJpegThread != NULL) {
+        mJpegThread->stopThread();
+        mJpegThread.clear();
+    }
+}
+
+/****************************************************************************
+ * JPEG compressor thread
+ ***************************************************************************/
+
+CallbackNotifier::JpegThread::JpegThread(CallbackNotifier* notifier)
+    : Thread(true),   // Callbacks may involve Java calls.
+      mNotifier(notifier)
+{
+    mEncoder.setThreadCount(JpegEncoder::getDefaultThreadCount());
+}
+
+CallbackNotifier::JpegThread::~JpegThread()
+{
+    for (size_t n = 0; n < mQueue.size(); n++) {
+        delete[] mQueue[n].frame;
+    }
+}
+
+status_t CallbackNotifier::JpegThread::queuePicture(const void* frame,
+                                                    int width,
+                                                    int height,
+                                                    int quality,
+                                                    StageTracer* tracer)
+{
+    const size_t size = (width * height * 12) / 8;
+    Picture picture;
+    picture.frame = new uint8_t[size];
+    if (picture.frame == NULL) {
+        return ENOMEM;
+    }
+    memcpy(picture.frame, frame, size);
+    picture.width = width;
+    picture.height = height;
+    picture.quality = quality;
+    picture.tracer = tracer;
+
+    Mutex::Autolock locker(&mQueueLock);
+    mQueue.push_back(picture);
+    mQueueCondition.signal();
+    return NO_ERROR;
+}
+
+void CallbackNotifier::JpegThread::stopThread()
+{
+    {
+        Mutex::Autolock locker(&mQueueLock);
+        for (size_t n = 0; n < mQueue.size(); n++) {
+            delete[] mQueue[n].frame;
+        }
+        mQueue.clear();
+        requestExit();
+        mQueueCondition.signal();
+    }
+    requestExitAndWait();
+}
+
+bool CallbackNotifier::JpegThread::threadLoop()
+{
+    Picture picture;
+    {
+        Mutex::Autolock locker(&mQueueLock);
+        while (mQueue.isEmpty()) {
+            if (exitPending()) {
+                return false;
+            }
+            mQueueCondition.wait(mQueueLock);
+        }
+        picture = mQueue[0];
+        mQueue.removeAt(0);
+    }
+
+    const nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    const status_t res =
+        mEncoder.compress(picture.frame, JpegEncoder::INPUT_NV21, picture.width,
+                          picture.height, picture.width, picture.quality);
+    delete[] picture.frame;
+    if (res == NO_ERROR) {
+        const nsecs_t end = systemTime(SYSTEM_TIME_MONOTONIC);
+        picture.tracer->record(StageTracer::STAGE_JPEG, start, end);
+        ALOGV("%s: Compressed JPEG: [%dx%d] -> %d bytes in %lld us",
+             __FUNCTION__, picture.width, picture.height,
+             mEncoder.getCompressedSize(), (end - start) / 1000LL);
+        mNotifier->onPictureCompressed(mEncoder.getCompressedImage(),
+                                       mEncoder.getCompressedSize());
+    } else {
+        ALOGE("%s: Compression failure in CAMERA_MSG_COMPRESSED_IMAGE",
+             __FUNCTION__);
     }
-    return false;
+    return true;
 }
 
 }; /* namespace android */
@@ -22,6 +22,13 @@
  * via set_callbacks, enable_msg_type, and disable_msg_type camera HAL API.
  */
 
+#include <utils/Vector.h>
+#include "CallbackBufferPool.h"
+#include "GrallocBufferPool.h"
+#include "GrallocMappingCache.h"
+#include "JpegEncoder.h"
+#include "StageTracer.h"
+
 namespace android {
 
 class EmulatedCameraDevice;
@@ -74,6 +81,11 @@ public:
      * callback. This method is called by the containing emulated camera object
      * when it is handing the camera_device_ops_t::store_meta_data_in_buffers
      * callback.
+     * When enabled, video frames are delivered in NV21 gralloc buffers that
+     * are recycled, and the data of CAMERA_MSG_VIDEO_FRAME callbacks contains
+     * kMetadataBufferTypeGrallocSource metadata that refers to the buffer,
+     * rather than the frame itself. This takes effect the next time video
+     * recording is enabled.
      * Return:
      *  NO_ERROR on success, or an appropriate error status.
      */
@@ -185,12 +197,112 @@ public:
      ***************************************************************************/
 
 protected:
+    /* Pushes a copy of a video frame through the CAMERA_MSG_VIDEO_FRAME
+     * callback. */
+    void deliverVideoFrame(const void* frame,
+                           nsecs_t timestamp,
+                           EmulatedCameraDevice* camera_dev);
+
+    /* Pushes a reference to a video frame through the CAMERA_MSG_VIDEO_FRAME
+     * callback in the metadata mode. See storeMetaDataInBuffers. */
+    void deliverVideoMetadata(nsecs_t timestamp,
+                              EmulatedCameraDevice* camera_dev);
+
+    /* Called once a video frame callback returns. Frees the video buffers if
+     * this has been requested while the callback was running. */
+    void endVideoDelivery();
+
+    /* Frees buffers used to deliver video frames, or, while a video frame
+     * callback is running, once it returns.
+     * Note: this method must be called while holding mObjectLock.
+     */
+    void freeVideoBuffers();
+
     /* Checks if it's time to push new video frame.
      * Note that this method must be called while object is locked.
      * Param:
      *  timestamp - Timestamp for the new frame. */
     bool isNewVideoFrameTime(nsecs_t timestamp);
 
+    /* Pushes a compressed picture through the CAMERA_MSG_COMPRESSED_IMAGE
+     * callback.
+     * This method is called on the JPEG compressor thread.
+     * Param:
+     *  jpeg, size - Compressed picture.
+     */
+    void onPictureCompressed(const uint8_t* jpeg, size_t size);
+
+    /* Stops the JPEG compressor thread, dropping pictures that have not been
+     * compressed yet. */
+    void stopJpegThread();
+
+    /****************************************************************************
+     * JPEG compressor thread
+     ***************************************************************************/
+
+    /* Compresses pictures off the camera device's worker thread.
+     *
+     * The worker thread only copies the frame, and queues it here, so it can
+     * go on capturing while the picture is compressed. Compressed pictures are
+     * delivered to the framework from this thread, in the order they were
+     * taken.
+     */
+    class JpegThread : public Thread {
+    public:
+        /* Constructs JpegThread instance. */
+        explicit JpegThread(CallbackNotifier* notifier);
+
+        /* Destructs JpegThread instance. */
+        ~JpegThread();
+
+        /* Queues a picture for compression.
+         * Param:
+         *  frame - NV21 frame to compress. The frame is copied.
+         *  width, height - Frame dimensions.
+         *  quality - JPEG quality.
+         *  tracer - Tracer to record compression time with.
+         * Return:
+         *  NO_ERROR on success, or an appropriate error status.
+         */
+        status_t queuePicture(const void* frame,
+                              int width,
+                              int height,
+                              int quality,
+                              StageTracer* tracer);
+
+        /* Stops the thread, dropping pictures that are still queued, and waits
+         * for the picture that is being compressed to be delivered. */
+        void stopThread();
+
+    private:
+        /* A picture waiting to be compressed. */
+        struct Picture {
+            uint8_t*    frame;
+            int         width;
+            int         height;
+            int         quality;
+            StageTracer* tracer;
+        };
+
+        /* Implements abstract method of the base Thread class. */
+        bool threadLoop();
+
+        /* Notifier that delivers compressed pictures. */
+        CallbackNotifier*   mNotifier;
+
+        /* Protects the queue. */
+        Mutex               mQueueLock;
+
+        /* Signaled when a picture is queued, or the thread is stopping. */
+        Condition           mQueueCondition;
+
+        /* Pictures waiting to be compressed. */
+        Vector<Picture>     mQueue;
+
+        /* Encoder used by this thread. */
+        JpegEncoder         mEncoder;
+    };
+
     /****************************************************************************
      * Data members
      ***************************************************************************/
@@ -209,8 +321,8 @@ protected:
     camera_request_memory           mGetMemoryCB;
     void*                           mCBOpaque;
 
-    /* Timestamp when last frame has been delivered to the framework. */
-    nsecs_t                         mLastFrameTimestamp;
+    /* Timestamp the next video frame is due at. */
+    nsecs_t                         mNextFrameTimestamp;
 
     /* Video frequency in nanosec. */
     nsecs_t                         mFrameRefreshFreq;
@@ -224,8 +336,42 @@ protected:
     /* Video recording status. */
     bool                            mVideoRecEnabled;
 
+    /* Video frames are delivered as references to gralloc buffers (see
+     * storeMetaDataInBuffers). The first flag is what has been requested,
+     * and the second one is what the current recording uses. */
+    bool                            mStoreMetaData;
+    bool                            mVideoMetaData;
+
     /* Picture taking status. */
     bool                            mTakingPicture;
+
+    /* Buffers used to deliver video frames. A buffer stays in use until the
+     * framework releases the frame via releaseRecordingFrame. */
+    CallbackBufferPool              mVideoBuffers;
+
+    /* A video frame callback is running on the camera device thread, with the
+     * memory of mVideoBuffers. If the buffers are to be freed meanwhile, the
+     * second flag is set, and they are freed once the callback returns. */
+    bool                            mVideoDelivering;
+    bool                            mVideoFreePending;
+
+    /* Gralloc buffers video frames are copied to in the metadata mode. A
+     * buffer is in use as long as the metadata buffer of the same index in
+     * mVideoBuffers is. */
+    GrallocBufferPool               mVideoGrallocBuffers;
+    GrallocMappingCache             mVideoMappings;
+
+    /* Number of buffers used to deliver video frames. This limits the number
+     * of video frames the framework may hold on to. */
+    static const int                mVideoBufferNum = 8;
+
+    /* Byte size of a video buffer in the metadata mode. */
+    static const size_t             mVideoMetadataSize =
+        sizeof(uint32_t) + sizeof(buffer_handle_t);
+
+    /* Thread that compresses pictures. Created when the first picture is
+     * taken. */
+    sp<JpegThread>                  mJpegThread;
 };
 
 }; /* namespace android */
@@ -21,10 +21,193 @@
 #define LOG_NDEBUG 0
 #define LOG_TAG "EmulatedCamera_Converter"
 #include <cutils/log.h>
+#include <pthread.h>
+#include <string.h>
 #include "Converters.h"
+#include "ConvertersSIMD.h"
+#include "WorkerPool.h"
 
 namespace android {
 
+/*
+ * Scalar row converters.
+ * These are the reference implementations: SIMD row converters must produce
+ * bit-exact RGB values for the same input.
+ */
+
+static void _YUV420SToRGB565Row(const uint8_t* Y,
+                                const uint8_t* U,
+                                const uint8_t* V,
+                                int dUV,
+                                void* rgb_row,
+                                int width)
+{
+    uint16_t* rgb = reinterpret_cast<uint16_t*>(rgb_row);
+    for (int x = 0; x < width; x += 2, U += dUV, V += dUV) {
+        const uint8_t nU = *U;
+        const uint8_t nV = *V;
+        *rgb = YUVToRGB565(*Y, nU, nV);
+        Y++; rgb++;
+        *rgb = YUVToRGB565(*Y, nU, nV);
+        Y++; rgb++;
+    }
+}
+
+static void _YUV420SToRGB32Row(const uint8_t* Y,
+                               const uint8_t* U,
+                               const uint8_t* V,
+                               int dUV,
+                               void* rgb_row,
+                               int width)
+{
+    uint32_t* rgb = reinterpret_cast<uint32_t*>(rgb_row);
+    for (int x = 0; x < width; x += 2, U += dUV, V += dUV) {
+        const uint8_t nU = *U;
+        const uint8_t nV = *V;
+        *rgb = YUVToRGB32(*Y, nU, nV);
+        Y++; rgb++;
+        *rgb = YUVToRGB32(*Y, nU, nV);
+        Y++; rgb++;
+    }
+}
+
+/*
+ * Converter dispatch.
+ */
+
+/* Row converters used by the framebuffer converters. */
+static YUV420RowConverter   _RGB565RowConverter = _YUV420SToRGB565Row;
+static YUV420RowConverter   _RGB32RowConverter = _YUV420SToRGB32Row;
+
+/* Guards one-time selection of the best available row converters. */
+static pthread_once_t       _ConvertersOnce = PTHREAD_ONCE_INIT;
+
+/* Pool used to convert large frames in bands. */
+static WorkerPool           _ConverterPool;
+
+/* Frames with fewer pixels than this are never split into bands: dispatch
+ * overhead would outweigh the gain. */
+static const int            _MinBandedPixels = 640 * 480;
+
+static bool _GetRowConverters(ConverterImpl impl,
+                              YUV420RowConverter* to_rgb565,
+                              YUV420RowConverter* to_rgb32)
+{
+    YUV420RowConverter rgb565 = NULL;
+    YUV420RowConverter rgb32 = NULL;
+
+    switch (impl) {
+        case CONVERTER_SCALAR:
+            rgb565 = _YUV420SToRGB565Row;
+            rgb32 = _YUV420SToRGB32Row;
+            break;
+
+        case CONVERTER_SSE2:
+            rgb565 = GetYUV420SToRGB565Row_SSE2();
+            rgb32 = GetYUV420SToRGB32Row_SSE2();
+            break;
+
+        case CONVERTER_NEON:
+            rgb565 = GetYUV420SToRGB565Row_NEON();
+            rgb32 = GetYUV420SToRGB32Row_NEON();
+            break;
+
+        default:
+            break;
+    }
+
+    if (rgb565 == NULL || rgb32 == NULL) {
+        return false;
+    }
+    *to_rgb565 = rgb565;
+    *to_rgb32 = rgb32;
+    return true;
+}
+
+static void _InitConverters()
+{
+    const ConverterImpl impl = getBestConverterImpl();
+    _GetRowConverters(impl, &_RGB565RowConverter, &_RGB32RowConverter);
+    ALOGV("%s: Using converter implementation %d", __FUNCTION__, impl);
+}
+
+ConverterImpl getBestConverterImpl()
+{
+    if (GetYUV420SToRGB32Row_NEON() != NULL) {
+        return CONVERTER_NEON;
+    }
+    if (GetYUV420SToRGB32Row_SSE2() != NULL) {
+        return CONVERTER_SSE2;
+    }
+    return CONVERTER_SCALAR;
+}
+
+bool setConverterImpl(ConverterImpl impl)
+{
+    pthread_once(&_ConvertersOnce, _InitConverters);
+    return _GetRowConverters(impl, &_RGB565RowConverter, &_RGB32RowConverter);
+}
+
+status_t setConverterThreads(int num_threads)
+{
+    return _ConverterPool.setThreadCount(num_threads);
+}
+
+/* Describes a YUV 4:2:0 -> RGB conversion job that may be split in bands. */
+struct YUV420SConversion {
+    YUV420RowConverter  converter;
+    const uint8_t*      Y;
+    const uint8_t*      U;
+    const uint8_t*      V;
+    int                 dUV;
+    uint8_t*            rgb;
+    int                 rgb_pix_size;
+    int                 width;
+};
+
+/* Converts rows [start, end) of a YUV 4:2:0 conversion job. 'start' must be
+ * even, so the band begins on a chroma row boundary. */
+static void _YUV420SToRGBBand(void* opaque, int start, int end)
+{
+    const YUV420SConversion* job = reinterpret_cast<YUV420SConversion*>(opaque);
+    const int uv_row = (job->width / 2) * job->dUV;
+
+    for (int y = start; y < end; y++) {
+        const int uv_off = (y / 2) * uv_row;
+        job->converter(job->Y + y * job->width,
+                       job->U + uv_off, job->V + uv_off, job->dUV,
+                       job->rgb + y * job->width * job->rgb_pix_size,
+                       job->width);
+    }
+}
+
+static void _YUV420SToRGB(YUV420RowConverter converter,
+                          const uint8_t* Y,
+                          const uint8_t* U,
+                          const uint8_t* V,
+                          int dUV,
+                          void* rgb,
+                          int rgb_pix_size,
+                          int width,
+                          int height)
+{
+    YUV420SConversion job;
+    job.converter = converter;
+    job.Y = Y;
+    job.U = U;
+    job.V = V;
+    job.dUV = dUV;
+    job.rgb = reinterpret_cast<uint8_t*>(rgb);
+    job.rgb_pix_size = rgb_pix_size;
+    job.width = width;
+
+    if (width * height >= _MinBandedPixels) {
+        _ConverterPool.runBands(_YUV420SToRGBBand, &job, height, 2);
+    } else {
+        _YUV420SToRGBBand(&job, 0, height);
+    }
+}
+
 static void _YUV420SToRGB565(const uint8_t* Y,
                              const uint8_t* U,
                              const uint8_t* V,
@@ -33,26 +216,9 @@ static void _YUV420SToRGB565(const uint8_t* Y,
                              int width,
                              int height)
 {
-    const uint8_t* U_pos = U;
-    const uint8_t* V_pos = V;
-
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x += 2, U += dUV, V += dUV) {
-            const uint8_t nU = *U;
-            const uint8_t nV = *V;
-            *rgb = YUVToRGB565(*Y, nU, nV);
-            Y++; rgb++;
-            *rgb = YUVToRGB565(*Y, nU, nV);
-            Y++; rgb++;
-        }
-        if (y & 0x1) {
-            U_pos = U;
-            V_pos = V;
-        } else {
-            U = U_pos;
-            V = V_pos;
-        }
-    }
+    pthread_once(&_ConvertersOnce, _InitConverters);
+    _YUV420SToRGB(_RGB565RowConverter, Y, U, V, dUV, rgb, sizeof(uint16_t),
+                  width, height);
 }
 
 static void _YUV420SToRGB32(const uint8_t* Y,
@@ -63,26 +229,9 @@ static void _YUV420SToRGB32(const uint8_t* Y,
                             int width,
                             int height)
 {
-    const uint8_t* U_pos = U;
-    const uint8_t* V_pos = V;
-
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x += 2, U += dUV, V += dUV) {
-            const uint8_t nU = *U;
-            const uint8_t nV = *V;
-            *rgb = YUVToRGB32(*Y, nU, nV);
-            Y++; rgb++;
-            *rgb = YUVToRGB32(*Y, nU, nV);
-            Y++; rgb++;
-        }
-        if (y & 0x1) {
-            U_pos = U;
-            V_pos = V;
-        } else {
-            U = U_pos;
-            V = V_pos;
-        }
-    }
+    pthread_once(&_ConvertersOnce, _InitConverters);
+    _YUV420SToRGB(_RGB32RowConverter, Y, U, V, dUV, rgb, sizeof(uint32_t),
+                  width, height);
 }
 
 void YV12ToRGB565(const void* yv12, void* rgb, int width, int height)
@@ -170,4 +319,92 @@ void NV21ToRGB32(const void* nv21, void* rgb, int width, int height)
                  reinterpret_cast<uint32_t*>(rgb), width, height);
 }
 
+/* Copies a plane of 'height' rows, 'width' bytes each. */
+static void _CopyPlane(const uint8_t* src,
+                       int src_stride,
+                       uint8_t* dst,
+                       int dst_stride,
+                       int width,
+                       int height)
+{
+    if (src_stride == width && dst_stride == width) {
+        memcpy(dst, src, width * height);
+        return;
+    }
+    for (int y = 0; y < height; y++, src += src_stride, dst += dst_stride) {
+        memcpy(dst, src, width);
+    }
+}
+
+void YUV420ToYV12(const uint8_t* Y,
+                  const uint8_t* U,
+                  const uint8_t* V,
+                  int dUV,
+                  void* yv12,
+                  int width,
+                  int height,
+                  int y_stride,
+                  int uv_stride)
+{
+    const int uv_width = width / 2;
+    const int uv_height = height / 2;
+    uint8_t* dst_Y = reinterpret_cast<uint8_t*>(yv12);
+    uint8_t* dst_V = dst_Y + y_stride * height;
+    uint8_t* dst_U = dst_V + uv_stride * uv_height;
+
+    _CopyPlane(Y, width, dst_Y, y_stride, width, height);
+    if (dUV == 1) {
+        _CopyPlane(V, uv_width, dst_V, uv_stride, uv_width, uv_height);
+        _CopyPlane(U, uv_width, dst_U, uv_stride, uv_width, uv_height);
+        return;
+    }
+
+    /* Deinterleave chroma. */
+    const int src_row = uv_width * dUV;
+    for (int y = 0; y < uv_height; y++) {
+        const uint8_t* u = U + y * src_row;
+        const uint8_t* v = V + y * src_row;
+        uint8_t* du = dst_U + y * uv_stride;
+        uint8_t* dv = dst_V + y * uv_stride;
+        for (int x = 0; x < uv_width; x++, u += dUV, v += dUV) {
+            du[x] = *u;
+            dv[x] = *v;
+        }
+    }
+}
+
+void YUV420ToNV21(const uint8_t* Y,
+                  const uint8_t* U,
+                  const uint8_t* V,
+                  int dUV,
+                  void* nv21,
+                  int width,
+                  int height,
+                  int stride)
+{
+    const int uv_width = width / 2;
+    const int uv_height = height / 2;
+    uint8_t* dst_Y = reinterpret_cast<uint8_t*>(nv21);
+    uint8_t* dst_VU = dst_Y + stride * height;
+
+    _CopyPlane(Y, width, dst_Y, stride, width, height);
+    if (dUV == 2 && V + 1 == U) {
+        /* Source is NV21 as well. */
+        _CopyPlane(V, width, dst_VU, stride, width, uv_height);
+        return;
+    }
+
+    /* Interleave, or swap chroma. */
+    const int src_row = uv_width * dUV;
+    for (int y = 0; y < uv_height; y++) {
+        const uint8_t* u = U + y * src_row;
+        const uint8_t* v = V + y * src_row;
+        uint8_t* dvu = dst_VU + y * stride;
+        for (int x = 0; x < uv_width; x++, u += dUV, v += dUV) {
+            *dvu++ = *v;
+            *dvu++ = *u;
+        }
+    }
+}
+
 }; /* namespace android */
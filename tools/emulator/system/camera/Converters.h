@@ -18,6 +18,7 @@
 #define HW_EMULATOR_CAMERA_CONVERTERS_H
 
 #include <endian.h>
+#include <utils/Errors.h>
 
 #ifndef __BYTE_ORDER
 #error "could not determine byte order"
@@ -253,6 +254,57 @@ struct YUVPixel {
     }
 };
 
+/* Converts a single row of an YUV 4:2:0 framebuffer into RGB.
+ * Param:
+ *  Y - Beginning of the row in the Y pane.
+ *  U, V - Beginning of the chroma row that corresponds to the Y row.
+ *  dUV - Byte distance between adjacent U (and V) values: 1 for planar, and 2
+ *      for interleaved (NV12 / NV21) chroma panes.
+ *  rgb - Beginning of the row in the RGB framebuffer.
+ *  width - Row width in pixels. Must be even.
+ */
+typedef void (*YUV420RowConverter)(const uint8_t* Y,
+                                   const uint8_t* U,
+                                   const uint8_t* V,
+                                   int dUV,
+                                   void* rgb,
+                                   int width);
+
+/* Enumerates implementations of the YUV -> RGB framebuffer converters. */
+enum ConverterImpl {
+    /* Portable C implementation. This is the reference implementation. */
+    CONVERTER_SCALAR,
+    /* x86 SSE2 implementation. */
+    CONVERTER_SSE2,
+    /* ARM NEON implementation. */
+    CONVERTER_NEON
+};
+
+/* Gets the fastest converter implementation supported by the CPU.
+ * This is the implementation that is used by default.
+ */
+ConverterImpl getBestConverterImpl();
+
+/* Forces the framebuffer converters to use the given implementation.
+ * This is intended for testing, and benchmarking.
+ * Return:
+ *  true on success, or false if the implementation is not supported by the
+ *  CPU, or was not built in.
+ */
+bool setConverterImpl(ConverterImpl impl);
+
+/* Sets the number of worker threads used to convert large frames.
+ * Frames of VGA size and larger are split into horizontal bands that are
+ * converted in parallel by the calling thread, and the worker threads. By
+ * default there are no worker threads, and frames are converted entirely on the
+ * calling thread.
+ * Param:
+ *  num_threads - Number of worker threads. 0 disables banded conversion.
+ * Return:
+ *  NO_ERROR on success, or an appropriate error status.
+ */
+status_t setConverterThreads(int num_threads);
+
 /* Converts an YV12 framebuffer to RGB565 framebuffer.
  * Param:
  *  yv12 - YV12 framebuffer.
@@ -309,6 +361,51 @@ void NV21ToRGB565(const void* nv21, void* rgb, int width, int height);
  */
 void NV21ToRGB32(const void* nv21, void* rgb, int width, int height);
 
+/*
+ * YUV 4:2:0 framebuffer copies.
+ *
+ * These copy a YUV 4:2:0 framebuffer given by its planes into a preview window
+ * buffer, laid out with the buffer's row strides. Chroma is only copied, or
+ * (de)interleaved, so no color conversion takes place.
+ */
+
+/* Copies a YUV 4:2:0 framebuffer to a YV12 framebuffer.
+ * Param:
+ *  Y, U, V - Luma, and chroma planes of the source framebuffer. Chroma planes
+ *      are 'width / 2' pixels wide.
+ *  dUV - Distance between two U (or V) values in the source framebuffer:
+ *      1 for planar, and 2 for interleaved chroma.
+ *  yv12 - YV12 framebuffer.
+ *  width, height - Dimensions for both framebuffers.
+ *  y_stride, uv_stride - Byte distance between rows of the luma, and the
+ *      chroma planes of the YV12 framebuffer.
+ */
+void YUV420ToYV12(const uint8_t* Y,
+                  const uint8_t* U,
+                  const uint8_t* V,
+                  int dUV,
+                  void* yv12,
+                  int width,
+                  int height,
+                  int y_stride,
+                  int uv_stride);
+
+/* Copies a YUV 4:2:0 framebuffer to an NV21 framebuffer.
+ * Param:
+ *  Y, U, V, dUV - Source framebuffer, as in YUV420ToYV12.
+ *  nv21 - NV21 framebuffer.
+ *  width, height - Dimensions for both framebuffers.
+ *  stride - Byte distance between rows of both planes of the NV21 framebuffer.
+ */
+void YUV420ToNV21(const uint8_t* Y,
+                  const uint8_t* U,
+                  const uint8_t* V,
+                  int dUV,
+                  void* nv21,
+                  int width,
+                  int height,
+                  int stride);
+
 }; /* namespace android */
 
 #endif  /* HW_EMULATOR_CAMERA_CONVERTERS_H */
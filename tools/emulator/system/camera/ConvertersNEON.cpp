@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Contains NEON implementation of the YUV 4:2:0 -> RGB row converters.
+ *
+ * Eight pixels are converted per iteration. To stay bit-exact with the scalar
+ * converters, the 298 * C + 409 * E... sums are computed in 32 bits, and
+ * vqrshrn / vqmovun provide the "+ 128 >> 8", and the clamp to 0-255.
+ *
+ * On ARM this file is built with NEON enabled (see Android.mk), but the NEON
+ * row converters are only handed out when the CPU reports NEON support.
+ */
+
+#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera_ConverterNEON"
+#include <cutils/log.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "ConvertersSIMD.h"
+
+#if (defined(__ARM_NEON__) || defined(__aarch64__)) && __BYTE_ORDER == __LITTLE_ENDIAN
+
+#include <arm_neon.h>
+
+namespace android {
+
+/* Computed R, G, and B values for 8 pixels, clamped to the 0-255 range. */
+struct RGBx8 {
+    uint8x8_t r;
+    uint8x8_t g;
+    uint8x8_t b;
+};
+
+/* Loads 4 chroma values as 16-bit lanes, minus 128. */
+static inline int16x4_t _loadChroma(const uint8_t* C, int dUV)
+{
+    uint16x4_t c;
+    if (dUV == 1) {
+        uint32_t packed;
+        memcpy(&packed, C, sizeof(packed));
+        c = vget_low_u16(vmovl_u8(vcreate_u8(packed)));
+    } else {
+        /* Interleaved pane: read the 7 bytes that end at the last value we
+         * need, so we never touch memory past the end of the chroma row. */
+        uint64_t packed = 0;
+        memcpy(&packed, C, 7);
+        c = vand_u16(vreinterpret_u16_u64(vcreate_u64(packed)), vdup_n_u16(0x00ff));
+    }
+    return vsub_s16(vreinterpret_s16_u16(c), vdup_n_s16(128));
+}
+
+/* Adds a per-chroma term to the luma terms of the two pixels sharing the
+ * chroma, and scales the sum down to a clamped 8-bit range. */
+static inline uint8x8_t _combine(int32x4_t y_lo, int32x4_t y_hi, int32x4_t c)
+{
+    const int32x4x2_t dup = vzipq_s32(c, c);
+    return vqmovun_s16(vcombine_s16(vqrshrn_n_s32(vaddq_s32(y_lo, dup.val[0]), 8),
+                                    vqrshrn_n_s32(vaddq_s32(y_hi, dup.val[1]), 8)));
+}
+
+/* Converts 8 pixels.
+ * The luma term 298 * C is computed per pixel, while the chroma terms
+ * (409 * E, -100 * D - 208 * E, 516 * D) are computed once per chroma pair. */
+static inline void _YUVToRGBx8(const uint8_t* Y,
+                               const uint8_t* U,
+                               const uint8_t* V,
+                               int dUV,
+                               RGBx8* out)
+{
+    const int16x8_t C =
+        vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(Y))), vdupq_n_s16(16));
+    const int16x4_t D = _loadChroma(U, dUV);
+    const int16x4_t E = _loadChroma(V, dUV);
+
+    const int32x4_t y_lo = vmull_n_s16(vget_low_s16(C), 298);
+    const int32x4_t y_hi = vmull_n_s16(vget_high_s16(C), 298);
+
+    out->r = _combine(y_lo, y_hi, vmull_n_s16(E, 409));
+    out->g = _combine(y_lo, y_hi, vmlsl_n_s16(vmull_n_s16(D, -100), E, 208));
+    out->b = _combine(y_lo, y_hi, vmull_n_s16(D, 516));
+}
+
+static void _YUV420SToRGB565Row_NEON(const uint8_t* Y,
+                                     const uint8_t* U,
+                                     const uint8_t* V,
+                                     int dUV,
+                                     void* rgb_row,
+                                     int width)
+{
+    uint16_t* rgb = reinterpret_cast<uint16_t*>(rgb_row);
+    int x = 0;
+    for (; x + 8 <= width; x += 8, Y += 8, U += 4 * dUV, V += 4 * dUV, rgb += 8) {
+        RGBx8 px;
+        _YUVToRGBx8(Y, U, V, dUV, &px);
+        uint16x8_t pix = vmovl_u8(vshr_n_u8(px.r, 3));
+        pix = vorrq_u16(pix, vshlq_n_u16(vmovl_u8(vshr_n_u8(px.g, 2)), 5));
+        pix = vorrq_u16(pix, vshlq_n_u16(vmovl_u8(vshr_n_u8(px.b, 3)), 11));
+        vst1q_u16(rgb, pix);
+    }
+    /* Tail. */
+    for (; x < width; x += 2, U += dUV, V += dUV) {
+        *rgb++ = YUVToRGB565(*Y++, *U, *V);
+        *rgb++ = YUVToRGB565(*Y++, *U, *V);
+    }
+}
+
+static void _YUV420SToRGB32Row_NEON(const uint8_t* Y,
+                                    const uint8_t* U,
+                                    const uint8_t* V,
+                                    int dUV,
+                                    void* rgb_row,
+                                    int width)
+{
+    uint32_t* rgb = reinterpret_cast<uint32_t*>(rgb_row);
+    int x = 0;
+    for (; x + 8 <= width; x += 8, Y += 8, U += 4 * dUV, V += 4 * dUV, rgb += 8) {
+        RGBx8 px;
+        _YUVToRGBx8(Y, U, V, dUV, &px);
+        uint8x8x4_t rgba;
+        rgba.val[0] = px.r;
+        rgba.val[1] = px.g;
+        rgba.val[2] = px.b;
+        rgba.val[3] = vdup_n_u8(0);
+        vst4_u8(reinterpret_cast<uint8_t*>(rgb), rgba);
+    }
+    /* Tail. */
+    for (; x < width; x += 2, U += dUV, V += dUV) {
+        *rgb++ = YUVToRGB32(*Y++, *U, *V);
+        *rgb++ = YUVToRGB32(*Y++, *U, *V);
+    }
+}
+
+/* NEON support detected by _DetectNEON. */
+static bool             _HasNEON = false;
+static pthread_once_t   _DetectNEONOnce = PTHREAD_ONCE_INIT;
+
+/* Checks the "Features" line in /proc/cpuinfo for NEON support. NEON is
+ * optional on ARMv7, so having it enabled at build time isn't enough. */
+static void _DetectNEON()
+{
+#if defined(__aarch64__)
+    _HasNEON = true;
+#else
+    FILE* cpuinfo = fopen("/proc/cpuinfo", "r");
+    if (cpuinfo == NULL) {
+        ALOGW("%s: Unable to open /proc/cpuinfo: %s", __FUNCTION__, strerror(errno));
+        return;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), cpuinfo) != NULL) {
+        if (strncmp(line, "Features", 8) == 0 && strstr(line, " neon") != NULL) {
+            _HasNEON = true;
+            break;
+        }
+    }
+    fclose(cpuinfo);
+#endif
+}
+
+static bool _HaveNEON()
+{
+    pthread_once(&_DetectNEONOnce, _DetectNEON);
+    return _HasNEON;
+}
+
+YUV420RowConverter GetYUV420SToRGB565Row_NEON()
+{
+    return _HaveNEON() ? _YUV420SToRGB565Row_NEON : NULL;
+}
+
+YUV420RowConverter GetYUV420SToRGB32Row_NEON()
+{
+    return _HaveNEON() ? _YUV420SToRGB32Row_NEON : NULL;
+}
+
+}; /* namespace android */
+
+#else   // __ARM_NEON__
+
+namespace android {
+
+YUV420RowConverter GetYUV420SToRGB565Row_NEON()
+{
+    return NULL;
+}
+
+YUV420RowConverter GetYUV420SToRGB32Row_NEON()
+{
+    return NULL;
+}
+
+}; /* namespace android */
+
+#endif  // __ARM_NEON__
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HW_EMULATOR_CAMERA_CONVERTERS_SIMD_H
+#define HW_EMULATOR_CAMERA_CONVERTERS_SIMD_H
+
+/*
+ * Contains declarations of the vectorized row converters used internally by
+ * the framebuffer conversion routines declared in Converters.h.
+ *
+ * Each getter returns NULL if the corresponding instruction set has not been
+ * built in, or is not supported by the CPU the code runs on. Vectorized row
+ * converters produce the same RGB values as the scalar ones.
+ */
+
+#include "Converters.h"
+
+namespace android {
+
+/* Gets SSE2 row converters. Implemented in ConvertersSSE2.cpp */
+YUV420RowConverter GetYUV420SToRGB565Row_SSE2();
+YUV420RowConverter GetYUV420SToRGB32Row_SSE2();
+
+/* Gets NEON row converters. Implemented in ConvertersNEON.cpp */
+YUV420RowConverter GetYUV420SToRGB565Row_NEON();
+YUV420RowConverter GetYUV420SToRGB32Row_NEON();
+
+}; /* namespace android */
+
+#endif  /* HW_EMULATOR_CAMERA_CONVERTERS_SIMD_H */
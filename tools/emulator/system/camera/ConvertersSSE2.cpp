@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Contains SSE2 implementation of the YUV 4:2:0 -> RGB row converters.
+ *
+ * Eight pixels are converted per iteration. To stay bit-exact with the scalar
+ * converters, the 298 * C + 409 * E... sums are computed in 32 bits: luma
+ * terms with pmullw / pmulhw, and chroma terms with pmaddwd over (U, V) pairs.
+ */
+
+#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera_ConverterSSE2"
+#include <cutils/log.h>
+#include <string.h>
+#include "ConvertersSIMD.h"
+
+#if defined(__SSE2__) && __BYTE_ORDER == __LITTLE_ENDIAN
+
+#include <emmintrin.h>
+#if defined(__i386__)
+#include <cpuid.h>
+#endif
+
+namespace android {
+
+/* Computed R, G, and B values for 8 pixels, as 16-bit lanes clamped to the
+ * 0-255 range. */
+struct RGBx8 {
+    __m128i r;
+    __m128i g;
+    __m128i b;
+};
+
+/* Chroma coefficients, laid out to match the order of the (D, E) pairs
+ * returned from _loadChroma. */
+struct ChromaCoeffs {
+    __m128i r;
+    __m128i g;
+    __m128i b;
+};
+
+/* Initializes chroma coefficients for a row.
+ * Param:
+ *  v_first - true if V precedes U in the chroma pairs (NV21).
+ */
+static inline void _initChromaCoeffs(bool v_first, ChromaCoeffs* k)
+{
+    if (v_first) {
+        k->r = _mm_set_epi16(0, 409, 0, 409, 0, 409, 0, 409);
+        k->g = _mm_set_epi16(-100, -208, -100, -208, -100, -208, -100, -208);
+        k->b = _mm_set_epi16(516, 0, 516, 0, 516, 0, 516, 0);
+    } else {
+        k->r = _mm_set_epi16(409, 0, 409, 0, 409, 0, 409, 0);
+        k->g = _mm_set_epi16(-208, -100, -208, -100, -208, -100, -208, -100);
+        k->b = _mm_set_epi16(0, 516, 0, 516, 0, 516, 0, 516);
+    }
+}
+
+/* Loads 4 chroma pairs as 16-bit (U - 128, V - 128) lanes. For interleaved
+ * panes the pairs are loaded in the pane's order, starting at 'UV'. */
+static inline __m128i _loadChroma(const uint8_t* U,
+                                  const uint8_t* V,
+                                  const uint8_t* UV,
+                                  int dUV)
+{
+    __m128i pairs;
+    if (dUV == 1) {
+        uint32_t u, v;
+        memcpy(&u, U, sizeof(u));
+        memcpy(&v, V, sizeof(v));
+        pairs = _mm_unpacklo_epi8(_mm_cvtsi32_si128(u), _mm_cvtsi32_si128(v));
+    } else {
+        pairs = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(UV));
+    }
+    return _mm_sub_epi16(_mm_unpacklo_epi8(pairs, _mm_setzero_si128()),
+                         _mm_set1_epi16(128));
+}
+
+/* Adds a per-chroma term to the luma terms of the two pixels sharing the
+ * chroma, and scales the sum down to a clamped 8-bit range. */
+static inline __m128i _combine(__m128i y_lo, __m128i y_hi, __m128i c)
+{
+    const __m128i lo = _mm_srai_epi32(_mm_add_epi32(y_lo, _mm_unpacklo_epi32(c, c)), 8);
+    const __m128i hi = _mm_srai_epi32(_mm_add_epi32(y_hi, _mm_unpackhi_epi32(c, c)), 8);
+    /* packs keeps the value in 16 bits, and max/min implement clamp(). */
+    return _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(lo, hi), _mm_setzero_si128()),
+                         _mm_set1_epi16(255));
+}
+
+/* Converts 8 pixels.
+ * The luma term 298 * C + 128 is computed per pixel, while the chroma terms
+ * (409 * E, -100 * D - 208 * E, 516 * D) are computed once per chroma pair. */
+static inline void _YUVToRGBx8(const uint8_t* Y,
+                               __m128i chroma,
+                               const ChromaCoeffs& k,
+                               RGBx8* out)
+{
+    const __m128i C = _mm_sub_epi16(
+        _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(Y)),
+                          _mm_setzero_si128()),
+        _mm_set1_epi16(16));
+    const __m128i k298 = _mm_set1_epi16(298);
+    const __m128i prod_lo = _mm_mullo_epi16(C, k298);
+    const __m128i prod_hi = _mm_mulhi_epi16(C, k298);
+    const __m128i round = _mm_set1_epi32(128);
+    const __m128i y_lo = _mm_add_epi32(_mm_unpacklo_epi16(prod_lo, prod_hi), round);
+    const __m128i y_hi = _mm_add_epi32(_mm_unpackhi_epi16(prod_lo, prod_hi), round);
+
+    out->r = _combine(y_lo, y_hi, _mm_madd_epi16(chroma, k.r));
+    out->g = _combine(y_lo, y_hi, _mm_madd_epi16(chroma, k.g));
+    out->b = _combine(y_lo, y_hi, _mm_madd_epi16(chroma, k.b));
+}
+
+static void _YUV420SToRGB565Row_SSE2(const uint8_t* Y,
+                                     const uint8_t* U,
+                                     const uint8_t* V,
+                                     int dUV,
+                                     void* rgb_row,
+                                     int width)
+{
+    uint16_t* rgb = reinterpret_cast<uint16_t*>(rgb_row);
+    const uint8_t* UV = (U < V) ? U : V;
+    ChromaCoeffs k;
+    _initChromaCoeffs(dUV == 2 && V < U, &k);
+    int x = 0;
+    for (; x + 8 <= width; x += 8, Y += 8, U += 4 * dUV, V += 4 * dUV,
+                           UV += 4 * dUV, rgb += 8) {
+        RGBx8 px;
+        _YUVToRGBx8(Y, _loadChroma(U, V, UV, dUV), k, &px);
+        const __m128i r5 = _mm_srli_epi16(px.r, 3);
+        const __m128i g6 = _mm_slli_epi16(_mm_srli_epi16(px.g, 2), 5);
+        const __m128i b5 = _mm_slli_epi16(_mm_srli_epi16(px.b, 3), 11);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rgb),
+                         _mm_or_si128(_mm_or_si128(r5, g6), b5));
+    }
+    /* Tail. */
+    for (; x < width; x += 2, U += dUV, V += dUV) {
+        *rgb++ = YUVToRGB565(*Y++, *U, *V);
+        *rgb++ = YUVToRGB565(*Y++, *U, *V);
+    }
+}
+
+static void _YUV420SToRGB32Row_SSE2(const uint8_t* Y,
+                                    const uint8_t* U,
+                                    const uint8_t* V,
+                                    int dUV,
+                                    void* rgb_row,
+                                    int width)
+{
+    uint32_t* rgb = reinterpret_cast<uint32_t*>(rgb_row);
+    const uint8_t* UV = (U < V) ? U : V;
+    ChromaCoeffs k;
+    _initChromaCoeffs(dUV == 2 && V < U, &k);
+    int x = 0;
+    for (; x + 8 <= width; x += 8, Y += 8, U += 4 * dUV, V += 4 * dUV,
+                           UV += 4 * dUV, rgb += 8) {
+        RGBx8 px;
+        _YUVToRGBx8(Y, _loadChroma(U, V, UV, dUV), k, &px);
+        /* Values are already clamped, so packing can't saturate. */
+        const __m128i r8 = _mm_packus_epi16(px.r, px.r);
+        const __m128i g8 = _mm_packus_epi16(px.g, px.g);
+        const __m128i b8 = _mm_packus_epi16(px.b, px.b);
+        const __m128i rg = _mm_unpacklo_epi8(r8, g8);
+        const __m128i b0 = _mm_unpacklo_epi8(b8, _mm_setzero_si128());
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rgb),
+                         _mm_unpacklo_epi16(rg, b0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rgb + 4),
+                         _mm_unpackhi_epi16(rg, b0));
+    }
+    /* Tail. */
+    for (; x < width; x += 2, U += dUV, V += dUV) {
+        *rgb++ = YUVToRGB32(*Y++, *U, *V);
+        *rgb++ = YUVToRGB32(*Y++, *U, *V);
+    }
+}
+
+/* Checks if the CPU supports SSE2. SSE2 is part of the x86-64 baseline, so the
+ * check is only needed on 32-bit x86. */
+static bool _HaveSSE2()
+{
+#if defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return (edx & bit_SSE2) != 0;
+#else
+    return true;
+#endif
+}
+
+YUV420RowConverter GetYUV420SToRGB565Row_SSE2()
+{
+    return _HaveSSE2() ? _YUV420SToRGB565Row_SSE2 : NULL;
+}
+
+YUV420RowConverter GetYUV420SToRGB32Row_SSE2()
+{
+    return _HaveSSE2() ? _YUV420SToRGB32Row_SSE2 : NULL;
+}
+
+}; /* namespace android */
+
+#else   // __SSE2__
+
+namespace android {
+
+YUV420RowConverter GetYUV420SToRGB565Row_SSE2()
+{
+    return NULL;
+}
+
+YUV420RowConverter GetYUV420SToRGB32Row_SSE2()
+{
+    return NULL;
+}
+
+}; /* namespace android */
+
+#endif  // __SSE2__
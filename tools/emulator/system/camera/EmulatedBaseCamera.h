@@ -79,6 +79,12 @@ class EmulatedBaseCamera {
      */
     virtual status_t getCameraInfo(struct camera_info* info) = 0;
 
+    /* Gets zero-based ID assigned to this camera. */
+    inline int getCameraId() const
+    {
+        return mCameraID;
+    }
+
     /****************************************************************************
      * Data members
      ***************************************************************************/
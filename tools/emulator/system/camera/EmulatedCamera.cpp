@@ -26,10 +26,12 @@
 #define LOG_NDEBUG 0
 #define LOG_TAG "EmulatedCamera_Camera"
 #include <cutils/log.h>
+#include <unistd.h>
 #include <ui/Rect.h>
 #include "EmulatedCamera.h"
 //#include "EmulatedFakeCameraDevice.h"
 #include "Converters.h"
+#include "EmulatedCameraFactory.h"
 
 /* Defines whether we should trace parameter changes. */
 #define DEBUG_PARAM 1
@@ -200,6 +202,12 @@ status_t EmulatedCamera::connectCamera(hw_device_t** device)
         res = getCameraDevice()->connectDevice();
         if (res == NO_ERROR) {
             *device = &common;
+            camera_dev->getStageTracer().reset();
+            const String8 trace_path =
+                gEmulatedCameraFactory.getTraceFilePath(getCameraId());
+            if (!trace_path.isEmpty()) {
+                camera_dev->getStageTracer().startTraceFile(trace_path.string());
+            }
         }
     }
 
@@ -524,8 +532,24 @@ status_t EmulatedCamera::dumpCamera(int fd)
 {
     ALOGV("%s", __FUNCTION__);
 
-    /* TODO: Future enhancements. */
-    return -EINVAL;
+    EmulatedCameraDevice* const camera_dev = getCameraDevice();
+    if (camera_dev == NULL) {
+        return -EINVAL;
+    }
+
+    String8 result;
+    FramePacer::Stats stats;
+    camera_dev->getFrameStats(&stats);
+    result.appendFormat("  Emulated camera %d:\n", getCameraId());
+    result.appendFormat("    Frames: %u delivered at %.2f FPS, %u dropped,"
+                        " jitter %lld us mean, %lld us max\n",
+                        stats.frames, stats.fps, stats.dropped,
+                        (long long)(stats.meanJitter / 1000LL),
+                        (long long)(stats.maxJitter / 1000LL));
+    result.append("    Pipeline stages:\n");
+    camera_dev->getStageTracer().dump(result, "      ");
+    write(fd, result.string(), result.size());
+    return NO_ERROR;
 }
 
 /****************************************************************************
@@ -605,6 +629,9 @@ status_t EmulatedCamera::doStartPreview()
     }
     ALOGD("Starting camera: %dx%d -> %.4s(%s)",
          width, height, reinterpret_cast<const char*>(&org_fmt), pix_fmt);
+    /* Frames are delivered at the preview frame rate, which is also the rate
+     * video is recorded at. */
+    camera_dev->setFrameRate(mParameters.getPreviewFrameRate());
     res = camera_dev->startDevice(width, height, org_fmt);
     if (res != NO_ERROR) {
         mPreviewWindow.stopPreview();
@@ -674,6 +701,9 @@ status_t EmulatedCamera::cleanupCamera()
     }
 
     mCallbackNotifier.cleanupCBNotifier();
+    if (camera_dev != NULL) {
+        camera_dev->getStageTracer().stopTraceFile();
+    }
 
     return NO_ERROR;
 }
@@ -38,6 +38,8 @@ EmulatedCameraDevice::EmulatedCameraDevice(EmulatedCamera* camera_hal)
       mCurFrameTimestamp(0),
       mCameraHAL(camera_hal),
       mCurrentFrame(NULL),
+      mPreviewFormat(HAL_PIXEL_FORMAT_RGBA_8888),
+      mFrameRate(kDefaultFrameRate),
       mExposureCompensation(1.0f),
       mWhiteBalanceScale(NULL),
       mSupportedWhiteBalanceScale(),
@@ -91,7 +93,9 @@ status_t EmulatedCameraDevice::startDeliveringFrames(bool one_burst)
         return EINVAL;
     }
 
-    /* Frames will be delivered from the thread routine. */
+    /* Frames will be delivered from the thread routine. The first one is due
+     * right away. */
+    mFramePacer.start(mFrameRate, systemTime(SYSTEM_TIME_MONOTONIC));
     const status_t res = startWorkerThread(one_burst);
     ALOGE_IF(res != NO_ERROR, "%s: startWorkerThread failed", __FUNCTION__);
     return res;
@@ -108,6 +112,13 @@ status_t EmulatedCameraDevice::stopDeliveringFrames()
 
     const status_t res = stopWorkerThread();
     ALOGE_IF(res != NO_ERROR, "%s: startWorkerThread failed", __FUNCTION__);
+
+    FramePacer::Stats stats;
+    mFramePacer.getStats(&stats);
+    ALOGV("%s: %u frames at %.2f FPS (target %d), %u dropped, jitter %lld us"
+         " mean, %lld us max", __FUNCTION__, stats.frames, stats.fps,
+         mFrameRate, stats.dropped, (long long)(stats.meanJitter / 1000LL),
+         (long long)(stats.maxJitter / 1000LL));
     return res;
 }
 
@@ -155,7 +166,9 @@ void EmulatedCameraDevice::changeWhiteBalance(uint8_t& y,
     v = RGB2V(r, g, b);
 }
 
-status_t EmulatedCameraDevice::getCurrentPreviewFrame(void* buffer)
+status_t EmulatedCameraDevice::getCurrentPreviewFrame(void* buffer,
+                                                      int format,
+                                                      int stride)
 {
     if (!isStarted()) {
         ALOGE("%s: Device is not started", __FUNCTION__);
@@ -167,6 +180,35 @@ status_t EmulatedCameraDevice::getCurrentPreviewFrame(void* buffer)
     }
 
     /* In emulation the framebuffer is never RGB. */
+    const uint8_t* Y;
+    const uint8_t* U;
+    const uint8_t* V;
+    int dUV;
+    if (!getFramePlanes(&Y, &U, &V, &dUV)) {
+        ALOGE("%s: Unknown pixel format %.4s",
+             __FUNCTION__, reinterpret_cast<const char*>(&mPixelFormat));
+        return EINVAL;
+    }
+
+    switch (format) {
+        case HAL_PIXEL_FORMAT_YV12: {
+            /* Chroma rows are aligned to 16 bytes, like luma rows. */
+            const int uv_stride = ((stride / 2) + 15) & ~15;
+            YUV420ToYV12(Y, U, V, dUV, buffer, mFrameWidth, mFrameHeight,
+                         stride, uv_stride);
+            return NO_ERROR;
+        }
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+            YUV420ToNV21(Y, U, V, dUV, buffer, mFrameWidth, mFrameHeight,
+                         stride);
+            return NO_ERROR;
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+            break;
+        default:
+            ALOGE("%s: Unsupported preview format %d", __FUNCTION__, format);
+            return EINVAL;
+    }
+
     switch (mPixelFormat) {
         case V4L2_PIX_FMT_YVU420:
             YV12ToRGB32(mCurrentFrame, buffer, mFrameWidth, mFrameHeight);
@@ -188,6 +230,20 @@ status_t EmulatedCameraDevice::getCurrentPreviewFrame(void* buffer)
     }
 }
 
+int EmulatedCameraDevice::getNativePreviewFormat() const
+{
+    switch (mPixelFormat) {
+        case V4L2_PIX_FMT_YVU420:
+        case V4L2_PIX_FMT_YUV420:
+            return HAL_PIXEL_FORMAT_YV12;
+        case V4L2_PIX_FMT_NV21:
+        case V4L2_PIX_FMT_NV12:
+            return HAL_PIXEL_FORMAT_YCrCb_420_SP;
+        default:
+            return HAL_PIXEL_FORMAT_RGBA_8888;
+    }
+}
+
 /****************************************************************************
  * Emulated camera device private API
  ***************************************************************************/
@@ -240,6 +296,38 @@ void EmulatedCameraDevice::commonStopDevice()
     }
 }
 
+bool EmulatedCameraDevice::getFramePlanes(const uint8_t** Y,
+                                          const uint8_t** U,
+                                          const uint8_t** V,
+                                          int* dUV) const
+{
+    *Y = mCurrentFrame;
+    switch (mPixelFormat) {
+        case V4L2_PIX_FMT_YVU420:
+            *V = *Y + mTotalPixels;
+            *U = *V + mTotalPixels / 4;
+            *dUV = 1;
+            return true;
+        case V4L2_PIX_FMT_YUV420:
+            *U = *Y + mTotalPixels;
+            *V = *U + mTotalPixels / 4;
+            *dUV = 1;
+            return true;
+        case V4L2_PIX_FMT_NV21:
+            *V = *Y + mTotalPixels;
+            *U = *V + 1;
+            *dUV = 2;
+            return true;
+        case V4L2_PIX_FMT_NV12:
+            *U = *Y + mTotalPixels;
+            *V = *U + 1;
+            *dUV = 2;
+            return true;
+        default:
+            return false;
+    }
+}
+
 /****************************************************************************
  * Worker thread management.
  ***************************************************************************/
@@ -394,4 +482,24 @@ EmulatedCameraDevice::WorkerThread::Select(int fd, int timeout)
     }
 }
 
+EmulatedCameraDevice::WorkerThread::SelectRes
+EmulatedCameraDevice::WorkerThread::WaitUntil(nsecs_t deadline)
+{
+    /* Timeouts are relative, so they are recomputed from the deadline every
+     * time select returns early. */
+    for (;;) {
+        const nsecs_t left = deadline - systemTime(SYSTEM_TIME_MONOTONIC);
+        if (left <= 0) {
+            return TIMEOUT;
+        }
+        /* Round up, since a zero timeout means no timeout at all. */
+        const nsecs_t timeout = (left + 999LL) / 1000LL;
+        const SelectRes res =
+            Select(-1, timeout < 1000000LL ? (int)timeout : 1000000);
+        if (res != TIMEOUT) {
+            return res;
+        }
+    }
+}
+
 };  /* namespace android */
@@ -31,6 +31,8 @@
 #include <utils/String8.h>
 #include "EmulatedCameraCommon.h"
 #include "Converters.h"
+#include "FramePacer.h"
+#include "StageTracer.h"
 
 namespace android {
 
@@ -179,10 +181,58 @@ public:
      * onNextFrameAvailable callback.
      * Param:
      *  buffer - Buffer, large enough to contain the entire preview frame.
+     *  format - Pixel format of the buffer: HAL_PIXEL_FORMAT_RGBA_8888, or the
+     *      format returned from getNativePreviewFormat.
+     *  stride - Row stride of the buffer in pixels. YUV frames are laid out
+     *      with it (chroma rows of YV12 buffers are aligned as gralloc aligns
+     *      them), while RGBA frames are always tightly packed.
      * Return:
      *  NO_ERROR on success, or an appropriate error status.
      */
-    virtual status_t getCurrentPreviewFrame(void* buffer);
+    virtual status_t getCurrentPreviewFrame(void* buffer, int format, int stride);
+
+    /* Gets preview window pixel format that frames can be copied to without
+     * color conversion.
+     * This method must be called only on started instance of this class.
+     * Return:
+     *  HAL_PIXEL_FORMAT_YV12 for planar frames, HAL_PIXEL_FORMAT_YCrCb_420_SP
+     *  for semi-planar frames, or HAL_PIXEL_FORMAT_RGBA_8888 if frames have to
+     *  be converted to RGB.
+     */
+    int getNativePreviewFormat() const;
+
+    /* Sets pixel format of the preview window buffers that frames are
+     * delivered to. Devices that can obtain preview frames in more than one
+     * way use it to pick the cheapest one.
+     * Param:
+     *  format - HAL_PIXEL_FORMAT_XXX format of the preview window buffers.
+     */
+    inline void setPreviewFormat(int format)
+    {
+        mPreviewFormat = format;
+    }
+
+    /* Sets the rate frames are delivered at. This takes effect the next time
+     * startDeliveringFrames is called.
+     * Param:
+     *  fps - Frames per second.
+     */
+    inline void setFrameRate(int fps)
+    {
+        mFrameRate = fps;
+    }
+
+    /* Gets frame delivery statistics since frames started to be delivered. */
+    inline void getFrameStats(FramePacer::Stats* stats)
+    {
+        mFramePacer.getStats(stats);
+    }
+
+    /* Gets tracer the camera pipeline stages record their durations with. */
+    inline StageTracer& getStageTracer()
+    {
+        return mStageTracer;
+    }
 
     /* Gets width of the frame obtained from the physical device.
      * Return:
@@ -291,6 +341,19 @@ protected:
      */
     virtual void commonStopDevice();
 
+    /* Gets planes of the current framebuffer.
+     * Param:
+     *  Y, U, V - Upon success contain luma, and chroma planes.
+     *  dUV - Upon success contains distance between two U (or V) values: 1 for
+     *      planar, and 2 for semi-planar frames.
+     * Return:
+     *  true on success, or false if the pixel format isn't YUV 4:2:0.
+     */
+    bool getFramePlanes(const uint8_t** Y,
+                        const uint8_t** U,
+                        const uint8_t** V,
+                        int* dUV) const;
+
     /** Computes a luminance value after taking the exposure compensation.
      * value into account.
      *
@@ -432,6 +495,16 @@ protected:
              */
             SelectRes Select(int fd, int timeout);
 
+            /* Waits till an absolute deadline, keeping in mind thread exit
+             * message.
+             * Param:
+             *  deadline - SYSTEM_TIME_MONOTONIC time to wait till.
+             * Return:
+             *  TIMEOUT once the deadline has passed, or see SelectRes enum
+             *  comments.
+             */
+            SelectRes WaitUntil(nsecs_t deadline);
+
         /****************************************************************************
          * Private API
          ***************************************************************************/
@@ -515,6 +588,20 @@ protected:
     /* Total number of pixels */
     int                         mTotalPixels;
 
+    /* Pixel format of the preview window buffers (HAL_PIXEL_FORMAT_XXX). This
+     * is kept while the device is stopped, so it's known on the next start. */
+    int                         mPreviewFormat;
+
+    /* Rate frames are delivered at, in frames per second. */
+    int                         mFrameRate;
+    static const int            kDefaultFrameRate = 30;
+
+    /* Schedules frame delivery in the worker thread. */
+    FramePacer                  mFramePacer;
+
+    /* Records durations of the pipeline stages. */
+    StageTracer                 mStageTracer;
+
     /* Exposure compensation value */
     float                       mExposureCompensation;
 
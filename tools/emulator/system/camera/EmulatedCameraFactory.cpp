@@ -26,6 +26,7 @@
 #include "EmulatedQemuCamera.h"
 #include "EmulatedFakeCamera.h"
 #include "EmulatedFakeCamera2.h"
+#include "Converters.h"
 #include "EmulatedCameraFactory.h"
 
 extern camera_module_t HAL_MODULE_INFO_SYM;
@@ -159,6 +160,13 @@ EmulatedCameraFactory::EmulatedCameraFactory()
     ALOGV("%d cameras are being emulated. %d of them are fake cameras.",
           mEmulatedCameraNum, mFakeCameraNum);
 
+    const int converter_threads = getConverterThreadCount();
+    if (converter_threads > 0) {
+        res = setConverterThreads(converter_threads);
+        ALOGE_IF(res != NO_ERROR, "%s: Unable to start %d converter threads",
+                 __FUNCTION__, converter_threads);
+    }
+
     mConstructedOK = true;
 }
 
@@ -437,6 +445,53 @@ int EmulatedCameraFactory::getFrontCameraHalVersion()
     return 1;
 }
 
+int EmulatedCameraFactory::getConverterThreadCount()
+{
+    /* Defined by 'qemu.sf.camera_converter_threads' boot property: if the
+     * property doesn't exist, frames are converted on the camera device's
+     * worker thread only. */
+    char prop[PROPERTY_VALUE_MAX];
+    if (property_get("qemu.sf.camera_converter_threads", prop, NULL) > 0) {
+        char *prop_end = prop;
+        int val = strtol(prop, &prop_end, 10);
+        if (*prop_end == '\0' && val >= 0) {
+            return val;
+        }
+        // Badly formatted property, should just be a number
+        ALOGE("qemu.sf.camera_converter_threads is not a number: %s", prop);
+    }
+    return 0;
+}
+
+int EmulatedCameraFactory::getFakeSensorPipelineDepth()
+{
+    /* Defined by 'qemu.sf.camera_pipeline_depth' boot property. */
+    char prop[PROPERTY_VALUE_MAX];
+    if (property_get("qemu.sf.camera_pipeline_depth", prop, NULL) > 0) {
+        char *prop_end = prop;
+        int val = strtol(prop, &prop_end, 10);
+        if (*prop_end == '\0' && val > 0) {
+            return val;
+        }
+        // Badly formatted property, should just be a positive number
+        ALOGE("qemu.sf.camera_pipeline_depth is not a positive number: %s",
+             prop);
+    }
+    return 0;
+}
+
+String8 EmulatedCameraFactory::getTraceFilePath(int camera_id)
+{
+    /* Defined by 'qemu.sf.camera_trace' boot property, which names a directory
+     * the cameras write their trace files to. */
+    char prop[PROPERTY_VALUE_MAX];
+    String8 path;
+    if (property_get("qemu.sf.camera_trace", prop, NULL) > 0) {
+        path.appendFormat("%s/camera%d.trace", prop, camera_id);
+    }
+    return path;
+}
+
 /********************************************************************************
  * Initializer for the static member structure.
  *******************************************************************************/
@@ -17,6 +17,7 @@
 #ifndef HW_EMULATOR_CAMERA_EMULATED_CAMERA_FACTORY_H
 #define HW_EMULATOR_CAMERA_EMULATED_CAMERA_FACTORY_H
 
+#include <utils/String8.h>
 #include "EmulatedBaseCamera.h"
 #include "QemuClient.h"
 
@@ -119,6 +120,18 @@ public:
         return mConstructedOK;
     }
 
+    /* Gets number of worker threads to use for banded frame conversion, and
+     * drawing of fake frames. */
+    int getConverterThreadCount();
+
+    /* Gets the number of frames the fake camera2 sensor may have in readout at
+     * once, or 0 to use the sensor's default. */
+    int getFakeSensorPipelineDepth();
+
+    /* Gets path of the file a camera traces its pipeline stages to, or an empty
+     * string if stages are not traced to a file. */
+    String8 getTraceFilePath(int camera_id);
+
     /****************************************************************************
      * Private API
      ***************************************************************************/
@@ -28,6 +28,7 @@
 #include <ui/Rect.h>
 #include <ui/GraphicBufferMapper.h>
 #include "gralloc_cb.h"
+#include "GrallocMappingCache.h"
 
 namespace android {
 
@@ -35,11 +36,11 @@ const int64_t USEC = 1000LL;
 const int64_t MSEC = USEC * 1000LL;
 const int64_t SEC = MSEC * 1000LL;
 
-const uint32_t EmulatedFakeCamera2::kAvailableFormats[4] = {
+const uint32_t EmulatedFakeCamera2::kAvailableFormats[5] = {
         HAL_PIXEL_FORMAT_RAW_SENSOR,
         HAL_PIXEL_FORMAT_BLOB,
         HAL_PIXEL_FORMAT_RGBA_8888,
-        //        HAL_PIXEL_FORMAT_YV12,
+        HAL_PIXEL_FORMAT_YV12,
         HAL_PIXEL_FORMAT_YCrCb_420_SP
 };
 
@@ -52,13 +53,13 @@ const uint64_t EmulatedFakeCamera2::kAvailableRawMinDurations[1] = {
     Sensor::kFrameDurationRange[0]
 };
 
-const uint32_t EmulatedFakeCamera2::kAvailableProcessedSizesBack[4] = {
-    640, 480, 320, 240
+const uint32_t EmulatedFakeCamera2::kAvailableProcessedSizesBack[8] = {
+    640, 480, 352, 288, 320, 240, 176, 144
     //    Sensor::kResolution[0], Sensor::kResolution[1]
 };
 
-const uint32_t EmulatedFakeCamera2::kAvailableProcessedSizesFront[4] = {
-    320, 240, 160, 120
+const uint32_t EmulatedFakeCamera2::kAvailableProcessedSizesFront[6] = {
+    320, 240, 176, 144, 160, 120
     //    Sensor::kResolution[0], Sensor::kResolution[1]
 };
 
@@ -96,6 +97,9 @@ EmulatedFakeCamera2::~EmulatedFakeCamera2() {
     if (mCameraInfo != NULL) {
         free_camera_metadata(mCameraInfo);
     }
+    for (size_t i = 0; i < mStreams.size(); i++) {
+        delete mStreams.valueAt(i).mappings;
+    }
 }
 
 /****************************************************************************
@@ -143,12 +147,23 @@ status_t EmulatedFakeCamera2::connectCamera(hw_device_t** device) {
     mConfigureThread = new ConfigureThread(this);
     mReadoutThread = new ReadoutThread(this);
     mControlThread = new ControlThread(this);
-    mSensor = new Sensor(this);
+    mSensor = new Sensor(&mAuxBufferPool, &mStageTracer);
     mJpegCompressor = new JpegCompressor(this);
 
     mNextStreamId = 1;
     mNextReprocessStreamId = 1;
 
+    int pipelineDepth = gEmulatedCameraFactory.getFakeSensorPipelineDepth();
+    if (pipelineDepth > 0) {
+        mSensor->setPipelineDepth(pipelineDepth);
+    }
+
+    mStageTracer.reset();
+    String8 tracePath = gEmulatedCameraFactory.getTraceFilePath(getCameraId());
+    if (!tracePath.isEmpty()) {
+        mStageTracer.startTraceFile(tracePath.string());
+    }
+
     res = mSensor->startUp();
     if (res != NO_ERROR) return res;
 
@@ -188,6 +203,7 @@ status_t EmulatedFakeCamera2::closeCamera() {
     mConfigureThread->join();
     mReadoutThread->join();
     mControlThread->join();
+    mStageTracer.stopTraceFile();
 
     ALOGV("%s exit", __FUNCTION__);
     return NO_ERROR;
@@ -361,6 +377,7 @@ int EmulatedFakeCamera2::allocateStream(
     newStream.format = format;
     // TODO: Query stride from gralloc
     newStream.stride = width;
+    newStream.mappings = new GrallocMappingCache();
 
     mStreams.add(mNextStreamId, newStream);
 
@@ -415,6 +432,8 @@ int EmulatedFakeCamera2::registerStreamBuffers(
             __FUNCTION__, stream_id, finalFormat, stream.format);
 
     stream.format = finalFormat;
+    // Handles of a new buffer set may match ones of an old set
+    stream.mappings->reset();
 
     return NO_ERROR;
 }
@@ -446,6 +465,7 @@ int EmulatedFakeCamera2::releaseStream(uint32_t stream_id) {
             break;
     }
 
+    delete mStreams.valueAt(streamIndex).mappings;
     mStreams.removeItemsAt(streamIndex);
 
     return NO_ERROR;
@@ -556,6 +576,27 @@ typedef struct emulator_tag_info {
     uint8_t     tag_type;
 } emulator_tag_info_t;
 
+const uint32_t EmulatedFakeCamera2::kRequestTags[kRequestTagSlotCount] = {
+    ANDROID_REQUEST_TYPE,
+    ANDROID_REQUEST_OUTPUT_STREAMS,
+    ANDROID_REQUEST_INPUT_STREAMS,
+    ANDROID_REQUEST_FRAME_COUNT,
+    ANDROID_REQUEST_METADATA_MODE,
+    ANDROID_SENSOR_EXPOSURE_TIME,
+    ANDROID_SENSOR_FRAME_DURATION,
+    ANDROID_SENSOR_SENSITIVITY,
+    ANDROID_SENSOR_TIMESTAMP,
+    EMULATOR_SCENE_HOUROFDAY,
+    ANDROID_CONTROL_MODE,
+    ANDROID_CONTROL_EFFECT_MODE,
+    ANDROID_CONTROL_SCENE_MODE,
+    ANDROID_CONTROL_AF_MODE,
+    ANDROID_CONTROL_AE_MODE,
+    ANDROID_CONTROL_AE_LOCK,
+    ANDROID_CONTROL_AWB_MODE,
+    ANDROID_STATISTICS_FACE_DETECT_MODE
+};
+
 emulator_tag_info_t emulator_scene[EMULATOR_SCENE_END - EMULATOR_SCENE_START] = {
     { "hourOfDay", TYPE_INT32 }
 };
@@ -611,6 +652,9 @@ int EmulatedFakeCamera2::dump(int fd) {
             id, s.width, s.height, s.format, s.stride);
     }
 
+    result.appendFormat("      Pipeline stages:\n");
+    mStageTracer.dump(result, "        ");
+
     write(fd, result.string(), result.size());
 
     return NO_ERROR;
@@ -627,6 +671,8 @@ EmulatedFakeCamera2::ConfigureThread::ConfigureThread(EmulatedFakeCamera2 *paren
         Thread(false),
         mParent(parent),
         mRequestCount(0),
+        mRequestTags(kRequestTags, kRequestTagSlotCount),
+        mRequestStartTime(0),
         mNextBuffers(NULL) {
     mRunning = false;
 }
@@ -705,6 +751,7 @@ bool EmulatedFakeCamera2::ConfigureThread::threadLoop() {
         Mutex::Autolock il(mInternalsMutex);
 
         ALOGV("Configure: Getting next request");
+        mRequestStartTime = systemTime();
         res = mParent->mRequestQueueSrc->dequeue_request(
             mParent->mRequestQueueSrc,
             &mRequest);
@@ -725,8 +772,8 @@ bool EmulatedFakeCamera2::ConfigureThread::threadLoop() {
         }
 
         camera_metadata_entry_t type;
-        res = find_camera_metadata_entry(mRequest,
-                ANDROID_REQUEST_TYPE,
+        res = mRequestTags.find(mRequest,
+                kRequestType,
                 &type);
         if (res != NO_ERROR) {
             ALOGE("%s: error reading request type", __FUNCTION__);
@@ -788,8 +835,8 @@ bool EmulatedFakeCamera2::ConfigureThread::setupCapture() {
     mParent->mControlThread->processRequest(mRequest);
 
     camera_metadata_entry_t streams;
-    res = find_camera_metadata_entry(mRequest,
-            ANDROID_REQUEST_OUTPUT_STREAMS,
+    res = mRequestTags.find(mRequest,
+            kRequestOutputStreams,
             &streams);
     if (res != NO_ERROR) {
         ALOGE("%s: error reading output stream tag", __FUNCTION__);
@@ -825,8 +872,8 @@ bool EmulatedFakeCamera2::ConfigureThread::setupCapture() {
     }
 
     camera_metadata_entry_t e;
-    res = find_camera_metadata_entry(mRequest,
-            ANDROID_REQUEST_FRAME_COUNT,
+    res = mRequestTags.find(mRequest,
+            kRequestFrameCount,
             &e);
     if (res != NO_ERROR) {
         ALOGE("%s: error reading frame count tag: %s (%d)",
@@ -836,8 +883,8 @@ bool EmulatedFakeCamera2::ConfigureThread::setupCapture() {
     }
     mNextFrameNumber = *e.data.i32;
 
-    res = find_camera_metadata_entry(mRequest,
-            ANDROID_SENSOR_EXPOSURE_TIME,
+    res = mRequestTags.find(mRequest,
+            kSensorExposureTime,
             &e);
     if (res != NO_ERROR) {
         ALOGE("%s: error reading exposure time tag: %s (%d)",
@@ -847,8 +894,8 @@ bool EmulatedFakeCamera2::ConfigureThread::setupCapture() {
     }
     mNextExposureTime = *e.data.i64;
 
-    res = find_camera_metadata_entry(mRequest,
-            ANDROID_SENSOR_FRAME_DURATION,
+    res = mRequestTags.find(mRequest,
+            kSensorFrameDuration,
             &e);
     if (res != NO_ERROR) {
         ALOGE("%s: error reading frame duration tag", __FUNCTION__);
@@ -861,8 +908,8 @@ bool EmulatedFakeCamera2::ConfigureThread::setupCapture() {
             mNextExposureTime + Sensor::kMinVerticalBlank) {
         mNextFrameDuration = mNextExposureTime + Sensor::kMinVerticalBlank;
     }
-    res = find_camera_metadata_entry(mRequest,
-            ANDROID_SENSOR_SENSITIVITY,
+    res = mRequestTags.find(mRequest,
+            kSensorSensitivity,
             &e);
     if (res != NO_ERROR) {
         ALOGE("%s: error reading sensitivity tag", __FUNCTION__);
@@ -871,8 +918,8 @@ bool EmulatedFakeCamera2::ConfigureThread::setupCapture() {
     }
     mNextSensitivity = *e.data.i32;
 
-    res = find_camera_metadata_entry(mRequest,
-            EMULATOR_SCENE_HOUROFDAY,
+    res = mRequestTags.find(mRequest,
+            kSceneHourOfDay,
             &e);
     if (res == NO_ERROR) {
         ALOGV("Setting hour: %d", *e.data.i32);
@@ -901,6 +948,8 @@ bool EmulatedFakeCamera2::ConfigureThread::configureNextCapture() {
     ALOGV("Configure: Done configure for capture %d", mNextFrameNumber);
     mParent->mReadoutThread->setNextOperation(true, mRequest, mNextBuffers);
     mParent->mSensor->setDestinationBuffers(mNextBuffers);
+    mParent->mStageTracer.record(StageTracer::STAGE_CONFIGURE,
+            mRequestStartTime, systemTime(), mNextFrameNumber);
 
     mRequest = NULL;
     mNextBuffers = NULL;
@@ -911,15 +960,83 @@ bool EmulatedFakeCamera2::ConfigureThread::configureNextCapture() {
     return true;
 }
 
+// Planes of a YUV 4:2:0 buffer
+struct YUV420Planes {
+    uint8_t *y, *cb, *cr;
+    uint32_t yStride, chromaStride;
+    // Distance between two samples of a chroma plane
+    uint32_t chromaStep;
+};
+
+static bool isYUV420(int format) {
+    return format == HAL_PIXEL_FORMAT_YCrCb_420_SP ||
+            format == HAL_PIXEL_FORMAT_YV12;
+}
+
+// Finds the planes of a buffer, laid out the way the sensor writes them
+static void getYUV420Planes(const StreamBuffer &b, YUV420Planes *p) {
+    p->y = b.img;
+    if (b.format == HAL_PIXEL_FORMAT_YV12) {
+        p->yStride = (b.stride + 15) & ~15;
+        p->chromaStride = (p->yStride / 2 + 15) & ~15;
+        p->cr = b.img + p->yStride * b.height;
+        p->cb = p->cr + p->chromaStride * (b.height / 2);
+        p->chromaStep = 1;
+    } else {
+        p->yStride = b.stride;
+        p->chromaStride = b.stride;
+        p->cr = b.img + b.stride * b.height;
+        p->cb = p->cr + 1;
+        p->chromaStep = 2;
+    }
+}
+
+// Copies a YUV 4:2:0 image into a buffer of the same size, converting between
+// NV21 and YV12 if the formats differ
+static void copyYUV420(const StreamBuffer &src, const StreamBuffer &dst) {
+    YUV420Planes s, d;
+    getYUV420Planes(src, &s);
+    getYUV420Planes(dst, &d);
+
+    for (uint32_t y = 0; y < dst.height; y++) {
+        memcpy(d.y + y * d.yStride, s.y + y * s.yStride, dst.width);
+    }
+    const uint32_t chromaWidth = dst.width / 2;
+    for (uint32_t y = 0; y < dst.height / 2; y++) {
+        if (src.format == dst.format) {
+            // Both planes at once for NV21
+            memcpy(d.cr + y * d.chromaStride, s.cr + y * s.chromaStride,
+                    chromaWidth * d.chromaStep);
+            if (dst.format == HAL_PIXEL_FORMAT_YV12) {
+                memcpy(d.cb + y * d.chromaStride, s.cb + y * s.chromaStride,
+                        chromaWidth);
+            }
+            continue;
+        }
+        const uint8_t *sCb = s.cb + y * s.chromaStride;
+        const uint8_t *sCr = s.cr + y * s.chromaStride;
+        uint8_t *dCb = d.cb + y * d.chromaStride;
+        uint8_t *dCr = d.cr + y * d.chromaStride;
+        for (uint32_t x = 0; x < chromaWidth; x++) {
+            *dCb = *sCb;
+            *dCr = *sCr;
+            sCb += s.chromaStep;
+            sCr += s.chromaStep;
+            dCb += d.chromaStep;
+            dCr += d.chromaStep;
+        }
+    }
+}
+
 bool EmulatedFakeCamera2::ConfigureThread::setupReprocess() {
     status_t res;
 
-    mNextNeedsJpeg = true;
+    mNextNeedsJpeg = false;
     mNextIsCapture = false;
 
     camera_metadata_entry_t reprocessStreams;
-    res = find_camera_metadata_entry(mRequest,
-            ANDROID_REQUEST_INPUT_STREAMS,
+    res = mRequestTags.find(mRequest,
+            kRequestInputStreams,
             &reprocessStreams);
     if (res != NO_ERROR) {
         ALOGE("%s: error reading output stream tag", __FUNCTION__);
@@ -933,7 +1050,9 @@ bool EmulatedFakeCamera2::ConfigureThread::setupReprocess() {
     for (size_t i = 0; i < reprocessStreams.count; i++) {
         int streamId = reprocessStreams.data.u8[i];
         const ReprocessStream &s = mParent->getReprocessStreamInfo(streamId);
-        if (s.format != HAL_PIXEL_FORMAT_RGB_888) {
+        if (s.format != HAL_PIXEL_FORMAT_RGB_888 &&
+                s.format != HAL_PIXEL_FORMAT_YCrCb_420_SP &&
+                s.format != HAL_PIXEL_FORMAT_YV12) {
             ALOGE("%s: Only ZSL reprocessing supported!",
                     __FUNCTION__);
             mParent->signalError();
@@ -949,8 +1068,8 @@ bool EmulatedFakeCamera2::ConfigureThread::setupReprocess() {
     }
 
     camera_metadata_entry_t streams;
-    res = find_camera_metadata_entry(mRequest,
-            ANDROID_REQUEST_OUTPUT_STREAMS,
+    res = mRequestTags.find(mRequest,
+            kRequestOutputStreams,
             &streams);
     if (res != NO_ERROR) {
         ALOGE("%s: error reading output stream tag", __FUNCTION__);
@@ -958,14 +1077,22 @@ bool EmulatedFakeCamera2::ConfigureThread::setupReprocess() {
         return false;
     }
 
+    // JPEG outputs are compressed from the input as it is. YUV outputs are
+    // copied from a YUV input of the same size, converting the layout if
+    // needed.
     ALOGV("Configure: Setting up output buffers for reprocess");
     for (size_t i = 0; i < streams.count; i++) {
         int streamId = streams.data.u8[i];
         const Stream &s = mParent->getStreamInfo(streamId);
-        if (s.format != HAL_PIXEL_FORMAT_BLOB) {
-            // TODO: Support reprocess to YUV
-            ALOGE("%s: Non-JPEG output stream %d for reprocess not supported",
-                    __FUNCTION__, streamId);
+        if (s.format == HAL_PIXEL_FORMAT_BLOB) {
+            mNextNeedsJpeg = true;
+        } else if (!isYUV420(s.format) || reprocessStreams.count != 1 ||
+                !isYUV420((*mNextBuffers)[0].format) ||
+                s.width != (*mNextBuffers)[0].width ||
+                s.height != (*mNextBuffers)[0].height) {
+            ALOGE("%s: Output stream %d (%d x %d, format 0x%x) for reprocess "
+                    "not supported", __FUNCTION__, streamId, s.width, s.height,
+                    s.format);
             mParent->signalError();
             return false;
         }
@@ -982,8 +1109,8 @@ bool EmulatedFakeCamera2::ConfigureThread::setupReprocess() {
     }
 
     camera_metadata_entry_t e;
-    res = find_camera_metadata_entry(mRequest,
-            ANDROID_REQUEST_FRAME_COUNT,
+    res = mRequestTags.find(mRequest,
+            kRequestFrameCount,
             &e);
     if (res != NO_ERROR) {
         ALOGE("%s: error reading frame count tag: %s (%d)",
@@ -999,10 +1126,21 @@ bool EmulatedFakeCamera2::ConfigureThread::setupReprocess() {
 bool EmulatedFakeCamera2::ConfigureThread::configureNextReprocess() {
     Mutex::Autolock il(mInternalsMutex);
 
-    getBuffers();
+    if (getBuffers()) {
+        // Reprocessing to YUV is a copy, so it's done right away. There is
+        // a single input for YUV outputs, and it goes first.
+        for (size_t i = 1; i < mNextBuffers->size(); i++) {
+            const StreamBuffer &b = (*mNextBuffers)[i];
+            if (b.streamId > 0 && b.format != HAL_PIXEL_FORMAT_BLOB) {
+                copyYUV420((*mNextBuffers)[0], b);
+            }
+        }
+    }
 
     ALOGV("Configure: Done configure for reprocess %d", mNextFrameNumber);
     mParent->mReadoutThread->setNextOperation(false, mRequest, mNextBuffers);
+    mParent->mStageTracer.record(StageTracer::STAGE_CONFIGURE,
+            mRequestStartTime, systemTime(), mNextFrameNumber);
 
     mRequest = NULL;
     mNextBuffers = NULL;
@@ -1030,12 +1168,10 @@ bool EmulatedFakeCamera2::ConfigureThread::getBuffers() {
                 return false;
             }
 
-            /* Lock the buffer from the perspective of the graphics mapper */
-            const Rect rect(s.width, s.height);
-
-            res = GraphicBufferMapper::get().lock(*(b.buffer),
-                    GRALLOC_USAGE_HW_CAMERA_WRITE,
-                    rect, (void**)&(b.img) );
+            /* Lock the buffer from the perspective of the graphics mapper,
+             * unless it's still mapped from an earlier frame */
+            res = s.mappings->lock(b.buffer, GRALLOC_USAGE_HW_CAMERA_WRITE,
+                    s.width, s.height, (void**)&(b.img));
 
             if (res != NO_ERROR) {
                 ALOGE("%s: grbuffer_mapper.lock failure: %s (%d)",
@@ -1084,14 +1220,41 @@ EmulatedFakeCamera2::ReadoutThread::ReadoutThread(EmulatedFakeCamera2 *parent):
         mActive(false),
         mRequestCount(0),
         mRequest(NULL),
-        mBuffers(NULL) {
+        mBuffers(NULL),
+        mRequestTags(kRequestTags, kRequestTagSlotCount) {
     mInFlightQueue = new InFlightQueue[kInFlightQueueSize];
     mInFlightHead = 0;
     mInFlightTail = 0;
+
+    // Values are filled in for each frame
+    int64_t timestamp = 0;
+    int32_t hourOfDay = 0;
+    mResultTemplate = allocate_camera_metadata(2,
+            calculate_camera_metadata_entry_data_size(TYPE_INT64, 1) +
+            calculate_camera_metadata_entry_data_size(TYPE_INT32, 1));
+    if (mResultTemplate == NULL ||
+            add_camera_metadata_entry(mResultTemplate,
+                    ANDROID_SENSOR_TIMESTAMP, &timestamp, 1) != OK ||
+            add_camera_metadata_entry(mResultTemplate,
+                    EMULATOR_SCENE_HOUROFDAY, &hourOfDay, 1) != OK) {
+        ALOGE("%s: Unable to construct result metadata template",
+                __FUNCTION__);
+        if (mResultTemplate != NULL) {
+            free_camera_metadata(mResultTemplate);
+            mResultTemplate = NULL;
+        }
+        return;
+    }
+    // Entries can't move, since nothing is added to the template later
+    get_camera_metadata_entry(mResultTemplate, 0, &mResultTimestamp);
+    get_camera_metadata_entry(mResultTemplate, 1, &mResultHour);
 }
 
 EmulatedFakeCamera2::ReadoutThread::~ReadoutThread() {
-    delete mInFlightQueue;
+    delete[] mInFlightQueue;
+    if (mResultTemplate != NULL) {
+        free_camera_metadata(mResultTemplate);
+    }
 }
 
 status_t EmulatedFakeCamera2::ReadoutThread::readyToRun() {
@@ -1235,13 +1398,14 @@ bool EmulatedFakeCamera2::ReadoutThread::threadLoop() {
 
         if (!gotFrame) return true;
     }
+    nsecs_t readoutStartTime = systemTime();
 
     Mutex::Autolock iLock(mInternalsMutex);
 
     camera_metadata_entry_t entry;
     if (!mIsCapture) {
-        res = find_camera_metadata_entry(mRequest,
-                ANDROID_SENSOR_TIMESTAMP,
+        res = mRequestTags.find(mRequest,
+                kSensorTimestamp,
             &entry);
         if (res != NO_ERROR) {
             ALOGE("%s: error reading reprocessing timestamp: %s (%d)",
@@ -1252,8 +1416,8 @@ bool EmulatedFakeCamera2::ReadoutThread::threadLoop() {
         captureTime = entry.data.i64[0];
     }
 
-    res = find_camera_metadata_entry(mRequest,
-            ANDROID_REQUEST_FRAME_COUNT,
+    res = mRequestTags.find(mRequest,
+            kRequestFrameCount,
             &entry);
     if (res != NO_ERROR) {
         ALOGE("%s: error reading frame count tag: %s (%d)",
@@ -1263,8 +1427,8 @@ bool EmulatedFakeCamera2::ReadoutThread::threadLoop() {
     }
     frameNumber = *entry.data.i32;
 
-    res = find_camera_metadata_entry(mRequest,
-            ANDROID_REQUEST_METADATA_MODE,
+    res = mRequestTags.find(mRequest,
+            kRequestMetadataMode,
             &entry);
     if (res != NO_ERROR) {
         ALOGE("%s: error reading metadata mode tag: %s (%d)",
@@ -1282,12 +1446,37 @@ bool EmulatedFakeCamera2::ReadoutThread::threadLoop() {
 
         camera_metadata_t *frame = NULL;
 
+        // Capture results are the request, followed by the result template,
+        // and statistics if they are enabled.
+        uint8_t faceDetectMode = ANDROID_STATISTICS_FACE_DETECT_MODE_OFF;
+        bool requestHasHour = false;
+        if (mIsCapture) {
+            res = mRequestTags.find(mRequest,
+                    kStatisticsFaceDetectMode,
+                    &entry);
+            if (res == OK) {
+                faceDetectMode = entry.data.u8[0];
+            } else {
+                ALOGE("%s: Unable to find face detect mode!", __FUNCTION__);
+            }
+            requestHasHour = mRequestTags.find(mRequest,
+                    kSceneHourOfDay,
+                    &entry) == OK;
+        }
+
         size_t frame_entries = get_camera_metadata_entry_count(mRequest);
         size_t frame_data    = get_camera_metadata_data_count(mRequest);
-
-        // TODO: Dynamically calculate based on enabled statistics, etc
-        frame_entries += 10;
-        frame_data += 100;
+        if (mIsCapture) {
+            // Room for the template, or for the same entries added one by one
+            frame_entries += 2;
+            frame_data    +=
+                    calculate_camera_metadata_entry_data_size(TYPE_INT64, 1) +
+                    calculate_camera_metadata_entry_data_size(TYPE_INT32, 1);
+            if (faceDetectMode != ANDROID_STATISTICS_FACE_DETECT_MODE_OFF) {
+                frame_entries += kStatisticsEntryCount;
+                frame_data    += kStatisticsDataCount;
+            }
+        }
 
         res = mParent->mFrameQueueDst->dequeue_frame(mParent->mFrameQueueDst,
                 frame_entries, frame_data, &frame);
@@ -1304,30 +1493,42 @@ bool EmulatedFakeCamera2::ReadoutThread::threadLoop() {
         }
 
         if (mIsCapture) {
-            add_camera_metadata_entry(frame,
-                    ANDROID_SENSOR_TIMESTAMP,
-                    &captureTime,
-                    1);
-
             int32_t hourOfDay = (int32_t)mParent->mSensor->getScene().getHour();
-            camera_metadata_entry_t requestedHour;
-            res = find_camera_metadata_entry(frame,
-                    EMULATOR_SCENE_HOUROFDAY,
-                    &requestedHour);
-            if (res == NAME_NOT_FOUND) {
-                res = add_camera_metadata_entry(frame,
-                        EMULATOR_SCENE_HOUROFDAY,
-                        &hourOfDay, 1);
+            if (!requestHasHour && mResultTemplate != NULL) {
+                // Common case: fill in the template in place, and copy it over
+                *mResultTimestamp.data.i64 = captureTime;
+                *mResultHour.data.i32 = hourOfDay;
+                res = append_camera_metadata(frame, mResultTemplate);
                 if (res != NO_ERROR) {
-                    ALOGE("Unable to add vendor tag");
+                    ALOGE("Unable to append result metadata");
                 }
-            } else if (res == OK) {
-                *requestedHour.data.i32 = hourOfDay;
             } else {
-                ALOGE("%s: Error looking up vendor tag", __FUNCTION__);
+                // The request overrides the hour, so the frame already has
+                // the tag, and the template can't be appended as is.
+                add_camera_metadata_entry(frame,
+                        ANDROID_SENSOR_TIMESTAMP,
+                        &captureTime,
+                        1);
+
+                camera_metadata_entry_t requestedHour;
+                res = find_camera_metadata_entry(frame,
+                        EMULATOR_SCENE_HOUROFDAY,
+                        &requestedHour);
+                if (res == NAME_NOT_FOUND) {
+                    res = add_camera_metadata_entry(frame,
+                            EMULATOR_SCENE_HOUROFDAY,
+                            &hourOfDay, 1);
+                    if (res != NO_ERROR) {
+                        ALOGE("Unable to add vendor tag");
+                    }
+                } else if (res == OK) {
+                    *requestedHour.data.i32 = hourOfDay;
+                } else {
+                    ALOGE("%s: Error looking up vendor tag", __FUNCTION__);
+                }
             }
 
-            collectStatisticsMetadata(frame);
+            collectStatisticsMetadata(frame, faceDetectMode);
             // TODO: Collect all final values used from sensor in addition to timestamp
         }
 
@@ -1358,8 +1559,8 @@ bool EmulatedFakeCamera2::ReadoutThread::threadLoop() {
             } else {
                 ALOGV("Readout:    Sending image buffer %d (%p) to output stream %d",
                         i, (void*)*(b.buffer), b.streamId);
-                GraphicBufferMapper::get().unlock(*(b.buffer));
                 const Stream &s = mParent->getStreamInfo(b.streamId);
+                s.mappings->unlock(b.buffer);
                 res = s.ops->enqueue_buffer(s.ops, captureTime, b.buffer);
                 if (res != OK) {
                     ALOGE("Error enqueuing image buffer %p: %s (%d)", b.buffer,
@@ -1371,6 +1572,20 @@ bool EmulatedFakeCamera2::ReadoutThread::threadLoop() {
     }
 
     if (compressedBufferIndex == -1) {
+        // Without a JPEG to compress, reprocess inputs are done with
+        for (size_t i = 0; i < mBuffers->size(); i++) {
+            const StreamBuffer &b = (*mBuffers)[i];
+            if (b.streamId >= 0) continue;
+            GraphicBufferMapper::get().unlock(*(b.buffer));
+            const ReprocessStream &s =
+                    mParent->getReprocessStreamInfo(-b.streamId);
+            res = s.ops->release_buffer(s.ops, b.buffer);
+            if (res != OK) {
+                ALOGE("Error releasing reprocess buffer %p: %s (%d)",
+                        b.buffer, strerror(-res), res);
+                mParent->signalError();
+            }
+        }
         delete mBuffers;
         mBuffers = NULL;
     } else {
@@ -1381,6 +1596,15 @@ bool EmulatedFakeCamera2::ReadoutThread::threadLoop() {
         mBuffers = NULL;
     }
 
+    nsecs_t readoutEndTime = systemTime();
+    mParent->mStageTracer.record(StageTracer::STAGE_READOUT,
+            readoutStartTime, readoutEndTime, frameNumber);
+    if (mIsCapture) {
+        // Reprocess requests carry the capture time of the original frame
+        mParent->mStageTracer.record(StageTracer::STAGE_END_TO_END,
+                captureTime, readoutEndTime, frameNumber);
+    }
+
     Mutex::Autolock l(mInputMutex);
     mRequestCount--;
     ALOGV("Readout: Done with request %d", frameNumber);
@@ -1388,21 +1612,12 @@ bool EmulatedFakeCamera2::ReadoutThread::threadLoop() {
 }
 
 status_t EmulatedFakeCamera2::ReadoutThread::collectStatisticsMetadata(
-        camera_metadata_t *frame) {
+        camera_metadata_t *frame, uint8_t faceDetectMode) {
     // Completely fake face rectangles, don't correspond to real faces in scene
     ALOGV("Readout:    Collecting statistics metadata");
 
     status_t res;
-    camera_metadata_entry_t entry;
-    res = find_camera_metadata_entry(frame,
-                ANDROID_STATISTICS_FACE_DETECT_MODE,
-                &entry);
-    if (res != OK) {
-        ALOGE("%s: Unable to find face detect mode!", __FUNCTION__);
-        return BAD_VALUE;
-    }
-
-    if (entry.data.u8[0] == ANDROID_STATISTICS_FACE_DETECT_MODE_OFF) return OK;
+    if (faceDetectMode == ANDROID_STATISTICS_FACE_DETECT_MODE_OFF) return OK;
 
     // The coordinate system for the face regions is the raw sensor pixel
     // coordinates. Here, we map from the scene coordinates (0-19 in both axis)
@@ -1448,7 +1663,7 @@ status_t EmulatedFakeCamera2::ReadoutThread::collectStatisticsMetadata(
         return BAD_VALUE;
     }
 
-    if (entry.data.u8[0] == ANDROID_STATISTICS_FACE_DETECT_MODE_SIMPLE) return OK;
+    if (faceDetectMode == ANDROID_STATISTICS_FACE_DETECT_MODE_SIMPLE) return OK;
 
     // Advanced face detection options - add eye/mouth coordinates.  The
     // coordinates in order are (leftEyeX, leftEyeY, rightEyeX, rightEyeY,
@@ -1498,7 +1713,8 @@ status_t EmulatedFakeCamera2::ReadoutThread::collectStatisticsMetadata(
 
 EmulatedFakeCamera2::ControlThread::ControlThread(EmulatedFakeCamera2 *parent):
         Thread(false),
-        mParent(parent) {
+        mParent(parent),
+        mRequestTags(kRequestTags, kRequestTagSlotCount) {
     mRunning = false;
 }
 
@@ -1557,8 +1773,8 @@ status_t EmulatedFakeCamera2::ControlThread::processRequest(camera_metadata_t *r
 #define READ_IF_OK(res, what, def)                                             \
     (((res) == OK) ? (what) : (uint8_t)(def))
 
-    res = find_camera_metadata_entry(request,
-            ANDROID_CONTROL_MODE,
+    res = mRequestTags.find(request,
+            kControlMode,
             &mode);
     mControlMode = READ_IF_OK(res, mode.data.u8[0], ANDROID_CONTROL_MODE_OFF);
 
@@ -1577,20 +1793,20 @@ status_t EmulatedFakeCamera2::ControlThread::processRequest(camera_metadata_t *r
         return res;
     }
 
-    res = find_camera_metadata_entry(request,
-            ANDROID_CONTROL_EFFECT_MODE,
+    res = mRequestTags.find(request,
+            kControlEffectMode,
             &mode);
     mEffectMode = READ_IF_OK(res, mode.data.u8[0],
                              ANDROID_CONTROL_EFFECT_MODE_OFF);
 
-    res = find_camera_metadata_entry(request,
-            ANDROID_CONTROL_SCENE_MODE,
+    res = mRequestTags.find(request,
+            kControlSceneMode,
             &mode);
     mSceneMode = READ_IF_OK(res, mode.data.u8[0],
                              ANDROID_CONTROL_SCENE_MODE_UNSUPPORTED);
 
-    res = find_camera_metadata_entry(request,
-            ANDROID_CONTROL_AF_MODE,
+    res = mRequestTags.find(request,
+            kControlAfMode,
             &mode);
     if (mAfMode != mode.data.u8[0]) {
         ALOGV("AF new mode: %d, old mode %d", mode.data.u8[0], mAfMode);
@@ -1600,14 +1816,14 @@ status_t EmulatedFakeCamera2::ControlThread::processRequest(camera_metadata_t *r
         mCancelAf = false;
     }
 
-    res = find_camera_metadata_entry(request,
-            ANDROID_CONTROL_AE_MODE,
+    res = mRequestTags.find(request,
+            kControlAeMode,
             &mode);
     mAeMode = READ_IF_OK(res, mode.data.u8[0],
                              ANDROID_CONTROL_AE_MODE_OFF);
 
-    res = find_camera_metadata_entry(request,
-            ANDROID_CONTROL_AE_LOCK,
+    res = mRequestTags.find(request,
+            kControlAeLock,
             &mode);
     uint8_t aeLockVal = READ_IF_OK(res, mode.data.u8[0],
                                    ANDROID_CONTROL_AE_LOCK_ON);
@@ -1617,8 +1833,8 @@ status_t EmulatedFakeCamera2::ControlThread::processRequest(camera_metadata_t *r
     }
     mAeLock = aeLock;
 
-    res = find_camera_metadata_entry(request,
-            ANDROID_CONTROL_AWB_MODE,
+    res = mRequestTags.find(request,
+            kControlAwbMode,
             &mode);
     mAwbMode = READ_IF_OK(res, mode.data.u8[0],
                           ANDROID_CONTROL_AWB_MODE_OFF);
@@ -1627,8 +1843,8 @@ status_t EmulatedFakeCamera2::ControlThread::processRequest(camera_metadata_t *r
 
     if (mAeMode != ANDROID_CONTROL_AE_MODE_OFF) {
         camera_metadata_entry_t exposureTime;
-        res = find_camera_metadata_entry(request,
-                ANDROID_SENSOR_EXPOSURE_TIME,
+        res = mRequestTags.find(request,
+                kSensorExposureTime,
                 &exposureTime);
         if (res == OK) {
             exposureTime.data.i64[0] = mExposureTime;
@@ -1699,6 +1915,7 @@ bool EmulatedFakeCamera2::ControlThread::threadLoop() {
     bool    aeLock;
     int32_t precaptureTriggerId;
     nsecs_t nextSleep = kControlCycleDelay;
+    nsecs_t startTime = systemTime();
 
     {
         Mutex::Autolock lock(mInputMutex);
@@ -1754,6 +1971,8 @@ bool EmulatedFakeCamera2::ControlThread::threadLoop() {
     aeState = maybeStartAeScan(aeMode, aeLock, aeState);
     aeState = updateAeScan(aeMode, aeLock, aeState, &nextSleep);
     updateAeState(aeState, precaptureTriggerId);
+    mParent->mStageTracer.record(StageTracer::STAGE_CONTROL, startTime,
+            systemTime());
 
     int ret;
     timespec t;
@@ -27,6 +27,9 @@
 #include "fake-pipeline2/Base.h"
 #include "fake-pipeline2/Sensor.h"
 #include "fake-pipeline2/JpegCompressor.h"
+#include "fake-pipeline2/AuxBufferPool.h"
+#include "MetadataTagCache.h"
+#include "StageTracer.h"
 #include <utils/Condition.h>
 #include <utils/KeyedVector.h>
 #include <utils/String8.h>
@@ -142,6 +145,12 @@ public:
     // Notifies rest of camera subsystem of serious error
     void signalError();
 
+    // Auxiliary buffers passed from the sensor to the JPEG compressor
+    AuxBufferPool &getAuxBufferPool() { return mAuxBufferPool; }
+
+    // Durations of the pipeline stages
+    StageTracer &getStageTracer() { return mStageTracer; }
+
 private:
     /****************************************************************************
      * Utility methods
@@ -173,6 +182,36 @@ private:
      * currently-in-flight requests. Assumes mMutex is locked */
     bool isReprocessStreamInUse(uint32_t streamId);
 
+    /****************************************************************************
+     * Request metadata lookup
+     ***************************************************************************/
+
+    // Slots of the request tags that are read for every frame, in
+    // kRequestTags. Each pipeline thread finds them with its own
+    // MetadataTagCache.
+    enum RequestTagSlot {
+        kRequestType,
+        kRequestOutputStreams,
+        kRequestInputStreams,
+        kRequestFrameCount,
+        kRequestMetadataMode,
+        kSensorExposureTime,
+        kSensorFrameDuration,
+        kSensorSensitivity,
+        kSensorTimestamp,
+        kSceneHourOfDay,
+        kControlMode,
+        kControlEffectMode,
+        kControlSceneMode,
+        kControlAfMode,
+        kControlAeMode,
+        kControlAeLock,
+        kControlAwbMode,
+        kStatisticsFaceDetectMode,
+        kRequestTagSlotCount
+    };
+    static const uint32_t kRequestTags[kRequestTagSlotCount];
+
     /****************************************************************************
      * Pipeline controller threads
      ***************************************************************************/
@@ -211,11 +250,15 @@ private:
 
         camera_metadata_t *mRequest;
 
+        // Only used by the configure thread itself, so it needs no lock
+        MetadataTagCache mRequestTags;
+
         Mutex mInternalsMutex; // Lock before accessing below members.
         bool    mWaitingForReadout;
         bool    mNextNeedsJpeg;
         bool    mNextIsCapture;
         int32_t mNextFrameNumber;
+        nsecs_t mRequestStartTime; // When the request was dequeued
         int64_t mNextExposureTime;
         int64_t mNextFrameDuration;
         int32_t mNextSensitivity;
@@ -244,7 +287,8 @@ private:
         bool threadLoop();
 
         bool readyForNextCapture();
-        status_t collectStatisticsMetadata(camera_metadata_t *frame);
+        status_t collectStatisticsMetadata(camera_metadata_t *frame,
+                uint8_t faceDetectMode);
 
         // Inputs
         Mutex mInputMutex; // Protects mActive, mInFlightQueue, mRequestCount
@@ -253,7 +297,10 @@ private:
 
         bool mActive;
 
-        static const int kInFlightQueueSize = 4;
+        // Room for every request the sensor may be holding: one waiting to
+        // be captured, and up to the pipeline depth in readout. One slot is
+        // always left empty to tell a full queue from an empty one.
+        static const int kInFlightQueueSize = Sensor::kMaxPipelineDepth + 2;
         struct InFlightQueue {
             bool isCapture;
             camera_metadata_t *request;
@@ -272,6 +319,19 @@ private:
         camera_metadata_t *mRequest;
         Buffers *mBuffers;
 
+        MetadataTagCache mRequestTags;
+
+        // Result metadata added to every capture, allocated once. Its entries
+        // are updated in place through the resolved entries below, and the
+        // whole template is appended to each frame.
+        camera_metadata_t *mResultTemplate;
+        camera_metadata_entry_t mResultTimestamp;
+        camera_metadata_entry_t mResultHour;
+
+        // Upper bounds on the face statistics added to a frame
+        static const size_t kStatisticsEntryCount = 4;
+        static const size_t kStatisticsDataCount = 100;
+
     };
 
     // 3A management thread (auto-exposure, focus, white balance)
@@ -319,6 +379,8 @@ private:
         Mutex mInputMutex; // Protects input methods
         Condition mInputSignal;
 
+        MetadataTagCache mRequestTags;
+
         // Trigger notifications
         bool mStartAf;
         bool mCancelAf;
@@ -412,6 +474,9 @@ private:
     /** Simulated hardware interfaces */
     sp<Sensor> mSensor;
     sp<JpegCompressor> mJpegCompressor;
+    AuxBufferPool mAuxBufferPool;
+
+    StageTracer mStageTracer;
 
     /** Pipeline control threads */
     sp<ConfigureThread> mConfigureThread;
@@ -22,11 +22,27 @@
 #define LOG_NDEBUG 0
 #define LOG_TAG "EmulatedCamera_FakeDevice"
 #include <cutils/log.h>
+#include "EmulatedCameraFactory.h"
 #include "EmulatedFakeCamera.h"
 #include "EmulatedFakeCameraDevice.h"
 
 namespace android {
 
+/* Frames with fewer pixels than this are always drawn on the worker thread. */
+static const int _MinBandedPixels = 640 * 480;
+
+/* Fills 'count' chroma values that are 'step' bytes apart. */
+static void _fillChroma(uint8_t* dst, int step, int count, uint8_t value)
+{
+    if (step == 1) {
+        memset(dst, value, count);
+    } else {
+        for (int n = 0; n < count; n++, dst += step) {
+            *dst = value;
+        }
+    }
+}
+
 EmulatedFakeCameraDevice::EmulatedFakeCameraDevice(EmulatedFakeCamera* camera_hal)
     : EmulatedCameraDevice(camera_hal),
       mBlackYUV(kBlack32),
@@ -37,7 +53,9 @@ EmulatedFakeCameraDevice::EmulatedFakeCameraDevice(EmulatedFakeCamera* camera_ha
       mLastRedrawn(0),
       mCheckX(0),
       mCheckY(0),
-      mCcounter(0)
+      mCcounter(0),
+      mCheckSize(0),
+      mExposureTableComp(0.0f)
 #if EFCD_ROTATE_FRAME
       , mLastRotatedAt(0),
         mCurrentFrameType(0),
@@ -51,6 +69,8 @@ EmulatedFakeCameraDevice::EmulatedFakeCameraDevice(EmulatedFakeCamera* camera_ha
     mRedYUV.Y = mRedYUV.Y / 2;
     mGreenYUV.Y = mGreenYUV.Y / 2;
     mBlueYUV.Y = mBlueYUV.Y / 2;
+
+    mRowTemplates[0] = mRowTemplates[1] = NULL;
 }
 
 EmulatedFakeCameraDevice::~EmulatedFakeCameraDevice()
@@ -125,7 +145,7 @@ status_t EmulatedFakeCameraDevice::startDevice(int width,
         switch (mPixelFormat) {
             case V4L2_PIX_FMT_YVU420:
                 mFrameV = mCurrentFrame + mTotalPixels;
-                mFrameU = mFrameU + mTotalPixels / 4;
+                mFrameU = mFrameV + mTotalPixels / 4;
                 mUVStep = 1;
                 mUVTotalNum = mTotalPixels / 4;
                 break;
@@ -160,6 +180,18 @@ status_t EmulatedFakeCameraDevice::startDevice(int width,
         }
         /* Number of items in a single row inside U/V panes. */
         mUVInRow = (width / 2) * mUVStep;
+
+        /* Each row template holds a Y row, and a chroma row: either U and V
+         * rows of width / 2, or an interleaved row of width. */
+        mRowTemplates[0] = new uint8_t[width * 4];
+        mRowTemplates[1] = mRowTemplates[0] + width * 2;
+        mCheckSize = 0;
+
+        const int draw_threads = (mTotalPixels >= _MinBandedPixels) ?
+            gEmulatedCameraFactory.getConverterThreadCount() : 0;
+        if (draw_threads > 0 && mDrawPool.setThreadCount(draw_threads) != NO_ERROR) {
+            ALOGW("%s: Unable to start %d draw threads", __FUNCTION__, draw_threads);
+        }
         mState = ECDS_STARTED;
     } else {
         ALOGE("%s: commonStartDevice failed", __FUNCTION__);
@@ -179,6 +211,9 @@ status_t EmulatedFakeCameraDevice::stopDevice()
     }
 
     mFrameU = mFrameV = NULL;
+    delete[] mRowTemplates[0];
+    mRowTemplates[0] = mRowTemplates[1] = NULL;
+    mDrawPool.setThreadCount(0);
     EmulatedCameraDevice::commonStopDevice();
     mState = ECDS_CONNECTED;
 
@@ -191,13 +226,15 @@ status_t EmulatedFakeCameraDevice::stopDevice()
 
 bool EmulatedFakeCameraDevice::inWorkerThread()
 {
-    /* Wait till FPS timeout expires, or thread exit message is received. */
-    WorkerThread::SelectRes res =
-        getWorkerThread()->Select(-1, 1000000 / mEmulatedFPS);
+    /* Wait till the next frame is due, or thread exit message is received. */
+    const nsecs_t deadline = mFramePacer.getNextDeadline();
+    WorkerThread::SelectRes res = getWorkerThread()->WaitUntil(deadline);
     if (res == WorkerThread::EXIT_THREAD) {
         ALOGV("%s: Worker thread has been terminated.", __FUNCTION__);
         return false;
     }
+    const nsecs_t wakeup = systemTime(SYSTEM_TIME_MONOTONIC);
+    mStageTracer.record(StageTracer::STAGE_WAKEUP, deadline, wakeup);
 
     /* Lets see if we need to generate a new frame. */
     if ((systemTime(SYSTEM_TIME_MONOTONIC) - mLastRedrawn) >= mRedrawAfter) {
@@ -229,7 +266,9 @@ bool EmulatedFakeCameraDevice::inWorkerThread()
 
     /* Timestamp the current frame, and notify the camera HAL about new frame. */
     mCurFrameTimestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+    mStageTracer.record(StageTracer::STAGE_CAPTURE, wakeup, mCurFrameTimestamp);
     mCameraHAL->onNextFrameAvailable(mCurrentFrame, mCurFrameTimestamp, this);
+    mFramePacer.onFrame(mCurFrameTimestamp);
 
     return true;
 }
@@ -241,54 +280,18 @@ bool EmulatedFakeCameraDevice::inWorkerThread()
 void EmulatedFakeCameraDevice::drawCheckerboard()
 {
     const int size = mFrameWidth / 10;
-    bool black = true;
-
-    if((mCheckX / size) & 1)
-        black = false;
-    if((mCheckY / size) & 1)
-        black = !black;
-
-    int county = mCheckY % size;
-    int checkxremainder = mCheckX % size;
-    uint8_t* Y = mCurrentFrame;
-    uint8_t* U_pos = mFrameU;
-    uint8_t* V_pos = mFrameV;
-    uint8_t* U = U_pos;
-    uint8_t* V = V_pos;
-
-    YUVPixel adjustedWhite = YUVPixel(mWhiteYUV);
-    changeWhiteBalance(adjustedWhite.Y, adjustedWhite.U, adjustedWhite.V);
-
-    for(int y = 0; y < mFrameHeight; y++) {
-        int countx = checkxremainder;
-        bool current = black;
-        for(int x = 0; x < mFrameWidth; x += 2) {
-            if (current) {
-                mBlackYUV.get(Y, U, V);
-            } else {
-                adjustedWhite.get(Y, U, V);
-            }
-            *Y = changeExposure(*Y);
-            Y[1] = *Y;
-            Y += 2; U += mUVStep; V += mUVStep;
-            countx += 2;
-            if(countx >= size) {
-                countx = 0;
-                current = !current;
-            }
-        }
-        if (y & 0x1) {
-            U_pos = U;
-            V_pos = V;
-        } else {
-            U = U_pos;
-            V = V_pos;
-        }
-        if(county++ >= size) {
-            county = 0;
-            black = !black;
-        }
-    }
+
+    /* All checks of the frame share two colors, so white balance and exposure
+     * are applied once per frame rather than once per pixel. */
+    const YUVPixel black = adjustColor(mBlackYUV, false);
+    const YUVPixel white = adjustColor(mWhiteYUV, true);
+
+    /* Every row of the checker board is one of two rows, shifted by mCheckX.
+     * Render both once, and copy them into the frame. */
+    renderRowTemplates(size, black, white);
+    mCheckSize = size;
+    mDrawPool.runBands(drawCheckerboardBand, this, mFrameHeight, 2);
+
     mCheckX += 3;
     mCheckY++;
 
@@ -310,24 +313,108 @@ void EmulatedFakeCameraDevice::drawSquare(int x,
 {
     const int square_xstop = min(mFrameWidth, x + size);
     const int square_ystop = min(mFrameHeight, y + size);
-    uint8_t* Y_pos = mCurrentFrame + y * mFrameWidth + x;
+    if (x >= square_xstop) {
+        return;
+    }
+    const YUVPixel adjustedColor = adjustColor(*color, true);
 
-    YUVPixel adjustedColor = *color;
-    changeWhiteBalance(adjustedColor.Y, adjustedColor.U, adjustedColor.V);
+    /* Chroma covers the columns of the even pixels in the square. */
+    const int uv_first = (x + 1) / 2;
+    const int uv_count = min(mFrameWidth / 2, (square_xstop + 1) / 2) - uv_first;
+    uint8_t* Y_pos = mCurrentFrame + y * mFrameWidth;
 
     // Draw the square.
-    for (; y < square_ystop; y++) {
-        const int iUV = (y / 2) * mUVInRow + (x / 2) * mUVStep;
-        uint8_t* sqU = mFrameU + iUV;
-        uint8_t* sqV = mFrameV + iUV;
-        uint8_t* sqY = Y_pos;
-        for (int i = x; i < square_xstop; i += 2) {
-            adjustedColor.get(sqY, sqU, sqV);
-            *sqY = changeExposure(*sqY);
-            sqY[1] = *sqY;
-            sqY += 2; sqU += mUVStep; sqV += mUVStep;
+    for (int row = y; row < square_ystop; row++, Y_pos += mFrameWidth) {
+        memset(Y_pos + x, adjustedColor.Y, square_xstop - x);
+        if ((row & 1) == 0 && uv_count > 0) {
+            const int iUV = (row / 2) * mUVInRow + uv_first * mUVStep;
+            _fillChroma(mFrameU + iUV, mUVStep, uv_count, adjustedColor.U);
+            _fillChroma(mFrameV + iUV, mUVStep, uv_count, adjustedColor.V);
+        }
+    }
+}
+
+YUVPixel EmulatedFakeCameraDevice::adjustColor(const YUVPixel& color, bool balance)
+{
+    if (mExposureTableComp != mExposureCompensation) {
+        for (int n = 0; n < 256; n++) {
+            mExposureTable[n] = changeExposure(n);
+        }
+        mExposureTableComp = mExposureCompensation;
+    }
+
+    YUVPixel adjusted = color;
+    if (balance) {
+        changeWhiteBalance(adjusted.Y, adjusted.U, adjusted.V);
+    }
+    adjusted.Y = mExposureTable[adjusted.Y];
+    return adjusted;
+}
+
+void EmulatedFakeCameraDevice::renderRowTemplates(int size,
+                                                  const YUVPixel& black,
+                                                  const YUVPixel& white)
+{
+    const bool planar = mUVStep == 1;
+    for (int t = 0; t < 2; t++) {
+        uint8_t* Y = mRowTemplates[t];
+        uint8_t* chroma = Y + mFrameWidth;
+        /* Position of U, and V values in the chroma row template matches their
+         * position in the framebuffer. */
+        uint8_t* U = chroma;
+        uint8_t* V = chroma;
+        if (planar) {
+            V += mFrameWidth / 2;
+        } else if (mFrameU > mFrameV) {
+            U++;
+        } else {
+            V++;
+        }
+
+        /* Walk the checks, filling a span of each. */
+        const int uv_cols = mFrameWidth / 2;
+        bool is_black = (((mCheckX / size) & 1) == 0) == (t == 0);
+        int x = 0;
+        int run = size - mCheckX % size;
+        while (x < mFrameWidth) {
+            const int end = min(mFrameWidth, x + run);
+            const YUVPixel& c = is_black ? black : white;
+            memset(Y + x, c.Y, end - x);
+            const int uv_first = (x + 1) / 2;
+            const int uv_count = min(uv_cols, (end + 1) / 2) - uv_first;
+            if (uv_count > 0) {
+                _fillChroma(U + uv_first * mUVStep, mUVStep, uv_count, c.U);
+                _fillChroma(V + uv_first * mUVStep, mUVStep, uv_count, c.V);
+            }
+            x = end;
+            run = size;
+            is_black = !is_black;
+        }
+    }
+}
+
+void EmulatedFakeCameraDevice::drawCheckerboardBand(void* opaque, int start, int end)
+{
+    EmulatedFakeCameraDevice* dev =
+        reinterpret_cast<EmulatedFakeCameraDevice*>(opaque);
+    const int width = dev->mFrameWidth;
+    const int size = dev->mCheckSize;
+    const bool planar = dev->mUVStep == 1;
+    uint8_t* const chroma_base = planar ? NULL : min(dev->mFrameU, dev->mFrameV);
+
+    uint8_t* Y = dev->mCurrentFrame + start * width;
+    for (int y = start; y < end; y++, Y += width) {
+        const uint8_t* row = dev->mRowTemplates[((y + dev->mCheckY) / size) & 1];
+        memcpy(Y, row, width);
+        if ((y & 1) == 0) {
+            const int uv_off = (y / 2) * dev->mUVInRow;
+            if (planar) {
+                memcpy(dev->mFrameU + uv_off, row + width, width / 2);
+                memcpy(dev->mFrameV + uv_off, row + width + width / 2, width / 2);
+            } else {
+                memcpy(chroma_base + uv_off, row + width, width);
+            }
         }
-        Y_pos += mFrameWidth;
     }
 }
 
@@ -24,6 +24,7 @@
 
 #include "Converters.h"
 #include "EmulatedCameraDevice.h"
+#include "WorkerPool.h"
 
 /* This is used for debugging format / conversion issues. If EFCD_ROTATE_FRAME is
  * set to 0, the frame content will be always the "checkerboard". Otherwise, if
@@ -88,8 +89,8 @@ public:
 
 protected:
     /* Implementation of the worker thread routine.
-     * This method simply sleeps for a period of time defined by the FPS property
-     * of the fake camera (simulating frame frequency), and then calls emulated
+     * This method simply sleeps till the next frame is due at the frame rate
+     * set for the device (simulating frame frequency), and then calls emulated
      * camera's onNextFrameAvailable method.
      */
     bool inWorkerThread();
@@ -111,6 +112,27 @@ private:
      */
     void drawSquare(int x, int y, int size, const YUVPixel* color);
 
+    /* Applies current white balance, and exposure compensation to a color.
+     * Param:
+     *  color - Color to adjust.
+     *  balance - Whether or not white balance applies to the color.
+     * Return:
+     *  Adjusted color.
+     */
+    YUVPixel adjustColor(const YUVPixel& color, bool balance);
+
+    /* Renders the two rows the checker board is made of (one starting with a
+     * black check, and one starting with a white check) into mRowTemplates.
+     * Param:
+     *  size - Size of a check.
+     *  black, white - Adjusted colors of the checks.
+     */
+    void renderRowTemplates(int size, const YUVPixel& black, const YUVPixel& white);
+
+    /* WorkerPool routine that copies row templates into rows [start, end) of
+     * the frame. */
+    static void drawCheckerboardBand(void* opaque, int start, int end);
+
 #if EFCD_ROTATE_FRAME
     void drawSolid(YUVPixel* color);
     void drawStripes();
@@ -164,9 +186,22 @@ private:
     int         mCheckY;
     int         mCcounter;
 
-    /* Emulated FPS (frames per second).
-     * We will emulate 50 FPS. */
-    static const int        mEmulatedFPS = 50;
+    /* Size of a check in the current frame. */
+    int         mCheckSize;
+
+    /* Two rows the checker board is made of, rendered once per frame. Each
+     * template consists of mFrameWidth Y values, followed by a chroma row laid
+     * out as in the framebuffer: U, and V rows for planar formats, or a single
+     * interleaved row for NV12 / NV21. */
+    uint8_t*    mRowTemplates[2];
+
+    /* Lookup table for exposure compensation of Y values, and compensation
+     * it has been built for. */
+    uint8_t     mExposureTable[256];
+    float       mExposureTableComp;
+
+    /* Pool used to draw large frames in bands. */
+    WorkerPool  mDrawPool;
 
     /* Defines time (in nanoseconds) between redrawing the checker board.
      * We will redraw the checker board every 15 milliseconds. */
@@ -30,15 +30,19 @@ namespace android {
 EmulatedQemuCameraDevice::EmulatedQemuCameraDevice(EmulatedQemuCamera* camera_hal)
     : EmulatedCameraDevice(camera_hal),
       mQemuClient(),
-      mPreviewFrame(NULL)
+      mNextSlot(0),
+      mPreviewFrame(NULL),
+      mPreviewFrameSize(0),
+      mHoldingSharedFrame(false),
+      mStreamWhiteBalance(NULL),
+      mStreamExposure(0.0f)
 {
+    memset(mFrameRing, 0, sizeof(mFrameRing));
 }
 
 EmulatedQemuCameraDevice::~EmulatedQemuCameraDevice()
 {
-    if (mPreviewFrame != NULL) {
-        delete[] mPreviewFrame;
-    }
+    freeFrameRing();
 }
 
 /****************************************************************************
@@ -155,14 +159,12 @@ status_t EmulatedQemuCameraDevice::startDevice(int width,
         return res;
     }
 
-    /* Allocate preview frame buffer. */
-    /* TODO: Watch out for preview format changes! At this point we implement
-     * RGB32 only.*/
-    mPreviewFrame = new uint32_t[mTotalPixels];
-    if (mPreviewFrame == NULL) {
-        ALOGE("%s: Unable to allocate %d bytes for preview frame",
-             __FUNCTION__, mTotalPixels);
-        return ENOMEM;
+    /* Allocate frame ring. */
+    res = allocateFrameRing();
+    if (res != NO_ERROR) {
+        freeFrameRing();
+        EmulatedCameraDevice::commonStopDevice();
+        return res;
     }
 
     /* Start the actual camera device. */
@@ -173,10 +175,40 @@ status_t EmulatedQemuCameraDevice::startDevice(int width,
              reinterpret_cast<const char*>(&mPixelFormat),
              mFrameWidth, mFrameHeight);
         mState = ECDS_STARTED;
+
+        /* Let the service push frames, if it can, preferably into a frame
+         * ring shared with us, so only notifications go through the pipe.
+         * Otherwise frames will be queried one by one. */
+        mHoldingSharedFrame = false;
+        const status_t stream_res =
+            mQemuClient.queryStream(mFrameRate, mStreamDepth,
+                                    mFrameBufferSize, mPreviewFrameSize,
+                                    mWhiteBalanceScale[0],
+                                    mWhiteBalanceScale[1],
+                                    mWhiteBalanceScale[2],
+                                    mExposureCompensation, true);
+        if (stream_res == NO_ERROR) {
+            mStreamWhiteBalance = mWhiteBalanceScale;
+            mStreamExposure = mExposureCompensation;
+            ALOGV("%s: Qemu camera device '%s' is streaming%s",
+                 __FUNCTION__, (const char*)mDeviceName,
+                 mQemuClient.isSharedMemory() ? " through shared memory" : "");
+        } else if (!mQemuClient.isStarted()) {
+            /* The camera couldn't be restarted after a failed attempt to
+             * share the frame ring. */
+            ALOGE("%s: Unable to restart device '%s'",
+                 __FUNCTION__, (const char*)mDeviceName);
+            freeFrameRing();
+            EmulatedCameraDevice::commonStopDevice();
+            mState = ECDS_CONNECTED;
+            res = stream_res;
+        }
     } else {
         ALOGE("%s: Unable to start device '%s' for %.4s[%dx%d] frames",
              __FUNCTION__, (const char*)mDeviceName,
              reinterpret_cast<const char*>(&pix_fmt), width, height);
+        freeFrameRing();
+        EmulatedCameraDevice::commonStopDevice();
     }
 
     return res;
@@ -196,10 +228,7 @@ status_t EmulatedQemuCameraDevice::stopDevice()
     /* Stop the actual camera device. */
     status_t res = mQemuClient.queryStop();
     if (res == NO_ERROR) {
-        if (mPreviewFrame == NULL) {
-            delete[] mPreviewFrame;
-            mPreviewFrame = NULL;
-        }
+        freeFrameRing();
         EmulatedCameraDevice::commonStopDevice();
         mState = ECDS_CONNECTED;
         ALOGV("%s: Qemu camera device '%s' is stopped",
@@ -216,14 +245,16 @@ status_t EmulatedQemuCameraDevice::stopDevice()
  * EmulatedCameraDevice virtual overrides
  ***************************************************************************/
 
-status_t EmulatedQemuCameraDevice::getCurrentPreviewFrame(void* buffer)
+status_t EmulatedQemuCameraDevice::getCurrentPreviewFrame(void* buffer,
+                                                          int format,
+                                                          int stride)
 {
-    ALOGW_IF(mPreviewFrame == NULL, "%s: No preview frame", __FUNCTION__);
-    if (mPreviewFrame != NULL) {
+    if (format == HAL_PIXEL_FORMAT_RGBA_8888 && mPreviewFrame != NULL) {
         memcpy(buffer, mPreviewFrame, mTotalPixels * 4);
         return 0;
     } else {
-        return EmulatedCameraDevice::getCurrentPreviewFrame(buffer);
+        return EmulatedCameraDevice::getCurrentPreviewFrame(buffer, format,
+                                                             stride);
     }
 }
 
@@ -233,26 +264,82 @@ status_t EmulatedQemuCameraDevice::getCurrentPreviewFrame(void* buffer)
 
 bool EmulatedQemuCameraDevice::inWorkerThread()
 {
-    /* Wait till FPS timeout expires, or thread exit message is received. */
-    WorkerThread::SelectRes res =
-        getWorkerThread()->Select(-1, 1000000 / mEmulatedFPS);
+    /* In the streaming mode the service paces frames, so we wait for the next
+     * frame to arrive. Otherwise we wait till the next frame is due. In both
+     * cases the wait ends if thread exit message is received. */
+    const bool streaming = mQemuClient.isStreaming();
+    const nsecs_t deadline = mFramePacer.getNextDeadline();
+    WorkerThread::SelectRes res = streaming ?
+        getWorkerThread()->Select(mQemuClient.getPipeFD(), 0) :
+        getWorkerThread()->WaitUntil(deadline);
     if (res == WorkerThread::EXIT_THREAD) {
         ALOGV("%s: Worker thread has been terminated.", __FUNCTION__);
         return false;
     }
+    const nsecs_t wakeup = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (!streaming) {
+        /* In the streaming mode wake up time is up to the service. */
+        mStageTracer.record(StageTracer::STAGE_WAKEUP, deadline, wakeup);
+    }
 
-    /* Query frames from the service. */
-    status_t query_res = mQemuClient.queryFrame(mCurrentFrame, mPreviewFrame,
+    /* Query frames from the service directly into the next ring slot. */
+    const FrameSlot& slot = mFrameRing[mNextSlot];
+    uint32_t* preview = slot.preview;
+    status_t query_res;
+    if (streaming) {
+        /* Pass white balance, and exposure changes on to the service. They
+         * will apply to one of the frames that follow. */
+        if (mStreamWhiteBalance != mWhiteBalanceScale ||
+            mStreamExposure != mExposureCompensation) {
+            mStreamWhiteBalance = mWhiteBalanceScale;
+            mStreamExposure = mExposureCompensation;
+            mQemuClient.sendStreamParams(mWhiteBalanceScale[0],
+                                         mWhiteBalanceScale[1],
+                                         mWhiteBalanceScale[2],
+                                         mExposureCompensation);
+        }
+        QemuFrameHeader header;
+        if (mQemuClient.isSharedMemory()) {
+            const uint8_t* shared_video = NULL;
+            const uint8_t* shared_preview = NULL;
+            query_res = mQemuClient.receiveSharedFrame(&shared_video,
+                                                       &shared_preview,
+                                                       &header);
+            if (query_res == NO_ERROR) {
+                return deliverSharedFrame(shared_video, shared_preview, wakeup);
+            }
+        } else {
+            query_res = mQemuClient.receiveFrame(slot.video, preview,
                                                  mFrameBufferSize,
-                                                 mTotalPixels * 4,
-                                                 mWhiteBalanceScale[0],
-                                                 mWhiteBalanceScale[1],
-                                                 mWhiteBalanceScale[2],
-                                                 mExposureCompensation);
+                                                 mPreviewFrameSize,
+                                                 &header);
+        }
+    } else {
+        /* The preview window may have switched to the video frame format
+         * since the ring was allocated. */
+        if (mPreviewFormat != HAL_PIXEL_FORMAT_RGBA_8888) {
+            preview = NULL;
+        }
+        query_res = mQemuClient.queryFrame(slot.video, preview,
+                                           mFrameBufferSize,
+                                           mPreviewFrameSize,
+                                           mWhiteBalanceScale[0],
+                                           mWhiteBalanceScale[1],
+                                           mWhiteBalanceScale[2],
+                                           mExposureCompensation);
+    }
     if (query_res == NO_ERROR) {
+        /* Make the received frame current. */
+        mCurrentFrame = slot.video;
+        mPreviewFrame = preview;
+        mNextSlot = (mNextSlot + 1) % mFrameRingSize;
+
         /* Timestamp the current frame, and notify the camera HAL. */
         mCurFrameTimestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+        mStageTracer.record(StageTracer::STAGE_CAPTURE, wakeup,
+                            mCurFrameTimestamp);
         mCameraHAL->onNextFrameAvailable(mCurrentFrame, mCurFrameTimestamp, this);
+        mFramePacer.onFrame(mCurFrameTimestamp);
         return true;
     } else {
         ALOGE("%s: Unable to get current video frame: %s",
@@ -262,4 +349,75 @@ bool EmulatedQemuCameraDevice::inWorkerThread()
     }
 }
 
+bool EmulatedQemuCameraDevice::deliverSharedFrame(const uint8_t* video,
+                                                  const uint8_t* preview,
+                                                  nsecs_t wakeup)
+{
+    /* Frames in the shared ring are only read. */
+    mCurrentFrame = const_cast<uint8_t*>(video);
+    mPreviewFrame = reinterpret_cast<uint32_t*>(const_cast<uint8_t*>(preview));
+
+    mCurFrameTimestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+    mStageTracer.record(StageTracer::STAGE_CAPTURE, wakeup, mCurFrameTimestamp);
+    mCameraHAL->onNextFrameAvailable(mCurrentFrame, mCurFrameTimestamp, this);
+    mFramePacer.onFrame(mCurFrameTimestamp);
+
+    /* The previous frame has been replaced, so the service can reuse its
+     * slot. */
+    if (mHoldingSharedFrame && mQemuClient.releaseSharedFrame() != NO_ERROR) {
+        ALOGE("%s: Unable to release shared frame", __FUNCTION__);
+        mCameraHAL->onCameraDeviceError(CAMERA_ERROR_SERVER_DIED);
+        return false;
+    }
+    mHoldingSharedFrame = true;
+    return true;
+}
+
+/****************************************************************************
+ * Frame ring management.
+ ***************************************************************************/
+
+status_t EmulatedQemuCameraDevice::allocateFrameRing()
+{
+    /* The service converts preview frames to RGB32 for us, which is only
+     * needed if the preview window takes RGB32 frames. */
+    mPreviewFrameSize =
+        (mPreviewFormat == HAL_PIXEL_FORMAT_RGBA_8888) ? mTotalPixels * 4 : 0;
+    for (int n = 0; n < mFrameRingSize; n++) {
+        FrameSlot& slot = mFrameRing[n];
+        slot.video = (n == 0) ? mCurrentFrame : new uint8_t[mFrameBufferSize];
+        slot.preview = mPreviewFrameSize ? new uint32_t[mTotalPixels] : NULL;
+        if (slot.video == NULL || (mPreviewFrameSize && slot.preview == NULL)) {
+            ALOGE("%s: Unable to allocate %d bytes for frame ring slot %d",
+                 __FUNCTION__, mFrameBufferSize + mPreviewFrameSize, n);
+            return ENOMEM;
+        }
+    }
+    mNextSlot = 0;
+    mPreviewFrame = NULL;
+    return NO_ERROR;
+}
+
+void EmulatedQemuCameraDevice::freeFrameRing()
+{
+    for (int n = 0; n < mFrameRingSize; n++) {
+        FrameSlot& slot = mFrameRing[n];
+        if (n == 0) {
+            /* Give the adopted framebuffer back to the base class. */
+            if (slot.video != NULL) {
+                mCurrentFrame = slot.video;
+            }
+        } else if (slot.video != NULL) {
+            delete[] slot.video;
+        }
+        if (slot.preview != NULL) {
+            delete[] slot.preview;
+        }
+        slot.video = NULL;
+        slot.preview = NULL;
+    }
+    mNextSlot = 0;
+    mPreviewFrame = NULL;
+}
+
 }; /* namespace android */
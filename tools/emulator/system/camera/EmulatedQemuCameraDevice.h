@@ -81,10 +81,10 @@ public:
 
 public:
     /* Gets current preview fame into provided buffer.
-     * We override this method in order to provide preview frames cached in this
-     * object.
+     * We override this method in order to provide RGB32 preview frames cached
+     * in this object.
      */
-    status_t getCurrentPreviewFrame(void* buffer);
+    status_t getCurrentPreviewFrame(void* buffer, int format, int stride);
 
     /***************************************************************************
      * Worker thread management overrides.
@@ -96,6 +96,35 @@ protected:
     /* Implementation of the worker thread routine. */
     bool inWorkerThread();
 
+    /***************************************************************************
+     * Frame ring management.
+     **************************************************************************/
+
+private:
+    /* Allocates frame ring slots for the current frame dimensions.
+     * Slot 0 adopts the framebuffer allocated by commonStartDevice.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status.
+     */
+    status_t allocateFrameRing();
+
+    /* Frees frame ring slots, and gives framebuffer adopted by slot 0 back to
+     * the base class, so commonStopDevice can free it. */
+    void freeFrameRing();
+
+    /* Makes a frame received into the shared frame ring current, notifies
+     * the camera HAL, and releases the previous frame.
+     * Param:
+     *  video, preview - Frames in the shared ring. preview is NULL if preview
+     *      frames are not received from the service.
+     *  wakeup - Time the worker thread has woken up for the frame.
+     * Return:
+     *  true to continue the worker thread, or false on error.
+     */
+    bool deliverSharedFrame(const uint8_t* video,
+                            const uint8_t* preview,
+                            nsecs_t wakeup);
+
     /***************************************************************************
      * Qemu camera device data members
      **************************************************************************/
@@ -108,12 +137,51 @@ private:
     /* Name of the camera device connected to the host. */
     String8             mDeviceName;
 
-    /* Current preview framebuffer. */
+    /* Frames received from the service are read directly into the slots of
+     * a frame ring. Once a frame is received, mCurrentFrame and mPreviewFrame
+     * are pointed at the slot's buffers, and the next frame is read into the
+     * next slot. So, a frame that is being delivered to the camera HAL is never
+     * overwritten by a frame that is being received. */
+    struct FrameSlot {
+        /* Video frame in the original pixel format. */
+        uint8_t*    video;
+        /* RGB32 preview frame, or NULL if preview window buffers are filled
+         * from the video frame. */
+        uint32_t*   preview;
+    };
+
+    /* Number of slots in the frame ring. */
+    static const int    mFrameRingSize = 3;
+
+    /* Frame ring slots. */
+    FrameSlot           mFrameRing[mFrameRingSize];
+
+    /* Index of the slot that will receive the next frame. */
+    int                 mNextSlot;
+
+    /* Current preview framebuffer. Points into the frame ring. */
     uint32_t*           mPreviewFrame;
 
-    /* Emulated FPS (frames per second).
-     * We will emulate 50 FPS. */
-    static const int    mEmulatedFPS = 50;
+    /* Byte size of RGB32 preview frames received from the service. Zero if
+     * the preview window takes the video frame format, in which case the
+     * service isn't asked for preview frames at all. */
+    size_t              mPreviewFrameSize;
+
+    /* When the service shares a frame ring with us, frames are not received
+     * into the frame ring above. Instead mCurrentFrame and mPreviewFrame point
+     * into the shared ring, and the frame they point to is held until the next
+     * frame has been delivered. */
+    bool                mHoldingSharedFrame;
+
+    /* White balance, and exposure compensation last passed to the service in
+     * the streaming mode. */
+    const float*        mStreamWhiteBalance;
+    float               mStreamExposure;
+
+    /* Number of frames the service may push ahead of us in the streaming mode.
+     * This is kept small, so frames don't pile up in the pipe adding latency.
+     * With a shared frame ring this includes the frame we hold. */
+    static const int    mStreamDepth = mFrameRingSize - 1;
 };
 
 }; /* namespace android */
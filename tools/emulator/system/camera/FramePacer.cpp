@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Contains implementation of a class FramePacer that schedules frame delivery
+ * on absolute deadlines, and keeps statistics on the frame rate achieved.
+ */
+
+#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera_FramePacer"
+#include <cutils/log.h>
+#include "FramePacer.h"
+
+namespace android {
+
+FramePacer::FramePacer()
+    : mPeriod(0),
+      mNextDeadline(0),
+      mFirstFrameTime(0),
+      mLastFrameTime(0),
+      mFrames(0),
+      mDropped(0),
+      mJitterSum(0),
+      mMaxJitter(0)
+{
+}
+
+FramePacer::~FramePacer()
+{
+}
+
+/****************************************************************************
+ * Public API
+ ***************************************************************************/
+
+void FramePacer::start(int fps, nsecs_t now)
+{
+    Mutex::Autolock locker(&mLock);
+
+    if (fps <= 0) {
+        ALOGW("%s: Invalid frame rate %d, using 30 FPS", __FUNCTION__, fps);
+        fps = 30;
+    }
+    mPeriod = 1000000000LL / fps;
+    mNextDeadline = now;
+    mFirstFrameTime = mLastFrameTime = 0;
+    mFrames = mDropped = 0;
+    mJitterSum = mMaxJitter = 0;
+}
+
+nsecs_t FramePacer::getNextDeadline()
+{
+    Mutex::Autolock locker(&mLock);
+    return mNextDeadline;
+}
+
+int FramePacer::onFrame(nsecs_t now)
+{
+    Mutex::Autolock locker(&mLock);
+
+    if (mFrames == 0) {
+        mFirstFrameTime = now;
+    } else {
+        nsecs_t jitter = (now - mLastFrameTime) - mPeriod;
+        if (jitter < 0) {
+            jitter = -jitter;
+        }
+        mJitterSum += jitter;
+        if (jitter > mMaxJitter) {
+            mMaxJitter = jitter;
+        }
+    }
+    mFrames++;
+    mLastFrameTime = now;
+
+    /* If the next deadline has passed already, this frame is late by a whole
+     * period, or more. Drop deadlines that have passed, rather than deliver
+     * frames back to back to catch up. */
+    mNextDeadline += mPeriod;
+    int dropped = 0;
+    if (now >= mNextDeadline) {
+        dropped = (now - mNextDeadline) / mPeriod + 1;
+        mNextDeadline += dropped * mPeriod;
+        mDropped += dropped;
+    }
+    return dropped;
+}
+
+void FramePacer::getStats(Stats* stats)
+{
+    Mutex::Autolock locker(&mLock);
+
+    stats->frames = mFrames;
+    stats->dropped = mDropped;
+    /* Frame rate is measured between the first, and the last frame. */
+    const nsecs_t elapsed = mLastFrameTime - mFirstFrameTime;
+    stats->fps = (mFrames > 1 && elapsed > 0) ?
+        (mFrames - 1) * 1000000000.0f / elapsed : 0.0f;
+    stats->meanJitter = (mFrames > 1) ? mJitterSum / (mFrames - 1) : 0;
+    stats->maxJitter = mMaxJitter;
+}
+
+nsecs_t FramePacer::getPeriod()
+{
+    Mutex::Autolock locker(&mLock);
+    return mPeriod;
+}
+
+}; /* namespace android */
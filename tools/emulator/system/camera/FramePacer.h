@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HW_EMULATOR_CAMERA_FRAME_PACER_H
+#define HW_EMULATOR_CAMERA_FRAME_PACER_H
+
+/*
+ * Contains declaration of a class FramePacer that schedules frame delivery on
+ * absolute deadlines, and keeps statistics on the frame rate achieved.
+ */
+
+#include <stdint.h>
+#include <utils/Mutex.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+/* Schedules frames of an emulated camera device on a grid of absolute
+ * monotonic deadlines, one frame period apart.
+ *
+ * Since deadlines don't depend on when a frame is done, the time it takes to
+ * produce a frame doesn't add up to the frame period, and the frame rate
+ * doesn't drift. When the device falls behind by a whole period or more, the
+ * deadlines it has missed are dropped, rather than delivered back to back to
+ * catch up, so frames that follow are evenly spaced again.
+ *
+ * Statistics are updated by the worker thread, and may be read from any
+ * thread.
+ */
+class FramePacer {
+public:
+    /* Frame statistics since the pacer was started. */
+    struct Stats {
+        /* Number of frames delivered. */
+        uint32_t    frames;
+        /* Number of deadlines dropped because the device fell behind. */
+        uint32_t    dropped;
+        /* Achieved frame rate, in frames per second. */
+        float       fps;
+        /* Mean, and maximum difference between frame intervals and the frame
+         * period, in nanoseconds. */
+        nsecs_t     meanJitter;
+        nsecs_t     maxJitter;
+    };
+
+    /* Constructs FramePacer instance. */
+    FramePacer();
+
+    /* Destructs FramePacer instance. */
+    ~FramePacer();
+
+    /****************************************************************************
+     * Public API
+     ***************************************************************************/
+
+public:
+    /* Starts pacing frames, and resets statistics.
+     * Param:
+     *  fps - Frame rate to pace frames at.
+     *  now - Current monotonic time. The first frame is due right away.
+     */
+    void start(int fps, nsecs_t now);
+
+    /* Gets the deadline of the next frame. */
+    nsecs_t getNextDeadline();
+
+    /* Accounts for a frame delivered at the given time, and moves on to the
+     * deadline of the next frame.
+     * Param:
+     *  now - Monotonic time the frame has been delivered at.
+     * Return:
+     *  Number of deadlines dropped before the next one.
+     */
+    int onFrame(nsecs_t now);
+
+    /* Gets statistics since the pacer was started. */
+    void getStats(Stats* stats);
+
+    /* Gets the frame period, in nanoseconds. */
+    nsecs_t getPeriod();
+
+    /****************************************************************************
+     * Data members
+     ***************************************************************************/
+
+private:
+    /* Locks this instance for data changes. */
+    Mutex       mLock;
+
+    /* Frame period, in nanoseconds. */
+    nsecs_t     mPeriod;
+
+    /* Deadline of the next frame. */
+    nsecs_t     mNextDeadline;
+
+    /* Times of the first, and the last frame. */
+    nsecs_t     mFirstFrameTime;
+    nsecs_t     mLastFrameTime;
+
+    /* Counters, and sums the statistics are built from. */
+    uint32_t    mFrames;
+    uint32_t    mDropped;
+    nsecs_t     mJitterSum;
+    nsecs_t     mMaxJitter;
+};
+
+}; /* namespace android */
+
+#endif  /* HW_EMULATOR_CAMERA_FRAME_PACER_H */
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Contains implementation of a class GrallocBufferPool that allocates a set of
+ * gralloc buffers for frames that are passed to the framework by reference.
+ */
+
+#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera_GrallocBufferPool"
+#include <cutils/log.h>
+#include <ui/GraphicBufferAllocator.h>
+#include "GrallocBufferPool.h"
+
+namespace android {
+
+GrallocBufferPool::GrallocBufferPool()
+    : mBufferNum(0),
+      mWidth(0),
+      mHeight(0),
+      mFormat(0),
+      mUsage(0),
+      mStride(0)
+{
+}
+
+GrallocBufferPool::~GrallocBufferPool()
+{
+    freeBuffers();
+}
+
+/****************************************************************************
+ * Public API
+ ***************************************************************************/
+
+status_t GrallocBufferPool::configure(int width,
+                                      int height,
+                                      int format,
+                                      int usage,
+                                      int buffer_num)
+{
+    if (mBufferNum == buffer_num && mWidth == width && mHeight == height &&
+        mFormat == format && mUsage == usage) {
+        return NO_ERROR;
+    }
+
+    ALOGV("%s: %d buffers of %dx%d, format %d, usage 0x%x", __FUNCTION__,
+         buffer_num, width, height, format, usage);
+
+    if (width <= 0 || height <= 0 || buffer_num <= 0 ||
+        buffer_num > mMaxBuffers) {
+        ALOGE("%s: Invalid pool configuration %dx%d, %d buffers",
+             __FUNCTION__, width, height, buffer_num);
+        return EINVAL;
+    }
+
+    freeBuffers();
+    GraphicBufferAllocator& allocator = GraphicBufferAllocator::get();
+    for (int n = 0; n < buffer_num; n++) {
+        int32_t stride = 0;
+        const status_t res = allocator.alloc(width, height, format, usage,
+                                             &mHandles[n], &stride);
+        if (res != NO_ERROR) {
+            ALOGE("%s: Unable to allocate %dx%d buffer, format %d: %d -> %s",
+                 __FUNCTION__, width, height, format, -res, strerror(-res));
+            freeBuffers();
+            return -res;
+        }
+        mBufferNum = n + 1;
+        mStride = stride;
+    }
+
+    mWidth = width;
+    mHeight = height;
+    mFormat = format;
+    mUsage = usage;
+    return NO_ERROR;
+}
+
+void GrallocBufferPool::freeBuffers()
+{
+    GraphicBufferAllocator& allocator = GraphicBufferAllocator::get();
+    for (int n = 0; n < mBufferNum; n++) {
+        allocator.free(mHandles[n]);
+    }
+    mBufferNum = 0;
+    mWidth = mHeight = 0;
+    mFormat = mUsage = 0;
+    mStride = 0;
+}
+
+}; /* namespace android */
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HW_EMULATOR_CAMERA_GRALLOC_BUFFER_POOL_H
+#define HW_EMULATOR_CAMERA_GRALLOC_BUFFER_POOL_H
+
+/*
+ * Contains declaration of a class GrallocBufferPool that allocates a set of
+ * gralloc buffers for frames that are passed to the framework by reference.
+ */
+
+#include <utils/Errors.h>
+#include <system/window.h>
+
+namespace android {
+
+/* Allocates a set of gralloc buffers of the same geometry, format and usage.
+ *
+ * The pool only owns the buffers. Which of them are in use is tracked by the
+ * owner of the pool, which addresses buffers by index.
+ */
+class GrallocBufferPool {
+public:
+    /* Constructs GrallocBufferPool instance. */
+    GrallocBufferPool();
+
+    /* Destructs GrallocBufferPool instance, freeing all buffers. */
+    ~GrallocBufferPool();
+
+    /****************************************************************************
+     * Public API
+     ***************************************************************************/
+
+public:
+    /* Makes sure the pool has buffers of the given geometry.
+     * If the pool is already configured with the same parameters, this method
+     * does nothing. Otherwise current buffers are freed, and new ones are
+     * allocated.
+     * Param:
+     *  width, height - Buffer dimensions.
+     *  format - HAL_PIXEL_FORMAT_XXX format of the buffers.
+     *  usage - Gralloc usage of the buffers.
+     *  buffer_num - Number of buffers in the pool. Must not exceed
+     *      mMaxBuffers.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status.
+     */
+    status_t configure(int width,
+                       int height,
+                       int format,
+                       int usage,
+                       int buffer_num);
+
+    /* Frees all buffers of the pool. None of them must be in use. */
+    void freeBuffers();
+
+    /* Gets handle of a buffer. */
+    inline buffer_handle_t* getHandle(int index)
+    {
+        return &mHandles[index];
+    }
+
+    /* Gets row stride of the buffers in pixels. */
+    inline int getStride() const
+    {
+        return mStride;
+    }
+
+    /* Checks if the pool has buffers. */
+    inline bool isConfigured() const
+    {
+        return mBufferNum != 0;
+    }
+
+    /****************************************************************************
+     * Data members
+     ***************************************************************************/
+
+public:
+    /* Maximum number of buffers in the pool. */
+    static const int        mMaxBuffers = 32;
+
+private:
+    /* Buffer handles. */
+    buffer_handle_t         mHandles[mMaxBuffers];
+
+    /* Number of buffers in the pool. */
+    int                     mBufferNum;
+
+    /* Buffer geometry, format, and usage. */
+    int                     mWidth;
+    int                     mHeight;
+    int                     mFormat;
+    int                     mUsage;
+
+    /* Row stride of the buffers in pixels, as chosen by gralloc. */
+    int                     mStride;
+};
+
+}; /* namespace android */
+
+#endif  /* HW_EMULATOR_CAMERA_GRALLOC_BUFFER_POOL_H */
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Contains implementation of a class GrallocMappingCache that keeps the CPU
+ * addresses of a stream's gralloc buffers across frames.
+ */
+
+#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera_GrallocMappingCache"
+#include <cutils/log.h>
+#include <unistd.h>
+#include <ui/Rect.h>
+#include <ui/GraphicBufferMapper.h>
+#include "gralloc_cb.h"
+#include "GrallocMappingCache.h"
+
+namespace android {
+
+GrallocMappingCache::GrallocMappingCache()
+    : mMappingCount(0),
+      mLockCount(0)
+{
+}
+
+GrallocMappingCache::~GrallocMappingCache()
+{
+}
+
+/****************************************************************************
+ * Public API
+ ***************************************************************************/
+
+status_t GrallocMappingCache::lock(buffer_handle_t* buffer,
+                                   int usage,
+                                   int width,
+                                   int height,
+                                   void** img)
+{
+    Mutex::Autolock locker(&mLock);
+
+    const int index = findMapping(*buffer);
+    if (index >= 0) {
+        *img = mMappings[index].img;
+        return NO_ERROR;
+    }
+
+    const Rect rect(width, height);
+    status_t res = GraphicBufferMapper::get().lock(*buffer, usage, rect, img);
+    if (res != NO_ERROR) {
+        return res;
+    }
+    mLockCount++;
+
+    void* persistent = NULL;
+    if (getPersistentAddress(*buffer, &persistent) && persistent == *img) {
+        if (mMappingCount == kMaxMappings) {
+            /* Buffers that are still locked will be unlocked with the mapper,
+             * since they are no longer found. */
+            ALOGV("%s: Buffer set has changed, dropping %d mappings",
+                 __FUNCTION__, mMappingCount);
+            mMappingCount = 0;
+        }
+        Mapping& mapping = mMappings[mMappingCount++];
+        mapping.handle = *buffer;
+        mapping.img = *img;
+        mapping.locked = true;
+    }
+    return NO_ERROR;
+}
+
+void GrallocMappingCache::unlock(buffer_handle_t* buffer)
+{
+    Mutex::Autolock locker(&mLock);
+
+    const int index = findMapping(*buffer);
+    if (index >= 0) {
+        if (mMappings[index].locked) {
+            GraphicBufferMapper::get().unlock(*buffer);
+            mMappings[index].locked = false;
+        }
+        return;
+    }
+    GraphicBufferMapper::get().unlock(*buffer);
+}
+
+void GrallocMappingCache::reset()
+{
+    Mutex::Autolock locker(&mLock);
+    mMappingCount = 0;
+}
+
+uint32_t GrallocMappingCache::getLockCount()
+{
+    Mutex::Autolock locker(&mLock);
+    return mLockCount;
+}
+
+/****************************************************************************
+ * Private API
+ ***************************************************************************/
+
+bool GrallocMappingCache::getPersistentAddress(buffer_handle_t handle,
+                                               void** img)
+{
+    cb_handle_t* cb = const_cast<cb_handle_t*>(
+            reinterpret_cast<const cb_handle_t*>(handle));
+    if (!cb_handle_t::validate(cb) || cb->hostHandle != 0 ||
+        cb->ashmemBase == 0 || cb->ashmemBasePid != getpid()) {
+        return false;
+    }
+    *img = reinterpret_cast<void*>(cb->ashmemBase +
+                                   (cb->canBePosted() ? sizeof(int) : 0));
+    return true;
+}
+
+int GrallocMappingCache::findMapping(buffer_handle_t handle)
+{
+    for (int n = 0; n < mMappingCount; n++) {
+        if (mMappings[n].handle == handle) {
+            /* Handles can be reused for new buffers, so make sure the buffer
+             * is still mapped where it was. */
+            void* img;
+            if (getPersistentAddress(handle, &img) && img == mMappings[n].img) {
+                return n;
+            }
+            mMappings[n] = mMappings[--mMappingCount];
+            return -1;
+        }
+    }
+    return -1;
+}
+
+}; /* namespace android */
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HW_EMULATOR_CAMERA_GRALLOC_MAPPING_CACHE_H
+#define HW_EMULATOR_CAMERA_GRALLOC_MAPPING_CACHE_H
+
+/*
+ * Contains declaration of a class GrallocMappingCache that keeps the CPU
+ * addresses of a stream's gralloc buffers across frames.
+ */
+
+#include <stdint.h>
+#include <utils/Errors.h>
+#include <utils/Mutex.h>
+#include <system/window.h>
+
+namespace android {
+
+/* Maps the gralloc buffers of one camera output stream (or preview window) once,
+ * and reuses the mappings while the stream lives.
+ *
+ * Streams cycle through a small ring of buffers, so after the first round every
+ * buffer that is dequeued has been mapped before. Only buffers that live in
+ * guest memory alone are kept mapped: for those, the emulator's gralloc lock
+ * returns a fixed address, and unlock does nothing. Buffers that are backed by
+ * a host color buffer (e.g. preview window buffers that are composited with
+ * GPU emulation) must be unlocked to upload each frame, so they are locked and
+ * unlocked on every frame, as are buffers from other gralloc implementations.
+ *
+ * When a buffer that hasn't been seen arrives, and the cache is full, the
+ * buffer set has changed, so the cache forgets all mappings and starts over.
+ *
+ * Buffers are locked by one thread, and unlocked by another, so the cache is
+ * thread-safe.
+ */
+class GrallocMappingCache {
+public:
+    /* Constructs GrallocMappingCache instance. */
+    GrallocMappingCache();
+
+    /* Destructs GrallocMappingCache instance. */
+    ~GrallocMappingCache();
+
+    /****************************************************************************
+     * Public API
+     ***************************************************************************/
+
+public:
+    /* Obtains CPU address of a buffer, locking it if it's not mapped yet.
+     * Param:
+     *  buffer - Buffer to lock.
+     *  usage - Gralloc usage to lock the buffer with.
+     *  width, height - Dimensions of the locked region.
+     *  img - Upon success contains buffer address.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status.
+     */
+    status_t lock(buffer_handle_t* buffer,
+                  int usage,
+                  int width,
+                  int height,
+                  void** img);
+
+    /* Releases a buffer obtained with lock. Buffers that stay mapped are only
+     * unlocked after the first lock. */
+    void unlock(buffer_handle_t* buffer);
+
+    /* Forgets all mappings. This must be called when the buffer set changes
+     * (e.g. when buffers are reallocated), since buffer handles can be reused.
+     */
+    void reset();
+
+    /* Gets the number of times buffers have been locked with the mapper. */
+    uint32_t getLockCount();
+
+    /****************************************************************************
+     * Private API
+     ***************************************************************************/
+
+private:
+    /* Checks if a buffer can stay mapped, and gets its address. */
+    static bool getPersistentAddress(buffer_handle_t handle, void** img);
+
+    /* Finds mapping of a buffer, or returns -1. Must be called with mLock held. */
+    int findMapping(buffer_handle_t handle);
+
+    /****************************************************************************
+     * Data members
+     ***************************************************************************/
+
+private:
+    /* Camera2 streams have up to 4 buffers, and preview windows a few more. */
+    static const int    kMaxMappings = 8;
+
+    /* Locks this instance for data changes. */
+    Mutex               mLock;
+
+    struct Mapping {
+        buffer_handle_t handle;
+        void*           img;
+        /* Buffer is locked with the mapper, and must be unlocked once. */
+        bool            locked;
+    };
+    Mapping             mMappings[kMaxMappings];
+    int                 mMappingCount;
+
+    /* Number of locks with the mapper. */
+    uint32_t            mLockCount;
+};
+
+}; /* namespace android */
+
+#endif  /* HW_EMULATOR_CAMERA_GRALLOC_MAPPING_CACHE_H */
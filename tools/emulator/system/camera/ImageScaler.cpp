@@ -0,0 +1,321 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Contains implementation of a class ImageScaler that resizes 8-bit images, and
+ * image planes by arbitrary ratios.
+ *
+ * Weights are Q8 fixed point, and add up to 256 for every destination pixel.
+ * Blended rows hold Q8 values, which fit 16 bits, so the row pass runs on
+ * 16-bit lanes. The column pass produces Q16 sums that are rounded to 8 bits.
+ */
+
+#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera_ImageScaler"
+#include <cutils/log.h>
+#include <string.h>
+#include "ImageScaler.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace android {
+
+ImageScaler::ImageScaler()
+    : mSrcWidth(0),
+      mSrcHeight(0),
+      mDstWidth(0),
+      mDstHeight(0),
+      mChannels(0)
+{
+    mHorizontal.taps = 0;
+    mHorizontal.start = NULL;
+    mHorizontal.weights = NULL;
+    mVertical.taps = 0;
+    mVertical.start = NULL;
+    mVertical.weights = NULL;
+}
+
+ImageScaler::~ImageScaler()
+{
+    freeFilter(&mHorizontal);
+    freeFilter(&mVertical);
+}
+
+/****************************************************************************
+ * Public API
+ ***************************************************************************/
+
+status_t ImageScaler::configure(int src_width,
+                                int src_height,
+                                int dst_width,
+                                int dst_height,
+                                int channels)
+{
+    if (src_width == mSrcWidth && src_height == mSrcHeight &&
+        dst_width == mDstWidth && dst_height == mDstHeight &&
+        channels == mChannels) {
+        return NO_ERROR;
+    }
+
+    if (src_width <= 0 || src_height <= 0 || dst_width <= 0 ||
+        dst_height <= 0 || channels <= 0 || channels > 4) {
+        ALOGE("%s: Invalid scaling %dx%d -> %dx%d, %d channels", __FUNCTION__,
+             src_width, src_height, dst_width, dst_height, channels);
+        return EINVAL;
+    }
+
+    /* Invalidate current configuration, in case building filters fails. */
+    mSrcWidth = mSrcHeight = mDstWidth = mDstHeight = mChannels = 0;
+    freeFilter(&mHorizontal);
+    freeFilter(&mVertical);
+    status_t res = buildFilter(src_width, dst_width, &mHorizontal);
+    if (res == NO_ERROR) {
+        res = buildFilter(src_height, dst_height, &mVertical);
+    }
+    if (res != NO_ERROR) {
+        ALOGE("%s: Unable to build filters for %dx%d -> %dx%d", __FUNCTION__,
+             src_width, src_height, dst_width, dst_height);
+        freeFilter(&mHorizontal);
+        freeFilter(&mVertical);
+        return res;
+    }
+
+    mSrcWidth = src_width;
+    mSrcHeight = src_height;
+    mDstWidth = dst_width;
+    mDstHeight = dst_height;
+    mChannels = channels;
+    return NO_ERROR;
+}
+
+void ImageScaler::scaleRows(const uint8_t* src,
+                            int src_stride,
+                            uint8_t* dst,
+                            int dst_stride,
+                            int first_row,
+                            int last_row) const
+{
+    if (isIdentity()) {
+        const int row_size = mDstWidth * mChannels;
+        for (int y = first_row; y < last_row; y++) {
+            memcpy(dst + y * dst_stride, src + y * src_stride, row_size);
+        }
+        return;
+    }
+
+    const int blended_size = mSrcWidth * mChannels;
+    uint16_t stack_row[mMaxStackRow];
+    uint16_t* blended = stack_row;
+    if (blended_size > mMaxStackRow) {
+        blended = new uint16_t[blended_size];
+    }
+
+    for (int y = first_row; y < last_row; y++) {
+        blendRows(src, src_stride, y, blended);
+        blendColumns(blended, dst + y * dst_stride);
+    }
+
+    if (blended != stack_row) {
+        delete[] blended;
+    }
+}
+
+/****************************************************************************
+ * Private API
+ ***************************************************************************/
+
+status_t ImageScaler::buildFilter(int src_size, int dst_size, Filter* filter)
+{
+    int taps;
+    if (dst_size < src_size) {
+        /* A destination pixel covers src_size / dst_size source pixels, which
+         * can straddle one more pixel than that. */
+        taps = (src_size + dst_size - 1) / dst_size + 1;
+    } else {
+        taps = 2;
+    }
+    if (taps > src_size) {
+        taps = src_size;
+    }
+
+    filter->taps = taps;
+    filter->start = new int[dst_size];
+    filter->weights = new uint16_t[dst_size * taps];
+    if (filter->start == NULL || filter->weights == NULL) {
+        return ENOMEM;
+    }
+    memset(filter->weights, 0, dst_size * taps * sizeof(uint16_t));
+
+    for (int n = 0; n < dst_size; n++) {
+        uint16_t* weights = filter->weights + n * taps;
+        int start;
+        if (dst_size < src_size) {
+            /* Area averaging. Positions are in units of 1 / dst_size source
+             * pixels, so destination pixel n covers [a, b), and each source
+             * pixel is dst_size units wide. Weights are rounded from the
+             * running coverage, so they add up to exactly 256. */
+            const int a = n * src_size;
+            const int b = a + src_size;
+            start = a / dst_size;
+            const int end = (b + dst_size - 1) / dst_size;
+            int covered = 0;
+            int prev = 0;
+            for (int k = start; k < end; k++) {
+                const int k_a = k * dst_size;
+                const int k_b = k_a + dst_size;
+                covered += (k_b < b ? k_b : b) - (k_a > a ? k_a : a);
+                const int next = (covered * 256 + src_size / 2) / src_size;
+                weights[k - start] = next - prev;
+                prev = next;
+            }
+        } else {
+            /* Bilinear. Pixel centers are aligned, so equal sizes map each
+             * pixel onto itself. */
+            int64_t pos = ((int64_t)(2 * n + 1) * src_size * 256 + dst_size) /
+                          (2 * dst_size) - 128;
+            if (pos < 0) {
+                pos = 0;
+            } else if (pos > (src_size - 1) * 256) {
+                pos = (src_size - 1) * 256;
+            }
+            start = (int)(pos >> 8);
+            const int frac = (int)(pos & 255);
+            weights[0] = 256 - frac;
+            if (taps > 1) {
+                weights[1] = frac;
+            }
+        }
+
+        /* Keep taps inside the source. Weights past the last source pixel
+         * are zero, so shifting them in front changes nothing. */
+        const int shift = start + taps - src_size;
+        if (shift > 0) {
+            memmove(weights + shift, weights, (taps - shift) * sizeof(uint16_t));
+            memset(weights, 0, shift * sizeof(uint16_t));
+            start -= shift;
+        }
+        filter->start[n] = start;
+    }
+    return NO_ERROR;
+}
+
+void ImageScaler::freeFilter(Filter* filter)
+{
+    delete[] filter->start;
+    delete[] filter->weights;
+    filter->start = NULL;
+    filter->weights = NULL;
+    filter->taps = 0;
+}
+
+void ImageScaler::blendRows(const uint8_t* src,
+                            int src_stride,
+                            int dst_row,
+                            uint16_t* blended) const
+{
+    const int taps = mVertical.taps;
+    const uint8_t* rows = src + mVertical.start[dst_row] * src_stride;
+    const uint16_t* weights = mVertical.weights + dst_row * taps;
+    const int size = mSrcWidth * mChannels;
+
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16) {
+        __m128i lo = zero;
+        __m128i hi = zero;
+        for (int t = 0; t < taps; t++) {
+            const __m128i w = _mm_set1_epi16(weights[t]);
+            const __m128i x = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(rows + t * src_stride + i));
+            lo = _mm_add_epi16(lo, _mm_mullo_epi16(_mm_unpacklo_epi8(x, zero), w));
+            hi = _mm_add_epi16(hi, _mm_mullo_epi16(_mm_unpackhi_epi8(x, zero), w));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(blended + i), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(blended + i + 8), hi);
+    }
+#elif defined(__ARM_NEON__)
+    for (; i + 16 <= size; i += 16) {
+        uint16x8_t lo = vdupq_n_u16(0);
+        uint16x8_t hi = vdupq_n_u16(0);
+        for (int t = 0; t < taps; t++) {
+            const uint8x16_t x = vld1q_u8(rows + t * src_stride + i);
+            lo = vmlaq_n_u16(lo, vmovl_u8(vget_low_u8(x)), weights[t]);
+            hi = vmlaq_n_u16(hi, vmovl_u8(vget_high_u8(x)), weights[t]);
+        }
+        vst1q_u16(blended + i, lo);
+        vst1q_u16(blended + i + 8, hi);
+    }
+#endif
+    for (; i < size; i++) {
+        uint16_t sum = 0;
+        for (int t = 0; t < taps; t++) {
+            sum += rows[t * src_stride + i] * weights[t];
+        }
+        blended[i] = sum;
+    }
+}
+
+/* Blends columns for a fixed number of channels, so the channel loop unrolls. */
+template <int channels>
+static inline void _blendColumns(const uint16_t* blended,
+                                 uint8_t* dst,
+                                 int dst_width,
+                                 int taps,
+                                 const int* start,
+                                 const uint16_t* weights,
+                                 int num_channels)
+{
+    const int ch = channels > 0 ? channels : num_channels;
+    for (int x = 0; x < dst_width; x++, weights += taps) {
+        const uint16_t* px = blended + start[x] * ch;
+        for (int c = 0; c < ch; c++) {
+            uint32_t sum = 32768;
+            for (int t = 0; t < taps; t++) {
+                sum += px[t * ch + c] * weights[t];
+            }
+            *dst++ = sum >> 16;
+        }
+    }
+}
+
+void ImageScaler::blendColumns(const uint16_t* blended, uint8_t* dst) const
+{
+    switch (mChannels) {
+        case 1:
+            _blendColumns<1>(blended, dst, mDstWidth, mHorizontal.taps,
+                             mHorizontal.start, mHorizontal.weights, 1);
+            break;
+        case 2:
+            _blendColumns<2>(blended, dst, mDstWidth, mHorizontal.taps,
+                             mHorizontal.start, mHorizontal.weights, 2);
+            break;
+        case 4:
+            _blendColumns<4>(blended, dst, mDstWidth, mHorizontal.taps,
+                             mHorizontal.start, mHorizontal.weights, 4);
+            break;
+        default:
+            _blendColumns<0>(blended, dst, mDstWidth, mHorizontal.taps,
+                             mHorizontal.start, mHorizontal.weights, mChannels);
+            break;
+    }
+}
+
+}; /* namespace android */
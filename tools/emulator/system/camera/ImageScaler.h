@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HW_EMULATOR_CAMERA_IMAGE_SCALER_H
+#define HW_EMULATOR_CAMERA_IMAGE_SCALER_H
+
+/*
+ * Contains declaration of a class ImageScaler that resizes 8-bit images, and
+ * image planes by arbitrary ratios.
+ */
+
+#include <stdint.h>
+#include <utils/Errors.h>
+
+namespace android {
+
+/* Resizes 8-bit images with interleaved channels by arbitrary ratios.
+ *
+ * A dimension that shrinks is filtered with area averaging: each destination
+ * pixel is the average of the source pixels it covers, weighted by coverage.
+ * A dimension that grows is filtered bilinearly. Filtering is separable: the
+ * source rows that contribute to a destination row are blended first (this
+ * pass is vectorized with SSE2, or NEON where available), then each
+ * destination pixel blends the columns it covers.
+ *
+ * Channels are filtered independently, so the same class scales RGB32 images
+ * (4 channels), YUV 4:2:0 luma and planar chroma (1 channel), and interleaved
+ * NV12 / NV21 chroma (2 channels). A YUV 4:2:0 frame is scaled plane by plane,
+ * with one instance for luma, and one for chroma.
+ *
+ * Filter tables are computed by configure, so scaling frames of the same size
+ * over and over costs no setup. Once configured, an instance can scale
+ * several images, or several bands of an image at the same time.
+ */
+class ImageScaler {
+public:
+    /* Constructs ImageScaler instance. */
+    ImageScaler();
+
+    /* Destructs ImageScaler instance. */
+    ~ImageScaler();
+
+    /****************************************************************************
+     * Public API
+     ***************************************************************************/
+
+public:
+    /* Prepares the scaler for the given image sizes.
+     * If the scaler is already configured with the same parameters, this
+     * method does nothing.
+     * Param:
+     *  src_width, src_height - Source image dimensions in pixels.
+     *  dst_width, dst_height - Destination image dimensions in pixels.
+     *  channels - Number of interleaved 8-bit channels per pixel (1 - 4).
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status.
+     */
+    status_t configure(int src_width,
+                       int src_height,
+                       int dst_width,
+                       int dst_height,
+                       int channels);
+
+    /* Scales a range of destination rows.
+     * Scaling of disjoint row ranges can run concurrently, e.g. in WorkerPool
+     * bands.
+     * Param:
+     *  src - Source image.
+     *  src_stride - Byte distance between source rows.
+     *  dst - Destination image. Rows are addressed from the top of the image,
+     *      not from first_row.
+     *  dst_stride - Byte distance between destination rows.
+     *  first_row, last_row - Range [first_row, last_row) of destination rows
+     *      to produce.
+     */
+    void scaleRows(const uint8_t* src,
+                   int src_stride,
+                   uint8_t* dst,
+                   int dst_stride,
+                   int first_row,
+                   int last_row) const;
+
+    /* Scales an entire image.
+     * See scaleRows for parameters.
+     */
+    void scale(const void* src, int src_stride, void* dst, int dst_stride) const
+    {
+        scaleRows(reinterpret_cast<const uint8_t*>(src), src_stride,
+                  reinterpret_cast<uint8_t*>(dst), dst_stride, 0, mDstHeight);
+    }
+
+    /* Checks whether the configured sizes match, so scaling is a copy. */
+    bool isIdentity() const
+    {
+        return mSrcWidth == mDstWidth && mSrcHeight == mDstHeight;
+    }
+
+    /****************************************************************************
+     * Private API
+     ***************************************************************************/
+
+private:
+    /* Filter along one dimension. Destination pixel n blends 'taps' source
+     * pixels starting with start[n], with Q8 weights[n * taps ...] that add up
+     * to 256. */
+    struct Filter {
+        int         taps;
+        int*        start;
+        uint16_t*   weights;
+    };
+
+    /* Computes filter tables for one dimension.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status.
+     */
+    static status_t buildFilter(int src_size, int dst_size, Filter* filter);
+
+    /* Releases filter tables. */
+    static void freeFilter(Filter* filter);
+
+    /* Blends source rows for a destination row into a row of Q8 values. */
+    void blendRows(const uint8_t* src,
+                   int src_stride,
+                   int dst_row,
+                   uint16_t* blended) const;
+
+    /* Blends columns of a row of Q8 values into a destination row. */
+    void blendColumns(const uint16_t* blended, uint8_t* dst) const;
+
+    /****************************************************************************
+     * Data members
+     ***************************************************************************/
+
+private:
+    /* Longest source row (in bytes) that is blended in a stack buffer. */
+    static const int    mMaxStackRow = 8192;
+
+    /* Configured image parameters. */
+    int                 mSrcWidth;
+    int                 mSrcHeight;
+    int                 mDstWidth;
+    int                 mDstHeight;
+    int                 mChannels;
+
+    /* Filters for columns, and rows. */
+    Filter              mHorizontal;
+    Filter              mVertical;
+};
+
+}; /* namespace android */
+
+#endif  /* HW_EMULATOR_CAMERA_IMAGE_SCALER_H */
@@ -0,0 +1,468 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Contains implementation of a class JpegEncoder that compresses RGB, and YUV
+ * 4:2:0 images into JPEG with libjpeg.
+ */
+
+#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera_JpegEncoder"
+#include <cutils/log.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "JpegEncoder.h"
+
+extern "C" {
+#include <jpeglib.h>
+#include <jerror.h>
+}
+
+namespace android {
+
+/* Height of an MCU row: both, RGB, and YUV images are compressed with 2x2
+ * luma sampling. */
+static const int _MCURows = 16;
+
+/* Maximum restart interval that fits the DRI marker. */
+static const int _MaxRestartInterval = 0xffff;
+
+/* Images smaller than this are not worth splitting into strips. */
+static const int _MinStripedPixels = 640 * 480;
+
+/* Initial size of a strip buffer. */
+static const size_t _MinStripCapacity = 64 * 1024;
+
+/* Error manager that returns control to compressStrip on errors. */
+struct StripError : public jpeg_error_mgr {
+    jmp_buf env;
+};
+
+/* Destination manager that compresses into a growing strip buffer. */
+struct StripDestination : public jpeg_destination_mgr {
+    uint8_t**   data;
+    size_t*     capacity;
+};
+
+static void _errorExit(j_common_ptr cinfo)
+{
+    char msg[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, msg);
+    ALOGE("%s: %s", __FUNCTION__, msg);
+    longjmp(static_cast<StripError*>(cinfo->err)->env, 1);
+}
+
+static void _initDestination(j_compress_ptr cinfo)
+{
+    StripDestination* dest = static_cast<StripDestination*>(cinfo->dest);
+    dest->next_output_byte = *dest->data;
+    dest->free_in_buffer = *dest->capacity;
+}
+
+static boolean _emptyOutputBuffer(j_compress_ptr cinfo)
+{
+    /* The entire buffer is full. Double it. */
+    StripDestination* dest = static_cast<StripDestination*>(cinfo->dest);
+    const size_t used = *dest->capacity;
+    uint8_t* grown = reinterpret_cast<uint8_t*>(realloc(*dest->data, used * 2));
+    if (grown == NULL) {
+        ERREXIT(cinfo, JERR_OUT_OF_MEMORY);
+    }
+    *dest->data = grown;
+    *dest->capacity = used * 2;
+    dest->next_output_byte = grown + used;
+    dest->free_in_buffer = used;
+    return TRUE;
+}
+
+static void _termDestination(j_compress_ptr cinfo)
+{
+}
+
+/* Copies a row, replicating the last pixel into the padding. */
+static void _copyRow(uint8_t* dst, const uint8_t* src, int width, int padded)
+{
+    memcpy(dst, src, width);
+    memset(dst + width, src[width - 1], padded - width);
+}
+
+/* Splits an interleaved chroma row, replicating the last pixel into the
+ * padding. */
+static void _splitRow(uint8_t* first,
+                      uint8_t* second,
+                      const uint8_t* src,
+                      int width,
+                      int padded)
+{
+    for (int x = 0; x < width; x++) {
+        first[x] = src[2 * x];
+        second[x] = src[2 * x + 1];
+    }
+    memset(first + width, first[width - 1], padded - width);
+    memset(second + width, second[width - 1], padded - width);
+}
+
+JpegEncoder::JpegEncoder()
+    : mPool(),
+      mImage(NULL),
+      mFormat(INPUT_RGB888),
+      mWidth(0),
+      mHeight(0),
+      mStride(0),
+      mQuality(0),
+      mRestartInterval(0),
+      mOutput(NULL),
+      mOutputSize(0),
+      mStitched(NULL),
+      mStitchedCapacity(0)
+{
+    memset(mStrips, 0, sizeof(mStrips));
+}
+
+JpegEncoder::~JpegEncoder()
+{
+    for (int n = 0; n < mMaxStrips; n++) {
+        free(mStrips[n].data);
+    }
+    free(mStitched);
+}
+
+/****************************************************************************
+ * Public API
+ ***************************************************************************/
+
+status_t JpegEncoder::setThreadCount(int num_threads)
+{
+    if (num_threads >= mMaxStrips) {
+        num_threads = mMaxStrips - 1;
+    }
+    return mPool.setThreadCount(num_threads);
+}
+
+int JpegEncoder::getDefaultThreadCount()
+{
+    /* The calling thread compresses a strip too. */
+    return WorkerPool::getDefaultThreadCount();
+}
+
+status_t JpegEncoder::compress(const void* image,
+                               InputFormat format,
+                               int width,
+                               int height,
+                               int stride,
+                               int quality)
+{
+    ALOGV("%s: %p[%dx%d], format %d", __FUNCTION__, image, width, height, format);
+
+    if (image == NULL || width <= 0 || height <= 0 || stride < width) {
+        ALOGE("%s: Invalid image %p[%dx%d], stride %d",
+             __FUNCTION__, image, width, height, stride);
+        return EINVAL;
+    }
+
+    mImage = reinterpret_cast<const uint8_t*>(image);
+    mFormat = format;
+    mWidth = width;
+    mHeight = height;
+    mStride = stride;
+    mQuality = quality;
+    mOutput = NULL;
+    mOutputSize = 0;
+
+    /* Split the image into strips of whole MCU rows. Each strip becomes a
+     * restart interval, so the interval must fit the DRI marker. */
+    const int mcu_rows = (height + _MCURows - 1) / _MCURows;
+    const int mcus_per_row = (width + _MCURows - 1) / _MCURows;
+    int strip_num = mPool.getThreadCount() + 1;
+    if (width * height < _MinStripedPixels) {
+        strip_num = 1;
+    }
+    if (strip_num > mcu_rows) {
+        strip_num = mcu_rows;
+    }
+    int strip_mcu_rows = (mcu_rows + strip_num - 1) / strip_num;
+    if (mcus_per_row * strip_mcu_rows > _MaxRestartInterval) {
+        strip_num = 1;
+        strip_mcu_rows = mcu_rows;
+    }
+    /* Rounding up may leave fewer strips than planned. */
+    strip_num = (mcu_rows + strip_mcu_rows - 1) / strip_mcu_rows;
+    mRestartInterval = (strip_num > 1) ? mcus_per_row * strip_mcu_rows : 0;
+
+    for (int n = 0; n < strip_num; n++) {
+        Strip& strip = mStrips[n];
+        strip.first_row = n * strip_mcu_rows * _MCURows;
+        strip.rows = strip_mcu_rows * _MCURows;
+        if (strip.first_row + strip.rows > height) {
+            strip.rows = height - strip.first_row;
+        }
+        strip.size = 0;
+        strip.status = NO_ERROR;
+    }
+
+    if (strip_num == 1) {
+        compressStrip(&mStrips[0]);
+    } else {
+        mPool.runBands(compressStrips, this, strip_num, 1);
+    }
+
+    for (int n = 0; n < strip_num; n++) {
+        if (mStrips[n].status != NO_ERROR) {
+            ALOGE("%s: Unable to compress strip %d", __FUNCTION__, n);
+            return mStrips[n].status;
+        }
+    }
+
+    if (strip_num == 1) {
+        mOutput = mStrips[0].data;
+        mOutputSize = mStrips[0].size;
+        return NO_ERROR;
+    }
+    return stitchStrips(strip_num);
+}
+
+/****************************************************************************
+ * Private API
+ ***************************************************************************/
+
+void JpegEncoder::compressStrips(void* opaque, int start, int end)
+{
+    JpegEncoder* encoder = reinterpret_cast<JpegEncoder*>(opaque);
+    for (int n = start; n < end; n++) {
+        encoder->compressStrip(&encoder->mStrips[n]);
+    }
+}
+
+void JpegEncoder::compressStrip(Strip* strip)
+{
+    if (strip->capacity < _MinStripCapacity) {
+        free(strip->data);
+        strip->data = reinterpret_cast<uint8_t*>(malloc(_MinStripCapacity));
+        strip->capacity = (strip->data != NULL) ? _MinStripCapacity : 0;
+        if (strip->data == NULL) {
+            strip->status = ENOMEM;
+            return;
+        }
+    }
+
+    /* Rows of raw YUV data are padded to whole MCUs. */
+    const int padded_width = (mWidth + _MCURows - 1) / _MCURows * _MCURows;
+    uint8_t* const scratch = (mFormat == INPUT_RGB888) ? NULL :
+        reinterpret_cast<uint8_t*>(malloc(padded_width * _MCURows * 2));
+    if (mFormat != INPUT_RGB888 && scratch == NULL) {
+        strip->status = ENOMEM;
+        return;
+    }
+
+    jpeg_compress_struct cinfo;
+    StripError error;
+    cinfo.err = jpeg_std_error(&error);
+    error.error_exit = _errorExit;
+    if (setjmp(error.env)) {
+        jpeg_destroy_compress(&cinfo);
+        free(scratch);
+        strip->status = EIO;
+        return;
+    }
+
+    jpeg_create_compress(&cinfo);
+
+    StripDestination dest;
+    dest.init_destination = _initDestination;
+    dest.empty_output_buffer = _emptyOutputBuffer;
+    dest.term_destination = _termDestination;
+    dest.data = &strip->data;
+    dest.capacity = &strip->capacity;
+    cinfo.dest = &dest;
+
+    cinfo.image_width = mWidth;
+    cinfo.image_height = strip->rows;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = (mFormat == INPUT_RGB888) ? JCS_RGB : JCS_YCbCr;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, mQuality, TRUE);
+    cinfo.restart_interval = mRestartInterval;
+    if (mFormat != INPUT_RGB888) {
+        cinfo.raw_data_in = TRUE;
+        cinfo.comp_info[0].h_samp_factor = 2;
+        cinfo.comp_info[0].v_samp_factor = 2;
+        cinfo.comp_info[1].h_samp_factor = 1;
+        cinfo.comp_info[1].v_samp_factor = 1;
+        cinfo.comp_info[2].h_samp_factor = 1;
+        cinfo.comp_info[2].v_samp_factor = 1;
+    }
+
+    jpeg_start_compress(&cinfo, TRUE);
+
+    if (mFormat == INPUT_RGB888) {
+        const int row_stride = mStride * 3;
+        JSAMPROW rows[_MCURows];
+        while (cinfo.next_scanline < cinfo.image_height) {
+            int num = 0;
+            for (; num < _MCURows &&
+                   cinfo.next_scanline + num < cinfo.image_height; num++) {
+                rows[num] = const_cast<JSAMPROW>(mImage +
+                    (strip->first_row + cinfo.next_scanline + num) * row_stride);
+            }
+            jpeg_write_scanlines(&cinfo, rows, num);
+        }
+    } else {
+        /* Raw data is fed an MCU row at a time: 16 luma rows, and 8 rows for
+         * each of the chroma planes. Rows past the end of the image repeat
+         * the last image row. */
+        const int chroma_width = (mWidth + 1) / 2;
+        const int padded_chroma = padded_width / 2;
+        const uint8_t* y_plane = mImage;
+        const uint8_t* v_plane = mImage + mStride * mHeight;
+        int chroma_stride = mStride;
+        const uint8_t* u_plane = v_plane;
+        if (mFormat == INPUT_YV12) {
+            chroma_stride = ((mStride / 2) + 15) & ~15;
+            u_plane = v_plane + chroma_stride * ((mHeight + 1) / 2);
+        }
+
+        JSAMPROW y_rows[_MCURows];
+        JSAMPROW cb_rows[_MCURows / 2];
+        JSAMPROW cr_rows[_MCURows / 2];
+        for (int n = 0; n < _MCURows; n++) {
+            y_rows[n] = scratch + n * padded_width;
+        }
+        for (int n = 0; n < _MCURows / 2; n++) {
+            cb_rows[n] = scratch + (_MCURows + n) * padded_width;
+            cr_rows[n] = cb_rows[n] + padded_chroma;
+        }
+        JSAMPARRAY planes[3] = { y_rows, cb_rows, cr_rows };
+
+        const int last_row = strip->first_row + strip->rows - 1;
+        while (cinfo.next_scanline < cinfo.image_height) {
+            const int first = strip->first_row + cinfo.next_scanline;
+            for (int n = 0; n < _MCURows; n++) {
+                const int row = (first + n < last_row) ? first + n : last_row;
+                _copyRow(y_rows[n], y_plane + row * mStride, mWidth, padded_width);
+            }
+            for (int n = 0; n < _MCURows / 2; n++) {
+                const int row = ((first + 2 * n < last_row) ? first + 2 * n
+                                                            : last_row) / 2;
+                if (mFormat == INPUT_NV21) {
+                    _splitRow(cr_rows[n], cb_rows[n], v_plane + row * chroma_stride,
+                              chroma_width, padded_chroma);
+                } else {
+                    _copyRow(cr_rows[n], v_plane + row * chroma_stride,
+                             chroma_width, padded_chroma);
+                    _copyRow(cb_rows[n], u_plane + row * chroma_stride,
+                             chroma_width, padded_chroma);
+                }
+            }
+            jpeg_write_raw_data(&cinfo, planes, _MCURows);
+        }
+    }
+
+    jpeg_finish_compress(&cinfo);
+    strip->size = strip->capacity - dest.free_in_buffer;
+    jpeg_destroy_compress(&cinfo);
+    free(scratch);
+}
+
+/* Finds the end of the headers (i.e. the start of entropy-coded data) in a
+ * compressed strip.
+ * Param:
+ *  data, size - Compressed strip.
+ *  sof_height - Upon success contains offset of the image height field in the
+ *      SOF marker, or 0 if there is no SOF marker.
+ * Return:
+ *  Offset of the entropy-coded data, or 0 if headers are malformed.
+ */
+static size_t _findScanData(const uint8_t* data, size_t size, size_t* sof_height)
+{
+    *sof_height = 0;
+    size_t pos = 2;     /* Past SOI */
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xff) {
+            return 0;
+        }
+        const uint8_t marker = data[pos + 1];
+        const size_t len = (data[pos + 2] << 8) | data[pos + 3];
+        if (marker == 0xc0 || marker == 0xc1) {
+            *sof_height = pos + 5;
+        }
+        pos += 2 + len;
+        if (marker == 0xda) {
+            return (pos <= size) ? pos : 0;
+        }
+    }
+    return 0;
+}
+
+status_t JpegEncoder::stitchStrips(int strip_num)
+{
+    /* The stitched image is the headers of the first strip, with the image
+     * height patched, followed by entropy-coded data of all strips separated
+     * with RSTn markers, followed by EOI. */
+    size_t total = 0;
+    for (int n = 0; n < strip_num; n++) {
+        total += mStrips[n].size + 2;
+    }
+    if (!reserveOutput(total)) {
+        ALOGE("%s: Unable to allocate %d bytes", __FUNCTION__, total);
+        return ENOMEM;
+    }
+
+    uint8_t* out = mStitched;
+    for (int n = 0; n < strip_num; n++) {
+        const Strip& strip = mStrips[n];
+        size_t sof_height;
+        const size_t scan = _findScanData(strip.data, strip.size, &sof_height);
+        if (scan == 0 || sof_height == 0 || strip.size < scan + 2 ||
+            strip.data[strip.size - 2] != 0xff || strip.data[strip.size - 1] != 0xd9) {
+            ALOGE("%s: Malformed strip %d", __FUNCTION__, n);
+            return EIO;
+        }
+        if (n == 0) {
+            memcpy(out, strip.data, scan);
+            out[sof_height] = mHeight >> 8;
+            out[sof_height + 1] = mHeight & 0xff;
+            out += scan;
+        } else {
+            *out++ = 0xff;
+            *out++ = 0xd0 + ((n - 1) & 7);
+        }
+        const size_t data_size = strip.size - 2 - scan;
+        memcpy(out, strip.data + scan, data_size);
+        out += data_size;
+    }
+    *out++ = 0xff;
+    *out++ = 0xd9;
+
+    mOutput = mStitched;
+    mOutputSize = out - mStitched;
+    ALOGV("%s: %d strips, %d bytes", __FUNCTION__, strip_num, mOutputSize);
+    return NO_ERROR;
+}
+
+bool JpegEncoder::reserveOutput(size_t size)
+{
+    if (mStitchedCapacity >= size) {
+        return true;
+    }
+    free(mStitched);
+    mStitched = reinterpret_cast<uint8_t*>(malloc(size));
+    mStitchedCapacity = (mStitched != NULL) ? size : 0;
+    return mStitched != NULL;
+}
+
+}; /* namespace android */
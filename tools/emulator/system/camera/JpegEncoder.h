@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HW_EMULATOR_CAMERA_JPEG_ENCODER_H
+#define HW_EMULATOR_CAMERA_JPEG_ENCODER_H
+
+/*
+ * Contains declaration of a class JpegEncoder that compresses RGB, and YUV
+ * 4:2:0 images into JPEG with libjpeg.
+ */
+
+#include <stdint.h>
+#include <utils/Errors.h>
+#include "WorkerPool.h"
+
+namespace android {
+
+/* Compresses RGB, and YUV 4:2:0 images into JPEG.
+ *
+ * YUV images are fed to libjpeg as raw downsampled data, so no color
+ * conversion, or downsampling is done by libjpeg.
+ *
+ * Large images can be compressed in parallel on a WorkerPool. In this case the
+ * image is split into horizontal strips that are a whole number of MCU rows
+ * high. Each strip is compressed separately, with the same tables, and the
+ * strips are then stitched into a single JPEG where each strip is a restart
+ * interval. Decoders see a regular baseline JPEG with restart markers.
+ *
+ * An instance of this class is not thread-safe: it compresses one image at a
+ * time.
+ */
+class JpegEncoder {
+public:
+    /* Formats of images that can be compressed. */
+    enum InputFormat {
+        /* Packed 24-bit RGB. */
+        INPUT_RGB888,
+        /* Y plane, followed by interleaved V/U plane. */
+        INPUT_NV21,
+        /* Y plane, followed by V, and U planes. Chroma stride is the luma stride
+         * divided by two, and aligned to 16 bytes. */
+        INPUT_YV12,
+    };
+
+    /* Constructs JpegEncoder instance. */
+    JpegEncoder();
+
+    /* Destructs JpegEncoder instance. */
+    ~JpegEncoder();
+
+    /****************************************************************************
+     * Public API
+     ***************************************************************************/
+
+public:
+    /* Sets the number of worker threads used to compress large images.
+     * Param:
+     *  num_threads - Number of worker threads. 0 compresses all images on the
+     *      calling thread.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status.
+     */
+    status_t setThreadCount(int num_threads);
+
+    /* Gets the number of worker threads that suits the CPU the code runs on. */
+    static int getDefaultThreadCount();
+
+    /* Compresses an image.
+     * Use getCompressedImage, and getCompressedSize methods to obtain the
+     * compressed image.
+     * Param:
+     *  image - Image to compress.
+     *  format - Image format.
+     *  width, height - Image dimensions.
+     *  stride - Row stride in pixels (for YUV images, stride of the Y plane).
+     *  quality - JPEG quality (1 - 100).
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status.
+     */
+    status_t compress(const void* image,
+                      InputFormat format,
+                      int width,
+                      int height,
+                      int stride,
+                      int quality);
+
+    /* Gets the compressed image.
+     * This method must be called only after a successful completion of the
+     * compress call. The returned buffer is valid till the next compress call.
+     */
+    const uint8_t* getCompressedImage() const
+    {
+        return mOutput;
+    }
+
+    /* Gets size of the compressed image.
+     * This method must be called only after a successful completion of the
+     * compress call.
+     */
+    size_t getCompressedSize() const
+    {
+        return mOutputSize;
+    }
+
+    /****************************************************************************
+     * Private API
+     ***************************************************************************/
+
+private:
+    /* A horizontal strip of the image, compressed as a standalone JPEG. */
+    struct Strip {
+        /* First image row in the strip. */
+        int         first_row;
+        /* Number of image rows in the strip. */
+        int         rows;
+        /* Compressed strip. */
+        uint8_t*    data;
+        size_t      size;
+        size_t      capacity;
+        /* Compression status. */
+        status_t    status;
+    };
+
+    /* Compresses a strip. */
+    void compressStrip(Strip* strip);
+
+    /* WorkerPool routine that compresses strips [start, end). */
+    static void compressStrips(void* opaque, int start, int end);
+
+    /* Stitches compressed strips into a single JPEG in mOutput.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status.
+     */
+    status_t stitchStrips(int strip_num);
+
+    /* Makes sure the output buffer can hold at least 'size' bytes. */
+    bool reserveOutput(size_t size);
+
+    /****************************************************************************
+     * Data members
+     ***************************************************************************/
+
+private:
+    /* Maximum number of strips. */
+    static const int    mMaxStrips = 8;
+
+    /* Worker threads used to compress strips. */
+    WorkerPool          mPool;
+
+    /* Strips of the image that is being compressed. Strip buffers are kept
+     * between calls, so they don't need to grow for every image. */
+    Strip               mStrips[mMaxStrips];
+
+    /* Parameters of the image that is being compressed. */
+    const uint8_t*      mImage;
+    InputFormat         mFormat;
+    int                 mWidth;
+    int                 mHeight;
+    int                 mStride;
+    int                 mQuality;
+    /* Restart interval in MCUs, or 0 if the image is compressed as one strip. */
+    int                 mRestartInterval;
+
+    /* Stitched image. If the image is compressed as a single strip, this
+     * points to the strip data. */
+    const uint8_t*      mOutput;
+    size_t              mOutputSize;
+
+    /* Buffer where strips are stitched. */
+    uint8_t*            mStitched;
+    size_t              mStitchedCapacity;
+};
+
+}; /* namespace android */
+
+#endif  /* HW_EMULATOR_CAMERA_JPEG_ENCODER_H */
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Contains implementation of a class MetadataTagCache that finds entries of
+ * camera metadata buffers by remembered entry index.
+ */
+
+#include "MetadataTagCache.h"
+
+namespace android {
+
+MetadataTagCache::MetadataTagCache(const uint32_t *tags, size_t tagCount)
+    : mTags(tags),
+      mTagCount(tagCount)
+{
+    mIndices = new size_t[tagCount];
+    reset();
+}
+
+MetadataTagCache::~MetadataTagCache()
+{
+    delete[] mIndices;
+}
+
+/****************************************************************************
+ * Public API
+ ***************************************************************************/
+
+status_t MetadataTagCache::find(camera_metadata_t *metadata,
+                                size_t slot,
+                                camera_metadata_entry_t *entry)
+{
+    const uint32_t tag = mTags[slot];
+    const size_t index = mIndices[slot];
+
+    /* get_camera_metadata_entry fails for out of range indices, so a stale
+     * index from a larger buffer is safe to try. */
+    if (index != kNoIndex &&
+        get_camera_metadata_entry(metadata, index, entry) == OK &&
+        entry->tag == tag) {
+        return OK;
+    }
+
+    status_t res = find_camera_metadata_entry(metadata, tag, entry);
+    if (res != OK) {
+        return res;
+    }
+    mIndices[slot] = entry->index;
+    return OK;
+}
+
+void MetadataTagCache::reset()
+{
+    for (size_t n = 0; n < mTagCount; n++) {
+        mIndices[n] = kNoIndex;
+    }
+}
+
+}; /* namespace android */
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HW_EMULATOR_CAMERA_METADATA_TAG_CACHE_H
+#define HW_EMULATOR_CAMERA_METADATA_TAG_CACHE_H
+
+/*
+ * Contains declaration of a class MetadataTagCache that finds entries of
+ * camera metadata buffers by remembered entry index.
+ */
+
+#include <stdint.h>
+#include <utils/Errors.h>
+#include "system/camera_metadata.h"
+
+namespace android {
+
+/* Finds entries of a fixed set of tags in camera metadata buffers.
+ *
+ * Requests of a repeating capture are copies of one template, so a tag is
+ * found at the same entry index in every one of them. The cache remembers the
+ * index each tag was last found at, and checks that index first, which turns
+ * the search into a single lookup. If the tag isn't there, the cache falls back
+ * to find_camera_metadata_entry, and remembers the new index.
+ *
+ * An instance of this class is not thread-safe; each thread that reads
+ * metadata should use its own.
+ */
+class MetadataTagCache {
+public:
+    /* Constructs MetadataTagCache instance.
+     * Param:
+     *  tags - Tags to find, indexed by slot. The array must outlive the cache.
+     *  tagCount - Number of tags in the array.
+     */
+    MetadataTagCache(const uint32_t *tags, size_t tagCount);
+
+    /* Destructs MetadataTagCache instance. */
+    ~MetadataTagCache();
+
+    /****************************************************************************
+     * Public API
+     ***************************************************************************/
+
+public:
+    /* Finds the entry of a tag.
+     * Param:
+     *  metadata - Metadata buffer to search.
+     *  slot - Index of the tag in the array passed to the constructor.
+     *  entry - Upon success contains the entry.
+     * Return:
+     *  OK on success, NAME_NOT_FOUND if the buffer has no entry for the tag.
+     */
+    status_t find(camera_metadata_t *metadata,
+                  size_t slot,
+                  camera_metadata_entry_t *entry);
+
+    /* Forgets all remembered entry indices. */
+    void reset();
+
+    /****************************************************************************
+     * Data members
+     ***************************************************************************/
+
+private:
+    /* Tags to find, indexed by slot. */
+    const uint32_t      *mTags;
+    size_t              mTagCount;
+
+    /* Entry index each tag was last found at, or kNoIndex. */
+    size_t              *mIndices;
+
+    static const size_t kNoIndex = (size_t)-1;
+};
+
+}; /* namespace android */
+
+#endif  /* HW_EMULATOR_CAMERA_METADATA_TAG_CACHE_H */
@@ -22,8 +22,6 @@
 #define LOG_NDEBUG 0
 #define LOG_TAG "EmulatedCamera_Preview"
 #include <cutils/log.h>
-#include <ui/Rect.h>
-#include <ui/GraphicBufferMapper.h>
 #include "EmulatedCameraDevice.h"
 #include "PreviewWindow.h"
 
@@ -31,9 +29,11 @@ namespace android {
 
 PreviewWindow::PreviewWindow()
     : mPreviewWindow(NULL),
-      mLastPreviewed(0),
+      mNextPreview(0),
       mPreviewFrameWidth(0),
       mPreviewFrameHeight(0),
+      mPreviewFrameFormat(HAL_PIXEL_FORMAT_RGBA_8888),
+      mNativeFormatFailed(false),
       mPreviewEnabled(false)
 {
 }
@@ -57,7 +57,9 @@ status_t PreviewWindow::setPreviewWindow(struct preview_stream_ops* window,
     /* Reset preview info. */
     mPreviewFrameWidth = mPreviewFrameHeight = 0;
     mPreviewAfter = 0;
-    mLastPreviewed = 0;
+    mNextPreview = 0;
+    mNativeFormatFailed = false;
+    mBufferMappings.reset();
 
     if (window != NULL) {
         /* The CPU will write each frame to the preview window buffer.
@@ -111,24 +113,28 @@ void PreviewWindow::onNextFrameAvailable(const void* frame,
     if (!isPreviewEnabled() || mPreviewWindow == NULL || !isPreviewTime()) {
         return;
     }
+    const nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
 
     /* Make sure that preview window dimensions are OK with the camera device */
     if (adjustPreviewDimensions(camera_dev)) {
         /* Need to set / adjust buffer geometry for the preview window.
-         * Note that in the emulator preview window uses only RGB for pixel
-         * formats. */
-        ALOGV("%s: Adjusting preview windows %p geometry to %dx%d",
+         * Frames are copied as they are into YV12, or NV21 buffers, if the
+         * window can allocate those. Otherwise they are converted to RGB. */
+        ALOGV("%s: Adjusting preview windows %p geometry to %dx%d, format %d",
              __FUNCTION__, mPreviewWindow, mPreviewFrameWidth,
-             mPreviewFrameHeight);
+             mPreviewFrameHeight, mPreviewFrameFormat);
         res = mPreviewWindow->set_buffers_geometry(mPreviewWindow,
                                                    mPreviewFrameWidth,
                                                    mPreviewFrameHeight,
-                                                   HAL_PIXEL_FORMAT_RGBA_8888);
+                                                   mPreviewFrameFormat);
+        /* The window reallocates its buffers for the new geometry. */
+        mBufferMappings.reset();
         if (res != NO_ERROR) {
             ALOGE("%s: Error in set_buffers_geometry %d -> %s",
                  __FUNCTION__, -res, strerror(-res));
             return;
         }
+        camera_dev->setPreviewFormat(mPreviewFrameFormat);
     }
 
     /*
@@ -140,6 +146,15 @@ void PreviewWindow::onNextFrameAvailable(const void* frame,
     int stride = 0;
     res = mPreviewWindow->dequeue_buffer(mPreviewWindow, &buffer, &stride);
     if (res != NO_ERROR || buffer == NULL) {
+        if (mPreviewFrameFormat != HAL_PIXEL_FORMAT_RGBA_8888) {
+            /* Gralloc can't allocate YUV buffers for this window (e.g. they
+             * would need a host color buffer). Use RGB from the next frame. */
+            ALOGW("%s: Unable to dequeue format %d buffer, falling back to RGB",
+                 __FUNCTION__, mPreviewFrameFormat);
+            mNativeFormatFailed = true;
+            mPreviewFrameWidth = mPreviewFrameHeight = 0;
+            return;
+        }
         ALOGE("%s: Unable to dequeue preview window buffer: %d -> %s",
             __FUNCTION__, -res, strerror(-res));
         return;
@@ -155,11 +170,11 @@ void PreviewWindow::onNextFrameAvailable(const void* frame,
     }
 
     /* Now let the graphics framework to lock the buffer, and provide
-     * us with the framebuffer data address. */
+     * us with the framebuffer data address. Buffers that stay mapped are
+     * only locked the first time they are seen. */
     void* img = NULL;
-    const Rect rect(mPreviewFrameWidth, mPreviewFrameHeight);
-    GraphicBufferMapper& grbuffer_mapper(GraphicBufferMapper::get());
-    res = grbuffer_mapper.lock(*buffer, GRALLOC_USAGE_SW_WRITE_OFTEN, rect, &img);
+    res = mBufferMappings.lock(buffer, GRALLOC_USAGE_SW_WRITE_OFTEN,
+                               mPreviewFrameWidth, mPreviewFrameHeight, &img);
     if (res != NO_ERROR) {
         ALOGE("%s: grbuffer_mapper.lock failure: %d -> %s",
              __FUNCTION__, res, strerror(res));
@@ -167,9 +182,9 @@ void PreviewWindow::onNextFrameAvailable(const void* frame,
         return;
     }
 
-    /* Frames come in in YV12/NV12/NV21 format. Since preview window doesn't
-     * supports those formats, we need to obtain the frame in RGB565. */
-    res = camera_dev->getCurrentPreviewFrame(img);
+    /* Frames come in in YV12/NV12/NV21 format, and are copied, or converted
+     * to the format of the preview window. */
+    res = camera_dev->getCurrentPreviewFrame(img, mPreviewFrameFormat, stride);
     if (res == NO_ERROR) {
         /* Show it. */
         mPreviewWindow->set_timestamp(mPreviewWindow, timestamp);
@@ -178,7 +193,11 @@ void PreviewWindow::onNextFrameAvailable(const void* frame,
         ALOGE("%s: Unable to obtain preview frame: %d", __FUNCTION__, res);
         mPreviewWindow->cancel_buffer(mPreviewWindow, buffer);
     }
-    grbuffer_mapper.unlock(*buffer);
+    mBufferMappings.unlock(buffer);
+    if (res == NO_ERROR) {
+        camera_dev->getStageTracer().record(StageTracer::STAGE_PREVIEW, start,
+                                            systemTime(SYSTEM_TIME_MONOTONIC));
+    }
 }
 
 /***************************************************************************
@@ -187,9 +206,13 @@ void PreviewWindow::onNextFrameAvailable(const void* frame,
 
 bool PreviewWindow::adjustPreviewDimensions(EmulatedCameraDevice* camera_dev)
 {
+    const int format = mNativeFormatFailed ? HAL_PIXEL_FORMAT_RGBA_8888 :
+                                             camera_dev->getNativePreviewFormat();
+
     /* Match the cached frame dimensions against the actual ones. */
     if (mPreviewFrameWidth == camera_dev->getFrameWidth() &&
-        mPreviewFrameHeight == camera_dev->getFrameHeight()) {
+        mPreviewFrameHeight == camera_dev->getFrameHeight() &&
+        mPreviewFrameFormat == format) {
         /* They match. */
         return false;
     }
@@ -197,6 +220,7 @@ bool PreviewWindow::adjustPreviewDimensions(EmulatedCameraDevice* camera_dev)
     /* They don't match: adjust the cache. */
     mPreviewFrameWidth = camera_dev->getFrameWidth();
     mPreviewFrameHeight = camera_dev->getFrameHeight();
+    mPreviewFrameFormat = format;
 
     return true;
 }
@@ -206,11 +230,22 @@ bool PreviewWindow::isPreviewTime()
     timeval cur_time;
     gettimeofday(&cur_time, NULL);
     const uint64_t cur_mks = cur_time.tv_sec * 1000000LL + cur_time.tv_usec;
-    if ((cur_mks - mLastPreviewed) >= mPreviewAfter) {
-        mLastPreviewed = cur_mks;
-        return true;
+    /* Frames are due on a grid one preview period apart, and the camera device
+     * delivers them at about the same rate, so frames within half a period of
+     * the due time are taken. Otherwise frames that come in a little early
+     * would be skipped. */
+    if (mNextPreview == 0) {
+        mNextPreview = cur_mks;
     }
-    return false;
+    if (cur_mks + mPreviewAfter / 2 < mNextPreview) {
+        return false;
+    }
+    mNextPreview += mPreviewAfter;
+    if (cur_mks >= mNextPreview) {
+        /* Fell behind by a period, or more: start over from this frame. */
+        mNextPreview = cur_mks + mPreviewAfter;
+    }
+    return true;
 }
 
 }; /* namespace android */
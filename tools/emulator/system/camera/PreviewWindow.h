@@ -22,6 +22,8 @@
  * of a preview window set via set_preview_window camera HAL API.
  */
 
+#include "GrallocMappingCache.h"
+
 namespace android {
 
 class EmulatedCameraDevice;
@@ -108,8 +110,8 @@ public:
      **************************************************************************/
 
 protected:
-    /* Adjusts cached dimensions of the preview window frame according to the
-     * frame dimensions used by the camera device.
+    /* Adjusts cached dimensions, and format of the preview window frame
+     * according to the frames delivered by the camera device.
      *
      * When preview is started, it's not known (hard to define) what are going
      * to be the dimensions of the frames that are going to be displayed. Plus,
@@ -142,9 +144,9 @@ protected:
     /* Preview window instance. */
     preview_stream_ops*             mPreviewWindow;
 
-    /* Timestamp (abs. microseconds) when last frame has been pushed to the
-     * preview window. */
-    uint64_t                        mLastPreviewed;
+    /* Timestamp (abs. microseconds) when next frame is due to be pushed to
+     * the preview window. */
+    uint64_t                        mNextPreview;
 
     /* Preview frequency in microseconds. */
     uint32_t                        mPreviewAfter;
@@ -156,6 +158,16 @@ protected:
     int                             mPreviewFrameWidth;
     int                             mPreviewFrameHeight;
 
+    /* Cached preview window buffer format (HAL_PIXEL_FORMAT_XXX). */
+    int                             mPreviewFrameFormat;
+
+    /* The window failed to provide buffers in the frame format, so frames are
+     * converted to RGB. */
+    bool                            mNativeFormatFailed;
+
+    /* Mappings of the preview window buffers. */
+    GrallocMappingCache             mBufferMappings;
+
     /* Preview status. */
     bool                            mPreviewEnabled;
 };
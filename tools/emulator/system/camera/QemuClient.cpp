@@ -22,7 +22,12 @@
 #define LOG_NDEBUG 1
 #define LOG_TAG "EmulatedCamera_QemuClient"
 #include <cutils/log.h>
-#include "EmulatedCamera.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "QemuClient.h"
 
 #define LOG_QUERIES 0
@@ -245,6 +250,23 @@ status_t QemuClient::connectClient(const char* param)
     return NO_ERROR;
 }
 
+status_t QemuClient::attachClient(int fd)
+{
+    ALOGV("%s: %d", __FUNCTION__, fd);
+
+    if (mPipeFD >= 0) {
+        ALOGE("%s: Qemu client is already connected", __FUNCTION__);
+        return EINVAL;
+    }
+    if (fd < 0) {
+        ALOGE("%s: Invalid descriptor %d", __FUNCTION__, fd);
+        return EINVAL;
+    }
+
+    mPipeFD = fd;
+    return NO_ERROR;
+}
+
 void QemuClient::disconnectClient()
 {
     ALOGV("%s", __FUNCTION__);
@@ -281,31 +303,10 @@ status_t QemuClient::receiveMessage(void** data, size_t* data_size)
     *data = NULL;
     *data_size = 0;
 
-    if (mPipeFD < 0) {
-        ALOGE("%s: Qemu client is not connected", __FUNCTION__);
-        return EINVAL;
-    }
-
-    /* The way the service replies to a query, it sends payload size first, and
-     * then it sends the payload itself. Note that payload size is sent as a
-     * string, containing 8 characters representing a hexadecimal payload size
-     * value. Note also, that the string doesn't contain zero-terminator. */
     size_t payload_size;
-    char payload_size_str[9];
-    int rd_res = qemud_fd_read(mPipeFD, payload_size_str, 8);
-    if (rd_res != 8) {
-        ALOGE("%s: Unable to obtain payload size: %s",
-             __FUNCTION__, strerror(errno));
-        return errno ? errno : EIO;
-    }
-
-    /* Convert payload size. */
-    errno = 0;
-    payload_size_str[8] = '\0';
-    payload_size = strtol(payload_size_str, NULL, 16);
-    if (errno) {
-        ALOGE("%s: Invalid payload size '%s'", __FUNCTION__, payload_size_str);
-        return EIO;
+    status_t res = receivePayloadSize(&payload_size);
+    if (res != NO_ERROR) {
+        return res;
     }
 
     /* Allocate payload data buffer, and read the payload there. */
@@ -315,17 +316,14 @@ status_t QemuClient::receiveMessage(void** data, size_t* data_size)
              __FUNCTION__, payload_size);
         return ENOMEM;
     }
-    rd_res = qemud_fd_read(mPipeFD, *data, payload_size);
-    if (static_cast<size_t>(rd_res) == payload_size) {
+    res = receiveData(*data, payload_size);
+    if (res == NO_ERROR) {
         *data_size = payload_size;
-        return NO_ERROR;
     } else {
-        ALOGE("%s: Read size %d doesnt match expected payload size %d: %s",
-             __FUNCTION__, rd_res, payload_size, strerror(errno));
         free(*data);
         *data = NULL;
-        return errno ? errno : EIO;
     }
+    return res;
 }
 
 status_t QemuClient::doQuery(QemuQuery* query)
@@ -364,6 +362,75 @@ status_t QemuClient::doQuery(QemuQuery* query)
     return res1;
 }
 
+/****************************************************************************
+ * Helpers for receiving data without intermediate buffers.
+ ***************************************************************************/
+
+status_t QemuClient::receivePayloadSize(size_t* payload_size)
+{
+    *payload_size = 0;
+
+    if (mPipeFD < 0) {
+        ALOGE("%s: Qemu client is not connected", __FUNCTION__);
+        return EINVAL;
+    }
+
+    /* The way the service replies to a query, it sends payload size first, and
+     * then it sends the payload itself. Note that payload size is sent as a
+     * string, containing 8 characters representing a hexadecimal payload size
+     * value. Note also, that the string doesn't contain zero-terminator. */
+    char payload_size_str[9];
+    int rd_res = qemud_fd_read(mPipeFD, payload_size_str, 8);
+    if (rd_res != 8) {
+        ALOGE("%s: Unable to obtain payload size: %s",
+             __FUNCTION__, strerror(errno));
+        return errno ? errno : EIO;
+    }
+
+    /* Convert payload size. */
+    errno = 0;
+    payload_size_str[8] = '\0';
+    *payload_size = strtol(payload_size_str, NULL, 16);
+    if (errno) {
+        ALOGE("%s: Invalid payload size '%s'", __FUNCTION__, payload_size_str);
+        return EIO;
+    }
+
+    return NO_ERROR;
+}
+
+status_t QemuClient::receiveData(void* buffer, size_t size)
+{
+    /* Large frames may arrive in more than one chunk. */
+    uint8_t* dst = reinterpret_cast<uint8_t*>(buffer);
+    size_t received = 0;
+    while (received < size) {
+        const int rd_res = qemud_fd_read(mPipeFD, dst + received, size - received);
+        if (rd_res <= 0) {
+            ALOGE("%s: Read size %d doesnt match expected payload size %d: %s",
+                 __FUNCTION__, received, size,
+                 rd_res ? strerror(errno) : "Connection closed");
+            return (rd_res && errno) ? errno : EIO;
+        }
+        received += rd_res;
+    }
+    return NO_ERROR;
+}
+
+status_t QemuClient::discardData(size_t size)
+{
+    char scratch[256];
+    while (size > 0) {
+        const size_t chunk = (size > sizeof(scratch)) ? sizeof(scratch) : size;
+        const status_t res = receiveData(scratch, chunk);
+        if (res != NO_ERROR) {
+            return res;
+        }
+        size -= chunk;
+    }
+    return NO_ERROR;
+}
+
 /****************************************************************************
  * Qemu client for the 'factory' service.
  ***************************************************************************/
@@ -432,15 +499,33 @@ const char CameraQemuClient::mQueryStart[]      = "start";
 const char CameraQemuClient::mQueryStop[]       = "stop";
 /* Get next video frame from the camera device. */
 const char CameraQemuClient::mQueryFrame[]      = "frame";
+/* Start pushing frames from the camera device. */
+const char CameraQemuClient::mQueryStream[]     = "stream";
+/* Acknowledge a pushed frame. */
+const char CameraQemuClient::mQueryNext[]       = "next";
+/* Change parameters of the pushed frames. */
+const char CameraQemuClient::mQueryParams[]     = "params";
 
 CameraQemuClient::CameraQemuClient()
-    : QemuClient()
+    : QemuClient(),
+      mStreaming(false),
+      mNextSequence(0),
+      mSharedRing(NULL),
+      mSharedRingSize(0),
+      mSharedSlots(0),
+      mSharedSlotSize(0),
+      mVideoSize(0),
+      mPreviewSize(0),
+      mStarted(false),
+      mPixelFormat(0),
+      mWidth(0),
+      mHeight(0)
 {
 }
 
 CameraQemuClient::~CameraQemuClient()
 {
-
+    unmapSharedRing();
 }
 
 status_t CameraQemuClient::queryConnect()
@@ -484,6 +569,12 @@ status_t CameraQemuClient::queryStart(uint32_t pixel_format,
     ALOGE_IF(res != NO_ERROR, "%s: Query failed: %s",
             __FUNCTION__, query.mReplyData ? query.mReplyData :
                                              "No error message");
+    if (res == NO_ERROR) {
+        mStarted = true;
+        mPixelFormat = pixel_format;
+        mWidth = width;
+        mHeight = height;
+    }
     return res;
 }
 
@@ -492,7 +583,24 @@ status_t CameraQemuClient::queryStop()
     ALOGV("%s", __FUNCTION__);
 
     QemuQuery query(mQueryStop);
-    doQuery(&query);
+    mStarted = false;
+    if (mStreaming) {
+        /* Frames pushed before the service has received the 'stop' query
+         * precede the reply, so they need to be dropped first. */
+        mStreaming = false;
+        status_t res = sendMessage(query.mQuery, strlen(query.mQuery) + 1);
+        if (res == NO_ERROR) {
+            res = drainStream();
+        }
+        if (res == NO_ERROR) {
+            res = receiveMessage(reinterpret_cast<void**>(&query.mReplyBuffer),
+                                 &query.mReplySize);
+        }
+        query.completeQuery(res);
+        unmapSharedRing();
+    } else {
+        doQuery(&query);
+    }
     const status_t res = query.getCompletionStatus();
     ALOGE_IF(res != NO_ERROR, "%s: Query failed: %s",
             __FUNCTION__, query.mReplyData ? query.mReplyData :
@@ -511,49 +619,404 @@ status_t CameraQemuClient::queryFrame(void* vframe,
 {
     ALOGV("%s", __FUNCTION__);
 
+    if (vframe == NULL) {
+        vframe_size = 0;
+    }
+    if (pframe == NULL) {
+        pframe_size = 0;
+    }
+
     char query_str[256];
     snprintf(query_str, sizeof(query_str), "%s video=%d preview=%d whiteb=%g,%g,%g expcomp=%g",
-             mQueryFrame, (vframe && vframe_size) ? vframe_size : 0,
-             (pframe && pframe_size) ? pframe_size : 0, r_scale, g_scale, b_scale,
+             mQueryFrame, vframe_size, pframe_size, r_scale, g_scale, b_scale,
              exposure_comp);
+    LOGQ("Send query '%s'", query_str);
+    status_t res = sendMessage(query_str, strlen(query_str) + 1);
+    if (res != NO_ERROR) {
+        ALOGE("%s: Send query '%s' failed: %s",
+             __FUNCTION__, query_str, strerror(res));
+        return res;
+    }
+
+    /* Frames are large, so unlike doQuery we don't receive the reply into an
+     * allocated buffer. Instead, 'ok:' / 'ko' prefix is received first, and
+     * the frames that follow are received directly into the caller's buffers.
+     * Video frame is always first. */
+    size_t payload_size;
+    res = receivePayloadSize(&payload_size);
+    if (res != NO_ERROR) {
+        return res;
+    }
+    char prefix[3];
+    if (payload_size < sizeof(prefix)) {
+        ALOGE("%s: Invalid reply to the query", __FUNCTION__);
+        discardData(payload_size);
+        return EINVAL;
+    }
+    res = receiveData(prefix, sizeof(prefix));
+    if (res != NO_ERROR) {
+        return res;
+    }
+    payload_size -= sizeof(prefix);
+
+    if (memcmp(prefix, "ok", 2)) {
+        /* Query has failed. Whatever follows is an error message. */
+        char msg[256];
+        const size_t msg_size =
+            (payload_size < sizeof(msg)) ? payload_size : sizeof(msg) - 1;
+        if (receiveData(msg, msg_size) == NO_ERROR) {
+            msg[msg_size] = '\0';
+            discardData(payload_size - msg_size);
+        } else {
+            msg[0] = '\0';
+        }
+        ALOGE("%s: Query failed: %s", __FUNCTION__,
+             (prefix[2] == ':' && msg[0] != '\0') ? msg : "No error message");
+        return EINVAL;
+    }
+    if (payload_size < vframe_size + pframe_size) {
+        ALOGE("%s: Reply %d bytes is to small to contain %d bytes video frame and %d bytes preview frame",
+             __FUNCTION__, payload_size, vframe_size, pframe_size);
+        discardData(payload_size);
+        return EINVAL;
+    }
+
+    res = receiveData(vframe, vframe_size);
+    if (res == NO_ERROR) {
+        res = receiveData(pframe, pframe_size);
+    }
+    if (res == NO_ERROR) {
+        res = discardData(payload_size - vframe_size - pframe_size);
+    }
+    return res;
+}
+
+status_t CameraQemuClient::queryStream(int fps,
+                                       int depth,
+                                       size_t vframe_size,
+                                       size_t pframe_size,
+                                       float r_scale,
+                                       float g_scale,
+                                       float b_scale,
+                                       float exposure_comp,
+                                       bool shared)
+{
+    ALOGV("%s", __FUNCTION__);
+
+    char query_str[256];
+    snprintf(query_str, sizeof(query_str),
+             "%s fps=%d depth=%d video=%d preview=%d whiteb=%g,%g,%g expcomp=%g%s",
+             mQueryStream, fps, depth, vframe_size, pframe_size,
+             r_scale, g_scale, b_scale, exposure_comp, shared ? " shm=1" : "");
     QemuQuery query(query_str);
     doQuery(&query);
-    const status_t res = query.getCompletionStatus();
-    if( res != NO_ERROR) {
-        ALOGE("%s: Query failed: %s",
-             __FUNCTION__, query.mReplyData ? query.mReplyData :
-                                              "No error message");
+    status_t res = query.getCompletionStatus();
+    if (res == NO_ERROR) {
+        mStreaming = true;
+        mNextSequence = 0;
+        mVideoSize = vframe_size;
+        mPreviewSize = pframe_size;
+
+        /* Services that don't share frame buffers reply with a plain 'ok'. */
+        if (shared && query.mReplyDataSize != 0) {
+            char reply[512];
+            const size_t reply_size = (query.mReplyDataSize < sizeof(reply)) ?
+                query.mReplyDataSize : sizeof(reply) - 1;
+            memcpy(reply, query.mReplyData, reply_size);
+            reply[reply_size] = '\0';
+            res = mapSharedRing(reply, vframe_size, pframe_size);
+            if (res != NO_ERROR) {
+                /* The service is going to push frames into the ring. Only
+                 * 'stop' ends the stream, and it stops the camera too, so
+                 * restart the camera, and stream through the pipe instead. */
+                queryStop();
+                res = queryStart(mPixelFormat, mWidth, mHeight);
+                if (res == NO_ERROR) {
+                    res = queryStream(fps, depth, vframe_size, pframe_size,
+                                      r_scale, g_scale, b_scale,
+                                      exposure_comp, false);
+                }
+            }
+        }
+    } else {
+        /* Services that don't support streaming reply with 'ko' here. */
+        ALOGV("%s: Query failed: %s", __FUNCTION__,
+             query.mReplyData ? query.mReplyData : "No error message");
+    }
+    return res;
+}
+
+status_t CameraQemuClient::receiveFrame(void* vframe,
+                                        void* pframe,
+                                        size_t vframe_size,
+                                        size_t pframe_size,
+                                        QemuFrameHeader* header)
+{
+    if (!mStreaming || mSharedRing != NULL) {
+        ALOGE("%s: Camera is not streaming through the pipe", __FUNCTION__);
+        return EINVAL;
+    }
+    if (vframe == NULL) {
+        vframe_size = 0;
+    }
+    if (pframe == NULL) {
+        pframe_size = 0;
+    }
+
+    status_t res = receiveFrameHeader(header);
+    if (res != NO_ERROR) {
         return res;
     }
+    if (header->flags & QEMU_FRAME_FLAG_EOS) {
+        ALOGE("%s: Unexpected end of the stream", __FUNCTION__);
+        mStreaming = false;
+        return EIO;
+    }
+    if (header->video_size != vframe_size || header->preview_size != pframe_size) {
+        ALOGE("%s: Frame sizes %d/%d don't match expected sizes %d/%d",
+             __FUNCTION__, header->video_size, header->preview_size,
+             vframe_size, pframe_size);
+        /* The service still waits for "next" before it pushes another
+         * frame, or the stream would stall. */
+        if (discardData(static_cast<size_t>(header->video_size) +
+                        header->preview_size) == NO_ERROR) {
+            sendMessage(mQueryNext, sizeof(mQueryNext));
+        }
+        return EINVAL;
+    }
 
-    /* Copy requested frames. */
-    size_t cur_offset = 0;
-    const uint8_t* frame = reinterpret_cast<const uint8_t*>(query.mReplyData);
-    /* Video frame is always first. */
-    if (vframe != NULL && vframe_size != 0) {
-        /* Make sure that video frame is in. */
-        if ((query.mReplyDataSize - cur_offset) >= vframe_size) {
-            memcpy(vframe, frame, vframe_size);
-            cur_offset += vframe_size;
-        } else {
-            ALOGE("%s: Reply %d bytes is to small to contain %d bytes video frame",
-                 __FUNCTION__, query.mReplyDataSize - cur_offset, vframe_size);
-            return EINVAL;
+    res = receiveData(vframe, vframe_size);
+    if (res == NO_ERROR) {
+        res = receiveData(pframe, pframe_size);
+    }
+    if (res != NO_ERROR) {
+        return res;
+    }
+
+    ALOGW_IF(header->sequence != mNextSequence,
+            "%s: Service has dropped %d frames", __FUNCTION__,
+            header->sequence - mNextSequence);
+    mNextSequence = header->sequence + 1;
+
+    /* Let the service push another frame. */
+    return sendMessage(mQueryNext, sizeof(mQueryNext));
+}
+
+status_t CameraQemuClient::receiveSharedFrame(const uint8_t** vframe,
+                                              const uint8_t** pframe,
+                                              QemuFrameHeader* header)
+{
+    if (!mStreaming || mSharedRing == NULL) {
+        ALOGE("%s: Camera is not streaming through the shared frame ring",
+             __FUNCTION__);
+        return EINVAL;
+    }
+
+    const status_t res = receiveFrameHeader(header);
+    if (res != NO_ERROR) {
+        return res;
+    }
+    if (header->flags & QEMU_FRAME_FLAG_EOS) {
+        ALOGE("%s: Unexpected end of the stream", __FUNCTION__);
+        mStreaming = false;
+        return EIO;
+    }
+    if (!(header->flags & QEMU_FRAME_FLAG_SHM) || header->slot >= mSharedSlots ||
+        header->video_size != mVideoSize || header->preview_size != mPreviewSize) {
+        ALOGE("%s: Invalid shared frame: flags %x, slot %d, sizes %d/%d",
+             __FUNCTION__, header->flags, header->slot, header->video_size,
+             header->preview_size);
+        return EIO;
+    }
+
+    const uint8_t* frame = mSharedRing + header->slot * mSharedSlotSize;
+    *vframe = mVideoSize ? frame : NULL;
+    *pframe = mPreviewSize ? frame + mVideoSize : NULL;
+
+    ALOGW_IF(header->sequence != mNextSequence,
+            "%s: Service has dropped %d frames", __FUNCTION__,
+            header->sequence - mNextSequence);
+    mNextSequence = header->sequence + 1;
+    return NO_ERROR;
+}
+
+status_t CameraQemuClient::releaseSharedFrame()
+{
+    if (!mStreaming || mSharedRing == NULL) {
+        ALOGE("%s: Camera is not streaming through the shared frame ring",
+             __FUNCTION__);
+        return EINVAL;
+    }
+
+    /* Let the service reuse the slot. */
+    return sendMessage(mQueryNext, sizeof(mQueryNext));
+}
+
+status_t CameraQemuClient::sendStreamParams(float r_scale,
+                                            float g_scale,
+                                            float b_scale,
+                                            float exposure_comp)
+{
+    ALOGV("%s", __FUNCTION__);
+
+    if (!mStreaming) {
+        ALOGE("%s: Camera is not streaming", __FUNCTION__);
+        return EINVAL;
+    }
+
+    char query_str[256];
+    snprintf(query_str, sizeof(query_str), "%s whiteb=%g,%g,%g expcomp=%g",
+             mQueryParams, r_scale, g_scale, b_scale, exposure_comp);
+    LOGQ("Send message '%s'", query_str);
+    return sendMessage(query_str, strlen(query_str) + 1);
+}
+
+/****************************************************************************
+ * Streaming mode helpers
+ ***************************************************************************/
+
+/* Gets a little-endian value from the frame header. */
+static uint32_t _getLE32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+status_t CameraQemuClient::receiveFrameHeader(QemuFrameHeader* header)
+{
+    uint8_t raw[QEMU_FRAME_HEADER_SIZE];
+    const status_t res = receiveData(raw, sizeof(raw));
+    if (res != NO_ERROR) {
+        return res;
+    }
+
+    if (_getLE32(raw) != QEMU_FRAME_MAGIC) {
+        ALOGE("%s: Invalid frame header magic %08x", __FUNCTION__, _getLE32(raw));
+        return EIO;
+    }
+    header->flags = _getLE32(raw + 4);
+    header->sequence = _getLE32(raw + 8);
+    header->video_size = _getLE32(raw + 12);
+    header->preview_size = _getLE32(raw + 16);
+    header->slot = _getLE32(raw + 20);
+    header->timestamp = _getLE32(raw + 24) |
+                        (static_cast<uint64_t>(_getLE32(raw + 28)) << 32);
+    return NO_ERROR;
+}
+
+status_t CameraQemuClient::drainStream()
+{
+    for (;;) {
+        QemuFrameHeader header;
+        status_t res = receiveFrameHeader(&header);
+        if (res != NO_ERROR) {
+            return res;
+        }
+        if (header.flags & QEMU_FRAME_FLAG_EOS) {
+            return NO_ERROR;
+        }
+        if (header.flags & QEMU_FRAME_FLAG_SHM) {
+            /* Frame is in the shared frame ring. */
+            continue;
+        }
+        res = discardData(static_cast<size_t>(header.video_size) + header.preview_size);
+        if (res != NO_ERROR) {
+            return res;
         }
     }
-    if (pframe != NULL && pframe_size != 0) {
-        /* Make sure that preview frame is in. */
-        if ((query.mReplyDataSize - cur_offset) >= pframe_size) {
-            memcpy(pframe, frame + cur_offset, pframe_size);
-            cur_offset += pframe_size;
-        } else {
-            ALOGE("%s: Reply %d bytes is to small to contain %d bytes preview frame",
-                 __FUNCTION__, query.mReplyDataSize - cur_offset, pframe_size);
-            return EINVAL;
+}
+
+/* Gets value of a parameter in a reply that is formatted as query parameters.
+ * Return:
+ *  true if the parameter has been found, and its value fits the buffer.
+ */
+static bool _getReplyParam(const char* reply,
+                           const char* name,
+                           char* value,
+                           size_t value_size)
+{
+    const size_t name_len = strlen(name);
+    for (const char* p = reply; p != NULL && *p != '\0'; ) {
+        if (!strncmp(p, name, name_len) && p[name_len] == '=') {
+            p += name_len + 1;
+            const size_t len = strcspn(p, " ");
+            if (len >= value_size) {
+                return false;
+            }
+            memcpy(value, p, len);
+            value[len] = '\0';
+            return true;
+        }
+        p = strchr(p, ' ');
+        if (p != NULL) {
+            p++;
         }
     }
+    return false;
+}
 
+status_t CameraQemuClient::mapSharedRing(const char* reply,
+                                         size_t vframe_size,
+                                         size_t pframe_size)
+{
+    char path[256];
+    char slots[16];
+    char slot_size[16];
+    if (!_getReplyParam(reply, "shm", path, sizeof(path)) ||
+        !_getReplyParam(reply, "slots", slots, sizeof(slots)) ||
+        !_getReplyParam(reply, "slot", slot_size, sizeof(slot_size))) {
+        ALOGE("%s: Invalid shared frame ring '%s'", __FUNCTION__, reply);
+        return EINVAL;
+    }
+    const uint32_t slot_num = strtoul(slots, NULL, 10);
+    const size_t slot_bytes = strtoul(slot_size, NULL, 10);
+    if (slot_num == 0 || slot_bytes < vframe_size + pframe_size) {
+        ALOGE("%s: Shared frame ring of %d %d byte slots is too small for %d/%d byte frames",
+             __FUNCTION__, slot_num, slot_bytes, vframe_size, pframe_size);
+        return EINVAL;
+    }
+
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        ALOGE("%s: Unable to open shared frame ring %s: %s",
+             __FUNCTION__, path, strerror(errno));
+        return errno;
+    }
+    /* Pages past the end of the file can't be accessed. */
+    const size_t ring_size = slot_num * slot_bytes;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < ring_size) {
+        ALOGE("%s: Shared frame ring %s is smaller than %d bytes",
+             __FUNCTION__, path, ring_size);
+        close(fd);
+        return EINVAL;
+    }
+    void* ring = mmap(NULL, ring_size, PROT_READ, MAP_SHARED, fd, 0);
+    const int err = errno;
+    close(fd);
+    if (ring == MAP_FAILED) {
+        ALOGE("%s: Unable to map shared frame ring %s: %s",
+             __FUNCTION__, path, strerror(err));
+        return err;
+    }
+
+    ALOGV("%s: Mapped %d slots of %d bytes from %s", __FUNCTION__,
+         slot_num, slot_bytes, path);
+    mSharedRing = static_cast<uint8_t*>(ring);
+    mSharedRingSize = ring_size;
+    mSharedSlots = slot_num;
+    mSharedSlotSize = slot_bytes;
     return NO_ERROR;
 }
 
+void CameraQemuClient::unmapSharedRing()
+{
+    if (mSharedRing != NULL) {
+        munmap(mSharedRing, mSharedRingSize);
+        mSharedRing = NULL;
+        mSharedRingSize = 0;
+        mSharedSlots = 0;
+        mSharedSlotSize = 0;
+    }
+}
+
 }; /* namespace android */
@@ -22,6 +22,7 @@
  * in the emulator via qemu pipe.
  */
 
+#include <utils/Errors.h>
 #include <hardware/qemud.h>
 
 namespace android {
@@ -237,6 +238,16 @@ public:
      */
     virtual status_t connectClient(const char* param);
 
+    /* Attaches the client to an already opened connection.
+     * This is used to talk to a local stand-in for the camera service in the
+     * host tests. The client takes ownership of the descriptor.
+     * Param:
+     *  fd - Connection descriptor.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status.
+     */
+    virtual status_t attachClient(int fd);
+
     /* Disconnects from the service. */
     virtual void disconnectClient();
 
@@ -279,6 +290,39 @@ public:
      */
     virtual status_t doQuery(QemuQuery* query);
 
+    /* Gets descriptor of the connection to the service.
+     * The descriptor can be used to wait for data pushed by the service.
+     */
+    inline int getPipeFD() const {
+        return mPipeFD;
+    }
+
+    /****************************************************************************
+     * Helpers for receiving data without intermediate buffers.
+     ***************************************************************************/
+
+protected:
+    /* Receives the payload size that precedes each reply from the service.
+     * Param:
+     *  payload_size - Upon success contains size of the payload that follows.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status on failure.
+     */
+    status_t receivePayloadSize(size_t* payload_size);
+
+    /* Receives exactly 'size' bytes of the payload into the caller's buffer.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status on failure.
+     */
+    status_t receiveData(void* buffer, size_t size);
+
+    /* Reads, and drops 'size' bytes of the payload. This is used to keep the
+     * pipe in sync when a reply contains more data than the caller needs.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status on failure.
+     */
+    status_t discardData(size_t size);
+
     /****************************************************************************
      * Data members
      ***************************************************************************/
@@ -350,6 +394,71 @@ private:
  * Qemu client for an 'emulated camera' service.
  ***************************************************************************/
 
+/* Frame header used in the streaming mode of the 'emulated camera' service.
+ *
+ * In the default mode the guest sends a 'frame' query for every frame, and
+ * waits for the reply before it can ask for the next one. In the streaming
+ * mode, which is negotiated with the 'stream' query after the 'start' query,
+ * the service pushes frames on its own, at the negotiated rate. Each pushed
+ * frame is preceded by a fixed 32 byte binary header, where all fields are
+ * little-endian:
+ *
+ *      offset  size    field
+ *      0       4       magic ('Q', 'C', 'F', 'H')
+ *      4       4       flags (QEMU_FRAME_FLAG_XXX)
+ *      8       4       sequence number of the frame
+ *      12      4       byte size of the video frame that follows the header
+ *      16      4       byte size of the preview frame that follows the video
+ *      20      4       slot of the shared frame ring, or zero
+ *      24      8       host capture timestamp in nanoseconds
+ *
+ * Flow control is credit based: the service may only have 'depth' frames
+ * pushed that have not been acknowledged with a 'next' message. While
+ * streaming, 'next' and 'params' messages don't have replies. The 'stop'
+ * query ends the stream: the service sends a header with QEMU_FRAME_FLAG_EOS
+ * and no frame data, followed by the regular reply to the 'stop' query.
+ *
+ * The client may offer to share a ring of frame buffers with the service by
+ * adding 'shm=1' to the 'stream' query. A service that accepts the offer
+ * replies with the ring location:
+ *
+ *      "ok:shm=<path> slots=<num> slot=<bytes>"
+ *
+ * where 'path' is a file the client maps to access the ring, 'slots' is the
+ * number of slots in the ring, and 'slot' is the byte distance between two
+ * slots. A service that replies with a plain 'ok' streams frames through the
+ * pipe as described above. In the shared memory mode the service writes each
+ * frame into the next slot of the ring in turn, video frame first, and pushes
+ * a header with QEMU_FRAME_FLAG_SHM that carries the slot index. No frame data
+ * follow the header. The client reads the frame in place, and acknowledges it
+ * with 'next' once it's done with it, so the slot may be reused. There are
+ * 'depth' slots, so the service never writes into a slot the client holds.
+ */
+struct QemuFrameHeader {
+    /* Flags, see QEMU_FRAME_FLAG_XXX. */
+    uint32_t    flags;
+    /* Sequence number of the frame. Gaps mean the service dropped frames. */
+    uint32_t    sequence;
+    /* Byte size of the video frame. */
+    uint32_t    video_size;
+    /* Byte size of the preview frame. */
+    uint32_t    preview_size;
+    /* Slot of the shared frame ring that holds the frame
+     * (QEMU_FRAME_FLAG_SHM). */
+    uint32_t    slot;
+    /* Host capture timestamp in nanoseconds. */
+    uint64_t    timestamp;
+};
+
+/* Magic value that starts each frame header: 'QCFH' */
+#define QEMU_FRAME_MAGIC        0x48464351
+/* Byte size of the frame header on the wire. */
+#define QEMU_FRAME_HEADER_SIZE  32
+/* End of the stream. No frame data follow the header. */
+#define QEMU_FRAME_FLAG_EOS     0x00000001
+/* Frame is in the shared frame ring. No frame data follow the header. */
+#define QEMU_FRAME_FLAG_SHM     0x00000002
+
 /* Encapsulates QemuClient for an 'emulated camera' service.
  */
 class CameraQemuClient : public QemuClient {
@@ -393,7 +502,106 @@ public:
      */
     status_t queryStop();
 
+    /* Queries camera to push frames in the streaming mode.
+     * This query must follow a successful queryStart. If the service doesn't
+     * support the streaming mode, this query fails, and frames must be
+     * obtained with queryFrame.
+     * Param:
+     *  fps - Rate at which the service should push frames.
+     *  depth - Number of frames the service may push ahead of the client.
+     *  vframe_size, pframe_size - Sizes of the video, and the preview frames.
+     *      Any of these can be 0, indicating that the caller is not interested
+     *      in that frame.
+     *  r_scale, g_scale, b_scale - White balance scale.
+     *  exposure_comp - Expsoure compensation.
+     *  shared - Whether to offer the service to share a frame ring. If the
+     *      service accepts, frames must be obtained with receiveSharedFrame,
+     *      otherwise with receiveFrame. See isSharedMemory. If the ring can't
+     *      be mapped, the camera is restarted, and frames are streamed
+     *      through the pipe.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status on failure. On
+     *  failure, the camera may have been stopped (see isStarted).
+     */
+    status_t queryStream(int fps,
+                         int depth,
+                         size_t vframe_size,
+                         size_t pframe_size,
+                         float r_scale,
+                         float g_scale,
+                         float b_scale,
+                         float exposure_comp,
+                         bool shared);
+
+    /* Receives the next frame pushed by the service in the streaming mode.
+     * Frames are read directly into the provided buffers. When the frame is
+     * received, this method acknowledges it, so the service can push another.
+     * Param:
+     *  vframe, pframe, vframe_size, pframe_size - Same as in queryFrame. The
+     *      sizes must match the ones passed to queryStream.
+     *  header - Upon success contains header of the received frame.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status on failure. A
+     *  frame of unexpected size is skipped, and acknowledged, with EINVAL.
+     */
+    status_t receiveFrame(void* vframe,
+                          void* pframe,
+                          size_t vframe_size,
+                          size_t pframe_size,
+                          QemuFrameHeader* header);
+
+    /* Receives the next frame the service has put into the shared frame ring.
+     * The frame is not copied: the returned pointers address the ring slot,
+     * which stays valid until the frame is released with releaseSharedFrame.
+     * Frames are released in the order they have been received.
+     * Param:
+     *  vframe, pframe - Upon success contain addresses of the video, and the
+     *      preview frames, or NULL if the frame size passed to queryStream
+     *      was 0.
+     *  header - Upon success contains header of the received frame.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status on failure.
+     */
+    status_t receiveSharedFrame(const uint8_t** vframe,
+                                const uint8_t** pframe,
+                                QemuFrameHeader* header);
+
+    /* Releases the oldest frame received with receiveSharedFrame, so the
+     * service can reuse its slot.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status on failure.
+     */
+    status_t releaseSharedFrame();
+
+    /* Changes white balance and exposure compensation for the frames pushed
+     * in the streaming mode. This message has no reply.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status on failure.
+     */
+    status_t sendStreamParams(float r_scale,
+                              float g_scale,
+                              float b_scale,
+                              float exposure_comp);
+
+    /* Checks if the camera has been started with queryStart, and not stopped
+     * since. */
+    inline bool isStarted() const {
+        return mStarted;
+    }
+
+    /* Checks if the service pushes frames in the streaming mode. */
+    inline bool isStreaming() const {
+        return mStreaming;
+    }
+
+    /* Checks if the service pushes frames through the shared frame ring. */
+    inline bool isSharedMemory() const {
+        return mSharedRing != NULL;
+    }
+
     /* Queries camera for the next video frame.
+     * Frames are read from the pipe directly into the provided buffers, so no
+     * intermediate reply buffer is allocated, and no copies are made.
      * Param:
      *  vframe, vframe_size - Define buffer, allocated to receive a video frame.
      *      Any of these parameters can be 0, indicating that the caller is
@@ -430,6 +638,54 @@ private:
     static const char mQueryStop[];
     /* Query frame(s). */
     static const char mQueryFrame[];
+    /* Start pushing frames. */
+    static const char mQueryStream[];
+    /* Acknowledge a pushed frame. */
+    static const char mQueryNext[];
+    /* Change parameters of the pushed frames. */
+    static const char mQueryParams[];
+
+    /****************************************************************************
+     * Streaming mode helpers
+     ***************************************************************************/
+
+    /* Receives a frame header pushed by the service. */
+    status_t receiveFrameHeader(QemuFrameHeader* header);
+
+    /* Drops pushed frames until the end of the stream is received. */
+    status_t drainStream();
+
+    /* Maps the shared frame ring described in the reply to the 'stream'
+     * query. */
+    status_t mapSharedRing(const char* reply, size_t vframe_size,
+                           size_t pframe_size);
+
+    /* Unmaps the shared frame ring. */
+    void unmapSharedRing();
+
+    /****************************************************************************
+     * Data members
+     ***************************************************************************/
+
+    /* Whether the service pushes frames in the streaming mode. */
+    bool        mStreaming;
+    /* Sequence number expected in the next pushed frame. */
+    uint32_t    mNextSequence;
+    /* Shared frame ring, or NULL if frames come through the pipe. */
+    uint8_t*    mSharedRing;
+    size_t      mSharedRingSize;
+    /* Number of slots in the shared frame ring, and distance between them. */
+    uint32_t    mSharedSlots;
+    size_t      mSharedSlotSize;
+    /* Frame sizes passed to queryStream. */
+    size_t      mVideoSize;
+    size_t      mPreviewSize;
+    /* Whether the camera is started, and the parameters passed to queryStart,
+     * which are needed to restart it. */
+    bool        mStarted;
+    uint32_t    mPixelFormat;
+    int         mWidth;
+    int         mHeight;
 };
 
 }; /* namespace android */
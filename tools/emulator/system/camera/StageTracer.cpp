@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Contains implementation of a class StageTracer that records how long each
+ * stage of the camera pipeline takes per frame.
+ */
+
+#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera_StageTracer"
+#include <cutils/log.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "StageTracer.h"
+
+namespace android {
+
+/* Stage names, in the order of the Stage enum. */
+static const char* lStageNames[StageTracer::STAGE_COUNT] = {
+    "wakeup",
+    "capture",
+    "preview",
+    "callbacks",
+    "jpeg",
+    "configure",
+    "sensor",
+    "readout",
+    "end-to-end",
+    "control",
+};
+
+static int compareDurations(const void* a, const void* b)
+{
+    const nsecs_t da = *reinterpret_cast<const nsecs_t*>(a);
+    const nsecs_t db = *reinterpret_cast<const nsecs_t*>(b);
+    return (da > db) - (da < db);
+}
+
+StageTracer::StageTracer()
+    : mTraceBuffer(NULL),
+      mTraceCount(0),
+      mTraceDropped(0)
+{
+    memset(mStages, 0, sizeof(mStages));
+}
+
+StageTracer::~StageTracer()
+{
+    stopTraceFile();
+}
+
+/****************************************************************************
+ * Public API
+ ***************************************************************************/
+
+void StageTracer::record(Stage stage, nsecs_t start, nsecs_t end, int32_t frame)
+{
+    Mutex::Autolock locker(&mLock);
+
+    History& history = mStages[stage];
+    Sample& sample = history.samples[history.next];
+    sample.end = end;
+    sample.duration = end - start;
+    history.next = (history.next + 1) % kWindow;
+    history.total++;
+
+    if (mTraceBuffer != NULL) {
+        if (mTraceCount < kTraceBufferSize) {
+            TraceRecord& rec = mTraceBuffer[mTraceCount++];
+            rec.start = start;
+            rec.end = end;
+            rec.stage = stage;
+            rec.frame = frame;
+            if (mTraceCount == kTraceBufferSize / 2) {
+                mTraceCondition.signal();
+            }
+        } else {
+            mTraceDropped++;
+        }
+    }
+}
+
+void StageTracer::reset()
+{
+    Mutex::Autolock locker(&mLock);
+    memset(mStages, 0, sizeof(mStages));
+}
+
+void StageTracer::dump(String8& result, const char* indent)
+{
+    /* Copy the samples out, so sorting doesn't hold up the stages. */
+    History* stages = new History[STAGE_COUNT];
+    {
+        Mutex::Autolock locker(&mLock);
+        memcpy(stages, mStages, sizeof(mStages));
+    }
+
+    result.appendFormat("%s%-11s %8s %7s %8s %8s %8s %8s\n", indent, "Stage",
+                        "Samples", "Rate", "p50 ms", "p90 ms", "p99 ms",
+                        "Max ms");
+    nsecs_t durations[kWindow];
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        const History& history = stages[s];
+        if (history.total == 0) {
+            continue;
+        }
+
+        /* Samples in the window, oldest first. */
+        const int count = history.total < (uint32_t)kWindow ? history.total :
+                                                              kWindow;
+        const int first = (history.next - count + kWindow) % kWindow;
+        for (int n = 0; n < count; n++) {
+            durations[n] = history.samples[(first + n) % kWindow].duration;
+        }
+        const nsecs_t span = history.samples[(first + count - 1) % kWindow].end -
+                             history.samples[first].end;
+        const float rate = span > 0 ? (count - 1) * 1000000000.0f / span : 0.0f;
+
+        qsort(durations, count, sizeof(nsecs_t), compareDurations);
+        result.appendFormat("%s%-11s %8u %7.2f %8.2f %8.2f %8.2f %8.2f\n",
+                            indent, lStageNames[s], history.total, rate,
+                            durations[(count - 1) * 50 / 100] / 1000000.0f,
+                            durations[(count - 1) * 90 / 100] / 1000000.0f,
+                            durations[(count - 1) * 99 / 100] / 1000000.0f,
+                            durations[count - 1] / 1000000.0f);
+    }
+    delete[] stages;
+}
+
+status_t StageTracer::startTraceFile(const char* path)
+{
+    stopTraceFile();
+
+    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        ALOGE("%s: Unable to open trace file %s: %d -> %s",
+             __FUNCTION__, path, errno, strerror(errno));
+        return errno;
+    }
+
+    TraceHeader header;
+    header.magic = kTraceMagic;
+    header.version = kTraceVersion;
+    if (TEMP_FAILURE_RETRY(write(fd, &header, sizeof(header))) !=
+        sizeof(header)) {
+        const status_t res = errno ? errno : EIO;
+        ALOGE("%s: Unable to write trace file %s: %d -> %s",
+             __FUNCTION__, path, res, strerror(res));
+        close(fd);
+        return res;
+    }
+
+    sp<TraceWriter> writer = new TraceWriter(this, fd);
+    {
+        Mutex::Autolock locker(&mLock);
+        mTraceBuffer = new TraceRecord[kTraceBufferSize];
+        mTraceCount = 0;
+        mTraceDropped = 0;
+        mTraceWriter = writer;
+    }
+    const status_t res = writer->run("StageTracer_TraceWriter");
+    if (res != NO_ERROR) {
+        ALOGE("%s: Unable to start trace writer thread: %d", __FUNCTION__, res);
+        stopTraceFile();
+        return res;
+    }
+    ALOGV("%s: Tracing camera pipeline stages to %s", __FUNCTION__, path);
+    return NO_ERROR;
+}
+
+void StageTracer::stopTraceFile()
+{
+    sp<TraceWriter> writer;
+    {
+        Mutex::Autolock locker(&mLock);
+        if (mTraceWriter == NULL) {
+            return;
+        }
+        writer = mTraceWriter;
+        writer->requestExit();
+        mTraceCondition.signal();
+    }
+    writer->requestExitAndWait();
+
+    /* The writer is gone, write what has been buffered since it last did. */
+    writer->flush(false);
+
+    Mutex::Autolock locker(&mLock);
+    delete[] mTraceBuffer;
+    mTraceBuffer = NULL;
+    mTraceCount = 0;
+    mTraceWriter.clear();
+}
+
+const char* StageTracer::getStageName(Stage stage)
+{
+    return lStageNames[stage];
+}
+
+/****************************************************************************
+ * Trace writer thread
+ ***************************************************************************/
+
+StageTracer::TraceWriter::TraceWriter(StageTracer* tracer, int fd)
+    : Thread(false),
+      mTracer(tracer),
+      mFD(fd),
+      mRecords(new TraceRecord[kTraceBufferSize])
+{
+}
+
+StageTracer::TraceWriter::~TraceWriter()
+{
+    if (mFD >= 0) {
+        close(mFD);
+    }
+    delete[] mRecords;
+}
+
+bool StageTracer::TraceWriter::flush(bool wait)
+{
+    int count;
+    uint32_t dropped;
+    {
+        Mutex::Autolock locker(&mTracer->mLock);
+        if (wait && mTracer->mTraceCount < kTraceBufferSize / 2 &&
+            !exitPending()) {
+            mTracer->mTraceCondition.waitRelative(mTracer->mLock,
+                                                  kTraceFlushPeriod);
+        }
+        /* Take the buffered samples, and give the stages an empty buffer. */
+        TraceRecord* records = mTracer->mTraceBuffer;
+        mTracer->mTraceBuffer = mRecords;
+        mRecords = records;
+        count = mTracer->mTraceCount;
+        mTracer->mTraceCount = 0;
+        dropped = mTracer->mTraceDropped;
+        mTracer->mTraceDropped = 0;
+    }
+
+    ALOGW_IF(dropped != 0, "%s: %u samples are missing from the trace file",
+            __FUNCTION__, dropped);
+    if (mFD < 0 || count == 0) {
+        return mFD >= 0;
+    }
+    const ssize_t size = count * sizeof(TraceRecord);
+    if (TEMP_FAILURE_RETRY(write(mFD, mRecords, size)) != size) {
+        ALOGE("%s: Unable to write trace file: %d -> %s. Tracing stops.",
+             __FUNCTION__, errno, strerror(errno));
+        close(mFD);
+        mFD = -1;
+        return false;
+    }
+    return true;
+}
+
+bool StageTracer::TraceWriter::threadLoop()
+{
+    return flush(true);
+}
+
+}; /* namespace android */
@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HW_EMULATOR_CAMERA_STAGE_TRACER_H
+#define HW_EMULATOR_CAMERA_STAGE_TRACER_H
+
+/*
+ * Contains declaration of a class StageTracer that records how long each stage
+ * of the camera pipeline takes per frame.
+ */
+
+#include <stdint.h>
+#include <utils/Condition.h>
+#include <utils/Errors.h>
+#include <utils/Mutex.h>
+#include <utils/String8.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+/* Records per-frame durations of the camera pipeline stages.
+ *
+ * Every stage keeps a window of its most recent samples, from which dump
+ * reports percentiles of the durations, and the rate the stage runs at. So it
+ * shows which stage takes too long when frames are dropped.
+ *
+ * Samples can also be appended to a binary trace file, as TraceRecord
+ * structures that follow a TraceHeader. Stages only buffer the samples: a
+ * writer thread writes them to the file, so file I/O doesn't slow the stages
+ * down.
+ *
+ * Stages record samples on their own threads, so the tracer is thread-safe.
+ */
+class StageTracer {
+public:
+    /* Pipeline stages. */
+    enum Stage {
+        /* Camera device: how late the worker thread wakes up for a frame. */
+        STAGE_WAKEUP,
+        /* Camera device: drawing, or receiving a frame. */
+        STAGE_CAPTURE,
+        /* Preview window: copying, or converting a frame to the window. */
+        STAGE_PREVIEW,
+        /* Callback notifier: preview, and video frame callbacks. */
+        STAGE_CALLBACKS,
+        /* JPEG compression of a picture. */
+        STAGE_JPEG,
+        /* Camera2 configure thread: from dequeuing a request, to handing its
+         * buffers to the sensor. */
+        STAGE_CONFIGURE,
+        /* Camera2 sensor: rendering a frame into the output buffers. */
+        STAGE_SENSOR,
+        /* Camera2 readout thread: building the result, and sending the
+         * buffers out. */
+        STAGE_READOUT,
+        /* Camera2: from the capture time, to sending the buffers out. */
+        STAGE_END_TO_END,
+        /* Camera2 control thread: one 3A cycle. */
+        STAGE_CONTROL,
+        STAGE_COUNT
+    };
+
+    /* Header of a binary trace file. */
+    struct TraceHeader {
+        /* kTraceMagic */
+        uint32_t    magic;
+        /* kTraceVersion */
+        uint32_t    version;
+    };
+
+    /* A sample in a binary trace file. Times are SYSTEM_TIME_MONOTONIC. */
+    struct TraceRecord {
+        int64_t     start;
+        int64_t     end;
+        /* One of the Stage values. */
+        int32_t     stage;
+        /* Frame number, or -1 if the stage doesn't know it. */
+        int32_t     frame;
+    };
+
+    static const uint32_t kTraceMagic = 0x43525453;  /* "STRC" */
+    static const uint32_t kTraceVersion = 1;
+
+    /* Constructs StageTracer instance. */
+    StageTracer();
+
+    /* Destructs StageTracer instance, closing the trace file. */
+    ~StageTracer();
+
+    /****************************************************************************
+     * Public API
+     ***************************************************************************/
+
+public:
+    /* Records a sample of a stage.
+     * Param:
+     *  stage - Stage the sample is for.
+     *  start, end - SYSTEM_TIME_MONOTONIC times the stage has started, and
+     *      ended at.
+     *  frame - Frame number, or -1 if the stage doesn't know it.
+     */
+    void record(Stage stage, nsecs_t start, nsecs_t end, int32_t frame = -1);
+
+    /* Forgets all samples. */
+    void reset();
+
+    /* Appends statistics of the stages that have samples to a string.
+     * Param:
+     *  result - String to append to.
+     *  indent - Prefix of every line.
+     */
+    void dump(String8& result, const char* indent);
+
+    /* Starts appending samples to a trace file.
+     * If samples are recorded faster than the trace file is written, samples
+     * that don't fit in the buffer are dropped, and the drop is logged.
+     * Param:
+     *  path - Path of the trace file. An existing file is overwritten.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status.
+     */
+    status_t startTraceFile(const char* path);
+
+    /* Stops appending samples to the trace file, writes the samples that are
+     * still buffered, and closes it. */
+    void stopTraceFile();
+
+    /* Gets name of a stage. */
+    static const char* getStageName(Stage stage);
+
+    /****************************************************************************
+     * Data members
+     ***************************************************************************/
+
+private:
+    /* Number of recent samples statistics are computed from. */
+    static const int    kWindow = 256;
+
+    struct Sample {
+        nsecs_t end;
+        nsecs_t duration;
+    };
+
+    struct History {
+        /* Ring of recent samples, and where the next one goes. */
+        Sample      samples[kWindow];
+        int         next;
+        /* Number of samples recorded since the last reset. */
+        uint32_t    total;
+    };
+
+    /* Number of samples buffered for the trace file. */
+    static const int    kTraceBufferSize = 4096;
+
+    /* How often buffered samples are written to the trace file. */
+    static const nsecs_t kTraceFlushPeriod = 100000000LL;
+
+    /* Writes the buffered samples to the trace file. */
+    class TraceWriter : public Thread {
+    public:
+        /* Constructs TraceWriter instance.
+         * Param:
+         *  tracer - Tracer whose samples are written.
+         *  fd - Trace file descriptor. The writer closes it when destroyed.
+         */
+        TraceWriter(StageTracer* tracer, int fd);
+
+        /* Destructs TraceWriter instance, closing the trace file. */
+        ~TraceWriter();
+
+        /* Writes the samples buffered by the tracer to the trace file.
+         * Param:
+         *  wait - Whether to wait until half of the buffer is used, or
+         *      kTraceFlushPeriod has passed, first.
+         * Return:
+         *  false if the trace file can't be written to anymore.
+         */
+        bool flush(bool wait);
+
+    private:
+        /* Implements abstract method of the base Thread class. */
+        bool threadLoop();
+
+        StageTracer*    mTracer;
+        int             mFD;
+        /* Samples being written. Swapped with the tracer's buffer. */
+        TraceRecord*    mRecords;
+    };
+
+    /* Locks this instance for data changes. */
+    Mutex               mLock;
+
+    History             mStages[STAGE_COUNT];
+
+    /* Samples waiting to be written to the trace file, or NULL if there's no
+     * trace file. */
+    TraceRecord*        mTraceBuffer;
+    int                 mTraceCount;
+    /* Number of samples dropped because the buffer was full. */
+    uint32_t            mTraceDropped;
+    /* Signals the writer that the buffer fills up. */
+    Condition           mTraceCondition;
+
+    /* Writes mTraceBuffer to the trace file. */
+    sp<TraceWriter>     mTraceWriter;
+};
+
+}; /* namespace android */
+
+#endif  /* HW_EMULATOR_CAMERA_STAGE_TRACER_H */
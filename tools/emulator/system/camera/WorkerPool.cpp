@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Contains implementation of a class WorkerPool that splits per-frame pixel
+ * processing into horizontal bands, and runs those bands on a small set of
+ * worker threads.
+ */
+
+#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera_WorkerPool"
+#include <cutils/log.h>
+#include <unistd.h>
+#include "WorkerPool.h"
+
+namespace android {
+
+WorkerPool::WorkerPool()
+    : mRoutine(NULL),
+      mOpaque(NULL),
+      mTotal(0),
+      mBandSize(0),
+      mNextStart(0),
+      mActive(0),
+      mStopping(false)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    Mutex::Autolock run_locker(&mRunLock);
+    stopWorkers();
+}
+
+/****************************************************************************
+ * Public API
+ ***************************************************************************/
+
+status_t WorkerPool::setThreadCount(int num_threads)
+{
+    ALOGV("%s: %d", __FUNCTION__, num_threads);
+
+    Mutex::Autolock run_locker(&mRunLock);
+    stopWorkers();
+
+    for (int n = 0; n < num_threads; n++) {
+        sp<Worker> worker = new Worker(this);
+        const status_t res =
+            worker->run("EmulatedCamera_WorkerPool", ANDROID_PRIORITY_URGENT_DISPLAY);
+        if (res != NO_ERROR) {
+            ALOGE("%s: Unable to start worker thread %d: %d",
+                 __FUNCTION__, n, res);
+            stopWorkers();
+            return res;
+        }
+        mWorkers.push_back(worker);
+    }
+
+    return NO_ERROR;
+}
+
+int WorkerPool::getThreadCount()
+{
+    Mutex::Autolock run_locker(&mRunLock);
+    return mWorkers.size();
+}
+
+int WorkerPool::getDefaultThreadCount()
+{
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus <= 1) {
+        return 0;
+    }
+    return (cpus > 4) ? 3 : cpus - 1;
+}
+
+void WorkerPool::runBands(BandRoutine routine,
+                          void* opaque,
+                          int total,
+                          int align)
+{
+    Mutex::Autolock run_locker(&mRunLock);
+
+    const int bands = mWorkers.size() + 1;
+    if (bands == 1 || total < bands * align) {
+        /* Not worth splitting. */
+        routine(opaque, 0, total);
+        return;
+    }
+
+    Mutex::Autolock locker(&mLock);
+
+    /* Band size is rounded up to the alignment, so the last band may be
+     * shorter than the others. */
+    mRoutine = routine;
+    mOpaque = opaque;
+    mTotal = total;
+    mBandSize = ((total + bands - 1) / bands + align - 1) / align * align;
+    mNextStart = 0;
+    mActive = 0;
+    mWorkAvailable.broadcast();
+
+    /* The calling thread processes bands too. */
+    int start, end;
+    while (takeBand(&start, &end)) {
+        runBand(start, end);
+    }
+    while (mActive > 0) {
+        mWorkDone.wait(mLock);
+    }
+
+    mRoutine = NULL;
+    mOpaque = NULL;
+}
+
+/****************************************************************************
+ * Private API
+ ***************************************************************************/
+
+void WorkerPool::stopWorkers()
+{
+    {
+        Mutex::Autolock locker(&mLock);
+        mStopping = true;
+        mWorkAvailable.broadcast();
+    }
+    for (size_t n = 0; n < mWorkers.size(); n++) {
+        mWorkers.editItemAt(n)->requestExitAndWait();
+    }
+    mWorkers.clear();
+
+    Mutex::Autolock locker(&mLock);
+    mStopping = false;
+}
+
+bool WorkerPool::takeBand(int* start, int* end)
+{
+    if (mRoutine == NULL || mNextStart >= mTotal) {
+        return false;
+    }
+    *start = mNextStart;
+    *end = (mTotal - mNextStart > mBandSize) ? mNextStart + mBandSize : mTotal;
+    mNextStart = *end;
+    return true;
+}
+
+void WorkerPool::runBand(int start, int end)
+{
+    BandRoutine routine = mRoutine;
+    void* opaque = mOpaque;
+
+    mActive++;
+    mLock.unlock();
+    routine(opaque, start, end);
+    mLock.lock();
+    mActive--;
+
+    if (mActive == 0 && mNextStart >= mTotal) {
+        mWorkDone.broadcast();
+    }
+}
+
+/****************************************************************************
+ * Worker thread implementation.
+ ***************************************************************************/
+
+bool WorkerPool::Worker::threadLoop()
+{
+    Mutex::Autolock locker(&mPool->mLock);
+
+    int start, end;
+    while (!mPool->mStopping && !mPool->takeBand(&start, &end)) {
+        mPool->mWorkAvailable.wait(mPool->mLock);
+    }
+    if (mPool->mStopping) {
+        return false;
+    }
+
+    mPool->runBand(start, end);
+    return true;
+}
+
+}; /* namespace android */
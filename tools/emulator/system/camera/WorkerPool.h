@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HW_EMULATOR_CAMERA_WORKER_POOL_H
+#define HW_EMULATOR_CAMERA_WORKER_POOL_H
+
+/*
+ * Contains declaration of a class WorkerPool that splits per-frame pixel
+ * processing into horizontal bands, and runs those bands on a small set of
+ * worker threads.
+ */
+
+#include <utils/threads.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+/* Encapsulates a small pool of worker threads used to process large frames in
+ * horizontal bands.
+ *
+ * The thread that calls runBands takes part in the processing, so a pool with
+ * N worker threads splits a frame into N + 1 bands. A pool with no worker
+ * threads simply runs the entire frame on the calling thread. Calls to
+ * runBands are serialized, so a single pool can be shared by several camera
+ * devices.
+ */
+class WorkerPool {
+public:
+    /* Routine that processes a single band.
+     * Param:
+     *  opaque - Opaque pointer passed to runBands.
+     *  start, end - Range of rows [start, end) to process.
+     */
+    typedef void (*BandRoutine)(void* opaque, int start, int end);
+
+    /* Constructs WorkerPool instance with no worker threads. */
+    WorkerPool();
+
+    /* Destructs WorkerPool instance, stopping all worker threads. */
+    ~WorkerPool();
+
+    /***************************************************************************
+     * Public API
+     **************************************************************************/
+
+public:
+    /* Sets the number of worker threads in the pool.
+     * Existing worker threads are stopped, and a new set of threads is started.
+     * Param:
+     *  num_threads - Number of worker threads to run. 0 disables banding.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status.
+     */
+    status_t setThreadCount(int num_threads);
+
+    /* Gets the number of worker threads in the pool. */
+    int getThreadCount();
+
+    /* Gets the number of worker threads that suits the CPU the code runs on:
+     * one less than the number of online CPUs (since the calling thread
+     * processes a band too), but no more than 3. */
+    static int getDefaultThreadCount();
+
+    /* Processes rows [0, total) in bands, and waits till all bands are done.
+     * Param:
+     *  routine - Routine to run for each band.
+     *  opaque - Opaque pointer to pass to the routine.
+     *  total - Total number of rows to process.
+     *  align - Row alignment for band boundaries (e.g. 2 for YUV 4:2:0
+     *      frames, where two rows share a chroma row).
+     */
+    void runBands(BandRoutine routine, void* opaque, int total, int align);
+
+    /***************************************************************************
+     * Private API
+     **************************************************************************/
+
+private:
+    /* Stops and releases all worker threads. Must be called with mRunLock
+     * held. */
+    void stopWorkers();
+
+    /* Picks the next band to process.
+     * Note that this method must be called while mLock is held.
+     * Param:
+     *  start, end - Upon success contain the band's row range.
+     * Return:
+     *  true if a band has been picked, or false if there are no more bands.
+     */
+    bool takeBand(int* start, int* end);
+
+    /* Runs one band, and updates completion accounting.
+     * Note that this method must be called while mLock is held. The lock is
+     * released while the band routine runs.
+     */
+    void runBand(int start, int end);
+
+    /* Encapsulates a worker thread in the pool. */
+    class Worker : public Thread {
+    public:
+        explicit Worker(WorkerPool* pool)
+            : Thread(false),
+              mPool(pool)
+        {
+        }
+
+    private:
+        bool threadLoop();
+
+        WorkerPool* mPool;
+    };
+    friend class Worker;
+
+    /***************************************************************************
+     * Data members
+     **************************************************************************/
+
+private:
+    /* Serializes runBands and setThreadCount calls. */
+    Mutex               mRunLock;
+
+    /* Protects the current job state below. */
+    Mutex               mLock;
+
+    /* Signaled when a new job is posted, or when workers should exit. */
+    Condition           mWorkAvailable;
+
+    /* Signaled when the last band of the current job completes. */
+    Condition           mWorkDone;
+
+    /* Worker threads. */
+    Vector< sp<Worker> > mWorkers;
+
+    /*
+     * Current job.
+     */
+
+    BandRoutine         mRoutine;
+    void*               mOpaque;
+    int                 mTotal;
+    int                 mBandSize;
+    int                 mNextStart;
+    int                 mActive;
+
+    /* Set when worker threads are being stopped. */
+    bool                mStopping;
+};
+
+}; /* namespace android */
+
+#endif  /* HW_EMULATOR_CAMERA_WORKER_POOL_H */
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera2_AuxBufferPool"
+#include <utils/Log.h>
+
+#include "AuxBufferPool.h"
+
+namespace android {
+
+AuxBufferPool::AuxBufferPool() {
+    for (size_t i = 0; i < kMaxBuffers; i++) {
+        mBuffers[i].img = NULL;
+        mBuffers[i].size = 0;
+        mBuffers[i].inUse = false;
+    }
+}
+
+AuxBufferPool::~AuxBufferPool() {
+    for (size_t i = 0; i < kMaxBuffers; i++) {
+        ALOGW_IF(mBuffers[i].inUse, "Auxiliary buffer %p is still in use",
+                mBuffers[i].img);
+        delete[] mBuffers[i].img;
+    }
+}
+
+uint8_t *AuxBufferPool::acquire(size_t size) {
+    Mutex::Autolock lock(mMutex);
+
+    // Prefer a free buffer that is already big enough, then any free slot,
+    // which is reallocated
+    Buffer *free = NULL;
+    for (size_t i = 0; i < kMaxBuffers; i++) {
+        Buffer &b = mBuffers[i];
+        if (b.inUse) continue;
+        if (b.size >= size) {
+            b.inUse = true;
+            return b.img;
+        }
+        if (free == NULL) free = &b;
+    }
+
+    if (free == NULL) {
+        ALOGV("%s: All %d auxiliary buffers in use, allocating %d bytes",
+                __FUNCTION__, kMaxBuffers, size);
+        return new uint8_t[size];
+    }
+
+    ALOGV("%s: Allocating auxiliary buffer of %d bytes", __FUNCTION__, size);
+    delete[] free->img;
+    free->img = new uint8_t[size];
+    free->size = size;
+    free->inUse = true;
+    return free->img;
+}
+
+void AuxBufferPool::release(uint8_t *img) {
+    Mutex::Autolock lock(mMutex);
+
+    for (size_t i = 0; i < kMaxBuffers; i++) {
+        if (mBuffers[i].img == img) {
+            mBuffers[i].inUse = false;
+            return;
+        }
+    }
+    // Allocated while the pool was exhausted
+    delete[] img;
+}
+
+} // namespace android
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This class recycles the auxiliary image buffers of the fake camera 2
+ * pipeline, such as the source images of JPEG captures. These are filled in by
+ * the sensor, and released by the JPEG compressor once it is done with them,
+ * so the pool is thread-safe.
+ */
+
+#ifndef HW_EMULATOR_CAMERA2_AUX_BUFFER_POOL_H
+#define HW_EMULATOR_CAMERA2_AUX_BUFFER_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "utils/Mutex.h"
+
+namespace android {
+
+class AuxBufferPool {
+  public:
+    AuxBufferPool();
+    ~AuxBufferPool();
+
+    // Returns a buffer of at least size bytes. Never fails; if every pooled
+    // buffer is in use, a buffer is allocated that is freed on release.
+    uint8_t *acquire(size_t size);
+
+    // Gives a buffer returned by acquire back to the pool
+    void release(uint8_t *img);
+
+  private:
+    // One buffer for the capture in progress, and one for the JPEG being
+    // compressed, with some slack for reprocessing
+    static const size_t kMaxBuffers = 4;
+
+    Mutex mMutex;
+    struct Buffer {
+        uint8_t *img;
+        size_t size;
+        bool inUse;
+    } mBuffers[kMaxBuffers];
+};
+
+} // namespace android
+
+#endif // HW_EMULATOR_CAMERA2_AUX_BUFFER_POOL_H
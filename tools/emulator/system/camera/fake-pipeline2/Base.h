@@ -28,6 +28,8 @@
 
 namespace android {
 
+class GrallocMappingCache;
+
 
 /* Internal structure for passing buffers across threads */
 struct StreamBuffer {
@@ -48,6 +50,8 @@ struct Stream {
     uint32_t width, height;
     int32_t format;
     uint32_t stride;
+    // Mappings of the stream's buffers; owned by the camera
+    GrallocMappingCache *mappings;
 };
 
 struct ReprocessStream {
@@ -22,6 +22,7 @@
 
 #include "JpegCompressor.h"
 #include "../EmulatedFakeCamera2.h"
+#include "../GrallocMappingCache.h"
 
 namespace android {
 
@@ -30,7 +31,10 @@ JpegCompressor::JpegCompressor(EmulatedFakeCamera2 *parent):
         mIsBusy(false),
         mParent(parent),
         mBuffers(NULL),
-        mCaptureTime(0) {
+        mCaptureTime(0),
+        mFoundJpeg(false),
+        mFoundAux(false) {
+    mEncoder.setThreadCount(JpegEncoder::getDefaultThreadCount());
 }
 
 JpegCompressor::~JpegCompressor() {
@@ -80,7 +84,8 @@ bool JpegCompressor::threadLoop() {
     // Find source and target buffers. Assumes only one buffer matches
     // each condition!
 
-    bool foundJpeg = false, mFoundAux = false;
+    mFoundJpeg = false;
+    mFoundAux = false;
     for (size_t i = 0; i < mBuffers->size(); i++) {
         const StreamBuffer &b = (*mBuffers)[i];
         if (b.format == HAL_PIXEL_FORMAT_BLOB) {
@@ -99,71 +104,69 @@ bool JpegCompressor::threadLoop() {
         return false;
     }
 
-    // Set up error management
-
-    mJpegErrorInfo = NULL;
-    JpegError error;
-    error.parent = this;
-
-    mCInfo.err = jpeg_std_error(&error);
-    mCInfo.err->error_exit = jpegErrorHandler;
-
-    jpeg_create_compress(&mCInfo);
-    if (checkError("Error initializing compression")) return false;
-
-    // Route compressed data straight to output stream buffer
-
-    JpegDestination jpegDestMgr;
-    jpegDestMgr.parent = this;
-    jpegDestMgr.init_destination = jpegInitDestination;
-    jpegDestMgr.empty_output_buffer = jpegEmptyOutputBuffer;
-    jpegDestMgr.term_destination = jpegTermDestination;
-
-    mCInfo.dest = &jpegDestMgr;
-
-    // Set up compression parameters
-
-    mCInfo.image_width = mAuxBuffer.width;
-    mCInfo.image_height = mAuxBuffer.height;
-    mCInfo.input_components = 3;
-    mCInfo.in_color_space = JCS_RGB;
-
-    jpeg_set_defaults(&mCInfo);
-    if (checkError("Error configuring defaults")) return false;
+    // YUV sources are fed to the encoder directly, skipping RGB conversion
+
+    JpegEncoder::InputFormat format;
+    uint32_t stride = mAuxBuffer.stride;
+    switch (mAuxBuffer.format) {
+        case HAL_PIXEL_FORMAT_RGB_888:
+            format = JpegEncoder::INPUT_RGB888;
+            break;
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+            format = JpegEncoder::INPUT_NV21;
+            break;
+        case HAL_PIXEL_FORMAT_YV12:
+            format = JpegEncoder::INPUT_YV12;
+            // The luma plane is 16-aligned, as gralloc allocates it
+            stride = (stride + 15) & ~15;
+            break;
+        default:
+            ALOGE("%s: Unsupported JPEG source format 0x%x", __FUNCTION__,
+                    mAuxBuffer.format);
+            cleanUp();
+            return false;
+    }
 
     // Do compression
 
-    jpeg_start_compress(&mCInfo, TRUE);
-    if (checkError("Error starting compression")) return false;
-
-    size_t rowStride = mAuxBuffer.stride * 3;
-    const size_t kChunkSize = 32;
-    while (mCInfo.next_scanline < mCInfo.image_height) {
-        JSAMPROW chunk[kChunkSize];
-        for (size_t i = 0 ; i < kChunkSize; i++) {
-            chunk[i] = (JSAMPROW)
-                    (mAuxBuffer.img + (i + mCInfo.next_scanline) * rowStride);
-        }
-        jpeg_write_scanlines(&mCInfo, chunk, kChunkSize);
-        if (checkError("Error while compressing")) return false;
-        if (exitPending()) {
-            ALOGV("%s: Cancel called, exiting early", __FUNCTION__);
-            cleanUp();
-            return false;
-        }
+    nsecs_t startTime = systemTime();
+    status_t res;
+    res = mEncoder.compress(mAuxBuffer.img, format,
+            mAuxBuffer.width, mAuxBuffer.height, stride, 90);
+    if (res != OK) {
+        ALOGE("%s: Error while compressing: %s (%d)", __FUNCTION__,
+                strerror(res), res);
+        cleanUp();
+        return false;
+    }
+    if (exitPending()) {
+        ALOGV("%s: Cancel called, exiting early", __FUNCTION__);
+        cleanUp();
+        return false;
     }
 
-    jpeg_finish_compress(&mCInfo);
-    if (checkError("Error while finishing compression")) return false;
+    const Stream &s = mParent->getStreamInfo(mJpegBuffer.streamId);
+    const size_t jpegSize = mEncoder.getCompressedSize();
+    if (jpegSize > kMaxJpegSize) {
+        // A truncated JPEG is corrupt, so give the buffer back unfilled
+        ALOGE("%s: JPEG destination buffer overflow! (%d bytes)",
+                __FUNCTION__, jpegSize);
+        s.mappings->unlock(mJpegBuffer.buffer);
+        s.ops->cancel_buffer(s.ops, mJpegBuffer.buffer);
+        mParent->signalError();
+        cleanUp();
+        return false;
+    }
+    memcpy(mJpegBuffer.img, mEncoder.getCompressedImage(), jpegSize);
+    mParent->getStageTracer().record(StageTracer::STAGE_JPEG, startTime,
+            systemTime());
 
     // Write to JPEG output stream
 
     ALOGV("%s: Compression complete, pushing to stream %d", __FUNCTION__,
           mJpegBuffer.streamId);
 
-    GraphicBufferMapper::get().unlock(*(mJpegBuffer.buffer));
-    status_t res;
-    const Stream &s = mParent->getStreamInfo(mJpegBuffer.streamId);
+    s.mappings->unlock(mJpegBuffer.buffer);
     res = s.ops->enqueue_buffer(s.ops, mCaptureTime, mJpegBuffer.buffer);
     if (res != OK) {
         ALOGE("%s: Error queueing compressed image buffer %p: %s (%d)",
@@ -203,27 +206,13 @@ bool JpegCompressor::waitForDone(nsecs_t timeout) {
     return (res == OK);
 }
 
-bool JpegCompressor::checkError(const char *msg) {
-    if (mJpegErrorInfo) {
-        char errBuffer[JMSG_LENGTH_MAX];
-        mJpegErrorInfo->err->format_message(mJpegErrorInfo, errBuffer);
-        ALOGE("%s: %s: %s",
-                __FUNCTION__, msg, errBuffer);
-        cleanUp();
-        mJpegErrorInfo = NULL;
-        return true;
-    }
-    return false;
-}
-
 void JpegCompressor::cleanUp() {
     status_t res;
-    jpeg_destroy_compress(&mCInfo);
     Mutex::Autolock lock(mBusyMutex);
 
     if (mFoundAux) {
         if (mAuxBuffer.streamId == 0) {
-            delete[] mAuxBuffer.img;
+            mParent->getAuxBufferPool().release(mAuxBuffer.img);
         } else {
             GraphicBufferMapper::get().unlock(*(mAuxBuffer.buffer));
             const ReprocessStream &s =
@@ -243,28 +232,4 @@ void JpegCompressor::cleanUp() {
     mDone.signal();
 }
 
-void JpegCompressor::jpegErrorHandler(j_common_ptr cinfo) {
-    JpegError *error = static_cast<JpegError*>(cinfo->err);
-    error->parent->mJpegErrorInfo = cinfo;
-}
-
-void JpegCompressor::jpegInitDestination(j_compress_ptr cinfo) {
-    JpegDestination *dest= static_cast<JpegDestination*>(cinfo->dest);
-    ALOGV("%s: Setting destination to %p, size %d",
-            __FUNCTION__, dest->parent->mJpegBuffer.img, kMaxJpegSize);
-    dest->next_output_byte = (JOCTET*)(dest->parent->mJpegBuffer.img);
-    dest->free_in_buffer = kMaxJpegSize;
-}
-
-boolean JpegCompressor::jpegEmptyOutputBuffer(j_compress_ptr cinfo) {
-    ALOGE("%s: JPEG destination buffer overflow!",
-            __FUNCTION__);
-    return true;
-}
-
-void JpegCompressor::jpegTermDestination(j_compress_ptr cinfo) {
-    ALOGV("%s: Done writing JPEG data. %d bytes left in buffer",
-            __FUNCTION__, cinfo->dest->free_in_buffer);
-}
-
 } // namespace android
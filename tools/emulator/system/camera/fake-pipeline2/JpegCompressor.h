@@ -17,8 +17,8 @@
 
 /**
  * This class simulates a hardware JPEG compressor.  It receives image buffers
- * in RGBA_8888 format, processes them in a worker thread, and then pushes them
- * out to their destination stream.
+ * in RGB_888, NV21, or YV12 format, processes them in a worker thread, and then
+ * pushes them out to their destination stream.
  */
 
 #ifndef HW_EMULATOR_CAMERA2_JPEG_H
@@ -29,12 +29,7 @@
 #include "utils/Timers.h"
 
 #include "Base.h"
-
-#include <stdio.h>
-
-extern "C" {
-#include <jpeglib.h>
-}
+#include "../JpegEncoder.h"
 
 namespace android {
 
@@ -76,24 +71,9 @@ class JpegCompressor: private Thread, public virtual RefBase {
     StreamBuffer mJpegBuffer, mAuxBuffer;
     bool mFoundJpeg, mFoundAux;
 
-    jpeg_compress_struct mCInfo;
-
-    struct JpegError : public jpeg_error_mgr {
-        JpegCompressor *parent;
-    };
-    j_common_ptr mJpegErrorInfo;
-
-    struct JpegDestination : public jpeg_destination_mgr {
-        JpegCompressor *parent;
-    };
-
-    static void jpegErrorHandler(j_common_ptr cinfo);
-
-    static void jpegInitDestination(j_compress_ptr cinfo);
-    static boolean jpegEmptyOutputBuffer(j_compress_ptr cinfo);
-    static void jpegTermDestination(j_compress_ptr cinfo);
+    // Kept across captures so strip buffers and worker threads are reused
+    JpegEncoder mEncoder;
 
-    bool checkError(const char *msg);
     void cleanUp();
 
     /**
@@ -18,6 +18,11 @@
 #define LOG_TAG "EmulatedCamera_Scene"
 #include <utils/Log.h>
 #include <stdlib.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
 
 #include "Scene.h"
 
@@ -347,7 +352,7 @@ const uint32_t* Scene::getPixelElectrons() {
         mCurrentY++;
         if (mCurrentY >= mSensorHeight) mCurrentY = 0;
         setReadoutPixel(mCurrentX, mCurrentY);
-    } else if (mSubX > mMapDiv) {
+    } else if (mSubX >= mMapDiv) {
         mSceneIdx++;
         mSceneX++;
         mCurrentSceneMaterial = &(mCurrentColors[kScene[mSceneIdx]]);
@@ -356,6 +361,78 @@ const uint32_t* Scene::getPixelElectrons() {
     return pixel;
 }
 
+int Scene::getRowSpans(int y, int x0, int x1, Span *spans) const {
+    if (x0 >= x1) return 0;
+
+    int sceneY = (y + mOffsetY + mHandshakeY) / mMapDiv;
+    sceneY = sceneY < 0 ? 0 : (sceneY >= kSceneHeight ? kSceneHeight - 1 : sceneY);
+    const uint8_t *sceneRow = kScene + sceneY * kSceneWidth;
+
+    // Walk scene cell boundaries instead of individual pixels
+    int pos = x0 + mOffsetX + mHandshakeX;
+    int sceneX = pos / mMapDiv;
+    int count = 0;
+    int x = x0;
+    while (x < x1) {
+        int end;
+        if (sceneX <= 0 && pos < mMapDiv) {
+            // Everything left of the scene repeats its first column
+            end = x + (mMapDiv - pos);
+            sceneX = 0;
+        } else if (sceneX >= kSceneWidth - 1) {
+            // ...and everything right of it the last one
+            end = x1;
+            sceneX = kSceneWidth - 1;
+        } else {
+            end = x + ((sceneX + 1) * mMapDiv - pos);
+        }
+        if (end > x1) end = x1;
+
+        const uint32_t *electrons = &(mCurrentColors[sceneRow[sceneX]]);
+        if (count > 0 && spans[count - 1].electrons == electrons) {
+            // Neighboring cells of the same material make a single span
+            spans[count - 1].length += end - x;
+        } else {
+            spans[count].x = x;
+            spans[count].length = end - x;
+            spans[count].electrons = electrons;
+            count++;
+        }
+        pos += end - x;
+        x = end;
+        sceneX++;
+    }
+    return count;
+}
+
+void Scene::getRowElectrons(int y, int x0, int x1, int channel,
+        uint32_t *out) const {
+    Span spans[kMaxRowSpans];
+    const int count = getRowSpans(y, x0, x1, spans);
+    for (int i = 0; i < count; i++) {
+        fillSpan(out, spans[i].electrons[channel], spans[i].length);
+        out += spans[i].length;
+    }
+}
+
+void Scene::fillSpan(uint32_t *dst, uint32_t value, int count) {
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128i v = _mm_set1_epi32(value);
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), v);
+    }
+#elif defined(__ARM_NEON__)
+    const uint32x4_t v = vdupq_n_u32(value);
+    for (; i + 4 <= count; i += 4) {
+        vst1q_u32(dst + i, v);
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = value;
+    }
+}
+
 // RGB->YUV, Jpeg standard
 const float Scene::kRgb2Yuv[12] = {
        0.299f,    0.587f,    0.114f,    0.f,
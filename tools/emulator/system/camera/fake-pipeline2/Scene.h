@@ -72,6 +72,31 @@ class Scene {
     // ColorChannels.
     const uint32_t* getPixelElectrons();
 
+    // A run of pixels in a sensor row that all see the same scene material.
+    struct Span {
+        int x;                      // First pixel of the run
+        int length;                 // Number of pixels in the run
+        const uint32_t *electrons;  // Indexable with ColorChannels
+    };
+
+    // The scene is kSceneWidth materials wide, so a row never has more spans
+    static const int kMaxRowSpans = 20;
+
+    // Split pixels [x0, x1) of sensor row y into spans of constant sensor
+    // response. Unlike getPixelElectrons, this doesn't touch the readout
+    // pixel, so it can be called from several threads at once. Returns the
+    // number of spans written to 'spans', which must hold kMaxRowSpans.
+    int getRowSpans(int y, int x0, int x1, Span *spans) const;
+
+    // Fill 'out' with the sensor response of one channel for pixels
+    // [x0, x1) of sensor row y. Thread-safe, like getRowSpans.
+    void getRowElectrons(int y, int x0, int x1, int channel,
+            uint32_t *out) const;
+
+    // Write 'value' into 'count' consecutive words, with vector stores where
+    // available. Used to expand spans into pixels.
+    static void fillSpan(uint32_t *dst, uint32_t value, int count);
+
     enum ColorChannels {
         R = 0,
         Gr,
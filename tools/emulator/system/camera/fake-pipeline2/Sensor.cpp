@@ -26,10 +26,10 @@
 
 #include <utils/Log.h>
 
-#include "../EmulatedFakeCamera2.h"
 #include "Sensor.h"
 #include <cmath>
 #include <cstdlib>
+#include <pthread.h>
 #include "system/camera_metadata.h"
 
 namespace android {
@@ -83,46 +83,100 @@ const uint32_t Sensor::kDefaultSensitivity = 100;
 
 /** A few utility functions for math, normal distributions */
 
-// Take advantage of IEEE floating-point format to calculate an approximate
-// square root. Accurate to within +-3.6%
-float sqrtf_approx(float r) {
-    // Modifier is based on IEEE floating-point representation; the
-    // manipulations boil down to finding approximate log2, dividing by two, and
-    // then inverting the log2. A bias is added to make the relative error
-    // symmetric about the real answer.
-    const int32_t modifier = 0x1FBB4000;
+// Noise generation. Each row of a frame gets its own xorshift generator,
+// seeded from the frame seed and the row number, and draws standard normal
+// samples from a table indexed by the generator output.
+
+static const int kGaussianTableBits = 12;
+static const int kGaussianTableSize = 1 << kGaussianTableBits;
+static float gGaussianTable[kGaussianTableSize];
+static pthread_once_t gGaussianTableOnce = PTHREAD_ONCE_INIT;
+
+// Fills the table with quantiles of the standard normal distribution, so a
+// uniformly random index yields a normally distributed sample
+static void initGaussianTable() {
+    for (int i = 0; i < kGaussianTableSize; i++) {
+        const double p = (i + 0.5) / kGaussianTableSize;
+        // Invert the CDF by bisection; this only runs once
+        double lo = -8, hi = 8;
+        for (int j = 0; j < 48; j++) {
+            const double mid = (lo + hi) / 2;
+            if (0.5 * erfc(-mid / M_SQRT2) < p) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        gGaussianTable[i] = (lo + hi) / 2;
+    }
+}
 
-    int32_t r_i = *(int32_t*)(&r);
-    r_i = (r_i >> 1) + modifier;
+// Mixes two values into a well-distributed, nonzero generator state
+static inline uint32_t noiseState(uint32_t seed, uint32_t index) {
+    uint32_t h = seed ^ (index * 0x9E3779B9);
+    h ^= h >> 16;
+    h *= 0x85EBCA6B;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35;
+    h ^= h >> 16;
+    return h ? h : 1;
+}
 
-    return *(float*)(&r_i);
+static inline float gaussianSample(uint32_t &state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return gGaussianTable[state >> (32 - kGaussianTableBits)];
 }
 
 
 
-Sensor::Sensor(EmulatedFakeCamera2 *parent):
+Sensor::Sensor(AuxBufferPool *auxBuffers, StageTracer *tracer):
         Thread(false),
-        mParent(parent),
+        mAuxBuffers(auxBuffers),
+        mTracer(tracer),
         mGotVSync(false),
         mExposureTime(kFrameDurationRange[0]-kMinVerticalBlank),
         mFrameDuration(kFrameDurationRange[0]),
         mGainFactor(kDefaultSensitivity),
         mNextBuffers(NULL),
-        mCapturedBuffers(NULL),
-        mScene(kResolution[0], kResolution[1], kElectronsPerLuxSecond)
+        mNoiseSeed(0),
+        mNoiseSeedChanged(false),
+        mReadoutHead(0),
+        mReadoutCount(0),
+        mPipelineDepth(kDefaultPipelineDepth),
+        mScene(kResolution[0], kResolution[1], kElectronsPerLuxSecond),
+        mFrameNoiseSeed(0),
+        mFrameCount(0),
+        mNoiseStddevGain(0)
 {
-
+    pthread_once(&gGaussianTableOnce, initGaussianTable);
+    mNoiseStddevTable = new float[kSaturationElectrons + 1];
+    mProcessedFrame = new uint8_t[kResolution[0] * kResolution[1] * 4];
+    mScaledFrame = NULL;
+    mScaledFrameSize = 0;
 }
 
 Sensor::~Sensor() {
     shutDown();
+    delete[] mNoiseStddevTable;
+    delete[] mProcessedFrame;
+    delete[] mScaledFrame;
 }
 
 status_t Sensor::startUp() {
     ALOGV("%s: E", __FUNCTION__);
 
     int res;
-    mCapturedBuffers = NULL;
+    {
+        Mutex::Autolock lock(mReadoutMutex);
+        mReadoutHead = 0;
+        mReadoutCount = 0;
+    }
+    res = mCapturePool.setThreadCount(WorkerPool::getDefaultThreadCount());
+    if (res != OK) {
+        ALOGW("Unable to start sensor capture workers: %d", res);
+    }
     res = run("EmulatedFakeCamera2::Sensor",
             ANDROID_PRIORITY_URGENT_DISPLAY);
 
@@ -140,6 +194,7 @@ status_t Sensor::shutDown() {
     if (res != OK) {
         ALOGE("Unable to shut down sensor capture thread: %d", res);
     }
+    mCapturePool.setThreadCount(0);
     return res;
 }
 
@@ -165,11 +220,32 @@ void Sensor::setSensitivity(uint32_t gain) {
     mGainFactor = gain;
 }
 
+void Sensor::setNoiseSeed(uint32_t seed) {
+    Mutex::Autolock lock(mControlMutex);
+    mNoiseSeed = seed;
+    mNoiseSeedChanged = true;
+}
+
 void Sensor::setDestinationBuffers(Buffers *buffers) {
     Mutex::Autolock lock(mControlMutex);
     mNextBuffers = buffers;
 }
 
+void Sensor::setPipelineDepth(uint32_t depth) {
+    Mutex::Autolock lock(mReadoutMutex);
+    if (depth < 1) depth = 1;
+    if (depth > kMaxPipelineDepth) depth = kMaxPipelineDepth;
+    ALOGV("Pipeline depth set to %d", depth);
+    mPipelineDepth = depth;
+    // A smaller depth takes effect as frames leave the queue
+    mReadoutComplete.signal();
+}
+
+uint32_t Sensor::getPipelineDepth() {
+    Mutex::Autolock lock(mReadoutMutex);
+    return mPipelineDepth;
+}
+
 bool Sensor::waitForVSync(nsecs_t reltime) {
     int res;
     Mutex::Autolock lock(mControlMutex);
@@ -186,30 +262,125 @@ bool Sensor::waitForVSync(nsecs_t reltime) {
 bool Sensor::waitForNewFrame(nsecs_t reltime,
         nsecs_t *captureTime) {
     Mutex::Autolock lock(mReadoutMutex);
-    uint8_t *ret;
-    if (mCapturedBuffers == NULL) {
-        int res;
-        res = mReadoutAvailable.waitRelative(mReadoutMutex, reltime);
-        if (res == TIMED_OUT) {
-            return false;
-        } else if (res != OK || mCapturedBuffers == NULL) {
+    nsecs_t deadline = systemTime() + reltime;
+    int res;
+    while (mReadoutCount == 0) {
+        nsecs_t timeLeft = deadline - systemTime();
+        if (timeLeft <= 0) return false;
+        res = mReadoutAvailable.waitRelative(mReadoutMutex, timeLeft);
+        if (res != OK && res != TIMED_OUT) {
             ALOGE("Error waiting for sensor readout signal: %d", res);
             return false;
         }
-    } else {
-        mReadoutComplete.signal();
     }
 
-    *captureTime = mCaptureTime;
-    mCapturedBuffers = NULL;
+    // Only this method removes frames, so the oldest frame stays put while
+    // the lock is released below. Wait for its last row to be read out.
+    const ReadoutFrame &frame = mReadoutQueue[mReadoutHead];
+    nsecs_t now = systemTime();
+    while (now < frame.readoutDoneTime) {
+        if (now >= deadline) return false;
+        nsecs_t waitTime = frame.readoutDoneTime < deadline ?
+                frame.readoutDoneTime - now : deadline - now;
+        res = mReadoutAvailable.waitRelative(mReadoutMutex, waitTime);
+        if (res != OK && res != TIMED_OUT) {
+            ALOGE("Error waiting for sensor readout to complete: %d", res);
+            return false;
+        }
+        now = systemTime();
+    }
+
+    *captureTime = frame.captureTime;
+    mReadoutHead = (mReadoutHead + 1) % kMaxPipelineDepth;
+    mReadoutCount--;
+    mReadoutComplete.signal();
+    return true;
+}
+
+void Sensor::captureFrame(Buffers *buffers, uint32_t gain,
+        uint64_t exposureDuration, nsecs_t captureTime) {
+    ALOGVV("Starting next capture: Exposure: %f ms, gain: %d",
+            (float)exposureDuration/1e6, gain);
+    mScene.setExposureDuration((float)exposureDuration/1e9);
+    mScene.calculateScene(captureTime);
+
+    // The scene is rendered once, and all processed streams are derived
+    // from that rendering
+    for (size_t i = 0; i < buffers->size(); i++) {
+        if ((*buffers)[i].format != HAL_PIXEL_FORMAT_RAW_SENSOR) {
+            captureProcessed(gain);
+            break;
+        }
+    }
+
+    // Might be adding more buffers, so size isn't constant
+    for (size_t i = 0; i < buffers->size(); i++) {
+        const StreamBuffer &b = (*buffers)[i];
+        ALOGVV("Sensor capturing buffer %d: stream %d,"
+                " %d x %d, format %x, stride %d, buf %p, img %p",
+                i, b.streamId, b.width, b.height, b.format, b.stride,
+                b.buffer, b.img);
+        switch(b.format) {
+            case HAL_PIXEL_FORMAT_RAW_SENSOR:
+                captureRaw(b.img, gain, b.stride);
+                break;
+            case HAL_PIXEL_FORMAT_RGB_888:
+                deriveRGB(b.img, b.width, b.height, b.stride);
+                break;
+            case HAL_PIXEL_FORMAT_RGBA_8888:
+                deriveRGBA(b.img, b.width, b.height, b.stride);
+                break;
+            case HAL_PIXEL_FORMAT_BLOB:
+                // Add auxillary buffer of the right size
+                // Assumes only one BLOB (JPEG) buffer in buffers. It's NV21,
+                // which the JPEG compressor takes without color conversion.
+                StreamBuffer bAux;
+                bAux.streamId = 0;
+                bAux.width = b.width;
+                bAux.height = b.height;
+                bAux.format = HAL_PIXEL_FORMAT_YCrCb_420_SP;
+                bAux.stride = b.width;
+                bAux.buffer = NULL;
+                // Released by the JPEG compressor
+                bAux.img = mAuxBuffers->acquire(b.width * b.height * 3 / 2);
+                buffers->push_back(bAux);
+                break;
+            case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+                deriveNV21(b.img, b.width, b.height, b.stride);
+                break;
+            case HAL_PIXEL_FORMAT_YV12:
+                deriveYV12(b.img, b.width, b.height, b.stride);
+                break;
+            default:
+                ALOGE("%s: Unknown format %x, no output", __FUNCTION__,
+                        b.format);
+                break;
+        }
+    }
+}
+
+bool Sensor::queueReadout(nsecs_t captureTime, nsecs_t readoutDoneTime) {
+    static const nsecs_t kWaitPerLoop = 10000000L; // 10 ms
+    Mutex::Autolock lock(mReadoutMutex);
+    if (mReadoutCount >= mPipelineDepth) {
+        ALOGV("Waiting for readout thread to catch up!");
+        while (mReadoutCount >= mPipelineDepth) {
+            if (exitPending()) return false;
+            mReadoutComplete.waitRelative(mReadoutMutex, kWaitPerLoop);
+        }
+    }
+    ReadoutFrame &frame =
+            mReadoutQueue[(mReadoutHead + mReadoutCount) % kMaxPipelineDepth];
+    frame.captureTime = captureTime;
+    frame.readoutDoneTime = readoutDoneTime;
+    mReadoutCount++;
+    mReadoutAvailable.signal();
     return true;
 }
 
 status_t Sensor::readyToRun() {
     ALOGV("Starting up sensor thread");
     mStartupTime = systemTime();
-    mNextCaptureTime = 0;
-    mNextCapturedBuffers = NULL;
     return OK;
 }
 
@@ -217,8 +388,9 @@ bool Sensor::threadLoop() {
     /**
      * Sensor capture operation main loop.
      *
-     * Stages are out-of-order relative to a single frame's processing, but
-     * in-order in time.
+     * Each loop configures and captures one frame. Stage 3, readout, isn't
+     * done by this thread: captured frames are put in the readout queue, and
+     * waitForNewFrame hands them out once their simulated readout is over.
      */
 
     /**
@@ -236,6 +408,11 @@ bool Sensor::threadLoop() {
         nextBuffers      = mNextBuffers;
         // Don't reuse a buffer set
         mNextBuffers = NULL;
+        if (mNoiseSeedChanged) {
+            mFrameCount = 0;
+            mNoiseSeedChanged = false;
+        }
+        mFrameNoiseSeed = noiseState(mNoiseSeed, mFrameCount++);
 
         // Signal VSync for start of readout
         ALOGVV("Sensor VSync");
@@ -244,102 +421,31 @@ bool Sensor::threadLoop() {
     }
 
     /**
-     * Stage 3: Read out latest captured image
+     * Stage 2: Capture new image
+     *
+     * The frame is captured during this frame period; readout of its rows
+     * starts at the next vertical sync and overlaps capture of the next frame.
+     * Rows are exposed right before they are read out, so the first row starts
+     * exposing one exposure time before the next vertical sync.
      */
 
-    Buffers *capturedBuffers = NULL;
-    nsecs_t captureTime = 0;
-
     nsecs_t startRealTime  = systemTime();
     // Stagefright cares about system time for timestamps, so base simulated
     // time on that.
-    nsecs_t simulatedTime    = startRealTime;
     nsecs_t frameEndRealTime = startRealTime + frameDuration;
-    nsecs_t frameReadoutEndRealTime = startRealTime +
+    nsecs_t captureTime = frameEndRealTime - exposureDuration;
+    nsecs_t readoutDoneRealTime = frameEndRealTime +
             kRowReadoutTime * kResolution[1];
 
-    if (mNextCapturedBuffers != NULL) {
-        ALOGVV("Sensor starting readout");
-        // Pretend we're doing readout now; will signal once enough time has elapsed
-        capturedBuffers = mNextCapturedBuffers;
-        captureTime    = mNextCaptureTime;
-    }
-    simulatedTime += kRowReadoutTime + kMinVerticalBlank;
-
-    // TODO: Move this signal to another thread to simulate readout
-    // time properly
-    if (capturedBuffers != NULL) {
-        ALOGVV("Sensor readout complete");
-        Mutex::Autolock lock(mReadoutMutex);
-        if (mCapturedBuffers != NULL) {
-            ALOGV("Waiting for readout thread to catch up!");
-            mReadoutComplete.wait(mReadoutMutex);
+    if (nextBuffers != NULL) {
+        captureFrame(nextBuffers, gain, exposureDuration, captureTime);
+        if (mTracer != NULL) {
+            mTracer->record(StageTracer::STAGE_SENSOR, startRealTime,
+                    systemTime());
         }
 
-        mCapturedBuffers = capturedBuffers;
-        mCaptureTime = captureTime;
-        mReadoutAvailable.signal();
-        capturedBuffers = NULL;
-    }
-
-    /**
-     * Stage 2: Capture new image
-     */
-
-    mNextCaptureTime = simulatedTime;
-    mNextCapturedBuffers = nextBuffers;
-
-    if (mNextCapturedBuffers != NULL) {
-        ALOGVV("Starting next capture: Exposure: %f ms, gain: %d",
-                (float)exposureDuration/1e6, gain);
-        mScene.setExposureDuration((float)exposureDuration/1e9);
-        mScene.calculateScene(mNextCaptureTime);
-
-        // Might be adding more buffers, so size isn't constant
-        for (size_t i = 0; i < mNextCapturedBuffers->size(); i++) {
-            const StreamBuffer &b = (*mNextCapturedBuffers)[i];
-            ALOGVV("Sensor capturing buffer %d: stream %d,"
-                    " %d x %d, format %x, stride %d, buf %p, img %p",
-                    i, b.streamId, b.width, b.height, b.format, b.stride,
-                    b.buffer, b.img);
-            switch(b.format) {
-                case HAL_PIXEL_FORMAT_RAW_SENSOR:
-                    captureRaw(b.img, gain, b.stride);
-                    break;
-                case HAL_PIXEL_FORMAT_RGB_888:
-                    captureRGB(b.img, gain, b.stride);
-                    break;
-                case HAL_PIXEL_FORMAT_RGBA_8888:
-                    captureRGBA(b.img, gain, b.stride);
-                    break;
-                case HAL_PIXEL_FORMAT_BLOB:
-                    // Add auxillary buffer of the right size
-                    // Assumes only one BLOB (JPEG) buffer in
-                    // mNextCapturedBuffers
-                    StreamBuffer bAux;
-                    bAux.streamId = 0;
-                    bAux.width = b.width;
-                    bAux.height = b.height;
-                    bAux.format = HAL_PIXEL_FORMAT_RGB_888;
-                    bAux.stride = b.width;
-                    bAux.buffer = NULL;
-                    // TODO: Reuse these
-                    bAux.img = new uint8_t[b.width * b.height * 3];
-                    mNextCapturedBuffers->push_back(bAux);
-                    break;
-                case HAL_PIXEL_FORMAT_YCrCb_420_SP:
-                    captureNV21(b.img, gain, b.stride);
-                    break;
-                case HAL_PIXEL_FORMAT_YV12:
-                    // TODO:
-                    ALOGE("%s: Format %x is TODO", __FUNCTION__, b.format);
-                    break;
-                default:
-                    ALOGE("%s: Unknown format %x, no output", __FUNCTION__,
-                            b.format);
-                    break;
-            }
-        }
+        ALOGVV("Sensor queueing frame for readout");
+        if (!queueReadout(captureTime, readoutDoneRealTime)) return false;
     }
 
     ALOGVV("Sensor vertical blanking interval");
@@ -362,140 +468,264 @@ bool Sensor::threadLoop() {
     return true;
 };
 
+void Sensor::captureBand(void *opaque, int start, int end) {
+    CaptureJob *job = static_cast<CaptureJob*>(opaque);
+    (job->sensor->*job->band)(*job, start, end);
+}
+
+void Sensor::runCapture(CaptureJob *job, int rows) {
+    job->sensor = this;
+    mCapturePool.runBands(captureBand, job, rows, 2);
+}
+
 void Sensor::captureRaw(uint8_t *img, uint32_t gain, uint32_t stride) {
     float totalGain = gain/100.0 * kBaseGainFactor;
-    float noiseVarGain =  totalGain * totalGain;
-    float readNoiseVar = kReadNoiseVarBeforeGain * noiseVarGain
-            + kReadNoiseVarAfterGain;
 
+    if (mNoiseStddevGain != gain) {
+        float noiseVarGain =  totalGain * totalGain;
+        float readNoiseVar = kReadNoiseVarBeforeGain * noiseVarGain
+                + kReadNoiseVarAfterGain;
+        for (uint32_t e = 0; e <= kSaturationElectrons; e++) {
+            float photonNoiseVar = e * noiseVarGain;
+            mNoiseStddevTable[e] = sqrtf(readNoiseVar + photonNoiseVar);
+        }
+        mNoiseStddevGain = gain;
+    }
+
+    CaptureJob job;
+    job.band = &Sensor::captureRawBand;
+    job.img = img;
+    job.stride = stride;
+    job.totalGain = totalGain;
+    runCapture(&job, kResolution[1]);
+    ALOGVV("Raw sensor image captured");
+}
+
+void Sensor::captureRawBand(const CaptureJob &job, int start, int end) {
     int bayerSelect[4] = {Scene::R, Scene::Gr, Scene::Gb, Scene::B}; // RGGB
-    mScene.setReadoutPixel(0,0);
-    for (unsigned int y = 0; y < kResolution[1]; y++ ) {
+    Scene::Span spans[Scene::kMaxRowSpans];
+    for (int y = start; y < end; y++) {
+        const int spanCount = mScene.getRowSpans(y, 0, kResolution[0], spans);
+        uint32_t noise = noiseState(mFrameNoiseSeed, y);
         int *bayerRow = bayerSelect + (y & 0x1) * 2;
-        uint16_t *px = (uint16_t*)img + y * stride;
-        for (unsigned int x = 0; x < kResolution[0]; x++) {
-            uint32_t electronCount;
-            electronCount = mScene.getPixelElectrons()[bayerRow[x & 0x1]];
-
-            // TODO: Better pixel saturation curve?
-            electronCount = (electronCount < kSaturationElectrons) ?
-                    electronCount : kSaturationElectrons;
-
-            // TODO: Better A/D saturation curve?
-            uint16_t rawCount = electronCount * totalGain;
-            rawCount = (rawCount < kMaxRawValue) ? rawCount : kMaxRawValue;
-
-            // Calculate noise value
-            // TODO: Use more-correct Gaussian instead of uniform noise
-            float photonNoiseVar = electronCount * noiseVarGain;
-            float noiseStddev = sqrtf_approx(readNoiseVar + photonNoiseVar);
-            // Scaled to roughly match gaussian/uniform noise stddev
-            float noiseSample = std::rand() * (2.5 / (1.0 + RAND_MAX)) - 1.25;
-
-            rawCount += kBlackLevel;
-            rawCount += noiseStddev * noiseSample;
-
-            *px++ = rawCount;
+        uint16_t *px = (uint16_t*)job.img + y * job.stride;
+        for (int s = 0; s < spanCount; s++) {
+            // Everything but noise is constant for each Bayer color in a span
+            float rawBase[2], noiseStddev[2];
+            for (int c = 0; c < 2; c++) {
+                uint32_t electronCount = spans[s].electrons[bayerRow[c]];
+
+                // TODO: Better pixel saturation curve?
+                electronCount = (electronCount < kSaturationElectrons) ?
+                        electronCount : kSaturationElectrons;
+
+                // TODO: Better A/D saturation curve?
+                uint16_t rawCount = electronCount * job.totalGain;
+                rawCount = (rawCount < kMaxRawValue) ? rawCount : kMaxRawValue;
+
+                rawBase[c] = rawCount + kBlackLevel;
+                noiseStddev[c] = mNoiseStddevTable[electronCount];
+            }
+            const int spanEnd = spans[s].x + spans[s].length;
+            for (int x = spans[s].x; x < spanEnd; x++) {
+                const int c = x & 0x1;
+                *px++ = rawBase[c] + noiseStddev[c] * gaussianSample(noise);
+            }
         }
         // TODO: Handle this better
         //simulatedTime += kRowReadoutTime;
     }
-    ALOGVV("Raw sensor image captured");
 }
 
-void Sensor::captureRGBA(uint8_t *img, uint32_t gain, uint32_t stride) {
+void Sensor::captureProcessed(uint32_t gain) {
     float totalGain = gain/100.0 * kBaseGainFactor;
+    CaptureJob job;
+    job.band = &Sensor::captureProcessedBand;
+    job.img = mProcessedFrame;
+    job.width = kResolution[0];
+    job.stride = kResolution[0];
     // In fixed-point math, calculate total scaling from electrons to 8bpp
-    int scale64x = 64 * totalGain * 255 / kMaxRawValue;
-    uint32_t inc = kResolution[0] / stride;
+    job.scale64x = 64 * totalGain * 255 / kMaxRawValue;
+    runCapture(&job, kResolution[1]);
+    ALOGVV("Processed sensor image captured");
+}
 
-    for (unsigned int y = 0, outY = 0; y < kResolution[1]; y+=inc, outY++ ) {
-        uint8_t *px = img + outY * stride * 4;
-        mScene.setReadoutPixel(0, y);
-        for (unsigned int x = 0; x < kResolution[0]; x+=inc) {
+void Sensor::captureProcessedBand(const CaptureJob &job, int start, int end) {
+    const int scale64x = job.scale64x;
+    Scene::Span spans[Scene::kMaxRowSpans];
+    for (int y = start; y < end; y++) {
+        uint32_t *px = (uint32_t*)job.img + y * job.stride;
+        const int spanCount = mScene.getRowSpans(y, 0, kResolution[0], spans);
+        for (int s = 0; s < spanCount; s++) {
             uint32_t rCount, gCount, bCount;
             // TODO: Perfect demosaicing is a cheat
-            const uint32_t *pixel = mScene.getPixelElectrons();
+            const uint32_t *pixel = spans[s].electrons;
             rCount = pixel[Scene::R]  * scale64x;
             gCount = pixel[Scene::Gr] * scale64x;
             bCount = pixel[Scene::B]  * scale64x;
 
-            *px++ = rCount < 255*64 ? rCount / 64 : 255;
-            *px++ = gCount < 255*64 ? gCount / 64 : 255;
-            *px++ = bCount < 255*64 ? bCount / 64 : 255;
-            *px++ = 255;
-            for (unsigned int j = 1; j < inc; j++)
-                mScene.getPixelElectrons();
+            uint8_t rgba[4];
+            rgba[0] = rCount < 255*64 ? rCount / 64 : 255;
+            rgba[1] = gCount < 255*64 ? gCount / 64 : 255;
+            rgba[2] = bCount < 255*64 ? bCount / 64 : 255;
+            rgba[3] = 255;
+            uint32_t value;
+            memcpy(&value, rgba, sizeof(value));
+
+            Scene::fillSpan(px + spans[s].x, value, spans[s].length);
         }
         // TODO: Handle this better
         //simulatedTime += kRowReadoutTime;
     }
+}
+
+void Sensor::deriveOutput(CaptureJob *job, uint32_t height) {
+    const uint32_t width = job->width;
+    // Crop the processed frame to the aspect ratio of the output, centered,
+    // and scale the crop to the output size
+    uint32_t cropWidth = kResolution[0];
+    uint32_t cropHeight = kResolution[1];
+    if (width * kResolution[1] > height * kResolution[0]) {
+        cropHeight = (kResolution[0] * height / width) & ~1;
+    } else {
+        cropWidth = (kResolution[1] * width / height) & ~1;
+    }
+    if (cropWidth == 0 || cropHeight == 0) {
+        ALOGE("%s: Unsupported output size %d x %d", __FUNCTION__,
+                width, height);
+        return;
+    }
+    if (mScaler.configure(cropWidth, cropHeight, width, height, 4) != OK) {
+        return;
+    }
+
+    // Outputs that aren't RGBA are scaled into scratch space first
+    if (job->band != &Sensor::deriveRGBABand &&
+            width * height > mScaledFrameSize) {
+        delete[] mScaledFrame;
+        mScaledFrameSize = width * height;
+        mScaledFrame = new uint8_t[mScaledFrameSize * 4];
+    }
+
+    job->height = height;
+    job->src = mProcessedFrame +
+            (((kResolution[1] - cropHeight) / 2) * kResolution[0] +
+             (kResolution[0] - cropWidth) / 2) * 4;
+    runCapture(job, height);
+}
+
+void Sensor::deriveRGBA(uint8_t *img, uint32_t width, uint32_t height,
+        uint32_t stride) {
+    CaptureJob job;
+    job.band = &Sensor::deriveRGBABand;
+    job.img = img;
+    job.width = width;
+    job.stride = stride;
+    deriveOutput(&job, height);
     ALOGVV("RGBA sensor image captured");
 }
 
-void Sensor::captureRGB(uint8_t *img, uint32_t gain, uint32_t stride) {
-    float totalGain = gain/100.0 * kBaseGainFactor;
-    // In fixed-point math, calculate total scaling from electrons to 8bpp
-    int scale64x = 64 * totalGain * 255 / kMaxRawValue;
-    uint32_t inc = kResolution[0] / stride;
+void Sensor::deriveRGBABand(const CaptureJob &job, int start, int end) {
+    mScaler.scaleRows(job.src, kResolution[0] * 4, job.img, job.stride * 4,
+            start, end);
+}
 
-    for (unsigned int y = 0, outY = 0; y < kResolution[1]; y += inc, outY++ ) {
-        mScene.setReadoutPixel(0, y);
-        uint8_t *px = img + outY * stride * 3;
-        for (unsigned int x = 0; x < kResolution[0]; x += inc) {
-            uint32_t rCount, gCount, bCount;
-            // TODO: Perfect demosaicing is a cheat
-            const uint32_t *pixel = mScene.getPixelElectrons();
-            rCount = pixel[Scene::R]  * scale64x;
-            gCount = pixel[Scene::Gr] * scale64x;
-            bCount = pixel[Scene::B]  * scale64x;
+void Sensor::deriveRGB(uint8_t *img, uint32_t width, uint32_t height,
+        uint32_t stride) {
+    CaptureJob job;
+    job.band = &Sensor::deriveRGBBand;
+    job.img = img;
+    job.width = width;
+    job.stride = stride;
+    deriveOutput(&job, height);
+    ALOGVV("RGB sensor image captured");
+}
 
-            *px++ = rCount < 255*64 ? rCount / 64 : 255;
-            *px++ = gCount < 255*64 ? gCount / 64 : 255;
-            *px++ = bCount < 255*64 ? bCount / 64 : 255;
-            for (unsigned int j = 1; j < inc; j++)
-                mScene.getPixelElectrons();
+void Sensor::deriveRGBBand(const CaptureJob &job, int start, int end) {
+    mScaler.scaleRows(job.src, kResolution[0] * 4, mScaledFrame,
+            job.width * 4, start, end);
+    for (int outY = start; outY < end; outY++) {
+        const uint8_t *src = mScaledFrame + outY * job.width * 4;
+        uint8_t *px = job.img + outY * job.stride * 3;
+        for (uint32_t x = 0; x < job.width; x++, src += 4) {
+            *px++ = src[0];
+            *px++ = src[1];
+            *px++ = src[2];
         }
-        // TODO: Handle this better
-        //simulatedTime += kRowReadoutTime;
     }
-    ALOGVV("RGB sensor image captured");
 }
 
-void Sensor::captureNV21(uint8_t *img, uint32_t gain, uint32_t stride) {
-    float totalGain = gain/100.0 * kBaseGainFactor;
-    // In fixed-point math, calculate total scaling from electrons to 8bpp
-    int scale64x = 64 * totalGain * 255 / kMaxRawValue;
-
-    // TODO: Make full-color
-    uint32_t inc = kResolution[0] / stride;
-    uint32_t outH = kResolution[1] / inc;
-    for (unsigned int y = 0, outY = 0, outUV = outH;
-         y < kResolution[1]; y+=inc, outY++, outUV ) {
-        uint8_t *pxY = img + outY * stride;
-        mScene.setReadoutPixel(0,y);
-        for (unsigned int x = 0; x < kResolution[0]; x+=inc) {
-            uint32_t rCount, gCount, bCount;
-            // TODO: Perfect demosaicing is a cheat
-            const uint32_t *pixel = mScene.getPixelElectrons();
-            rCount = pixel[Scene::R]  * scale64x;
-            gCount = pixel[Scene::Gr] * scale64x;
-            bCount = pixel[Scene::B]  * scale64x;
-            uint32_t avg = (rCount + gCount + bCount) / 3;
-            *pxY++ = avg < 255*64 ? avg / 64 : 255;
-            for (unsigned int j = 1; j < inc; j++)
-                mScene.getPixelElectrons();
+void Sensor::deriveNV21(uint8_t *img, uint32_t width, uint32_t height,
+        uint32_t stride) {
+    CaptureJob job;
+    job.band = &Sensor::deriveYUVBand;
+    job.img = img;
+    job.width = width;
+    job.stride = stride;
+    // Interleaved V/U plane follows the Y plane, with the same stride
+    job.cr = img + height * stride;
+    job.cb = job.cr + 1;
+    job.chromaStride = stride;
+    job.chromaStep = 2;
+    deriveOutput(&job, height);
+    ALOGVV("NV21 sensor image captured");
+}
+
+void Sensor::deriveYV12(uint8_t *img, uint32_t width, uint32_t height,
+        uint32_t stride) {
+    // YV12 rows are 16-byte aligned, and chroma planes have half the stride
+    // of the Y plane, also aligned to 16 bytes
+    const uint32_t yStride = (stride + 15) & ~15;
+    const uint32_t cStride = (yStride / 2 + 15) & ~15;
+    CaptureJob job;
+    job.band = &Sensor::deriveYUVBand;
+    job.img = img;
+    job.width = width;
+    job.stride = yStride;
+    job.cr = img + height * yStride;
+    job.cb = job.cr + (height / 2) * cStride;
+    job.chromaStride = cStride;
+    job.chromaStep = 1;
+    deriveOutput(&job, height);
+    ALOGVV("YV12 sensor image captured");
+}
+
+void Sensor::deriveYUVBand(const CaptureJob &job, int start, int end) {
+    mScaler.scaleRows(job.src, kResolution[0] * 4, mScaledFrame,
+            job.width * 4, start, end);
+    // Full-range BT.601 (JFIF) coefficients, in 8-bit fixed point. Chroma
+    // is offset by 128, and rounded.
+    const int kChromaOffset = (128 << 10) + 512;
+    for (int outY = start; outY < end; outY++) {
+        const uint8_t *src = mScaledFrame + outY * job.width * 4;
+        uint8_t *pxY = job.img + outY * job.stride;
+        for (uint32_t x = 0; x < job.width; x++, src += 4) {
+            *pxY++ = (77 * src[0] + 150 * src[1] + 29 * src[2] + 128) >> 8;
         }
-    }
-    for (unsigned int y = 0, outY = outH; y < kResolution[1]/2; y+=inc, outY++) {
-        uint8_t *px = img + outY * stride;
-        for (unsigned int x = 0; x < kResolution[0]; x+=inc) {
-            // UV to neutral
-            *px++ = 128;
-            *px++ = 128;
+
+        // Chroma is averaged over 2x2 blocks; bands start on even rows
+        if (outY & 1) continue;
+        const uint8_t *row0 = mScaledFrame + outY * job.width * 4;
+        // The last row of a frame with odd height has no pair
+        const uint8_t *row1 = (uint32_t)outY + 1 < job.height ?
+                row0 + job.width * 4 : row0;
+        uint8_t *pxCb = job.cb + (outY / 2) * job.chromaStride;
+        uint8_t *pxCr = job.cr + (outY / 2) * job.chromaStride;
+        for (uint32_t x = 0; x + 1 < job.width; x += 2) {
+            const int r = row0[0] + row0[4] + row1[0] + row1[4];
+            const int g = row0[1] + row0[5] + row1[1] + row1[5];
+            const int b = row0[2] + row0[6] + row1[2] + row1[6];
+            row0 += 8;
+            row1 += 8;
+            // Sums of 4 pixels, so shift by 2 more
+            const int cb = (-43 * r - 85 * g + 128 * b + kChromaOffset) >> 10;
+            const int cr = (128 * r - 107 * g - 21 * b + kChromaOffset) >> 10;
+            *pxCb = cb > 255 ? 255 : cb;
+            *pxCr = cr > 255 ? 255 : cr;
+            pxCb += job.chromaStep;
+            pxCr += job.chromaStep;
         }
     }
-    ALOGVV("NV21 sensor image captured");
 }
 
 } // namespace android
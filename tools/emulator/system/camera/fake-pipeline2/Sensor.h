@@ -34,6 +34,12 @@
  * sensor are exposed earlier in time than larger-numbered rows, with the time
  * offset between each row being equal to the row readout time.
  *
+ * Readout of a frame starts at the vertical sync that ends its capture, and
+ * takes the row readout time times the number of rows, so readout of frame N
+ * overlaps capture of frame N+1. Frames are kept in a readout queue until their
+ * readout completes and they are taken by waitForNewFrame. The queue holds up
+ * to the pipeline depth frames; the sensor stalls when it is full.
+ *
  * The characteristics of this sensor don't correspond to any actual sensor,
  * but are not far off typical sensors.
  *
@@ -79,15 +85,19 @@
 
 #include "Scene.h"
 #include "Base.h"
+#include "AuxBufferPool.h"
+#include "../WorkerPool.h"
+#include "../ImageScaler.h"
+#include "../StageTracer.h"
 
 namespace android {
 
-class EmulatedFakeCamera2;
-
 class Sensor: private Thread, public virtual RefBase {
   public:
 
-    Sensor(EmulatedFakeCamera2 *parent);
+    // Auxiliary buffers for JPEG outputs come from auxBuffers. Capture
+    // durations are recorded with tracer, unless it's NULL.
+    Sensor(AuxBufferPool *auxBuffers, StageTracer *tracer);
     ~Sensor();
 
     /*
@@ -109,8 +119,15 @@ class Sensor: private Thread, public virtual RefBase {
     void setExposureTime(uint64_t ns);
     void setFrameDuration(uint64_t ns);
     void setSensitivity(uint32_t gain);
+    // Seed for sensor noise. Output images are fully determined by the seed,
+    // the scene, and the number of frames captured since the seed was set.
+    void setNoiseSeed(uint32_t seed);
     // Buffer must be at least stride*height*2 bytes in size
     void setDestinationBuffers(Buffers *buffers);
+    // Number of captured frames that may be waiting for, or going through,
+    // readout at the same time. Clamped to [1, kMaxPipelineDepth].
+    void setPipelineDepth(uint32_t depth);
+    uint32_t getPipelineDepth();
 
     /*
      * Controls that cause reconfiguration delay
@@ -128,12 +145,24 @@ class Sensor: private Thread, public virtual RefBase {
     bool waitForVSync(nsecs_t reltime);
 
     // Wait until a new frame has been read out, and then return the time
-    // capture started.  May return immediately if a new frame has been pushed
-    // since the last wait for a new frame. Returns true if new frame is
-    // returned, false if timed out.
+    // capture started.  May return immediately if an earlier frame has already
+    // completed readout. Frames are returned in capture order. Returns true if
+    // new frame is returned, false if timed out.
     bool waitForNewFrame(nsecs_t reltime,
             nsecs_t *captureTime);
 
+    /*
+     * Image rendering
+     */
+
+    // Renders a frame into the buffers on the calling thread, with none of the
+    // sensor timing. JPEG outputs get an auxiliary RGB buffer appended to
+    // buffers. The capture thread uses this for every frame; it's public so
+    // the pixel pipeline can be benchmarked without a camera device. Must not
+    // be called while the sensor is started.
+    void captureFrame(Buffers *buffers, uint32_t gain,
+            uint64_t exposureDuration, nsecs_t captureTime);
+
     /**
      * Static sensor characteristics
      */
@@ -171,8 +200,12 @@ class Sensor: private Thread, public virtual RefBase {
     static const uint32_t kAvailableSensitivities[5];
     static const uint32_t kDefaultSensitivity;
 
+    static const uint32_t kMaxPipelineDepth = 4;
+    static const uint32_t kDefaultPipelineDepth = 2;
+
   private:
-    EmulatedFakeCamera2 *mParent;
+    AuxBufferPool *mAuxBuffers;
+    StageTracer *mTracer;
 
     Mutex mControlMutex; // Lock before accessing control parameters
     // Start of control parameters
@@ -182,6 +215,8 @@ class Sensor: private Thread, public virtual RefBase {
     uint64_t  mFrameDuration;
     uint32_t  mGainFactor;
     Buffers  *mNextBuffers;
+    uint32_t  mNoiseSeed;
+    bool      mNoiseSeedChanged;
 
     // End of control parameters
 
@@ -189,8 +224,14 @@ class Sensor: private Thread, public virtual RefBase {
     // Start of readout variables
     Condition mReadoutAvailable;
     Condition mReadoutComplete;
-    Buffers  *mCapturedBuffers;
-    nsecs_t   mCaptureTime;
+    struct ReadoutFrame {
+        nsecs_t captureTime;
+        // Time the last row of the frame has been read out
+        nsecs_t readoutDoneTime;
+    } mReadoutQueue[kMaxPipelineDepth];
+    uint32_t  mReadoutHead;
+    uint32_t  mReadoutCount;
+    uint32_t  mPipelineDepth;
     // End of readout variables
 
     // Time of sensor startup, used for simulation zero-time point
@@ -205,15 +246,79 @@ class Sensor: private Thread, public virtual RefBase {
 
     virtual bool threadLoop();
 
-    nsecs_t mNextCaptureTime;
-    Buffers *mNextCapturedBuffers;
+    // Queues a captured frame for readout, waiting for room in the readout
+    // queue. Returns false if the thread is asked to exit while waiting.
+    bool queueReadout(nsecs_t captureTime, nsecs_t readoutDoneTime);
 
     Scene mScene;
 
+    // Captures are split into row bands processed in parallel. Bands read
+    // the scene through its thread-safe span API.
+    WorkerPool mCapturePool;
+
+    // Noise seed for the frame being captured; each row derives its own
+    // generator state from it, so noise doesn't depend on banding.
+    uint32_t mFrameNoiseSeed;
+    uint32_t mFrameCount;
+
+    // Standard deviation of noise for each electron count, for the gain of
+    // the frame being captured
+    float *mNoiseStddevTable;
+    uint32_t mNoiseStddevGain;
+
+    // Full resolution RGBA rendering of the frame being captured, that
+    // processed streams are derived from
+    uint8_t *mProcessedFrame;
+
+    // Scales a crop of mProcessedFrame to the size of a processed output.
+    // Outputs that aren't RGBA are scaled into mScaledFrame, which holds
+    // mScaledFrameSize pixels, and converted from there.
+    ImageScaler mScaler;
+    uint8_t *mScaledFrame;
+    uint32_t mScaledFrameSize;
+
+    struct CaptureJob {
+        Sensor *sensor;
+        void (Sensor::*band)(const CaptureJob &job, int start, int end);
+        uint8_t *img;
+        uint32_t width;
+        uint32_t stride;
+        float totalGain;
+        int scale64x;
+        const uint8_t *src;
+        uint32_t height;
+        // YUV outputs: chroma planes, their row stride, and the distance
+        // between two samples of a plane
+        uint8_t *cb;
+        uint8_t *cr;
+        uint32_t chromaStride;
+        uint32_t chromaStep;
+    };
+    static void captureBand(void *opaque, int start, int end);
+    void runCapture(CaptureJob *job, int rows);
+
     void captureRaw(uint8_t *img, uint32_t gain, uint32_t stride);
-    void captureRGBA(uint8_t *img, uint32_t gain, uint32_t stride);
-    void captureRGB(uint8_t *img, uint32_t gain, uint32_t stride);
-    void captureNV21(uint8_t *img, uint32_t gain, uint32_t stride);
+    void captureProcessed(uint32_t gain);
+
+    void captureRawBand(const CaptureJob &job, int start, int end);
+    void captureProcessedBand(const CaptureJob &job, int start, int end);
+
+    // Processed outputs, derived from mProcessedFrame.
+    // deriveOutput crops and scales mProcessedFrame to the output of a job,
+    // which has band, img, width, stride (and chroma for YUV) set up
+    void deriveOutput(CaptureJob *job, uint32_t height);
+    void deriveRGBA(uint8_t *img, uint32_t width, uint32_t height,
+            uint32_t stride);
+    void deriveRGB(uint8_t *img, uint32_t width, uint32_t height,
+            uint32_t stride);
+    void deriveNV21(uint8_t *img, uint32_t width, uint32_t height,
+            uint32_t stride);
+    void deriveYV12(uint8_t *img, uint32_t width, uint32_t height,
+            uint32_t stride);
+
+    void deriveRGBABand(const CaptureJob &job, int start, int end);
+    void deriveRGBBand(const CaptureJob &job, int start, int end);
+    void deriveYUVBand(const CaptureJob &job, int start, int end);
 };
 
 }
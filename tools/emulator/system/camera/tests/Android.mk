@@ -0,0 +1,134 @@
+# Copyright (C) 2013 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Host-side tests for the parts of the emulated camera that don't depend on
+# the camera framework.
+
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := emulated_camera_converters_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_CFLAGS += -msse2
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/..
+LOCAL_SRC_FILES := \
+	ConvertersTest.cpp \
+	../Converters.cpp \
+	../ConvertersSSE2.cpp \
+	../ConvertersNEON.cpp \
+	../WorkerPool.cpp
+LOCAL_STATIC_LIBRARIES := libutils libcutils liblog
+LOCAL_LDLIBS += -lpthread
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := emulated_camera_qemu_client_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/..
+LOCAL_SRC_FILES := \
+	QemuClientTest.cpp \
+	QemuCameraServiceStub.cpp \
+	../QemuClient.cpp
+LOCAL_STATIC_LIBRARIES := libutils libcutils liblog
+LOCAL_LDLIBS += -lpthread
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := emulated_camera_image_scaler_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_CFLAGS += -msse2
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/..
+LOCAL_SRC_FILES := \
+	ImageScalerTest.cpp \
+	../ImageScaler.cpp
+LOCAL_STATIC_LIBRARIES := libutils libcutils liblog
+LOCAL_LDLIBS += -lpthread
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := emulated_camera_frame_pacer_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/..
+LOCAL_SRC_FILES := \
+	FramePacerTest.cpp \
+	../FramePacer.cpp
+LOCAL_STATIC_LIBRARIES := libutils libcutils liblog
+LOCAL_LDLIBS += -lpthread -lrt
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := emulated_camera_stage_tracer_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/..
+LOCAL_SRC_FILES := \
+	StageTracerTest.cpp \
+	../StageTracer.cpp
+LOCAL_STATIC_LIBRARIES := libutils libcutils liblog
+LOCAL_LDLIBS += -lpthread
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# external/jpeg only builds libjpeg for the target, so the tests that
+# compress JPEGs link the host's libjpeg instead. They are only built when
+# EMULATED_CAMERA_HOST_LIBJPEG is set to true, on hosts that have it.
+ifeq ($(EMULATED_CAMERA_HOST_LIBJPEG),true)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := emulated_camera_jpeg_encoder_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/..
+LOCAL_SRC_FILES := \
+	JpegEncoderTest.cpp \
+	../JpegEncoder.cpp \
+	../WorkerPool.cpp
+LOCAL_STATIC_LIBRARIES := libutils libcutils liblog
+LOCAL_LDLIBS += -ljpeg -lpthread
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := emulated_camera_pipeline_benchmark
+LOCAL_MODULE_TAGS := tests
+LOCAL_CFLAGS += -msse2
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/.. \
+	$(call include-path-for, camera)
+LOCAL_SRC_FILES := \
+	PipelineBenchmark.cpp \
+	../Converters.cpp \
+	../ConvertersSSE2.cpp \
+	../ConvertersNEON.cpp \
+	../WorkerPool.cpp \
+	../ImageScaler.cpp \
+	../JpegEncoder.cpp \
+	../StageTracer.cpp \
+	../fake-pipeline2/Scene.cpp \
+	../fake-pipeline2/Sensor.cpp \
+	../fake-pipeline2/AuxBufferPool.cpp
+LOCAL_STATIC_LIBRARIES := libutils libcutils liblog
+LOCAL_LDLIBS += -ljpeg -lpthread
+
+include $(BUILD_HOST_EXECUTABLE)
+
+endif
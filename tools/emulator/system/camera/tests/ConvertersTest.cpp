@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks that the vectorized, and the banded framebuffer converters produce
+ * the same RGB frames as the scalar reference converters.
+ *
+ * Usage: emulated_camera_converters_test
+ * Exit status is 0 if all conversions match, or 1 otherwise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Converters.h"
+
+using namespace android;
+
+typedef void (*FrameConverter)(const void* yuv, void* rgb, int width, int height);
+
+struct ConverterDesc {
+    const char*     name;
+    FrameConverter  convert;
+    int             rgb_pix_size;
+};
+
+static const ConverterDesc kConverters[] = {
+    { "YV12ToRGB565", YV12ToRGB565, 2 },
+    { "YV12ToRGB32",  YV12ToRGB32,  4 },
+    { "YU12ToRGB32",  YU12ToRGB32,  4 },
+    { "NV12ToRGB565", NV12ToRGB565, 2 },
+    { "NV12ToRGB32",  NV12ToRGB32,  4 },
+    { "NV21ToRGB565", NV21ToRGB565, 2 },
+    { "NV21ToRGB32",  NV21ToRGB32,  4 },
+};
+
+/* Sizes include widths that are not a multiple of the SIMD step, to cover the
+ * scalar tails, and frames large enough to be converted in bands. */
+static const int kSizes[][2] = {
+    { 2, 2 }, { 14, 6 }, { 176, 144 }, { 322, 242 }, { 640, 480 }, { 1282, 722 },
+};
+
+/* Compares two RGB frames. Alpha of RGB32 frames is not defined by the
+ * converters, so it's ignored. */
+static bool compareFrames(const uint8_t* ref, const uint8_t* out,
+                          int pix_size, int pixels, int* first_diff)
+{
+    for (int n = 0; n < pixels; n++) {
+        const int bytes = (pix_size == 4) ? 3 : pix_size;
+        if (memcmp(ref + n * pix_size, out + n * pix_size, bytes) != 0) {
+            *first_diff = n;
+            return false;
+        }
+    }
+    return true;
+}
+
+static int runConverter(const ConverterDesc& desc, ConverterImpl impl,
+                        int threads)
+{
+    int failures = 0;
+    for (size_t s = 0; s < sizeof(kSizes) / sizeof(*kSizes); s++) {
+        const int width = kSizes[s][0];
+        const int height = kSizes[s][1];
+        const int pixels = width * height;
+        const size_t yuv_size = (pixels * 12) / 8;
+        const size_t rgb_size = pixels * desc.rgb_pix_size;
+
+        uint8_t* yuv = new uint8_t[yuv_size];
+        uint8_t* ref = new uint8_t[rgb_size];
+        uint8_t* out = new uint8_t[rgb_size];
+        for (size_t n = 0; n < yuv_size; n++) {
+            yuv[n] = rand() & 0xff;
+        }
+
+        setConverterThreads(0);
+        setConverterImpl(CONVERTER_SCALAR);
+        desc.convert(yuv, ref, width, height);
+
+        setConverterImpl(impl);
+        setConverterThreads(threads);
+        memset(out, 0x5a, rgb_size);
+        desc.convert(yuv, out, width, height);
+
+        int diff = 0;
+        if (!compareFrames(ref, out, desc.rgb_pix_size, pixels, &diff)) {
+            printf("FAIL: %s impl=%d threads=%d %dx%d: pixel %d,%d differs\n",
+                   desc.name, impl, threads, width, height,
+                   diff % width, diff / width);
+            failures++;
+        }
+
+        delete[] yuv;
+        delete[] ref;
+        delete[] out;
+    }
+    return failures;
+}
+
+int main(int argc, char** argv)
+{
+    srand(1);
+
+    ConverterImpl impls[3];
+    int impl_num = 0;
+    impls[impl_num++] = CONVERTER_SCALAR;
+    if (setConverterImpl(CONVERTER_SSE2)) {
+        impls[impl_num++] = CONVERTER_SSE2;
+    }
+    if (setConverterImpl(CONVERTER_NEON)) {
+        impls[impl_num++] = CONVERTER_NEON;
+    }
+    printf("Best converter implementation: %d\n", getBestConverterImpl());
+
+    static const int kThreads[] = { 0, 1, 3 };
+    int failures = 0;
+    int runs = 0;
+    for (size_t c = 0; c < sizeof(kConverters) / sizeof(*kConverters); c++) {
+        for (int i = 0; i < impl_num; i++) {
+            for (size_t t = 0; t < sizeof(kThreads) / sizeof(*kThreads); t++) {
+                failures += runConverter(kConverters[c], impls[i], kThreads[t]);
+                runs++;
+            }
+        }
+    }
+    setConverterThreads(0);
+
+    printf("%s: %d converter runs, %d failures\n",
+           failures ? "FAILED" : "PASSED", runs, failures);
+    return failures ? 1 : 0;
+}
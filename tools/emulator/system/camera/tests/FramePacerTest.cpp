@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks that FramePacer keeps deadlines on a fixed grid regardless of how long
+ * frames take, drops deadlines that have been missed, and reports the frame
+ * rate achieved. Frames are simulated, so the checks don't depend on how busy
+ * the host is. Then paces 30 FPS for real for a second, and reports statistics.
+ *
+ * Usage: emulated_camera_frame_pacer_test
+ * Exit status is 0 if all checks pass, or 1 otherwise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "FramePacer.h"
+
+using namespace android;
+
+static const nsecs_t kPeriod30 = 1000000000LL / 30;
+
+/* Frames that take varying time, but less than a period, must neither shift
+ * the deadlines nor be dropped. */
+static int checkNoDrift()
+{
+    FramePacer pacer;
+    const nsecs_t start = 1000000000LL;
+    pacer.start(30, start);
+
+    for (int n = 0; n < 300; n++) {
+        const nsecs_t deadline = pacer.getNextDeadline();
+        if (deadline != start + n * kPeriod30) {
+            printf("FAIL: drift: deadline %d is %lld, expected %lld\n", n,
+                   (long long)deadline, (long long)(start + n * kPeriod30));
+            return 1;
+        }
+        /* Wake up to 2 ms late, and take up to 20 ms to deliver. */
+        const nsecs_t late = (rand() % 2000) * 1000LL;
+        const nsecs_t work = (rand() % 20000) * 1000LL;
+        if (pacer.onFrame(deadline + late + work) != 0) {
+            printf("FAIL: drift: frame %d was dropped\n", n);
+            return 1;
+        }
+    }
+
+    FramePacer::Stats stats;
+    pacer.getStats(&stats);
+    if (stats.frames != 300 || stats.dropped != 0 ||
+        stats.fps < 29.5f || stats.fps > 30.5f) {
+        printf("FAIL: drift: %u frames, %u dropped at %.2f FPS\n",
+               stats.frames, stats.dropped, stats.fps);
+        return 1;
+    }
+    return 0;
+}
+
+/* A frame that is late by more than a period must drop the missed deadlines,
+ * and keep the grid for the frames that follow. */
+static int checkDrop()
+{
+    FramePacer pacer;
+    pacer.start(30, 0);
+
+    pacer.onFrame(0);
+    /* Second frame is delivered 2.5 periods late. */
+    const int dropped = pacer.onFrame(kPeriod30 * 7 / 2);
+    if (dropped != 2) {
+        printf("FAIL: drop: %d deadlines dropped, expected 2\n", dropped);
+        return 1;
+    }
+    if (pacer.getNextDeadline() != 4 * kPeriod30) {
+        printf("FAIL: drop: next deadline is %lld, expected %lld\n",
+               (long long)pacer.getNextDeadline(), (long long)(4 * kPeriod30));
+        return 1;
+    }
+
+    FramePacer::Stats stats;
+    pacer.getStats(&stats);
+    if (stats.frames != 2 || stats.dropped != 2) {
+        printf("FAIL: drop: %u frames, %u dropped\n", stats.frames,
+               stats.dropped);
+        return 1;
+    }
+    return 0;
+}
+
+/* Paces frames for real, the way camera devices do. */
+static int checkRealTime()
+{
+    FramePacer pacer;
+    pacer.start(30, systemTime(SYSTEM_TIME_MONOTONIC));
+
+    for (int n = 0; n < 30; n++) {
+        const nsecs_t deadline = pacer.getNextDeadline();
+        struct timespec ts;
+        ts.tv_sec = deadline / 1000000000LL;
+        ts.tv_nsec = deadline % 1000000000LL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        /* Simulate 10 ms of frame processing. */
+        const nsecs_t busy = systemTime(SYSTEM_TIME_MONOTONIC) + 10000000LL;
+        while (systemTime(SYSTEM_TIME_MONOTONIC) < busy) {
+        }
+        pacer.onFrame(systemTime(SYSTEM_TIME_MONOTONIC));
+    }
+
+    FramePacer::Stats stats;
+    pacer.getStats(&stats);
+    printf("30 FPS for 1 s: %u frames at %.2f FPS, %u dropped, jitter %lld us"
+           " mean, %lld us max\n", stats.frames, stats.fps, stats.dropped,
+           (long long)(stats.meanJitter / 1000LL),
+           (long long)(stats.maxJitter / 1000LL));
+    /* A loaded host may drop frames, so only check the rate loosely. */
+    if (stats.fps < 25.0f || stats.fps > 31.0f) {
+        printf("FAIL: real time: %.2f FPS\n", stats.fps);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int failures = 0;
+    failures += checkNoDrift();
+    failures += checkDrop();
+    failures += checkRealTime();
+
+    if (failures) {
+        printf("%d check(s) FAILED\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
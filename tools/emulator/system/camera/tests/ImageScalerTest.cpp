@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks that ImageScaler matches a floating point reference of area averaging
+ * and bilinear filtering to within one level, that it keeps constant images
+ * constant, and that identity, and 2:1 scaling are exact. Also reports the
+ * time it takes to scale a VGA frame to CIF.
+ *
+ * Usage: emulated_camera_image_scaler_test
+ * Exit status is 0 if all checks pass, or 1 otherwise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ImageScaler.h"
+
+using namespace android;
+
+/* Source and destination sizes include odd ratios, sizes that are not a
+ * multiple of the SIMD step, and upscaling. */
+static const int kScalings[][4] = {
+    { 640, 480, 352, 288 }, { 640, 480, 320, 240 }, { 640, 480, 176, 144 },
+    { 640, 480, 160, 120 }, { 37, 23, 11, 7 }, { 176, 144, 640, 480 },
+    { 13, 9, 31, 17 }, { 5, 5, 1, 1 }, { 1, 1, 3, 2 },
+};
+
+static const int kChannels[] = { 1, 2, 3, 4 };
+
+/* Computes reference filter weights for one dimension. */
+static void referenceWeights(int src_size, int dst_size, int n, double* weights)
+{
+    memset(weights, 0, src_size * sizeof(double));
+    if (dst_size < src_size) {
+        const double a = (double)n * src_size / dst_size;
+        const double b = (double)(n + 1) * src_size / dst_size;
+        for (int k = 0; k < src_size; k++) {
+            const double lo = k > a ? k : a;
+            const double hi = k + 1 < b ? k + 1 : b;
+            if (hi > lo) {
+                weights[k] = (hi - lo) * dst_size / src_size;
+            }
+        }
+    } else {
+        double pos = (n + 0.5) * src_size / dst_size - 0.5;
+        if (pos < 0) {
+            pos = 0;
+        }
+        int k = (int)pos;
+        const double frac = pos - k;
+        weights[k] += 1.0 - frac;
+        if (frac > 0) {
+            weights[k + 1 < src_size ? k + 1 : k] += frac;
+        }
+    }
+}
+
+static void referenceScale(const uint8_t* src, int src_w, int src_h,
+                           uint8_t* dst, int dst_w, int dst_h, int ch)
+{
+    double* wx = new double[src_w];
+    double* wy = new double[src_h];
+    for (int y = 0; y < dst_h; y++) {
+        referenceWeights(src_h, dst_h, y, wy);
+        for (int x = 0; x < dst_w; x++) {
+            referenceWeights(src_w, dst_w, x, wx);
+            for (int c = 0; c < ch; c++) {
+                double sum = 0;
+                for (int sy = 0; sy < src_h; sy++) {
+                    if (wy[sy] == 0) continue;
+                    for (int sx = 0; sx < src_w; sx++) {
+                        sum += wy[sy] * wx[sx] * src[(sy * src_w + sx) * ch + c];
+                    }
+                }
+                dst[(y * dst_w + x) * ch + c] = (uint8_t)(sum + 0.5);
+            }
+        }
+    }
+    delete[] wx;
+    delete[] wy;
+}
+
+static int checkReference(int src_w, int src_h, int dst_w, int dst_h, int ch)
+{
+    const int src_size = src_w * src_h * ch;
+    const int dst_size = dst_w * dst_h * ch;
+    uint8_t* src = new uint8_t[src_size];
+    uint8_t* ref = new uint8_t[dst_size];
+    uint8_t* out = new uint8_t[dst_size];
+    for (int n = 0; n < src_size; n++) {
+        src[n] = rand() & 0xff;
+    }
+
+    int failures = 0;
+    ImageScaler scaler;
+    if (scaler.configure(src_w, src_h, dst_w, dst_h, ch) != NO_ERROR) {
+        printf("FAIL: %dx%d -> %dx%d, %d channels: configure failed\n",
+               src_w, src_h, dst_w, dst_h, ch);
+        failures++;
+    } else {
+        referenceScale(src, src_w, src_h, ref, dst_w, dst_h, ch);
+        scaler.scale(src, src_w * ch, out, dst_w * ch);
+        for (int n = 0; n < dst_size; n++) {
+            if (abs(ref[n] - out[n]) > 1) {
+                printf("FAIL: %dx%d -> %dx%d, %d channels: byte %d is %d,"
+                       " expected %d\n", src_w, src_h, dst_w, dst_h, ch, n,
+                       out[n], ref[n]);
+                failures++;
+                break;
+            }
+        }
+    }
+
+    delete[] src;
+    delete[] ref;
+    delete[] out;
+    return failures;
+}
+
+static int checkConstant(int src_w, int src_h, int dst_w, int dst_h)
+{
+    uint8_t* src = new uint8_t[src_w * src_h * 4];
+    uint8_t* out = new uint8_t[dst_w * dst_h * 4];
+    for (int n = 0; n < src_w * src_h; n++) {
+        src[n * 4] = 0;
+        src[n * 4 + 1] = 1;
+        src[n * 4 + 2] = 128;
+        src[n * 4 + 3] = 255;
+    }
+
+    int failures = 0;
+    ImageScaler scaler;
+    scaler.configure(src_w, src_h, dst_w, dst_h, 4);
+    scaler.scale(src, src_w * 4, out, dst_w * 4);
+    for (int n = 0; n < dst_w * dst_h * 4; n++) {
+        if (out[n] != src[n % 4]) {
+            printf("FAIL: constant %dx%d -> %dx%d: byte %d is %d\n",
+                   src_w, src_h, dst_w, dst_h, n, out[n]);
+            failures++;
+            break;
+        }
+    }
+
+    delete[] src;
+    delete[] out;
+    return failures;
+}
+
+static int checkExact(int src_w, int src_h, int dst_w, int dst_h)
+{
+    const int src_size = src_w * src_h;
+    uint8_t* src = new uint8_t[src_size];
+    uint8_t* out = new uint8_t[dst_w * dst_h];
+    for (int n = 0; n < src_size; n++) {
+        src[n] = rand() & 0xff;
+    }
+
+    int failures = 0;
+    ImageScaler scaler;
+    scaler.configure(src_w, src_h, dst_w, dst_h, 1);
+    scaler.scale(src, src_w, out, dst_w);
+    const int fx = src_w / dst_w;
+    const int fy = src_h / dst_h;
+    for (int y = 0; y < dst_h && !failures; y++) {
+        for (int x = 0; x < dst_w; x++) {
+            int sum = 0;
+            for (int sy = 0; sy < fy; sy++) {
+                for (int sx = 0; sx < fx; sx++) {
+                    sum += src[(y * fy + sy) * src_w + x * fx + sx];
+                }
+            }
+            const int expected = (sum + fx * fy / 2) / (fx * fy);
+            if (out[y * dst_w + x] != expected) {
+                printf("FAIL: exact %dx%d -> %dx%d: pixel %d,%d is %d,"
+                       " expected %d\n", src_w, src_h, dst_w, dst_h, x, y,
+                       out[y * dst_w + x], expected);
+                failures++;
+                break;
+            }
+        }
+    }
+
+    delete[] src;
+    delete[] out;
+    return failures;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Reports the average time it takes to scale a VGA frame to CIF. */
+static void benchmark(int channels)
+{
+    static const int kFrames = 100;
+    uint8_t* src = new uint8_t[640 * 480 * channels];
+    uint8_t* out = new uint8_t[352 * 288 * channels];
+    memset(src, 0x80, 640 * 480 * channels);
+
+    ImageScaler scaler;
+    scaler.configure(640, 480, 352, 288, channels);
+    const double start = now();
+    for (int n = 0; n < kFrames; n++) {
+        scaler.scale(src, 640 * channels, out, 352 * channels);
+    }
+    printf("640x480 -> 352x288, %d channels: %.3f ms per frame\n", channels,
+           (now() - start) * 1000 / kFrames);
+
+    delete[] src;
+    delete[] out;
+}
+
+int main(int argc, char** argv)
+{
+    srand(1);
+
+    int failures = 0;
+    int runs = 0;
+    for (size_t s = 0; s < sizeof(kScalings) / sizeof(*kScalings); s++) {
+        const int* sc = kScalings[s];
+        for (size_t c = 0; c < sizeof(kChannels) / sizeof(*kChannels); c++) {
+            failures += checkReference(sc[0], sc[1], sc[2], sc[3], kChannels[c]);
+            runs++;
+        }
+        failures += checkConstant(sc[0], sc[1], sc[2], sc[3]);
+        runs++;
+    }
+    failures += checkExact(640, 480, 320, 240);
+    failures += checkExact(64, 48, 16, 12);
+    failures += checkExact(33, 17, 33, 17);
+    runs += 3;
+
+    benchmark(4);
+    benchmark(1);
+
+    printf("%s: %d scaler runs, %d failures\n",
+           failures ? "FAILED" : "PASSED", runs, failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks that images compressed in parallel strips decode to the same pixels
+ * as images compressed on a single thread, for all input formats, and for
+ * sizes that don't split into whole MCUs.
+ *
+ * Usage: emulated_camera_jpeg_encoder_test
+ * Exit status is 0 if all checks pass, or 1 otherwise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "JpegEncoder.h"
+
+extern "C" {
+#include <jpeglib.h>
+}
+
+using namespace android;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            printf("FAIL: %s:%d: %s\n", __FILE__, __LINE__, #cond);         \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+/* Fills an image with a pattern that has both, smooth, and sharp areas. */
+static void fillImage(uint8_t* image, size_t size)
+{
+    for (size_t n = 0; n < size; n++) {
+        image[n] = (n * 7 + (n >> 9) * 13) & 0xff;
+    }
+}
+
+/* Decodes a JPEG into RGB888.
+ * Return:
+ *  Decoded image (to be freed by the caller), or NULL if the JPEG doesn't
+ *  match the expected dimensions.
+ */
+static uint8_t* decode(const uint8_t* jpeg, size_t size, int width, int height)
+{
+    jpeg_decompress_struct cinfo;
+    jpeg_error_mgr error;
+    cinfo.err = jpeg_std_error(&error);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, const_cast<uint8_t*>(jpeg), size);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+    if ((int)cinfo.output_width != width || (int)cinfo.output_height != height) {
+        jpeg_destroy_decompress(&cinfo);
+        return NULL;
+    }
+    uint8_t* out = new uint8_t[width * height * 3];
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = out + cinfo.output_scanline * width * 3;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return out;
+}
+
+static void testFormat(JpegEncoder::InputFormat format, int width, int height)
+{
+    int stride = width;
+    size_t size = width * height * 3;
+    if (format != JpegEncoder::INPUT_RGB888) {
+        /* Odd strides are padded, like gralloc buffers. */
+        stride = (width + 31) & ~31;
+        const int chroma_stride = ((stride / 2) + 15) & ~15;
+        size = stride * height + 2 * chroma_stride * ((height + 1) / 2) + stride;
+    }
+    uint8_t* image = new uint8_t[size];
+    fillImage(image, size);
+
+    JpegEncoder single;
+    CHECK(single.compress(image, format, width, height, stride, 90) == NO_ERROR);
+    uint8_t* expected = decode(single.getCompressedImage(),
+                               single.getCompressedSize(), width, height);
+    CHECK(expected != NULL);
+
+    JpegEncoder striped;
+    CHECK(striped.setThreadCount(3) == NO_ERROR);
+    /* Compress twice to check that strip buffers are reused correctly. */
+    for (int pass = 0; pass < 2; pass++) {
+        CHECK(striped.compress(image, format, width, height, stride, 90) == NO_ERROR);
+        uint8_t* actual = decode(striped.getCompressedImage(),
+                                 striped.getCompressedSize(), width, height);
+        CHECK(actual != NULL);
+        if (expected != NULL && actual != NULL) {
+            if (memcmp(expected, actual, width * height * 3) != 0) {
+                printf("FAIL: format %d, %dx%d decodes differently in strips\n",
+                       format, width, height);
+                failures++;
+            }
+        }
+        delete[] actual;
+    }
+
+    delete[] expected;
+    delete[] image;
+}
+
+int main(int argc, char** argv)
+{
+    static const JpegEncoder::InputFormat formats[] = {
+        JpegEncoder::INPUT_RGB888,
+        JpegEncoder::INPUT_NV21,
+        JpegEncoder::INPUT_YV12,
+    };
+    for (size_t n = 0; n < sizeof(formats) / sizeof(*formats); n++) {
+        testFormat(formats[n], 640, 480);
+        testFormat(formats[n], 1283, 721);
+        /* Too small to be split. */
+        testFormat(formats[n], 176, 144);
+    }
+
+    printf("%s: %d failures\n", failures ? "FAILED" : "PASSED", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,422 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures frames per second of the pixel processing stages of the emulated
+ * cameras at common resolutions: fake sensor outputs of every format, the
+ * framebuffer converters, and JPEG compression of every input format. Each
+ * output is checked, so a speedup that breaks the output doesn't go unnoticed:
+ * sensor and converter outputs against golden checksums, and JPEGs by decoding
+ * them, and comparing to the RGB sensor output they were made from.
+ *
+ * Sensor frames are rendered on the calling thread only, and the converters,
+ * and the JPEG encoder don't use worker threads, so the figures are per core.
+ *
+ * Usage: emulated_camera_pipeline_benchmark [-n frames] [-g]
+ *  -n frames - Number of frames each stage is timed for. Default is 30.
+ *  -g - Print checksums of the outputs in the form of the golden table, instead
+ *      of checking them. Use this after a change that alters outputs on
+ *      purpose.
+ * Exit status is 0 if all checks pass, or 1 otherwise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "Converters.h"
+#include "JpegEncoder.h"
+#include "fake-pipeline2/Sensor.h"
+
+extern "C" {
+#include <jpeglib.h>
+}
+
+using namespace android;
+
+/* Checksums of the outputs, as printed with -g. */
+static const struct {
+    const char* name;
+    uint32_t    checksum;
+} kGolden[] = {
+    { "sensor raw 640x480", 0x06601c4a },
+    { "sensor rgba 320x240", 0x463f1e15 },
+    { "sensor rgb 320x240", 0x8ee0d0af },
+    { "sensor nv21 320x240", 0xd4b9253f },
+    { "sensor yv12 320x240", 0xea172c49 },
+    { "nv21->rgb32 320x240", 0x263c90ac },
+    { "nv21->rgb565 320x240", 0x215cbf79 },
+    { "yv12->rgb32 320x240", 0x263c90ac },
+    { "yv12->rgb565 320x240", 0xf2a26701 },
+    { "nv21->yv12 320x240", 0xea172c49 },
+    { "yv12->nv21 320x240", 0xd4b9253f },
+    { "sensor rgba 640x480", 0xbe30cb52 },
+    { "sensor rgb 640x480", 0x95bf92e6 },
+    { "sensor nv21 640x480", 0x74d56852 },
+    { "sensor yv12 640x480", 0xc290e38a },
+    { "nv21->rgb32 640x480", 0x6007aa69 },
+    { "nv21->rgb565 640x480", 0xa9ebd985 },
+    { "yv12->rgb32 640x480", 0x6007aa69 },
+    { "yv12->rgb565 640x480", 0x41d93143 },
+    { "nv21->yv12 640x480", 0xc290e38a },
+    { "yv12->nv21 640x480", 0x74d56852 },
+    { "sensor rgba 1280x720", 0x8448d34f },
+    { "sensor rgb 1280x720", 0x3ce025e9 },
+    { "sensor nv21 1280x720", 0xba21238a },
+    { "sensor yv12 1280x720", 0xf03a9652 },
+    { "nv21->rgb32 1280x720", 0xfb0e64db },
+    { "nv21->rgb565 1280x720", 0xe18c150d },
+    { "yv12->rgb32 1280x720", 0xfb0e64db },
+    { "yv12->rgb565 1280x720", 0x2ef0df37 },
+    { "nv21->yv12 1280x720", 0xf03a9652 },
+    { "yv12->nv21 1280x720", 0xba21238a },
+};
+
+/* Largest mean absolute difference of a decoded JPEG from its source. */
+static const float kMaxJpegError = 4.0f;
+
+static const struct {
+    uint32_t    width;
+    uint32_t    height;
+} kSizes[] = {
+    { 320, 240 },
+    { 640, 480 },
+    { 1280, 720 },
+};
+
+static int gFrames = 30;
+static bool gPrintGolden = false;
+static int gFailures = 0;
+
+/* FNV-1a hash of a buffer. */
+static uint32_t checksum(const void* data, size_t size)
+{
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    uint32_t hash = 2166136261u;
+    for (size_t n = 0; n < size; n++) {
+        hash = (hash ^ p[n]) * 16777619u;
+    }
+    return hash;
+}
+
+/* Prints timing of a stage, and checks its output against the golden table. */
+static void report(const char* name, nsecs_t elapsed, const void* output,
+                   size_t size)
+{
+    const uint32_t sum = checksum(output, size);
+    const float ms = elapsed / 1000000.0f / gFrames;
+    if (gPrintGolden) {
+        printf("    { \"%s\", 0x%08x },\n", name, sum);
+        return;
+    }
+
+    const char* result = "no golden";
+    for (size_t n = 0; n < sizeof(kGolden) / sizeof(*kGolden); n++) {
+        if (strcmp(kGolden[n].name, name) == 0) {
+            result = kGolden[n].checksum == sum ? "ok" : "MISMATCH";
+            break;
+        }
+    }
+    if (strcmp(result, "ok") != 0) {
+        gFailures++;
+    }
+    printf("%-28s %9.3f %9.1f  %s\n", name, ms, 1000.0f / ms, result);
+}
+
+/*
+ * Fake sensor.
+ */
+
+struct SensorOutput {
+    uint32_t    format;
+    const char* name;
+};
+
+static const SensorOutput kSensorOutputs[] = {
+    { HAL_PIXEL_FORMAT_RGBA_8888, "rgba" },
+    { HAL_PIXEL_FORMAT_RGB_888, "rgb" },
+    { HAL_PIXEL_FORMAT_YCrCb_420_SP, "nv21" },
+    { HAL_PIXEL_FORMAT_YV12, "yv12" },
+};
+
+/* Size of a sensor output buffer, with the stride equal to the width. */
+static size_t getBufferSize(uint32_t format, uint32_t width, uint32_t height)
+{
+    switch (format) {
+        case HAL_PIXEL_FORMAT_RAW_SENSOR:
+            return width * height * 2;
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+            return width * height * 4;
+        case HAL_PIXEL_FORMAT_RGB_888:
+            return width * height * 3;
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+            return width * height * 3 / 2;
+        case HAL_PIXEL_FORMAT_YV12: {
+            const uint32_t y_stride = (width + 15) & ~15;
+            const uint32_t uv_stride = (y_stride / 2 + 15) & ~15;
+            return y_stride * height + uv_stride * height;
+        }
+    }
+    return 0;
+}
+
+/* Renders frames of the fake sensor into a buffer, and reports the rate.
+ * Return:
+ *  Last frame rendered, to be freed by the caller.
+ */
+static uint8_t* benchmarkSensor(Sensor* sensor, uint32_t format,
+                                const char* format_name, uint32_t width,
+                                uint32_t height)
+{
+    const size_t size = getBufferSize(format, width, height);
+    uint8_t* img = new uint8_t[size];
+    memset(img, 0, size);
+
+    Buffers buffers;
+    StreamBuffer b;
+    b.streamId = 1;
+    b.width = width;
+    b.height = height;
+    b.format = format;
+    b.stride = width;
+    b.buffer = NULL;
+    b.img = img;
+    buffers.push_back(b);
+
+    const uint64_t exposure =
+            Sensor::kFrameDurationRange[0] - Sensor::kMinVerticalBlank;
+    /* The first frame sets up scaling, so it's not timed. The scene shakes
+     * the viewpoint with rand(), which is reseeded so every frame is the
+     * same. */
+    srand(1);
+    sensor->captureFrame(&buffers, Sensor::kDefaultSensitivity, exposure, 0);
+    const nsecs_t start = systemTime();
+    for (int n = 0; n < gFrames; n++) {
+        srand(1);
+        sensor->captureFrame(&buffers, Sensor::kDefaultSensitivity, exposure,
+                0);
+    }
+    const nsecs_t elapsed = systemTime() - start;
+
+    char name[64];
+    snprintf(name, sizeof(name), "sensor %s %ux%u", format_name, width, height);
+    report(name, elapsed, img, size);
+    return img;
+}
+
+/*
+ * Framebuffer converters.
+ */
+
+typedef void (*RGBConverter)(const void* yuv, void* rgb, int width, int height);
+
+static void benchmarkRGBConverter(RGBConverter converter, const char* desc,
+                                  const void* yuv, int bpp, uint32_t width,
+                                  uint32_t height)
+{
+    const size_t size = width * height * bpp;
+    uint8_t* rgb = new uint8_t[size];
+    const nsecs_t start = systemTime();
+    for (int n = 0; n < gFrames; n++) {
+        converter(yuv, rgb, width, height);
+    }
+    const nsecs_t elapsed = systemTime() - start;
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s %ux%u", desc, width, height);
+    report(name, elapsed, rgb, size);
+    delete[] rgb;
+}
+
+static void benchmarkConverters(const uint8_t* nv21, const uint8_t* yv12,
+                                uint32_t width, uint32_t height)
+{
+    const uint32_t pixels = width * height;
+
+    benchmarkRGBConverter(NV21ToRGB32, "nv21->rgb32", nv21, 4, width, height);
+    benchmarkRGBConverter(NV21ToRGB565, "nv21->rgb565", nv21, 2, width, height);
+    benchmarkRGBConverter(YV12ToRGB32, "yv12->rgb32", yv12, 4, width, height);
+    benchmarkRGBConverter(YV12ToRGB565, "yv12->rgb565", yv12, 2, width, height);
+
+    /* Copies between YUV layouts, as done for preview windows. */
+    char name[64];
+    const size_t size = pixels * 3 / 2;
+    uint8_t* out = new uint8_t[size];
+    nsecs_t start = systemTime();
+    for (int n = 0; n < gFrames; n++) {
+        YUV420ToYV12(nv21, nv21 + pixels + 1, nv21 + pixels, 2, out, width,
+                     height, width, width / 2);
+    }
+    snprintf(name, sizeof(name), "nv21->yv12 %ux%u", width, height);
+    report(name, systemTime() - start, out, size);
+
+    start = systemTime();
+    for (int n = 0; n < gFrames; n++) {
+        YUV420ToNV21(yv12, yv12 + pixels + pixels / 4, yv12 + pixels, 1, out,
+                     width, height, width);
+    }
+    snprintf(name, sizeof(name), "yv12->nv21 %ux%u", width, height);
+    report(name, systemTime() - start, out, size);
+    delete[] out;
+}
+
+/*
+ * JPEG compression.
+ */
+
+/* Decodes a JPEG into RGB888.
+ * Return:
+ *  Decoded image (to be freed by the caller), or NULL if the JPEG doesn't
+ *  match the expected dimensions.
+ */
+static uint8_t* decode(const uint8_t* jpeg, size_t size, int width, int height)
+{
+    jpeg_decompress_struct cinfo;
+    jpeg_error_mgr error;
+    cinfo.err = jpeg_std_error(&error);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, const_cast<uint8_t*>(jpeg), size);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+    if ((int)cinfo.output_width != width || (int)cinfo.output_height != height) {
+        jpeg_destroy_decompress(&cinfo);
+        return NULL;
+    }
+    uint8_t* out = new uint8_t[width * height * 3];
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = out + cinfo.output_scanline * width * 3;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return out;
+}
+
+/* Compresses frames into JPEG, and reports the rate. The output is decoded,
+ * and compared to the RGB rendering of the same frame. */
+static void benchmarkJpeg(JpegEncoder::InputFormat format, const char* desc,
+                          const uint8_t* image, const uint8_t* rgb,
+                          uint32_t width, uint32_t height)
+{
+    JpegEncoder encoder;
+    const nsecs_t start = systemTime();
+    for (int n = 0; n < gFrames; n++) {
+        if (encoder.compress(image, format, width, height, width, 90) !=
+            NO_ERROR) {
+            printf("FAIL: %s %ux%u: compression failed\n", desc, width, height);
+            gFailures++;
+            return;
+        }
+    }
+    const float ms = (systemTime() - start) / 1000000.0f / gFrames;
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s %ux%u", desc, width, height);
+    if (gPrintGolden) {
+        /* JPEGs depend on the libjpeg version, so they have no checksums. */
+        return;
+    }
+    uint8_t* decoded = decode(encoder.getCompressedImage(),
+                              encoder.getCompressedSize(), width, height);
+    float error = -1.0f;
+    if (decoded != NULL) {
+        uint64_t total = 0;
+        for (size_t n = 0; n < width * height * 3; n++) {
+            total += abs(decoded[n] - rgb[n]);
+        }
+        error = (float)total / (width * height * 3);
+        delete[] decoded;
+    }
+    const bool ok = error >= 0.0f && error <= kMaxJpegError;
+    if (!ok) {
+        gFailures++;
+    }
+    printf("%-28s %9.3f %9.1f  %s (error %.2f, %u bytes)\n", name, ms,
+           1000.0f / ms, ok ? "ok" : "MISMATCH", error,
+           (unsigned)encoder.getCompressedSize());
+}
+
+int main(int argc, char** argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "n:g")) != -1) {
+        switch (opt) {
+            case 'n':
+                gFrames = atoi(optarg);
+                break;
+            case 'g':
+                gPrintGolden = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n frames] [-g]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (gFrames < 1) {
+        gFrames = 1;
+    }
+
+    if (!gPrintGolden) {
+        printf("%-28s %9s %9s  %s\n", "Stage", "ms/frame", "FPS", "Check");
+    }
+
+    AuxBufferPool aux_buffers;
+    sp<Sensor> sensor = new Sensor(&aux_buffers, NULL);
+
+    /* Raw output is always at the sensor resolution. */
+    delete[] benchmarkSensor(sensor.get(), HAL_PIXEL_FORMAT_RAW_SENSOR, "raw",
+                             Sensor::kResolution[0], Sensor::kResolution[1]);
+
+    for (size_t s = 0; s < sizeof(kSizes) / sizeof(*kSizes); s++) {
+        const uint32_t width = kSizes[s].width;
+        const uint32_t height = kSizes[s].height;
+
+        uint8_t* outputs[sizeof(kSensorOutputs) / sizeof(*kSensorOutputs)];
+        for (size_t f = 0; f < sizeof(kSensorOutputs) / sizeof(*kSensorOutputs);
+             f++) {
+            outputs[f] = benchmarkSensor(sensor.get(), kSensorOutputs[f].format,
+                                         kSensorOutputs[f].name, width, height);
+        }
+        const uint8_t* rgb = outputs[1];
+        const uint8_t* nv21 = outputs[2];
+        const uint8_t* yv12 = outputs[3];
+
+        benchmarkConverters(nv21, yv12, width, height);
+
+        benchmarkJpeg(JpegEncoder::INPUT_RGB888, "jpeg rgb", rgb, rgb, width,
+                      height);
+        benchmarkJpeg(JpegEncoder::INPUT_NV21, "jpeg nv21", nv21, rgb, width,
+                      height);
+        benchmarkJpeg(JpegEncoder::INPUT_YV12, "jpeg yv12", yv12, rgb, width,
+                      height);
+
+        for (size_t f = 0; f < sizeof(kSensorOutputs) / sizeof(*kSensorOutputs);
+             f++) {
+            delete[] outputs[f];
+        }
+    }
+
+    if (gPrintGolden) {
+        return 0;
+    }
+    if (gFailures) {
+        printf("%d check(s) FAILED\n", gFailures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,409 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Contains implementation of a class QemuCameraServiceStub that stands in for
+ * the 'emulated camera' service of the emulator in the host tests.
+ */
+
+#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera_ServiceStub"
+#include <cutils/log.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "QemuClient.h"
+#include "QemuCameraServiceStub.h"
+
+namespace android {
+
+QemuCameraServiceStub::QemuCameraServiceStub(bool streaming, bool shared_memory)
+    : Thread(false),
+      mAcceptStreaming(streaming),
+      mAcceptSharedMemory(shared_memory),
+      mBreakSharedRing(false),
+      mFD(-1),
+      mVideoSize(0),
+      mPreviewSize(0),
+      mExposure(0.0f),
+      mStarted(false),
+      mStreaming(false),
+      mFPS(0),
+      mCredits(0),
+      mSequence(0),
+      mNextFrameTime(0),
+      mFrame(NULL),
+      mFrameSize(0),
+      mRing(NULL),
+      mSlotSize(0),
+      mSlots(0),
+      mWriteSlot(0),
+      mBytesSent(0)
+{
+    mRingPath[0] = '\0';
+}
+
+QemuCameraServiceStub::~QemuCameraServiceStub()
+{
+    if (mFD >= 0) {
+        close(mFD);
+    }
+    if (mFrame != NULL) {
+        delete[] mFrame;
+    }
+    destroySharedRing();
+}
+
+/****************************************************************************
+ * Public API
+ ***************************************************************************/
+
+status_t QemuCameraServiceStub::startService(int* client_fd)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        ALOGE("%s: Unable to create socket pair: %s", __FUNCTION__, strerror(errno));
+        return errno;
+    }
+    mFD = fds[1];
+
+    const status_t res = run("QemuCameraServiceStub");
+    if (res != NO_ERROR) {
+        close(fds[0]);
+        return res;
+    }
+    *client_fd = fds[0];
+    return NO_ERROR;
+}
+
+void QemuCameraServiceStub::waitForExit()
+{
+    join();
+}
+
+void QemuCameraServiceStub::fillFrame(uint8_t* buf,
+                                      size_t size,
+                                      uint32_t sequence,
+                                      int salt,
+                                      float exposure_comp)
+{
+    const int base = sequence * 7 + salt * 13 + static_cast<int>(exposure_comp * 10);
+    for (size_t n = 0; n < size; n++) {
+        buf[n] = static_cast<uint8_t>(base + n);
+    }
+}
+
+/****************************************************************************
+ * Service implementation
+ ***************************************************************************/
+
+bool QemuCameraServiceStub::threadLoop()
+{
+    char msg[1024];
+    size_t msg_len = 0;
+
+    for (;;) {
+        /* In the streaming mode we also need to wake up for the next frame. */
+        int timeout = -1;
+        if (mStreaming) {
+            const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+            timeout = (now >= mNextFrameTime) ? 0 :
+                      static_cast<int>((mNextFrameTime - now) / 1000000) + 1;
+        }
+        struct pollfd pfd;
+        pfd.fd = mFD;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        const int res = TEMP_FAILURE_RETRY(poll(&pfd, 1, timeout));
+        if (res < 0) {
+            ALOGE("%s: poll failed: %s", __FUNCTION__, strerror(errno));
+            return false;
+        }
+
+        if (pfd.revents & (POLLIN | POLLHUP)) {
+            const int rd = TEMP_FAILURE_RETRY(read(mFD, msg + msg_len, 1));
+            if (rd <= 0) {
+                /* Client has closed the connection. */
+                return false;
+            }
+            /* Messages are zero-terminated strings. */
+            if (msg[msg_len] == '\0') {
+                if (!handleMessage(msg)) {
+                    return false;
+                }
+                msg_len = 0;
+            } else if (++msg_len == sizeof(msg)) {
+                ALOGE("%s: Message is too long", __FUNCTION__);
+                return false;
+            }
+        }
+
+        if (mStreaming && systemTime(SYSTEM_TIME_MONOTONIC) >= mNextFrameTime) {
+            mNextFrameTime += 1000000000LL / mFPS;
+            if (mCredits > 0) {
+                mCredits--;
+                if (!pushFrame()) {
+                    return false;
+                }
+            } else {
+                /* Client is behind. Drop the frame, like a real camera would. */
+                mSequence++;
+            }
+        }
+    }
+}
+
+bool QemuCameraServiceStub::handleMessage(const char* msg)
+{
+    if (!strncmp(msg, "next", 4)) {
+        mCredits++;
+        return true;
+    }
+    if (!strncmp(msg, "params ", 7)) {
+        const char* exp = getParam(msg, "expcomp");
+        if (exp != NULL) {
+            mExposure = strtod(exp, NULL);
+        }
+        return true;
+    }
+
+    if (!strncmp(msg, "start", 5)) {
+        mStarted = true;
+        return sendReply("ok", NULL, 0);
+    }
+    if ((!strncmp(msg, "frame ", 6) || !strncmp(msg, "stream", 6)) && !mStarted) {
+        static const char err[] = "Camera is not started";
+        return sendReply("ko:", err, sizeof(err));
+    }
+
+    if (!strncmp(msg, "frame ", 6)) {
+        const char* video = getParam(msg, "video");
+        const char* preview = getParam(msg, "preview");
+        const char* exp = getParam(msg, "expcomp");
+        const size_t video_size = video ? strtoul(video, NULL, 10) : 0;
+        const size_t preview_size = preview ? strtoul(preview, NULL, 10) : 0;
+        const float exposure = exp ? strtod(exp, NULL) : 0.0f;
+        if (mFrameSize < video_size + preview_size) {
+            delete[] mFrame;
+            mFrameSize = video_size + preview_size;
+            mFrame = new uint8_t[mFrameSize];
+        }
+        fillFrame(mFrame, video_size, mSequence, 0, exposure);
+        fillFrame(mFrame + video_size, preview_size, mSequence, 1, exposure);
+        mSequence++;
+        return sendReply("ok:", mFrame, video_size + preview_size);
+    }
+
+    if (!strncmp(msg, "stream", 6)) {
+        if (!mAcceptStreaming) {
+            static const char err[] = "Unknown query";
+            return sendReply("ko:", err, sizeof(err));
+        }
+        const char* fps = getParam(msg, "fps");
+        const char* depth = getParam(msg, "depth");
+        const char* video = getParam(msg, "video");
+        const char* preview = getParam(msg, "preview");
+        const char* exp = getParam(msg, "expcomp");
+        mFPS = fps ? atoi(fps) : 0;
+        mCredits = depth ? atoi(depth) : 0;
+        mVideoSize = video ? strtoul(video, NULL, 10) : 0;
+        mPreviewSize = preview ? strtoul(preview, NULL, 10) : 0;
+        mExposure = exp ? strtod(exp, NULL) : 0.0f;
+        if (mFPS <= 0 || mCredits <= 0) {
+            static const char err[] = "Invalid stream parameters";
+            return sendReply("ko:", err, sizeof(err));
+        }
+        if (mFrameSize < mVideoSize + mPreviewSize) {
+            delete[] mFrame;
+            mFrameSize = mVideoSize + mPreviewSize;
+            mFrame = new uint8_t[mFrameSize];
+        }
+        mSequence = 0;
+        mNextFrameTime = systemTime(SYSTEM_TIME_MONOTONIC);
+        mStreaming = true;
+
+        const char* shm = getParam(msg, "shm");
+        if (mAcceptSharedMemory && shm != NULL && atoi(shm) != 0) {
+            if (!createSharedRing()) {
+                return false;
+            }
+            char ring[128];
+            snprintf(ring, sizeof(ring), "shm=%s%s slots=%u slot=%u", mRingPath,
+                     mBreakSharedRing ? "-missing" : "",
+                     mSlots, static_cast<unsigned int>(mSlotSize));
+            return sendReply("ok:", ring, strlen(ring) + 1);
+        }
+        return sendReply("ok", NULL, 0);
+    }
+
+    if (!strncmp(msg, "stop", 4)) {
+        mStarted = false;
+        if (mStreaming) {
+            mStreaming = false;
+            const bool res = pushEndOfStream();
+            destroySharedRing();
+            return res && sendReply("ok", NULL, 0);
+        }
+    }
+
+    /* 'connect', and 'disconnect' need no work in the stub. */
+    return sendReply("ok", NULL, 0);
+}
+
+bool QemuCameraServiceStub::sendReply(const char* status,
+                                      const void* data,
+                                      size_t data_size)
+{
+    /* Reply without data includes the zero-terminator of the status. */
+    const size_t status_size = data_size ? strlen(status) : strlen(status) + 1;
+    char size_str[9];
+    snprintf(size_str, sizeof(size_str), "%08x",
+             static_cast<unsigned int>(status_size + data_size));
+    return writeAll(size_str, 8) &&
+           writeAll(status, status_size) &&
+           writeAll(data, data_size);
+}
+
+bool QemuCameraServiceStub::pushFrame()
+{
+    bool res;
+    if (mRing != NULL) {
+        /* Credits never exceed the slots, so the slot is free. */
+        uint8_t* frame = mRing + mWriteSlot * mSlotSize;
+        fillFrame(frame, mVideoSize, mSequence, 0, mExposure);
+        fillFrame(frame + mVideoSize, mPreviewSize, mSequence, 1, mExposure);
+        res = pushHeader(QEMU_FRAME_FLAG_SHM, mVideoSize, mPreviewSize,
+                         mWriteSlot);
+        mWriteSlot = (mWriteSlot + 1) % mSlots;
+    } else {
+        fillFrame(mFrame, mVideoSize, mSequence, 0, mExposure);
+        fillFrame(mFrame + mVideoSize, mPreviewSize, mSequence, 1, mExposure);
+        res = pushHeader(0, mVideoSize, mPreviewSize, 0) &&
+              writeAll(mFrame, mVideoSize + mPreviewSize);
+    }
+    mSequence++;
+    return res;
+}
+
+bool QemuCameraServiceStub::pushEndOfStream()
+{
+    return pushHeader(QEMU_FRAME_FLAG_EOS, 0, 0, 0);
+}
+
+bool QemuCameraServiceStub::createSharedRing()
+{
+    destroySharedRing();
+
+    /* Slots are page aligned, like the emulator would map them. */
+    mSlots = mCredits;
+    mSlotSize = (mVideoSize + mPreviewSize + 4095) & ~4095;
+    snprintf(mRingPath, sizeof(mRingPath), "/tmp/qemu_camera_ringXXXXXX");
+    const int fd = mkstemp(mRingPath);
+    if (fd < 0) {
+        ALOGE("%s: Unable to create shared frame ring: %s", __FUNCTION__,
+             strerror(errno));
+        mRingPath[0] = '\0';
+        return false;
+    }
+    void* ring = MAP_FAILED;
+    if (ftruncate(fd, mSlots * mSlotSize) == 0) {
+        ring = mmap(NULL, mSlots * mSlotSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (ring == MAP_FAILED) {
+        ALOGE("%s: Unable to map shared frame ring: %s", __FUNCTION__,
+             strerror(errno));
+        destroySharedRing();
+        return false;
+    }
+    mRing = static_cast<uint8_t*>(ring);
+    mWriteSlot = 0;
+    return true;
+}
+
+void QemuCameraServiceStub::destroySharedRing()
+{
+    if (mRing != NULL) {
+        munmap(mRing, mSlots * mSlotSize);
+        mRing = NULL;
+    }
+    if (mRingPath[0] != '\0') {
+        unlink(mRingPath);
+        mRingPath[0] = '\0';
+    }
+}
+
+/* Puts a little-endian value into the frame header. */
+static void _putLE32(uint8_t* p, uint32_t val)
+{
+    p[0] = val;
+    p[1] = val >> 8;
+    p[2] = val >> 16;
+    p[3] = val >> 24;
+}
+
+bool QemuCameraServiceStub::pushHeader(uint32_t flags,
+                                       uint32_t video_size,
+                                       uint32_t preview_size,
+                                       uint32_t slot)
+{
+    const uint64_t timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+    uint8_t header[QEMU_FRAME_HEADER_SIZE];
+    _putLE32(header, QEMU_FRAME_MAGIC);
+    _putLE32(header + 4, flags);
+    _putLE32(header + 8, mSequence);
+    _putLE32(header + 12, video_size);
+    _putLE32(header + 16, preview_size);
+    _putLE32(header + 20, slot);
+    _putLE32(header + 24, static_cast<uint32_t>(timestamp));
+    _putLE32(header + 28, static_cast<uint32_t>(timestamp >> 32));
+    return writeAll(header, sizeof(header));
+}
+
+const char* QemuCameraServiceStub::getParam(const char* msg, const char* name)
+{
+    const size_t name_len = strlen(name);
+    for (const char* p = strchr(msg, ' '); p != NULL; p = strchr(p + 1, ' ')) {
+        if (!strncmp(p + 1, name, name_len) && p[1 + name_len] == '=') {
+            return p + 2 + name_len;
+        }
+    }
+    return NULL;
+}
+
+bool QemuCameraServiceStub::writeAll(const void* data, size_t size)
+{
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(data);
+    while (size > 0) {
+        const int wr = TEMP_FAILURE_RETRY(write(mFD, src, size));
+        if (wr <= 0) {
+            ALOGE("%s: write failed: %s", __FUNCTION__, strerror(errno));
+            return false;
+        }
+        src += wr;
+        size -= wr;
+        mBytesSent += wr;
+    }
+    return true;
+}
+
+}; /* namespace android */
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HW_EMULATOR_CAMERA_TESTS_QEMU_CAMERA_SERVICE_STUB_H
+#define HW_EMULATOR_CAMERA_TESTS_QEMU_CAMERA_SERVICE_STUB_H
+
+/*
+ * Contains declaration of a class QemuCameraServiceStub that stands in for the
+ * 'emulated camera' service of the emulator in the host tests.
+ */
+
+#include <utils/threads.h>
+
+namespace android {
+
+/* Stands in for the 'emulated camera' service of the emulator.
+ * The stub serves a single client connected to the other end of a socket pair,
+ * and implements the query per frame, and the streaming protocols described
+ * in QemuClient.h. The shared frame ring is a temporary file. Frames are filled with a pattern that depends on
+ * the frame sequence number, and on the exposure compensation, so the tests can
+ * verify what they have received (see fillFrame).
+ */
+class QemuCameraServiceStub : public Thread {
+public:
+    /* Constructs QemuCameraServiceStub instance.
+     * Param:
+     *  streaming - Whether the stub should accept 'stream' queries. If false,
+     *      the stub behaves like a service that predates the streaming mode.
+     *  shared_memory - Whether the stub should accept offers to share a frame
+     *      ring. If false, frames are always streamed through the pipe.
+     */
+    QemuCameraServiceStub(bool streaming, bool shared_memory);
+
+    /* Destructs QemuCameraServiceStub instance. */
+    ~QemuCameraServiceStub();
+
+    /****************************************************************************
+     * Public API
+     ***************************************************************************/
+
+public:
+    /* Creates the connection, and starts serving it.
+     * Param:
+     *  client_fd - Upon success contains the client end of the connection. The
+     *      caller is responsible for closing it.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status.
+     */
+    status_t startService(int* client_fd);
+
+    /* Makes the stub offer a shared frame ring the client can't map, like a
+     * service running where the client can't see its files. Must be called
+     * before startService. */
+    inline void breakSharedRing() {
+        mBreakSharedRing = true;
+    }
+
+    /* Waits for the client to close the connection, and the stub to exit. */
+    void waitForExit();
+
+    /* Gets number of bytes the stub has sent to the client. */
+    inline size_t getBytesSent() const {
+        return mBytesSent;
+    }
+
+    /* Fills a frame with the pattern the stub sends for a given frame.
+     * Param:
+     *  buf, size - Buffer to fill.
+     *  sequence - Sequence number of the frame.
+     *  salt - A value that differs for video, and preview frames.
+     *  exposure_comp - Exposure compensation the frame was captured with.
+     */
+    static void fillFrame(uint8_t* buf,
+                          size_t size,
+                          uint32_t sequence,
+                          int salt,
+                          float exposure_comp);
+
+    /****************************************************************************
+     * Service implementation
+     ***************************************************************************/
+
+private:
+    /* Serves the connection until the client closes it. */
+    bool threadLoop();
+
+    /* Handles a message received from the client. */
+    bool handleMessage(const char* msg);
+
+    /* Sends a reply to a query. */
+    bool sendReply(const char* status, const void* data, size_t data_size);
+
+    /* Sends a frame in the streaming mode. */
+    bool pushFrame();
+
+    /* Sends the end of the stream marker in the streaming mode. */
+    bool pushEndOfStream();
+
+    /* Sends a frame header in the streaming mode. */
+    bool pushHeader(uint32_t flags,
+                    uint32_t video_size,
+                    uint32_t preview_size,
+                    uint32_t slot);
+
+    /* Creates the shared frame ring with a slot for each credit. */
+    bool createSharedRing();
+
+    /* Destroys the shared frame ring. */
+    void destroySharedRing();
+
+    /* Gets a parameter value from a query. */
+    static const char* getParam(const char* msg, const char* name);
+
+    /* Writes the entire buffer to the connection. */
+    bool writeAll(const void* data, size_t size);
+
+    /****************************************************************************
+     * Data members
+     ***************************************************************************/
+
+private:
+    /* Whether 'stream' queries are accepted. */
+    const bool      mAcceptStreaming;
+    /* Whether offers to share a frame ring are accepted. */
+    const bool      mAcceptSharedMemory;
+    /* Whether the offered frame ring can't be mapped. */
+    bool            mBreakSharedRing;
+    /* Service end of the connection. */
+    int             mFD;
+    /* Video, and preview frame sizes requested by the client. */
+    size_t          mVideoSize;
+    size_t          mPreviewSize;
+    /* Exposure compensation requested by the client. */
+    float           mExposure;
+    /* Whether the camera is started. Frames are only sent while it is. */
+    bool            mStarted;
+    /* Streaming mode state. */
+    bool            mStreaming;
+    int             mFPS;
+    int             mCredits;
+    uint32_t        mSequence;
+    nsecs_t         mNextFrameTime;
+    /* Frame buffer. */
+    uint8_t*        mFrame;
+    size_t          mFrameSize;
+    /* Shared frame ring, or NULL if frames are pushed through the pipe. */
+    uint8_t*        mRing;
+    size_t          mSlotSize;
+    uint32_t        mSlots;
+    /* Slot the next frame is written to. */
+    uint32_t        mWriteSlot;
+    /* Path of the file that backs the shared frame ring. */
+    char            mRingPath[64];
+    /* Number of bytes sent to the client. */
+    size_t          mBytesSent;
+};
+
+}; /* namespace android */
+
+#endif  /* HW_EMULATOR_CAMERA_TESTS_QEMU_CAMERA_SERVICE_STUB_H */
@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks the 'emulated camera' client against a local stand-in for the service
+ * in the emulator: frames queried one by one, frames pushed in the streaming
+ * mode through the pipe, and through a shared frame ring, frames of unexpected
+ * size, and fallbacks when the service doesn't support a mode, or the shared
+ * frame ring can't be mapped.
+ *
+ * Usage: emulated_camera_qemu_client_test
+ * Exit status is 0 if all checks pass, or 1 otherwise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "QemuClient.h"
+#include "QemuCameraServiceStub.h"
+
+using namespace android;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            printf("FAIL: %s:%d: %s\n", __FILE__, __LINE__, #cond);         \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+/* VGA frames are large enough to arrive in several chunks. */
+static const int kWidth = 640;
+static const int kHeight = 480;
+static const size_t kVideoSize = kWidth * kHeight * 12 / 8;
+static const size_t kPreviewSize = kWidth * kHeight * 4;
+
+/* Checks that a frame matches the pattern the stub has sent. */
+static bool checkFrame(const uint8_t* frame,
+                       size_t size,
+                       uint32_t sequence,
+                       int salt,
+                       float exposure_comp)
+{
+    uint8_t* expected = new uint8_t[size];
+    QemuCameraServiceStub::fillFrame(expected, size, sequence, salt, exposure_comp);
+    const bool res = memcmp(frame, expected, size) == 0;
+    delete[] expected;
+    return res;
+}
+
+/* Connects a client to a new stub, and starts the camera. */
+static sp<QemuCameraServiceStub> startCamera(CameraQemuClient* client,
+                                             bool streaming,
+                                             bool shared_memory)
+{
+    sp<QemuCameraServiceStub> service =
+        new QemuCameraServiceStub(streaming, shared_memory);
+    int fd = -1;
+    CHECK(service->startService(&fd) == NO_ERROR);
+    CHECK(client->attachClient(fd) == NO_ERROR);
+    CHECK(client->queryConnect() == NO_ERROR);
+    CHECK(client->queryStart(0, kWidth, kHeight) == NO_ERROR);
+    return service;
+}
+
+/* Stops the camera, and disconnects the client from the stub. */
+static void stopCamera(CameraQemuClient* client,
+                       const sp<QemuCameraServiceStub>& service)
+{
+    CHECK(client->queryStop() == NO_ERROR);
+    CHECK(!client->isStreaming());
+    /* Replies are still in sync with queries after the stream is stopped. */
+    CHECK(client->queryDisconnect() == NO_ERROR);
+    client->disconnectClient();
+    service->waitForExit();
+}
+
+static void testQueryFrames(uint8_t* video, uint8_t* preview)
+{
+    CameraQemuClient client;
+    sp<QemuCameraServiceStub> service = startCamera(&client, false, false);
+
+    /* Service doesn't support streaming, so the client falls back. */
+    CHECK(client.queryStream(50, 2, kVideoSize, kPreviewSize,
+                             1.0f, 1.0f, 1.0f, 0.0f, true) != NO_ERROR);
+    CHECK(!client.isStreaming());
+
+    for (uint32_t n = 0; n < 5; n++) {
+        const float exposure = n * 0.5f;
+        CHECK(client.queryFrame(video, preview, kVideoSize, kPreviewSize,
+                                1.0f, 1.0f, 1.0f, exposure) == NO_ERROR);
+        CHECK(checkFrame(video, kVideoSize, n, 0, exposure));
+        CHECK(checkFrame(preview, kPreviewSize, n, 1, exposure));
+    }
+    /* Only video frame is requested. */
+    CHECK(client.queryFrame(video, NULL, kVideoSize, 0,
+                            1.0f, 1.0f, 1.0f, 0.0f) == NO_ERROR);
+    CHECK(checkFrame(video, kVideoSize, 5, 0, 0.0f));
+
+    stopCamera(&client, service);
+}
+
+/* Streams frames through the pipe. If 'offer_shared' is set, the client
+ * offers a shared frame ring that the service declines. */
+static void testStreamFrames(uint8_t* video, uint8_t* preview, bool offer_shared)
+{
+    CameraQemuClient client;
+    sp<QemuCameraServiceStub> service = startCamera(&client, true, false);
+
+    CHECK(client.queryStream(200, 2, kVideoSize, kPreviewSize,
+                             1.0f, 1.0f, 1.0f, 0.0f, offer_shared) == NO_ERROR);
+    CHECK(client.isStreaming());
+    CHECK(!client.isSharedMemory());
+
+    /* Frames must come in order, and match the exposure that was requested.
+     * Up to 'depth' frames may already be in flight after params change. */
+    uint32_t last_sequence = 0;
+    int frames_since_change = -1;
+    float exposure = 0.0f;
+    for (int n = 0; n < 30; n++) {
+        if (n == 10) {
+            exposure = 1.5f;
+            CHECK(client.sendStreamParams(1.0f, 1.0f, 1.0f, exposure) == NO_ERROR);
+            frames_since_change = 0;
+        }
+
+        QemuFrameHeader header;
+        CHECK(client.receiveFrame(video, preview, kVideoSize, kPreviewSize,
+                                  &header) == NO_ERROR);
+        CHECK(header.flags == 0);
+        CHECK(header.video_size == kVideoSize);
+        CHECK(header.preview_size == kPreviewSize);
+        CHECK(n == 0 || header.sequence > last_sequence);
+        last_sequence = header.sequence;
+
+        const bool old_ok = checkFrame(video, kVideoSize, header.sequence, 0, 0.0f) &&
+                            checkFrame(preview, kPreviewSize, header.sequence, 1, 0.0f);
+        const bool new_ok = checkFrame(video, kVideoSize, header.sequence, 0, exposure) &&
+                            checkFrame(preview, kPreviewSize, header.sequence, 1, exposure);
+        if (frames_since_change < 0) {
+            CHECK(old_ok);
+        } else if (frames_since_change++ < 2) {
+            CHECK(old_ok || new_ok);
+        } else {
+            CHECK(new_ok);
+        }
+    }
+
+    /* Stopping drops the frames that are still in flight. */
+    stopCamera(&client, service);
+}
+
+/* A frame of unexpected size is skipped, but must not stall the stream: with
+ * a depth of 1 the service waits for "next" before it pushes another one. */
+static void testStreamSizeMismatch(uint8_t* video, uint8_t* preview)
+{
+    CameraQemuClient client;
+    sp<QemuCameraServiceStub> service = startCamera(&client, true, false);
+
+    CHECK(client.queryStream(200, 1, kVideoSize, kPreviewSize,
+                             1.0f, 1.0f, 1.0f, 0.0f, false) == NO_ERROR);
+
+    QemuFrameHeader header;
+    CHECK(client.receiveFrame(video, NULL, kVideoSize, 0, &header) == EINVAL);
+    for (int n = 0; n < 3; n++) {
+        CHECK(client.receiveFrame(video, preview, kVideoSize, kPreviewSize,
+                                  &header) == NO_ERROR);
+        CHECK(checkFrame(video, kVideoSize, header.sequence, 0, 0.0f));
+    }
+
+    stopCamera(&client, service);
+}
+
+/* The service offers a frame ring the client can't map. The camera is
+ * restarted, and frames are streamed through the pipe instead. */
+static void testSharedRingFailure(uint8_t* video, uint8_t* preview)
+{
+    CameraQemuClient client;
+    sp<QemuCameraServiceStub> service = new QemuCameraServiceStub(true, true);
+    service->breakSharedRing();
+    int fd = -1;
+    CHECK(service->startService(&fd) == NO_ERROR);
+    CHECK(client.attachClient(fd) == NO_ERROR);
+    CHECK(client.queryConnect() == NO_ERROR);
+    CHECK(client.queryStart(0, kWidth, kHeight) == NO_ERROR);
+
+    CHECK(client.queryStream(200, 2, kVideoSize, kPreviewSize,
+                             1.0f, 1.0f, 1.0f, 0.0f, true) == NO_ERROR);
+    CHECK(client.isStarted());
+    CHECK(client.isStreaming());
+    CHECK(!client.isSharedMemory());
+
+    for (int n = 0; n < 5; n++) {
+        QemuFrameHeader header;
+        CHECK(client.receiveFrame(video, preview, kVideoSize, kPreviewSize,
+                                  &header) == NO_ERROR);
+        CHECK(header.flags == 0);
+        CHECK(checkFrame(video, kVideoSize, header.sequence, 0, 0.0f));
+        CHECK(checkFrame(preview, kPreviewSize, header.sequence, 1, 0.0f));
+    }
+
+    stopCamera(&client, service);
+    CHECK(!client.isStarted());
+}
+
+static void testSharedFrames()
+{
+    CameraQemuClient client;
+    sp<QemuCameraServiceStub> service = startCamera(&client, true, true);
+
+    CHECK(client.queryStream(200, 3, kVideoSize, kPreviewSize,
+                             1.0f, 1.0f, 1.0f, 0.0f, true) == NO_ERROR);
+    CHECK(client.isStreaming());
+    CHECK(client.isSharedMemory());
+
+    /* Like the camera device, hold on to the last frame until the next one
+     * is received. The held frame must not be overwritten meanwhile. */
+    const int kFrames = 30;
+    uint32_t held_sequence = 0;
+    const uint8_t* held_video = NULL;
+    const uint8_t* held_preview = NULL;
+    for (int n = 0; n < kFrames; n++) {
+        const uint8_t* vframe = NULL;
+        const uint8_t* pframe = NULL;
+        QemuFrameHeader header;
+        CHECK(client.receiveSharedFrame(&vframe, &pframe, &header) == NO_ERROR);
+        CHECK(header.flags == QEMU_FRAME_FLAG_SHM);
+        CHECK(header.slot < 3);
+        CHECK(vframe != NULL && pframe != NULL);
+        if (vframe == NULL || pframe == NULL) {
+            break;
+        }
+        CHECK(checkFrame(vframe, kVideoSize, header.sequence, 0, 0.0f));
+        CHECK(checkFrame(pframe, kPreviewSize, header.sequence, 1, 0.0f));
+
+        if (held_video != NULL) {
+            CHECK(header.sequence > held_sequence);
+            CHECK(checkFrame(held_video, kVideoSize, held_sequence, 0, 0.0f));
+            CHECK(checkFrame(held_preview, kPreviewSize, held_sequence, 1, 0.0f));
+            CHECK(client.releaseSharedFrame() == NO_ERROR);
+        }
+        held_sequence = header.sequence;
+        held_video = vframe;
+        held_preview = pframe;
+    }
+
+    stopCamera(&client, service);
+    CHECK(!client.isSharedMemory());
+
+    /* Only frame headers, and replies went through the pipe. */
+    CHECK(service->getBytesSent() < kFrames * 64 + 1024);
+}
+
+int main(int argc, char** argv)
+{
+    uint8_t* video = new uint8_t[kVideoSize];
+    uint8_t* preview = new uint8_t[kPreviewSize];
+
+    testQueryFrames(video, preview);
+    testStreamFrames(video, preview, false);
+    testStreamFrames(video, preview, true);
+    testStreamSizeMismatch(video, preview);
+    testSharedFrames();
+    testSharedRingFailure(video, preview);
+
+    delete[] video;
+    delete[] preview;
+
+    printf("%s: %d failures\n", failures ? "FAILED" : "PASSED", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks that StageTracer reports percentiles and rates of the recent samples
+ * of a stage, and that the binary trace file holds every sample recorded.
+ *
+ * Usage: emulated_camera_stage_tracer_test
+ * Exit status is 0 if all checks pass, or 1 otherwise.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "StageTracer.h"
+
+using namespace android;
+
+static const nsecs_t kMs = 1000000LL;
+
+/* Finds the line of a stage in a dump, and parses its columns. */
+static bool parseStage(const String8& dump, const char* name, unsigned* samples,
+                       float* rate, float* p50, float* p90, float* p99,
+                       float* max)
+{
+    const char* line = dump.string();
+    while (line != NULL && *line != '\0') {
+        char stage[32];
+        if (sscanf(line, "%31s %u %f %f %f %f %f", stage, samples, rate, p50,
+                   p90, p99, max) == 7 && strcmp(stage, name) == 0) {
+            return true;
+        }
+        line = strchr(line, '\n');
+        if (line != NULL) {
+            line++;
+        }
+    }
+    return false;
+}
+
+/* Samples taking 1 to 100 ms, 10 ms apart, must report the matching
+ * percentiles at 100 samples per second. */
+static int checkStatistics()
+{
+    StageTracer tracer;
+    for (int n = 0; n < 100; n++) {
+        const nsecs_t end = (n + 1) * 10 * kMs;
+        tracer.record(StageTracer::STAGE_CAPTURE, end - (n + 1) * kMs, end, n);
+    }
+
+    String8 dump;
+    tracer.dump(dump, "");
+    unsigned samples;
+    float rate, p50, p90, p99, max;
+    if (!parseStage(dump, "capture", &samples, &rate, &p50, &p90, &p99, &max)) {
+        printf("FAIL: statistics: no capture stage in dump:\n%s", dump.string());
+        return 1;
+    }
+    if (samples != 100 || rate < 99.0f || rate > 101.0f || p50 != 50.0f ||
+        p90 != 90.0f || p99 != 99.0f || max != 100.0f) {
+        printf("FAIL: statistics: unexpected capture stage:\n%s", dump.string());
+        return 1;
+    }
+    if (parseStage(dump, "preview", &samples, &rate, &p50, &p90, &p99, &max)) {
+        printf("FAIL: statistics: stage without samples is dumped\n");
+        return 1;
+    }
+
+    /* Only the most recent samples count: 256 samples of 1 ms push the slow
+     * ones out of the window. */
+    for (int n = 0; n < 256; n++) {
+        const nsecs_t end = (n + 200) * 10 * kMs;
+        tracer.record(StageTracer::STAGE_CAPTURE, end - kMs, end, n);
+    }
+    dump = String8();
+    tracer.dump(dump, "");
+    if (!parseStage(dump, "capture", &samples, &rate, &p50, &p90, &p99, &max) ||
+        samples != 356 || max != 1.0f) {
+        printf("FAIL: statistics: window is not rolling:\n%s", dump.string());
+        return 1;
+    }
+    return 0;
+}
+
+/* Every sample recorded while tracing must be in the trace file. Samples are
+ * written while tracing, and what is left when tracing stops. */
+static int checkTraceFile()
+{
+    char path[] = "/tmp/stage_tracer_testXXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0) {
+        printf("FAIL: trace file: unable to create a temporary file\n");
+        return 1;
+    }
+    close(fd);
+
+    StageTracer tracer;
+    if (tracer.startTraceFile(path) != NO_ERROR) {
+        printf("FAIL: trace file: unable to start tracing to %s\n", path);
+        unlink(path);
+        return 1;
+    }
+    const int kBatch = 1500;
+    const int kSamples = 3 * kBatch + 10;
+    int failures = 0;
+    for (int n = 0; n < kSamples; n++) {
+        tracer.record(StageTracer::STAGE_READOUT, n * kMs, n * kMs + 500, n);
+        if (n % kBatch == kBatch - 1) {
+            usleep(300000);
+        }
+    }
+    struct stat st;
+    if (stat(path, &st) != 0 ||
+        st.st_size < (off_t)(sizeof(StageTracer::TraceHeader) +
+                             kBatch * sizeof(StageTracer::TraceRecord))) {
+        printf("FAIL: trace file: samples are not written while tracing\n");
+        failures = 1;
+    }
+    tracer.stopTraceFile();
+    /* Not traced. */
+    tracer.record(StageTracer::STAGE_READOUT, 0, 1);
+
+    FILE* file = fopen(path, "rb");
+    StageTracer::TraceHeader header;
+    if (file == NULL || fread(&header, sizeof(header), 1, file) != 1 ||
+        header.magic != StageTracer::kTraceMagic ||
+        header.version != StageTracer::kTraceVersion) {
+        printf("FAIL: trace file: bad header\n");
+        failures = 1;
+    } else {
+        StageTracer::TraceRecord rec;
+        int count = 0;
+        while (fread(&rec, sizeof(rec), 1, file) == 1) {
+            if (rec.stage != StageTracer::STAGE_READOUT || rec.frame != count ||
+                rec.start != count * kMs || rec.end != count * kMs + 500) {
+                printf("FAIL: trace file: bad record %d\n", count);
+                failures = 1;
+                break;
+            }
+            count++;
+        }
+        if (!failures && count != kSamples) {
+            printf("FAIL: trace file: %d records, expected %d\n", count,
+                   kSamples);
+            failures = 1;
+        }
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+    unlink(path);
+    return failures;
+}
+
+int main(int argc, char** argv)
+{
+    int failures = 0;
+    failures += checkStatistics();
+    failures += checkTraceFile();
+
+    if (failures) {
+        printf("%d check(s) FAILED\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -6,7 +6,9 @@
 #include <errno.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <termios.h>
+#include <time.h>
 #include <cutils/sockets.h>
 
 /*
@@ -73,6 +75,21 @@
  *
  *           ko:unknown command
  *
+ *   - the emulator can ask qemud for its traffic statistics by
+ *     sending the following through channel 0:
+ *
+ *           qemud-stats
+ *
+ *     qemud answers with one message per line of the statistics,
+ *     then a last one to tell it is done:
+ *
+ *           qemud-stats:<line>
+ *           qemud-stats:end
+ *
+ *     a client of /dev/socket/qemud can get the same statistics by
+ *     sending "qemud-stats" as the service name. qemud answers "OK"
+ *     followed by the statistics, then closes the connection.
+ *
  *
  *  Internally, the daemon maintains a "Client" object for each client
  *  connection (i.e. accepting socket connection).
@@ -156,6 +173,16 @@ xrealloc( void*  block, size_t  size )
 
 #define  xrenew(p,count)  (p) = xrealloc((p),sizeof(*(p))*(count))
 
+/* return the time elapsed since an arbitrary point, in microseconds */
+static int64_t
+time_us( void )
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
 static int
 hex2int( const uint8_t*  data, int  len )
 {
@@ -217,12 +244,24 @@ fd_read(int  fd, void*  to, int  len)
 }
 
 static int
-fd_write(int  fd, const void*  from, int  len)
+fd_readv(int  fd, const struct iovec*  iov, int  count)
+{
+    int  ret;
+
+    do {
+        ret = readv(fd, iov, count);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret;
+}
+
+static int
+fd_writev(int  fd, const struct iovec*  iov, int  count)
 {
     int  ret;
 
     do {
-        ret = write(fd, from, len);
+        ret = writev(fd, iov, count);
     } while (ret < 0 && errno == EINTR);
 
     return ret;
@@ -234,7 +273,7 @@ fd_setnonblock(int  fd)
     int  ret, flags;
 
     do {
-        flags = fcntl(fd, F_GETFD);
+        flags = fcntl(fd, F_GETFL);
     } while (flags < 0 && errno == EINTR);
 
     if (flags < 0) {
@@ -243,7 +282,7 @@ fd_setnonblock(int  fd)
     }
 
     do {
-        ret = fcntl(fd, F_SETFD, flags | O_NONBLOCK);
+        ret = fcntl(fd, F_SETFL, flags | O_NONBLOCK);
     } while (ret < 0 && errno == EINTR);
 
     if (ret < 0) {
@@ -284,6 +323,9 @@ fd_accept(int  fd)
  *
  * Note that you can only provide a single function to handle
  * all events related to a given file descriptor.
+ *
+ * - call looper_set_flush() to register a function that will be
+ *   called after the events of each epoll_wait() are handled.
 
  * You can call looper_enable/_disable/_del within a function
  * callback.
@@ -295,14 +337,16 @@ fd_accept(int  fd)
  */
 #include <sys/epoll.h>
 
-#define  MAX_CHANNELS  16
-#define  MAX_EVENTS    (MAX_CHANNELS+1)  /* each channel + the serial fd */
-
 /* the event handler function type, 'user' is a user-specific
  * opaque pointer passed to looper_add().
  */
 typedef void (*EventFunc)( void*  user, int  events );
 
+/* the function called after each batch of events, 'user' is
+ * the opaque pointer passed to looper_set_flush().
+ */
+typedef void (*FlushFunc)( void*  user );
+
 /* bit flags for the LoopHook structure.
  *
  * HOOK_PENDING means that an event happened on the
@@ -329,6 +373,9 @@ typedef struct {
 } LoopHook;
 
 /* Looper is the main object modeling a looper object
+ *
+ * 'fd_hooks' maps each file descriptor to the index of its
+ * hook in 'hooks', or -1 if it isn't monitored.
  */
 typedef struct {
     int                  epoll_fd;
@@ -336,6 +383,11 @@ typedef struct {
     int                  max_fds;
     struct epoll_event*  events;
     LoopHook*            hooks;
+    int*                 fd_hooks;
+    int                  fd_hooks_size;
+    uint32_t             wakeups;  /* number of event batches */
+    FlushFunc            flush_func;
+    void*                flush_user;
 } Looper;
 
 /* initialize a looper object */
@@ -347,6 +399,11 @@ looper_init( Looper*  l )
     l->max_fds  = 0;
     l->events   = NULL;
     l->hooks    = NULL;
+    l->fd_hooks = NULL;
+    l->fd_hooks_size = 0;
+    l->wakeups  = 0;
+    l->flush_func = NULL;
+    l->flush_user = NULL;
 }
 
 /* finalize a looper object */
@@ -355,8 +412,10 @@ looper_done( Looper*  l )
 {
     xfree(l->events);
     xfree(l->hooks);
+    xfree(l->fd_hooks);
     l->max_fds = 0;
     l->num_fds = 0;
+    l->fd_hooks_size = 0;
 
     close(l->epoll_fd);
     l->epoll_fd  = -1;
@@ -368,14 +427,32 @@ looper_done( Looper*  l )
 static LoopHook*
 looper_find( Looper*  l, int  fd )
 {
-    LoopHook*  hook = l->hooks;
-    LoopHook*  end  = hook + l->num_fds;
+    if (fd < 0 || fd >= l->fd_hooks_size || l->fd_hooks[fd] < 0)
+        return NULL;
+
+    return l->hooks + l->fd_hooks[fd];
+}
+
+/* record the index of the hook of a given file descriptor,
+ * growing the fd_hooks table if needed */
+static void
+looper_map( Looper*  l, int  fd, int  index )
+{
+    if (fd >= l->fd_hooks_size) {
+        int  old_size = l->fd_hooks_size;
+        int  new_size = old_size + (old_size >> 1) + 16;
+        int  n;
 
-    for ( ; hook < end; hook++ ) {
-        if (hook->fd == fd)
-            return hook;
+        if (new_size <= fd)
+            new_size = fd + 16;
+
+        xrenew( l->fd_hooks, new_size );
+        for (n = old_size; n < new_size; n++)
+            l->fd_hooks[n] = -1;
+
+        l->fd_hooks_size = new_size;
     }
-    return NULL;
+    l->fd_hooks[fd] = index;
 }
 
 /* grow the arrays in the looper object */
@@ -422,6 +499,9 @@ looper_add( Looper*  l, int  fd, EventFunc  func, void*  user )
     hook->wanted  = 0;
     hook->events  = 0;
 
+    /* if 'fd' is being closed, this replaces its old hook */
+    looper_map( l, fd, l->num_fds );
+
     fd_setnonblock(fd);
 
     ev.events   = 0;
@@ -498,6 +578,17 @@ looper_disable( Looper*  l, int  fd, int  events )
     }
 }
 
+/* register a function that is called after the events of each
+ * epoll_wait() are handled, e.g. to send the data they produced
+ * at once.
+ */
+static void
+looper_set_flush( Looper*  l, FlushFunc  func, void*  user )
+{
+    l->flush_func = func;
+    l->flush_user = user;
+}
+
 /* wait until an event occurs on one of the registered file
  * descriptors. Only returns in case of error !!
  */
@@ -520,6 +611,7 @@ looper_loop( Looper*  l )
             D("%s: huh ? epoll returned count=0", __FUNCTION__);
             continue;
         }
+        l->wakeups += 1;
 
         /* mark all pending hooks */
         for (n = 0; n < count; n++) {
@@ -538,6 +630,9 @@ looper_loop( Looper*  l )
             }
         }
 
+        if (l->flush_func)
+            l->flush_func( l->flush_user );
+
         /* now remove all the hooks that were closed by
          * the callbacks */
         for (n = 0; n < l->num_fds;) {
@@ -549,8 +644,22 @@ looper_loop( Looper*  l )
                 continue;
             }
 
-            hook[0]     = l->hooks[l->num_fds-1];
+            /* the fd may already be monitored again by a new hook */
+            if (l->fd_hooks[hook->fd] == n)
+                l->fd_hooks[hook->fd] = -1;
+
             l->num_fds -= 1;
+            if (n == l->num_fds)
+                continue;
+
+            /* move the last hook to index 'n' */
+            hook[0] = l->hooks[l->num_fds];
+            if (l->fd_hooks[hook->fd] == l->num_fds)
+                l->fd_hooks[hook->fd] = n;
+
+            if (hook->state & HOOK_CLOSING)
+                continue;
+
             ev.events   = hook->wanted;
             ev.data.ptr = hook;
             epoll_ctl( l->epoll_fd, EPOLL_CTL_MOD, hook->fd, &ev );
@@ -629,22 +738,102 @@ quote( const void*  data, int  len )
 }
 #endif /* T_ACTIVE */
 
+/** BUFFERS
+ **
+ ** Data read from a file descriptor is kept in reference-counted
+ ** Buffer objects, so that several packets can point into the same
+ ** buffer without copying it (e.g. all the messages received by a
+ ** single read() on the serial port).
+ **/
+
+typedef struct Buffer   Buffer;
+
+/* size of the buffers used to read from file descriptors */
+#define  BUFFER_SIZE  16384
+
+struct Buffer {
+    Buffer*   next;     /* used by the free list */
+    int       refcount;
+    int       size;
+    uint8_t   data[];
+};
+
+/* buffers of BUFFER_SIZE bytes are recycled through a free list,
+ * other sizes are allocated on demand.
+ */
+static Buffer*   _free_buffers;
+
+/* number of buffers of BUFFER_SIZE bytes, and how many are free */
+static int       _num_buffers;
+static int       _num_free_buffers;
+
+/* Allocate a buffer of 'size' bytes, with a single reference */
+static Buffer*
+buffer_alloc( int  size )
+{
+    Buffer*  b = NULL;
+
+    if (size == BUFFER_SIZE && _free_buffers != NULL) {
+        b = _free_buffers;
+        _free_buffers = b->next;
+        _num_free_buffers -= 1;
+    } else {
+        b = xalloc(sizeof(*b) + size);
+        b->size = size;
+        if (size == BUFFER_SIZE)
+            _num_buffers += 1;
+    }
+    b->next     = NULL;
+    b->refcount = 1;
+    return b;
+}
+
+static __inline__ void
+buffer_ref( Buffer*  b )
+{
+    b->refcount += 1;
+}
+
+/* Release a reference to a buffer, and set the pointer to NULL */
+static void
+buffer_unref( Buffer*  *pbuffer )
+{
+    Buffer*  b = *pbuffer;
+    if (b && --b->refcount == 0) {
+        if (b->size == BUFFER_SIZE) {
+            b->next       = _free_buffers;
+            _free_buffers = b;
+            _num_free_buffers += 1;
+        } else {
+            free(b);
+        }
+    }
+    *pbuffer = NULL;
+}
+
 /** PACKETS
  **
  ** We need a way to buffer data before it can be sent to the
  ** corresponding file descriptor. We use linked list of Packet
  ** objects to do this.
+ **
+ ** A packet's payload is either a slice of a Buffer, or, for
+ ** small control messages, stored in the packet itself.
  **/
 
 typedef struct Packet   Packet;
 
-#define  MAX_PAYLOAD  4000
+/* largest payload that can be stored in the packet itself */
+#define  PACKET_INLINE_SIZE  16
 
 struct Packet {
     Packet*   next;
     int       len;
     int       channel;
-    uint8_t   data[ MAX_PAYLOAD ];
+    uint8_t*  data;     /* payload */
+    Buffer*   buffer;   /* buffer 'data' points into, or NULL */
+    int64_t   queued;   /* time it was queued by a client, in us */
+    uint8_t   inline_data[ PACKET_INLINE_SIZE ];
 };
 
 /* we expect to alloc/free a lot of packets during
@@ -653,15 +842,21 @@ struct Packet {
  */
 static Packet*   _free_packets;
 
-/* Allocate a packet */
+/* number of packets, and how many are free */
+static int       _num_packets;
+static int       _num_free_packets;
+
+/* Get a packet from the free list, the caller sets its payload */
 static Packet*
-packet_alloc(void)
+packet_get(void)
 {
     Packet*  p = _free_packets;
     if (p != NULL) {
         _free_packets = p->next;
+        _num_free_packets -= 1;
     } else {
         xnew(p);
+        _num_packets += 1;
     }
     p->next    = NULL;
     p->len     = 0;
@@ -669,6 +864,37 @@ packet_alloc(void)
     return p;
 }
 
+/* Allocate a packet with room for 'size' bytes of payload */
+static Packet*
+packet_alloc( int  size )
+{
+    Packet*  p = packet_get();
+
+    if (size <= PACKET_INLINE_SIZE) {
+        p->buffer = NULL;
+        p->data   = p->inline_data;
+    } else {
+        p->buffer = buffer_alloc(size);
+        p->data   = p->buffer->data;
+    }
+    return p;
+}
+
+/* Allocate a packet whose payload is 'len' bytes at 'data' in
+ * buffer 'b'. This adds a reference to the buffer.
+ */
+static Packet*
+packet_alloc_slice( Buffer*  b, uint8_t*  data, int  len )
+{
+    Packet*  p = packet_get();
+
+    buffer_ref(b);
+    p->buffer = b;
+    p->data   = data;
+    p->len    = len;
+    return p;
+}
+
 /* Release a packet. This takes the address of a packet
  * pointer that will be set to NULL on exit (avoids
  * referencing dangling pointers in case of bugs)
@@ -678,8 +904,11 @@ packet_free( Packet*  *ppacket )
 {
     Packet*  p = *ppacket;
     if (p) {
+        buffer_unref(&p->buffer);
+        p->data       = NULL;
         p->next       = _free_packets;
         _free_packets = p;
+        _num_free_packets += 1;
         *ppacket = NULL;
     }
 }
@@ -745,17 +974,38 @@ receiver_close( Receiver*  r )
 typedef struct FDHandler      FDHandler;
 typedef struct FDHandlerList  FDHandlerList;
 
+/* a function that reads incoming data from a FDHandler's file
+ * descriptor itself, see fdhandler_set_reader() */
+typedef void (*ReadFunc)( void*  user, int  fd );
+
+/* the function called when a FDHandler has sent all its queued
+ * packets, see fdhandler_set_drain()
+ */
+typedef void (*DrainFunc)( void*  user );
+
 struct FDHandler {
     int             fd;
     FDHandlerList*  list;
     char            closing;
     Receiver        receiver[1];
 
+    /* optional incoming data reader */
+    ReadFunc        read_func;
+    void*           read_user;
+
     /* queue of outgoing packets */
     int             out_pos;
     Packet*         out_first;
     Packet**        out_ptail;
 
+    /* optional callback for when the queue gets empty */
+    DrainFunc       drain_func;
+    void*           drain_user;
+
+    /* list of handlers with packets queued since the last flush */
+    char            flush_pending;
+    FDHandler*      flush_next;
+
     FDHandler*      next;
     FDHandler**     pref;
 
@@ -775,6 +1025,11 @@ struct FDHandlerList {
      */
     FDHandler*   closing;
 
+    /* list of FDHandler objects that have
+     * packets to send, see fdhandler_list_flush()
+     */
+    FDHandler*   flushing;
+
 };
 
 /* remove a FDHandler from its current list */
@@ -797,13 +1052,18 @@ fdhandler_prepend( FDHandler*  f, FDHandler**  list )
         f->next->pref = &f->next;
 }
 
+static void  fdhandler_list_flush( FDHandlerList*  list );
+
 /* initialize a FDHandler list */
 static void
 fdhandler_list_init( FDHandlerList*  list, Looper*  looper )
 {
-    list->looper  = looper;
-    list->active  = NULL;
-    list->closing = NULL;
+    list->looper   = looper;
+    list->active   = NULL;
+    list->closing  = NULL;
+    list->flushing = NULL;
+
+    looper_set_flush( looper, (FlushFunc) fdhandler_list_flush, list );
 }
 
 
@@ -826,6 +1086,13 @@ fdhandler_close( FDHandler*  f )
     /* remove the handler from its list */
     fdhandler_remove(f);
 
+    if (f->flush_pending) {
+        FDHandler**  pnode = &f->list->flushing;
+        while (*pnode != f)
+            pnode = &(*pnode)->flush_next;
+        *pnode = f->flush_next;
+    }
+
     /* get rid of outgoing packet queue */
     if (f->out_first != NULL) {
         Packet*  p;
@@ -846,32 +1113,56 @@ fdhandler_close( FDHandler*  f )
     xfree(f);
 }
 
+/* Ask fdhandler_list_flush() to send the packets queued by
+ * the FDHandler, or to call its drain function if there
+ * are none.
+ */
+static void
+fdhandler_flush_later( FDHandler*  f )
+{
+    if (!f->flush_pending) {
+        f->flush_pending = 1;
+        f->flush_next    = f->list->flushing;
+        f->list->flushing = f;
+    }
+}
+
 /* Ask the FDHandler to cleanly shutdown the connection,
  * i.e. send any pending outgoing packets then auto-free
  * itself.
+ *
+ * the handler is never freed right away, but when the
+ * looper flushes it, so its callers can still check
+ * f->closing after posting a packet to its receiver.
  */
 static void
 fdhandler_shutdown( FDHandler*  f )
 {
     /* prevent later fdhandler_close() to
-     * call the receiver's close.
+     * call the receiver's close, and the receiver from
+     * getting more data: it may be gone already.
      */
     f->receiver->close = NULL;
+    f->receiver->post  = NULL;
 
-    if (f->out_first != NULL && !f->closing)
+    if (!f->closing)
     {
+        looper_disable( f->list->looper, f->fd, EPOLLIN );
+
         /* move the handler to the 'closing' list */
         f->closing = 1;
         fdhandler_remove(f);
         fdhandler_prepend(f, &f->list->closing);
-        return;
+        fdhandler_flush_later(f);
     }
-
-    fdhandler_close(f);
 }
 
 /* Enqueue a new packet that the FDHandler will
  * send through its file descriptor.
+ *
+ * nothing is sent right away: all the packets queued while
+ * handling a batch of events are sent together when the
+ * looper calls fdhandler_list_flush().
  */
 static void
 fdhandler_enqueue( FDHandler*  f, Packet*  p )
@@ -884,8 +1175,121 @@ fdhandler_enqueue( FDHandler*  f, Packet*  p )
 
     if (first == NULL) {
         f->out_pos = 0;
-        looper_enable( f->list->looper, f->fd, EPOLLOUT );
+        fdhandler_flush_later(f);
+    }
+}
+
+/* maximum number of packets, and bytes, sent by a single writev().
+ * the serial port doesn't take much more at once anyway.
+ */
+#define  MAX_WRITE_PACKETS  64
+#define  MAX_WRITE_SIZE     16384
+
+/* send as many queued packets as possible with a single writev().
+ * returns 1 if the queue is now empty, or 0 otherwise.
+ */
+static int
+fdhandler_write( FDHandler*  f )
+{
+    struct iovec  iov[ MAX_WRITE_PACKETS ];
+    Packet*       p;
+    int           count = 0, total = 0, pos = f->out_pos, len;
+
+    for (p = f->out_first;
+         p != NULL && count < MAX_WRITE_PACKETS && total < MAX_WRITE_SIZE;
+         p = p->next)
+    {
+        iov[count].iov_base = p->data + pos;
+        iov[count].iov_len  = p->len - pos;
+        total += p->len - pos;
+        count += 1;
+        pos    = 0;
+    }
+    if (count == 0)
+        return 1;
+
+    if ((len = fd_writev(f->fd, iov, count)) < 0) {
+        if (errno != EAGAIN)
+            D("%s: can't send: %s", __FUNCTION__, strerror(errno));
+        return 0;
+    }
+
+    /* free the packets that were sent completely */
+    while ((p = f->out_first) != NULL) {
+        int  avail = p->len - f->out_pos;
+
+        if (len < avail) {
+            f->out_pos += len;
+            break;
+        }
+        len         -= avail;
+        f->out_pos   = 0;
+        f->out_first = p->next;
+        packet_free(&p);
+    }
+
+    if (f->out_first == NULL) {
+        f->out_ptail = &f->out_first;
+        return 1;
+    }
+    return 0;
+}
+
+/* send the packets queued by the FDHandlers while handling the last
+ * batch of events. handlers that can't send everything wait for
+ * EPOLLOUT, and closing handlers that are done are freed.
+ */
+static void
+fdhandler_list_flush( FDHandlerList*  list )
+{
+    FDHandler*  f;
+
+    while ((f = list->flushing) != NULL) {
+        list->flushing   = f->flush_next;
+        f->flush_pending = 0;
+        f->flush_next    = NULL;
+
+        if (!fdhandler_write(f))
+            looper_enable( list->looper, f->fd, EPOLLOUT );
+        else if (f->closing)
+            fdhandler_close(f);
+        else if (f->drain_func)
+            f->drain_func( f->drain_user );
+    }
+}
+
+/* reads shorter than this are copied to a packet of their size,
+ * instead of holding a whole buffer while they are queued */
+#define  MIN_READ_SIZE  (BUFFER_SIZE/4)
+
+/* read incoming data, and post it to the receiver in a new
+ * packet. returns the number of bytes read, 0 at the end of
+ * the stream, or -1 on error.
+ */
+static int
+fdhandler_read( FDHandler*  f )
+{
+    Packet*  p = packet_alloc(BUFFER_SIZE);
+    int      len;
+
+    if ((len = fd_read(f->fd, p->data, BUFFER_SIZE)) < 0) {
+        if (errno != EAGAIN)
+            D("%s: can't recv: %s", __FUNCTION__, strerror(errno));
+        packet_free(&p);
+    } else if (len > 0) {
+        if (len < MIN_READ_SIZE) {
+            Packet*  q = packet_alloc(len);
+            memcpy( q->data, p->data, len );
+            packet_free(&p);
+            p = q;
+        }
+        p->len     = len;
+        p->channel = -101;  /* special debug value, not used */
+        receiver_post( f->receiver, p );
+    } else {
+        packet_free(&p);
     }
+    return len;
 }
 
 
@@ -893,8 +1297,6 @@ fdhandler_enqueue( FDHandler*  f, Packet*  p )
 static void
 fdhandler_event( FDHandler*  f, int  events )
 {
-   int  len;
-
     /* in certain cases, it's possible to have both EPOLLIN and
      * EPOLLHUP at the same time. This indicates that there is incoming
      * data to read, but that the connection was nonetheless closed
@@ -902,45 +1304,39 @@ fdhandler_event( FDHandler*  f, int  events )
      * the receiver to avoid packet loss.
      */
 
-    if (events & EPOLLIN) {
-        Packet*  p = packet_alloc();
-        int      len;
+    /* a closing handler doesn't read anymore */
+    if (f->closing) {
+        events &= ~EPOLLIN;
+    }
 
-        if ((len = fd_read(f->fd, p->data, MAX_PAYLOAD)) < 0) {
-            D("%s: can't recv: %s", __FUNCTION__, strerror(errno));
-            packet_free(&p);
-        } else if (len > 0) {
-            p->len     = len;
-            p->channel = -101;  /* special debug value, not used */
-            receiver_post( f->receiver, p );
-        }
+    if ((events & EPOLLIN) && f->read_func) {
+        f->read_func( f->read_user, f->fd );
+    } else if (events & EPOLLIN) {
+        fdhandler_read(f);
     }
 
     if (events & (EPOLLHUP|EPOLLERR)) {
-        /* disconnection */
+        /* disconnection. read everything that is left now, even if
+         * the receiver suspended reading: the peer can't send more,
+         * unless the receiver shut the handler down meanwhile */
         D("%s: disconnect on fd %d", __FUNCTION__, f->fd);
+        if (!f->read_func) {
+            while (!f->closing && fdhandler_read(f) > 0)
+                ;
+        }
         fdhandler_close(f);
         return;
     }
 
-    if (events & EPOLLOUT && f->out_first) {
-        Packet*  p = f->out_first;
-        int      avail, len;
-
-        avail = p->len - f->out_pos;
-        if ((len = fd_write(f->fd, p->data + f->out_pos, avail)) < 0) {
-            D("%s: can't send: %s", __FUNCTION__, strerror(errno));
-        } else {
-            f->out_pos += len;
-            if (f->out_pos >= p->len) {
-                f->out_pos   = 0;
-                f->out_first = p->next;
-                packet_free(&p);
-                if (f->out_first == NULL) {
-                    f->out_ptail = &f->out_first;
-                    looper_disable( f->list->looper, f->fd, EPOLLOUT );
-                }
-            }
+    if (events & EPOLLOUT) {
+        /* packets queued meanwhile are sent along, there's
+         * no need to flush them separately */
+        if (fdhandler_write(f)) {
+            looper_disable( f->list->looper, f->fd, EPOLLOUT );
+            if (f->closing)
+                fdhandler_close(f);
+            else if (f->drain_func)
+                f->drain_func( f->drain_user );
         }
     }
 }
@@ -970,6 +1366,29 @@ fdhandler_new( int             fd,
 }
 
 
+/* Let 'func' read incoming data from the FDHandler's file descriptor,
+ * instead of posting it to the receiver in new packets. This allows
+ * reading data directly where it belongs.
+ */
+static void
+fdhandler_set_reader( FDHandler*  f, ReadFunc  func, void*  user )
+{
+    f->read_func = func;
+    f->read_user = user;
+}
+
+
+/* Let 'func' be called each time the FDHandler has sent all its
+ * queued packets, e.g. to queue more of them.
+ */
+static void
+fdhandler_set_drain( FDHandler*  f, DrainFunc  func, void*  user )
+{
+    f->drain_func = func;
+    f->drain_user = user;
+}
+
+
 /* event callback function to monitor accepts() on server sockets.
  * the convention used here is that the receiver will receive a
  * dummy packet with the new client socket in p->channel
@@ -979,7 +1398,7 @@ fdhandler_accept_event( FDHandler*  f, int  events )
 {
     if (events & EPOLLIN) {
         /* this is an accept - send a dummy packet to the receiver */
-        Packet*  p = packet_alloc();
+        Packet*  p = packet_alloc(1);
 
         D("%s: accepting on fd %d", __FUNCTION__, f->fd);
         p->data[0] = 1;
@@ -1048,20 +1467,51 @@ fdhandler_new_accept( int             fd,
 
 #define  CHANNEL_CONTROL  0
 
+/* the maximum number of client channels, channel numbers go from 1
+ * to MAX_CHANNELS. can be lowered at build time, but the 2-char
+ * channel numbers of the header can't address more than 255.
+ */
+#ifndef  MAX_CHANNELS
+#define  MAX_CHANNELS  255
+#endif
+#if MAX_CHANNELS < 1 || MAX_CHANNELS > 255
+#error  MAX_CHANNELS must be between 1 and 255
+#endif
+
+/* the emulator doesn't accept larger payloads from the serial port,
+ * so larger packets are sent as several messages.
+ */
+#define  MAX_SERIAL_PAYLOAD  4000
+
 /* The Serial object receives data from the serial port,
  * extracts the payload size and channel index, then sends
  * the resulting messages as a packet to a generic receiver.
  *
+ * Data is read from the serial port into a Buffer, and each
+ * message that is complete in it is posted as a slice of that
+ * buffer, without copying. Messages shorter than MIN_SLICE_SIZE
+ * are copied instead, so that a client slow to read them doesn't
+ * hold a whole buffer for each one. When a message continues past the
+ * end of the data read, the rest of its payload is read directly
+ * into a packet of the payload size.
+ *
  * You can also use serial_send to send a packet through
  * the serial port.
  */
 typedef struct Serial {
     FDHandler*  fdhandler;   /* used to monitor serial port fd */
     Receiver    receiver[1]; /* send payload there */
-    int         in_len;      /* current bytes in input packet */
+    int         in_len;      /* current bytes in header, or in in_packet */
     int         in_datalen;  /* payload size, or 0 when reading header */
     int         in_channel;  /* extracted channel number */
-    Packet*     in_packet;   /* used to read incoming packets */
+    uint8_t     in_header[ HEADER_SIZE ];
+    Packet*     in_packet;   /* payload being read directly, or NULL */
+
+    /* messages and payload bytes received and sent */
+    uint32_t    in_messages;
+    uint64_t    in_bytes;
+    uint32_t    out_messages;
+    uint64_t    out_bytes;
 } Serial;
 
 
@@ -1079,7 +1529,29 @@ serial_dump( Packet*  p, const char*  funcname )
       funcname, p->len, quote(p->data, p->len));
 }
 
-/* a callback called when a packet arrives from the serial port's FDHandler.
+/* shorter messages are copied out of the serial buffer */
+#define  MIN_SLICE_SIZE  1024
+
+/* called when the payload of the current message has been received */
+static void
+serial_post( Serial*  s, Packet*  p )
+{
+    if (s->in_channel < 0) {
+        D("ignoring %d bytes addressed to channel %d",
+           p->len, s->in_channel);
+        packet_free(&p);
+    } else {
+        p->channel = s->in_channel;
+        s->in_messages += 1;
+        s->in_bytes    += p->len;
+        serial_dump( p, __FUNCTION__ );
+        receiver_post( s->receiver, p );
+    }
+    s->in_datalen = 0;
+    s->in_len     = 0;
+}
+
+/* parse 'count' bytes of data received from the serial port in buffer 'b'.
  *
  * This will essentially parse the header, extract the channel number and
  * the payload size and store them in 'in_datalen' and 'in_channel'.
@@ -1087,31 +1559,27 @@ serial_dump( Packet*  p, const char*  funcname )
  * After that, the payload is sent to the receiver once completed.
  */
 static void
-serial_fd_receive( Serial*  s, Packet*  p )
+serial_parse( Serial*  s, Buffer*  b, int  count )
 {
-    int      rpos  = 0, rcount = p->len;
-    Packet*  inp   = s->in_packet;
-    int      inpos = s->in_len;
+    int  rpos = 0;
 
-    serial_dump( p, __FUNCTION__ );
-
-    while (rpos < rcount)
+    while (rpos < count)
     {
-        int  avail = rcount - rpos;
+        int  avail = count - rpos;
 
         /* first, try to read the header */
         if (s->in_datalen == 0) {
-            int  wanted = HEADER_SIZE - inpos;
+            int  wanted = HEADER_SIZE - s->in_len;
             if (avail > wanted)
                 avail = wanted;
 
-            memcpy( inp->data + inpos, p->data + rpos, avail );
-            inpos += avail;
-            rpos  += avail;
+            memcpy( s->in_header + s->in_len, b->data + rpos, avail );
+            s->in_len += avail;
+            rpos      += avail;
 
-            if (inpos == HEADER_SIZE) {
-                s->in_datalen = hex2int( inp->data + LENGTH_OFFSET,  LENGTH_SIZE );
-                s->in_channel = hex2int( inp->data + CHANNEL_OFFSET, CHANNEL_SIZE );
+            if (s->in_len == HEADER_SIZE) {
+                s->in_datalen = hex2int( s->in_header + LENGTH_OFFSET,  LENGTH_SIZE );
+                s->in_channel = hex2int( s->in_header + CHANNEL_OFFSET, CHANNEL_SIZE );
 
                 if (s->in_datalen <= 0) {
                     D("ignoring %s packet from serial port",
@@ -1120,37 +1588,81 @@ serial_fd_receive( Serial*  s, Packet*  p )
                 }
 
                 //D("received %d bytes packet for channel %d", s->in_datalen, s->in_channel);
-                inpos = 0;
+                s->in_len = 0;
+            }
+        }
+        else if (avail >= s->in_datalen)
+        {
+            /* the whole payload is here, post it without copying
+             * unless it is short */
+            Packet*  p;
+
+            if (s->in_datalen < MIN_SLICE_SIZE) {
+                p = packet_alloc( s->in_datalen );
+                memcpy( p->data, b->data + rpos, s->in_datalen );
+                p->len = s->in_datalen;
+            } else {
+                p = packet_alloc_slice( b, b->data + rpos, s->in_datalen );
             }
+            rpos += s->in_datalen;
+            serial_post( s, p );
         }
-        else /* then, populate the packet itself */
+        else
         {
-            int   wanted = s->in_datalen - inpos;
+            /* the payload continues past this data, copy what we have
+             * and read the rest directly into the packet */
+            Packet*  p = packet_alloc( s->in_datalen );
+
+            memcpy( p->data, b->data + rpos, avail );
+            p->len       = s->in_datalen;
+            s->in_packet = p;
+            s->in_len    = avail;
+            rpos        += avail;
+        }
+    }
+}
 
-            if (avail > wanted)
-                avail = wanted;
+/* a callback called when data can be read from the serial port */
+static void
+serial_fd_read( Serial*  s, int  fd )
+{
+    Buffer*       b = buffer_alloc( BUFFER_SIZE );
+    struct iovec  iov[2];
+    int           count = 0, wanted = 0, len;
+
+    /* the rest of a pending payload goes directly to its packet,
+     * anything past it into the buffer */
+    if (s->in_packet != NULL) {
+        wanted = s->in_datalen - s->in_len;
+        iov[count].iov_base = s->in_packet->data + s->in_len;
+        iov[count].iov_len  = wanted;
+        count++;
+    }
+    iov[count].iov_base = b->data;
+    iov[count].iov_len  = BUFFER_SIZE;
+    count++;
+
+    len = fd_readv( fd, iov, count );
+    if (len < 0) {
+        D("%s: can't recv: %s", __FUNCTION__, strerror(errno));
+        len = 0;
+    }
 
-            memcpy( inp->data + inpos, p->data + rpos, avail );
-            inpos += avail;
-            rpos  += avail;
-
-            if (inpos == s->in_datalen) {
-                if (s->in_channel < 0) {
-                    D("ignoring %d bytes addressed to channel %d",
-                       inpos, s->in_channel);
-                } else {
-                    inp->len     = inpos;
-                    inp->channel = s->in_channel;
-                    receiver_post( s->receiver, inp );
-                    s->in_packet  = inp = packet_alloc();
-                }
-                s->in_datalen = 0;
-                inpos         = 0;
-            }
+    if (s->in_packet != NULL) {
+        if (len < wanted) {
+            s->in_len += len;
+            len = 0;
+        } else {
+            Packet*  p = s->in_packet;
+
+            s->in_packet = NULL;
+            len         -= wanted;
+            serial_post( s, p );
         }
     }
-    s->in_len = inpos;
-    packet_free(&p);
+
+    serial_parse( s, b, len );
+    buffer_unref( &b );
 }
 
 
@@ -1161,7 +1673,20 @@ serial_fd_receive( Serial*  s, Packet*  p )
 static void
 serial_send( Serial*  s, Packet*  p )
 {
-    Packet*  h = packet_alloc();
+    Packet*  h;
+
+    /* packets larger than MAX_SERIAL_PAYLOAD are sent as several
+     * messages, which share the packet's buffer */
+    while (p->len > MAX_SERIAL_PAYLOAD) {
+        Packet*  q = packet_alloc_slice( p->buffer, p->data, MAX_SERIAL_PAYLOAD );
+
+        q->channel = p->channel;
+        p->data   += MAX_SERIAL_PAYLOAD;
+        p->len    -= MAX_SERIAL_PAYLOAD;
+        serial_send( s, q );
+    }
+
+    h = packet_alloc( HEADER_SIZE );
 
     //D("sending to serial %d bytes from channel %d: '%.*s'", p->len, p->channel, p->len, p->data);
 
@@ -1173,6 +1698,9 @@ serial_send( Serial*  s, Packet*  p )
     serial_dump( h, __FUNCTION__ );
     serial_dump( p, __FUNCTION__ );
 
+    s->out_messages += 1;
+    s->out_bytes    += p->len;
+
     fdhandler_enqueue( s->fdhandler, h );
     fdhandler_enqueue( s->fdhandler, p );
 }
@@ -1188,16 +1716,22 @@ serial_init( Serial*         s,
     Receiver  recv;
 
     recv.user  = s;
-    recv.post  = (PostFunc)  serial_fd_receive;
+    recv.post  = NULL;
     recv.close = (CloseFunc) serial_fd_close;
 
     s->receiver[0] = receiver[0];
 
     s->fdhandler = fdhandler_new( fd, list, &recv );
+    fdhandler_set_reader( s->fdhandler, (ReadFunc) serial_fd_read, s );
     s->in_len     = 0;
     s->in_datalen = 0;
     s->in_channel = 0;
-    s->in_packet  = packet_alloc();
+    s->in_packet  = NULL;
+
+    s->in_messages  = 0;
+    s->in_bytes     = 0;
+    s->out_messages = 0;
+    s->out_bytes    = 0;
 }
 
 
@@ -1207,6 +1741,21 @@ serial_init( Serial*         s,
 typedef struct Client       Client;
 typedef struct Multiplexer  Multiplexer;
 
+/* traffic statistics of a client, see multiplexer_stats() */
+typedef struct {
+    uint32_t  out_messages;  /* sent to the emulator */
+    uint64_t  out_bytes;
+    uint32_t  in_messages;   /* received from the emulator */
+    uint64_t  in_bytes;
+    int       out_size_max;  /* largest queue, see QUEUE_COST() */
+    int64_t   delay_total;   /* time messages spent queued, in us */
+    int64_t   delay_max;
+    uint32_t  pauses;        /* times reading was suspended */
+} ClientStats;
+
+/* longest service name kept for the statistics */
+#define  MAX_SERVICE_NAME  32
+
 /* A Client object models a single qemud client socket
  * connection in the emulated system.
  *
@@ -1222,28 +1771,73 @@ typedef struct Multiplexer  Multiplexer;
  *
  * In case of failure, it can disconnect or try sending
  * the name of another service.
+ *
+ * the messages of a registered client wait in its own queue
+ * until the multiplexer schedules them on the serial port,
+ * see multiplexer_schedule().
  */
 struct Client {
-    Client*       next;
-    Client**      pref;
     int           channel;
     char          registered;
     FDHandler*    fdhandler;
     Multiplexer*  multiplexer;
+
+    /* queue of messages for the serial port, and the memory it
+     * uses in bytes, see QUEUE_COST() */
+    Packet*       out_first;
+    Packet**      out_ptail;
+    int           out_size;
+
+    /* bytes the client may still send in this round */
+    int           deficit;
+
+    /* set when reading from the client is suspended because
+     * its queue is full */
+    char          paused;
+
+    /* list of clients with queued messages */
+    char          ready;
+    Client*       ready_next;
+    Client*       ready_prev;
+
+    char          service[ MAX_SERVICE_NAME+1 ];
+    ClientStats   stats;
 };
 
+/* the multiplexer finds the client of a channel through the
+ * 'channels' table.
+ *
+ * free channel numbers are kept in the 'free_channels' ring, and
+ * reused in the order they were freed, so that the emulator has
+ * time to forget a channel before it is opened again.
+ */
 struct Multiplexer {
-    Client*        clients;
-    int            last_channel;
+    Client*        channels[MAX_CHANNELS+1];
+    int            free_channels[MAX_CHANNELS];
+    int            free_first;
+    int            free_count;
+    Client*        ready_first;
+    Client*        ready_last;
+
+    /* statistics, see multiplexer_stats() */
+    uint32_t       dropped;     /* messages for unknown channels */
+    uint32_t       cancelled;   /* messages of channels closed by the emulator */
+    int64_t        start_time;
+    int64_t        stats_time;  /* time, and wakeups, of the last query */
+    uint32_t       stats_wakeups;
     Serial         serial[1];
     Looper         looper[1];
     FDHandlerList  fdhandlers[1];
 };
 
 
-static int   multiplexer_open_channel( Multiplexer*  mult, Packet*  p );
+static int   multiplexer_open_channel( Multiplexer*  mult, Client*  c, Packet*  p );
+static void  multiplexer_release_channel( Multiplexer*  mult, int  channel );
 static void  multiplexer_close_channel( Multiplexer*  mult, int  channel );
-static void  multiplexer_serial_send( Multiplexer* mult, int  channel, Packet*  p );
+static void  multiplexer_serial_send( Multiplexer* mult, Client*  c, Packet*  p );
+static void  multiplexer_serial_flush( Multiplexer*  mult, Client*  c );
+static void  multiplexer_serial_cancel( Multiplexer*  mult, Client*  c );
+static void  multiplexer_send_stats( Multiplexer*  mult, Client*  c );
 
 static void
 client_dump( Client*  c, Packet*  p, const char*  funcname )
@@ -1257,10 +1851,10 @@ client_dump( Client*  c, Packet*  p, const char*  funcname )
 static void
 client_free( Client*  c )
 {
-    /* remove from list */
-    c->pref[0] = c->next;
-    if (c->next)
-        c->next->pref = c->pref;
+    multiplexer_serial_cancel(c->multiplexer, c);
+
+    if (c->channel > 0)
+        multiplexer_release_channel(c->multiplexer, c->channel);
 
     c->channel    = -1;
     c->registered = 0;
@@ -1286,7 +1880,7 @@ client_fd_receive( Client*  c, Packet*  p )
         /* the client is registered, just send the
          * data through the serial port
          */
-        multiplexer_serial_send(c->multiplexer, c->channel, p);
+        multiplexer_serial_send(c->multiplexer, c, p);
         return;
     }
 
@@ -1305,15 +1899,24 @@ client_fd_receive( Client*  c, Packet*  p )
     }
 
     /* the client hasn't registered a service yet,
-     * so this must be the name of a service, call
-     * the multiplexer to start registration for
-     * it.
+     * so this must be the name of a service. the
+     * statistics are answered by qemud itself.
+     */
+    if (p->len == 11 && !memcmp(p->data, "qemud-stats", 11)) {
+        packet_free(&p);
+        multiplexer_send_stats(c->multiplexer, c);
+        client_free(c);
+        return;
+    }
+
+    /* otherwise, call the multiplexer to start
+     * registration for it.
      */
     D("%s: attempting registration for service '%.*s'",
       __FUNCTION__, p->len, p->data);
-    c->channel = multiplexer_open_channel(c->multiplexer, p);
+    c->channel = multiplexer_open_channel(c->multiplexer, c, p);
     if (c->channel < 0) {
-        D("%s: service name too long", __FUNCTION__);
+        D("%s: could not open a channel", __FUNCTION__);
         goto BAD_CLIENT;
     }
     D("%s:    -> received channel id %d", __FUNCTION__, c->channel);
@@ -1330,9 +1933,12 @@ client_fd_close( Client*  c )
     /* no need to shutdown the FDHandler */
     c->fdhandler = NULL;
 
-    /* tell the emulator we're out */
-    if (c->channel > 0)
+    /* send what the client wrote before closing, then tell
+     * the emulator we're out */
+    if (c->channel > 0) {
+        multiplexer_serial_flush(c->multiplexer, c);
         multiplexer_close_channel(c->multiplexer, c->channel);
+    }
 
     /* free the client */
     client_free(c);
@@ -1344,7 +1950,7 @@ client_fd_close( Client*  c )
 static void
 client_registration( Client*  c, int  registered )
 {
-    Packet*  p = packet_alloc();
+    Packet*  p = packet_alloc(2);
 
     /* sends registration status to client */
     if (!registered) {
@@ -1364,6 +1970,7 @@ client_registration( Client*  c, int  registered )
     c->registered = registered;
     if (!registered) {
         /* allow the client to try registering another service */
+        multiplexer_release_channel(c->multiplexer, c->channel);
         c->channel = -1;
     }
 }
@@ -1381,8 +1988,7 @@ client_send( Client*  c, Packet*  p )
 static Client*
 client_new( Multiplexer*    mult,
             int             fd,
-            FDHandlerList*  pfdhandlers,
-            Client**        pclients )
+            FDHandlerList*  pfdhandlers )
 {
     Client*   c;
     Receiver  recv;
@@ -1390,10 +1996,18 @@ client_new( Multiplexer*    mult,
     xnew(c);
 
     c->multiplexer = mult;
-    c->next        = NULL;
-    c->pref        = &c->next;
     c->channel     = -1;
     c->registered  = 0;
+    c->out_first   = NULL;
+    c->out_ptail   = &c->out_first;
+    c->out_size    = 0;
+    c->deficit     = 0;
+    c->paused      = 0;
+    c->ready       = 0;
+    c->ready_next  = NULL;
+    c->ready_prev  = NULL;
+    c->service[0]  = 0;
+    memset( &c->stats, 0, sizeof(c->stats) );
 
     recv.user  = c;
     recv.post  = (PostFunc)  client_fd_receive;
@@ -1401,13 +2015,6 @@ client_new( Multiplexer*    mult,
 
     c->fdhandler = fdhandler_new( fd, pfdhandlers, &recv );
 
-    /* add to client list */
-    c->next   = *pclients;
-    c->pref   = pclients;
-    *pclients = c;
-    if (c->next)
-        c->next->pref = &c->next;
-
     return c;
 }
 
@@ -1418,13 +2025,10 @@ client_new( Multiplexer*    mult,
 static Client*
 multiplexer_find_client( Multiplexer*  mult, int  channel )
 {
-    Client* c = mult->clients;
+    if (channel <= 0 || channel > MAX_CHANNELS)
+        return NULL;
 
-    for ( ; c != NULL; c = c->next ) {
-        if (c->channel == channel)
-            return c;
-    }
-    return NULL;
+    return mult->channels[channel];
 }
 
 /* handle control messages coming from the serial port
@@ -1471,6 +2075,12 @@ multiplexer_handle_control( Multiplexer*  mult, Packet*  p )
         goto EXIT;
     }
 
+    /* statistics request */
+    if (p->len == 11 && !memcmp(p->data, "qemud-stats", 11)) {
+        multiplexer_send_stats(mult, NULL);
+        goto EXIT;
+    }
+
     /* A message that begins with "X00" is a probe sent by
      * the emulator used to detect which version of qemud it runs
      * against (in order to detect 1.0/1.1 system images. Just
@@ -1503,11 +2113,14 @@ multiplexer_serial_receive( Multiplexer*  mult, Packet*  p )
 
     client = multiplexer_find_client(mult, p->channel);
     if (client != NULL) {
+        client->stats.in_messages += 1;
+        client->stats.in_bytes    += p->len;
         client_send(client, p);
         return;
     }
 
     D("%s: discarding packet for unknown channel %d", __FUNCTION__, p->channel);
+    mult->dropped += 1;
     packet_free(&p);
 }
 
@@ -1518,49 +2131,260 @@ multiplexer_serial_close( Multiplexer*  mult )
     fatal("unexpected close of serial reader");
 }
 
-/* a function called to send a packet to the serial port */
+/* the messages of the clients are sent to the serial port with a
+ * deficit round-robin: each turn, a client with queued messages may
+ * send up to SERIAL_QUANTUM bytes more, so that a client sending
+ * lots of data doesn't delay the others.
+ *
+ * client messages are only queued on the serial port when its queue
+ * is empty, SERIAL_BATCH_SIZE bytes at a time, after the looper
+ * handled a batch of events. control messages are queued right away.
+ *
+ * reading from a client is suspended when its queue uses more than
+ * CLIENT_HIGH_WATER bytes, until it's back under CLIENT_LOW_WATER
+ * bytes. each message costs its payload and its Packet, which is
+ * close to the memory it holds, since fdhandler_read() copies short
+ * reads out of their buffer.
+ */
+#define  SERIAL_QUANTUM     MAX_SERIAL_PAYLOAD
+#define  SERIAL_BATCH_SIZE  MAX_WRITE_SIZE
+#define  CLIENT_HIGH_WATER  32768
+#define  CLIENT_LOW_WATER   8192
+
+#define  QUEUE_COST(p)  ((p)->len + (int)sizeof(Packet))
+
+/* add a client at the end of the ready list */
+static void
+multiplexer_ready_add( Multiplexer*  mult, Client*  c )
+{
+    c->ready      = 1;
+    c->ready_next = NULL;
+    c->ready_prev = mult->ready_last;
+    if (mult->ready_last)
+        mult->ready_last->ready_next = c;
+    else
+        mult->ready_first = c;
+    mult->ready_last = c;
+}
+
+/* remove a client from the ready list */
 static void
-multiplexer_serial_send( Multiplexer*  mult, int  channel, Packet*  p )
+multiplexer_ready_remove( Multiplexer*  mult, Client*  c )
 {
-    p->channel = channel;
+    if (c->ready_prev)
+        c->ready_prev->ready_next = c->ready_next;
+    else
+        mult->ready_first = c->ready_next;
+
+    if (c->ready_next)
+        c->ready_next->ready_prev = c->ready_prev;
+    else
+        mult->ready_last = c->ready_prev;
+
+    c->ready      = 0;
+    c->ready_next = NULL;
+    c->ready_prev = NULL;
+}
+
+/* remove the first message queued by a client */
+static Packet*
+multiplexer_dequeue( Multiplexer*  mult, Client*  c )
+{
+    Packet*  p = c->out_first;
+
+    c->out_first = p->next;
+    if (c->out_first == NULL)
+        c->out_ptail = &c->out_first;
+    c->out_size -= QUEUE_COST(p);
+    p->next      = NULL;
+
+    /* resume reading from the client when its queue is short again */
+    if (c->paused && c->out_size <= CLIENT_LOW_WATER) {
+        c->paused = 0;
+        if (c->fdhandler != NULL)
+            looper_enable( mult->looper, c->fdhandler->fd, EPOLLIN );
+    }
+    return p;
+}
+
+/* send a message dequeued from a client to the serial port */
+static void
+multiplexer_serial_post( Multiplexer*  mult, Client*  c, Packet*  p, int64_t  now )
+{
+    int64_t  delay = now - p->queued;
+
+    c->stats.out_messages += 1;
+    c->stats.out_bytes    += p->len;
+    c->stats.delay_total  += delay;
+    if (delay > c->stats.delay_max)
+        c->stats.delay_max = delay;
+
+    p->channel = c->channel;
     serial_send( mult->serial, p );
 }
 
+/* queue client messages on the serial port, if it has nothing
+ * to send. this is also called each time it sent everything.
+ */
+static void
+multiplexer_schedule( Multiplexer*  mult )
+{
+    int      budget = SERIAL_BATCH_SIZE;
+    int64_t  now;
+
+    if (mult->serial->fdhandler->out_first != NULL || mult->ready_first == NULL)
+        return;
 
+    now = time_us();
+
+    while (budget > 0 && mult->ready_first != NULL) {
+        Client*  c = mult->ready_first;
+        Packet*  p;
+
+        /* messages are never larger than the quantum, so each
+         * turn sends at least one */
+        c->deficit += SERIAL_QUANTUM;
+        while ((p = c->out_first) != NULL && p->len <= c->deficit) {
+            p = multiplexer_dequeue(mult, c);
+            c->deficit -= p->len;
+            budget     -= p->len + HEADER_SIZE;
+            multiplexer_serial_post(mult, c, p, now);
+        }
+
+        /* move the client to the end of the list for its next turn */
+        multiplexer_ready_remove(mult, c);
+        if (c->out_first != NULL)
+            multiplexer_ready_add(mult, c);
+    }
+}
+
+/* a function called to send a packet from a client to the serial port */
+static void
+multiplexer_serial_send( Multiplexer*  mult, Client*  c, Packet*  p )
+{
+    int64_t  now = time_us();
+
+    /* queue messages of at most MAX_SERIAL_PAYLOAD bytes, which
+     * share the packet's buffer */
+    while (p != NULL) {
+        Packet*  q = p;
+
+        if (p->len > MAX_SERIAL_PAYLOAD) {
+            q = packet_alloc_slice( p->buffer, p->data, MAX_SERIAL_PAYLOAD );
+            p->data += MAX_SERIAL_PAYLOAD;
+            p->len  -= MAX_SERIAL_PAYLOAD;
+        } else {
+            p = NULL;
+        }
+        q->next         = NULL;
+        q->queued       = now;
+        c->out_ptail[0] = q;
+        c->out_ptail    = &q->next;
+        c->out_size    += QUEUE_COST(q);
+    }
+
+    if (!c->ready) {
+        c->deficit = 0;
+        multiplexer_ready_add(mult, c);
+    }
+
+    if (c->out_size > c->stats.out_size_max)
+        c->stats.out_size_max = c->out_size;
+
+    /* stop reading from the client while its queue is full */
+    if (!c->paused && c->out_size > CLIENT_HIGH_WATER) {
+        c->paused = 1;
+        c->stats.pauses += 1;
+        looper_disable( mult->looper, c->fdhandler->fd, EPOLLIN );
+    }
+
+    /* schedule once all the clients with events had their say,
+     * see multiplexer_schedule() */
+    fdhandler_flush_later( mult->serial->fdhandler );
+}
+
+/* send all the messages queued by a client to the serial port now,
+ * e.g. before telling the emulator that its channel is closed.
+ */
+static void
+multiplexer_serial_flush( Multiplexer*  mult, Client*  c )
+{
+    int64_t  now = time_us();
+
+    while (c->out_first != NULL) {
+        Packet*  p = multiplexer_dequeue(mult, c);
+        multiplexer_serial_post(mult, c, p, now);
+    }
+    if (c->ready)
+        multiplexer_ready_remove(mult, c);
+}
+
+/* drop the messages queued by a client that goes away */
+static void
+multiplexer_serial_cancel( Multiplexer*  mult, Client*  c )
+{
+    while (c->out_first != NULL) {
+        Packet*  p = multiplexer_dequeue(mult, c);
+        mult->cancelled += 1;
+        packet_free(&p);
+    }
+    if (c->ready)
+        multiplexer_ready_remove(mult, c);
+}
+
+
+
+/* a function used to give a channel number back to the multiplexer
+ * once its client doesn't use it anymore.
+ */
+static void
+multiplexer_release_channel( Multiplexer*  mult, int  channel )
+{
+    int  last = (mult->free_first + mult->free_count) % MAX_CHANNELS;
+
+    mult->channels[channel]    = NULL;
+    mult->free_channels[last]  = channel;
+    mult->free_count          += 1;
+}
 
 /* a function used by a client to allocate a new channel id and
  * ask the emulator to open it. 'service' must be a packet containing
  * the name of the service in its payload.
  *
- * returns -1 if the service name is too long.
+ * returns -1 if the service name is too long, or if all channels
+ * are in use.
  *
  * notice that client_registration() will be called later when
  * the answer arrives.
  */
 static int
-multiplexer_open_channel( Multiplexer*  mult, Packet*  service )
+multiplexer_open_channel( Multiplexer*  mult, Client*  c, Packet*  service )
 {
-    Packet*   p = packet_alloc();
+    Packet*   p;
     int       len, channel;
 
-    /* find a free channel number, assume we don't have many
-     * clients here. */
-    {
-        Client*  c;
-    TRY_AGAIN:
-        channel = (++mult->last_channel) & 0xff;
-
-        for (c = mult->clients; c != NULL; c = c->next)
-            if (c->channel == channel)
-                goto TRY_AGAIN;
+    if (mult->free_count == 0) {
+        D("%s: all %d channels are in use", __FUNCTION__, MAX_CHANNELS);
+        return -1;
     }
 
-    len = snprintf((char*)p->data, sizeof p->data, "connect:%.*s:%02x", service->len, service->data, channel);
-    if (len >= (int)sizeof(p->data)) {
-        D("%s: weird, service name too long (%d > %d)", __FUNCTION__, len, sizeof(p->data));
+    /* take the channel that was freed first */
+    channel = mult->free_channels[mult->free_first];
+
+    p   = packet_alloc(MAX_SERIAL_PAYLOAD);
+    len = snprintf((char*)p->data, MAX_SERIAL_PAYLOAD, "connect:%.*s:%02x", service->len, service->data, channel);
+    if (len >= MAX_SERIAL_PAYLOAD) {
+        D("%s: weird, service name too long (%d > %d)", __FUNCTION__, len, MAX_SERIAL_PAYLOAD);
         packet_free(&p);
         return -1;
     }
+
+    mult->free_first  = (mult->free_first + 1) % MAX_CHANNELS;
+    mult->free_count -= 1;
+    mult->channels[channel] = c;
+
+    snprintf( c->service, sizeof(c->service), "%.*s", service->len, service->data );
+
     p->channel = CHANNEL_CONTROL;
     p->len     = len;
 
@@ -1572,10 +2396,10 @@ multiplexer_open_channel( Multiplexer*  mult, Packet*  service )
 static void
 multiplexer_close_channel( Multiplexer*  mult, int  channel )
 {
-    Packet*  p   = packet_alloc();
-    int      len = snprintf((char*)p->data, sizeof(p->data), "disconnect:%02x", channel);
+    Packet*  p   = packet_alloc(PACKET_INLINE_SIZE);
+    int      len = snprintf((char*)p->data, PACKET_INLINE_SIZE, "disconnect:%02x", channel);
 
-    if (len > (int)sizeof(p->data)) {
+    if (len >= PACKET_INLINE_SIZE) {
         /* should not happen */
         return;
     }
@@ -1586,6 +2410,137 @@ multiplexer_close_channel( Multiplexer*  mult, int  channel )
     serial_send(mult->serial, p);
 }
 
+/* a growable text buffer, used to format the statistics */
+typedef struct {
+    char*  text;
+    int    len;
+    int    size;
+} StatsText;
+
+static void
+stats_printf( StatsText*  t, const char*  fmt, ... )
+{
+    va_list  args;
+    int      len;
+
+    for (;;) {
+        va_start(args, fmt);
+        len = vsnprintf( t->text + t->len, t->size - t->len, fmt, args );
+        va_end(args);
+
+        if (len < t->size - t->len)
+            break;
+
+        t->size += len + 1024;
+        xrenew( t->text, t->size );
+    }
+    t->len += len;
+}
+
+/* format the traffic statistics of qemud and of each channel.
+ * the looper wakeup rate is computed since the previous call.
+ */
+static void
+multiplexer_stats( Multiplexer*  mult, StatsText*  t )
+{
+    Looper*   l       = mult->looper;
+    int64_t   now     = time_us();
+    int64_t   elapsed = now - mult->stats_time;
+    uint32_t  wakeups = l->wakeups - mult->stats_wakeups;
+    Serial*   s       = mult->serial;
+    int       n;
+
+    stats_printf(t, "uptime %.1f s, %u looper wakeups, %.1f/s since last query\n",
+                 (now - mult->start_time) / 1e6, l->wakeups,
+                 elapsed > 0 ? wakeups * 1e6 / elapsed : 0.);
+    mult->stats_time    = now;
+    mult->stats_wakeups = l->wakeups;
+
+    stats_printf(t, "serial: out %u messages, %llu bytes, in %u messages, %llu bytes\n",
+                 s->out_messages, (unsigned long long)s->out_bytes,
+                 s->in_messages, (unsigned long long)s->in_bytes);
+    stats_printf(t, "dropped: %u messages for unknown channels, %u of closed channels\n",
+                 mult->dropped, mult->cancelled);
+    stats_printf(t, "packets: %d, %d free, buffers: %d, %d free\n",
+                 _num_packets, _num_free_packets, _num_buffers, _num_free_buffers);
+
+    stats_printf(t, "ch service          out-msgs  out-bytes  in-msgs   in-bytes queued  q-max"
+                    " delay-avg delay-max pauses\n");
+    for (n = 1; n <= MAX_CHANNELS; n++) {
+        Client*       c = mult->channels[n];
+        ClientStats*  st;
+
+        if (c == NULL)
+            continue;
+
+        st = &c->stats;
+        stats_printf(t, "%02x %-16s %8u %10llu %8u %10llu %6d %6d %6.3f ms %6.3f ms %6u\n",
+                     n, c->service,
+                     st->out_messages, (unsigned long long)st->out_bytes,
+                     st->in_messages, (unsigned long long)st->in_bytes,
+                     c->out_size, st->out_size_max,
+                     st->out_messages ? st->delay_total / 1e3 / st->out_messages : 0.,
+                     st->delay_max / 1e3, st->pauses);
+    }
+}
+
+/* send a "qemud-stats:<line>" control message to the emulator */
+static void
+multiplexer_send_stats_line( Multiplexer*  mult, const char*  line, int  len )
+{
+    Packet*  p = packet_alloc(12 + len);
+
+    memcpy( p->data, "qemud-stats:", 12 );
+    memcpy( p->data + 12, line, len );
+    p->channel = CHANNEL_CONTROL;
+    p->len     = 12 + len;
+
+    serial_send(mult->serial, p);
+}
+
+/* send the statistics to the emulator, one line per control message,
+ * or to client 'c' if not NULL, after an "OK".
+ */
+static void
+multiplexer_send_stats( Multiplexer*  mult, Client*  c )
+{
+    StatsText  t;
+    Packet*    p;
+    int        pos, len;
+
+    t.size = 4096;
+    t.len  = 0;
+    t.text = xalloc(t.size);
+    multiplexer_stats(mult, &t);
+
+    if (c != NULL) {
+        p = packet_alloc(2);
+        memcpy( p->data, "OK", 2 );
+        p->len = 2;
+        client_send(c, p);
+
+        for (pos = 0; pos < t.len; pos += len) {
+            len = t.len - pos;
+            if (len > BUFFER_SIZE)
+                len = BUFFER_SIZE;
+
+            p = packet_alloc(len);
+            memcpy( p->data, t.text + pos, len );
+            p->len = len;
+            client_send(c, p);
+        }
+    } else {
+        for (pos = 0; pos < t.len; pos += len + 1) {
+            const char*  end = memchr( t.text + pos, '\n', t.len - pos );
+
+            len = end ? end - (t.text + pos) : t.len - pos;
+            multiplexer_send_stats_line(mult, t.text + pos, len);
+        }
+        multiplexer_send_stats_line(mult, "end", 3);
+    }
+    xfree(t.text);
+}
+
 /* this function is used when a new connection happens on the control
  * socket.
  */
@@ -1595,7 +2550,7 @@ multiplexer_control_accept( Multiplexer*  m, Packet*  p )
     /* the file descriptor for the new socket connection is
      * in p->channel. See fdhandler_accept_event() */
     int      fd     = p->channel;
-    Client*  client = client_new( m, fd, m->fdhandlers, &m->clients );
+    Client*  client = client_new( m, fd, m->fdhandlers );
 
     D("created client %p listening on fd %d", client, fd);
 
@@ -1612,7 +2567,7 @@ multiplexer_control_close( Multiplexer*  m )
 static void
 multiplexer_init( Multiplexer*  m, const char*  serial_dev )
 {
-    int       fd, control_fd;
+    int       fd, control_fd, n;
     Receiver  recv;
 
     /* initialize looper and fdhandlers list */
@@ -1642,6 +2597,7 @@ multiplexer_init( Multiplexer*  m, const char*  serial_dev )
     recv.close = (CloseFunc) multiplexer_serial_close;
 
     serial_init( m->serial, fd, m->fdhandlers, &recv );
+    fdhandler_set_drain( m->serial->fdhandler, (DrainFunc) multiplexer_schedule, m );
 
     /* open the qemud control socket */
     recv.user  = m;
@@ -1655,8 +2611,23 @@ multiplexer_init( Multiplexer*  m, const char*  serial_dev )
 
     fdhandler_new_accept( fd, m->fdhandlers, &recv );
 
-    /* initialize clients list */
-    m->clients = NULL;
+    /* initialize the channel table, all channels are free */
+    for (n = 0; n < MAX_CHANNELS; n++) {
+        m->channels[n+1]     = NULL;
+        m->free_channels[n]  = n+1;
+    }
+    m->channels[CHANNEL_CONTROL] = NULL;
+    m->free_first = 0;
+    m->free_count = MAX_CHANNELS;
+
+    m->ready_first = NULL;
+    m->ready_last  = NULL;
+
+    m->dropped       = 0;
+    m->cancelled     = 0;
+    m->start_time    = time_us();
+    m->stats_time    = m->start_time;
+    m->stats_wakeups = 0;
 }
 
 /** MAIN LOOP